@@ -27,6 +27,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/base.h>
 #include <freeradius-devel/util/conf.h>
+#include <freeradius-devel/util/latency.h>
 #include <freeradius-devel/autoconf.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -41,6 +42,7 @@ RCSID("$Id$")
 
 static fr_dict_t *dicts[255];
 static fr_dict_t **dict_end = dicts;
+static uint64_t dict_parse_time[255];		//!< How long each dictionary took to load.
 
 DIAG_OFF(unused-macros)
 #define DEBUG2(fmt, ...)	if (fr_log_fp && (fr_debug_lvl > 2)) fprintf(fr_log_fp , fmt "\n", ## __VA_ARGS__)
@@ -51,6 +53,8 @@ DIAG_ON(unused-macros)
 static void usage(void)
 {
 	fprintf(stderr, "usage: radict [OPTS] <attribute> [attribute...]\n");
+	fprintf(stderr, "  -C               Write binary images of the protocol dictionaries, and report\n");
+	fprintf(stderr, "                   how much faster they load.\n");
 	fprintf(stderr, "  -E               Export dictionary definitions.\n");
 	fprintf(stderr, "  -D <dictdir>     Set main dictionary directory (defaults to " DICTDIR ").\n");
 	fprintf(stderr, "  -x               Debugging mode.\n");
@@ -58,7 +62,7 @@ static void usage(void)
 	fprintf(stderr, "Very simple interface to extract attribute definitions from FreeRADIUS dictionaries\n");
 }
 
-static int load_dicts(TALLOC_CTX *ctx, char const *dict_dir)
+static int load_dicts(TALLOC_CTX *ctx, char const *dict_dir, char const *prefix)
 {
 	DIR		*dir;
 	struct dirent	*dp;
@@ -72,11 +76,22 @@ static int load_dicts(TALLOC_CTX *ctx, char const *dict_dir)
 	while ((dp = readdir(dir)) != NULL) {
 		struct stat stat_buff;
 		char *file_str;
+		char *proto_name;
 
 		if (dp->d_name[0] == '.') continue;
 
 		file_str = talloc_asprintf(NULL, "%s/%s", dict_dir, dp->d_name);
 
+		/*
+		 *	Protocols in sub-directories are named after
+		 *	the whole path, i.e. eap/sim is "eap-sim".
+		 */
+		if (prefix) {
+			proto_name = talloc_asprintf(file_str, "%s-%s", prefix, dp->d_name);
+		} else {
+			proto_name = talloc_typed_strdup(file_str, dp->d_name);
+		}
+
 		if (stat(file_str, &stat_buff) == -1) {
 			fr_strerror_printf("Failed stating file \"%s\": %s", file_str, fr_syserror(errno));
 		error:
@@ -102,17 +117,22 @@ static int load_dicts(TALLOC_CTX *ctx, char const *dict_dir)
 			 *	load it as a dictionary.
 			 */
 			if (ret == 0) {
+				uint64_t start;
+
 				if (dict_end >= (dicts + (sizeof(dicts) / sizeof(*dicts)))) {
 					fr_strerror_printf("Reached maximum number of dictionaries");
 					goto error;
 				}
 				INFO("Loading dictionary: %s/%s", dict_dir, dp->d_name);
-				if (fr_dict_protocol_afrom_file(dict_end++, dp->d_name) < 0) goto error;
+
+				start = fr_latency_now();
+				if (fr_dict_protocol_afrom_file(dict_end, proto_name) < 0) goto error;
+				dict_parse_time[dict_end++ - dicts] = fr_latency_now() - start;
 			/*
 			 *	...otherwise recurse to process sub-protocols (maybe?)
 			 */
 			} else {
-				if (load_dicts(ctx, file_str) < 0) goto error;
+				if (load_dicts(ctx, file_str, proto_name) < 0) goto error;
 			}
 		}
 		talloc_free(file_str);
@@ -179,6 +199,85 @@ static void fr_dict_export(uint64_t *count, uintptr_t *low, uintptr_t *high, fr_
 	_fr_dict_export(count, low, high, fr_dict_root(dict), 0);
 }
 
+static uint64_t da_count(fr_dict_attr_t const *da)
+{
+	unsigned int		i;
+	size_t			len;
+	fr_dict_attr_t const	*p;
+	uint64_t		count = 1;
+
+	len = talloc_array_length(da->children);
+	for (i = 0; i < len; i++) {
+		for (p = da->children[i]; p; p = p->next) count += da_count(p);
+	}
+
+	return count;
+}
+
+/** Write images of the protocol dictionaries, and time loading them
+ *
+ * Each protocol dictionary is freed, and reloaded from its image,
+ * one at a time, so that references to other protocols still resolve.
+ */
+static int cache_dicts(void)
+{
+	fr_dict_t	**dict_p;
+	uint64_t	total_parse = 0, total_image = 0;
+
+	/*
+	 *	The first dictionary is the internal one, which
+	 *	is always read from the text files.
+	 */
+	for (dict_p = dicts + 1; dict_p < dict_end; dict_p++) {
+		char		*name;
+		uint64_t	count, start, taken, parsed = dict_parse_time[dict_p - dicts];
+
+		name = talloc_typed_strdup(NULL, fr_dict_root(*dict_p)->name);
+		if (!name) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+
+		if (fr_dict_image_write(*dict_p, NULL) < 0) {
+			printf("%s\tnot cached: %s\n", name, fr_strerror());
+			talloc_free(name);
+			continue;
+		}
+
+		count = da_count(fr_dict_root(*dict_p));
+		fr_dict_free(dict_p);
+
+		start = fr_latency_now();
+		if (fr_dict_protocol_afrom_image(dict_p, name, NULL) < 0) {
+			fr_strerror_printf_push("Failed loading image of \"%s\"", name);
+		error:
+			talloc_free(name);
+			return -1;
+		}
+		taken = fr_latency_now() - start;
+
+		if (da_count(fr_dict_root(*dict_p)) != count) {
+			fr_strerror_printf("Image of \"%s\" has %" PRIu64 " attributes, expected %" PRIu64,
+					   name, da_count(fr_dict_root(*dict_p)), count);
+			goto error;
+		}
+
+		printf("%s\tparse %.3f ms\timage %.3f ms\tsaved %.3f ms\n", name,
+		       (double) parsed / 1000000, (double) taken / 1000000,
+		       ((double) parsed - (double) taken) / 1000000);
+
+		total_parse += parsed;
+		total_image += taken;
+		talloc_free(name);
+	}
+
+	printf("total\tparse %.3f ms\timage %.3f ms\tsaved %.3f ms\n",
+	       (double) total_parse / 1000000, (double) total_image / 1000000,
+	       ((double) total_parse - (double) total_image) / 1000000);
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	char const	*dict_dir = DICTDIR;
@@ -186,6 +285,7 @@ int main(int argc, char *argv[])
 	int		ret = 0;
 	bool		found = false;
 	bool		export = false;
+	bool		cache = false;
 
 	TALLOC_CTX	*autofree = talloc_autofree_context();
 
@@ -198,7 +298,11 @@ int main(int argc, char *argv[])
 
 	fr_debug_lvl = 1;
 
-	while ((c = getopt(argc, argv, "ED:xh")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "CED:xh")) != -1) switch (c) {
+		case 'C':
+			cache = true;
+			break;
+
 		case 'E':
 			export = true;
 			break;
@@ -235,6 +339,12 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
+	/*
+	 *	We're timing the text files, and writing new
+	 *	images, so don't load the old ones.
+	 */
+	if (cache) fr_dict_image_enable(false);
+
 	INFO("Loading dictionary: %s/%s", dict_dir, FR_DICTIONARY_FILE);
 
 	if (fr_dict_internal_afrom_file(dict_end++, NULL) < 0) {
@@ -243,7 +353,7 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
-	if (load_dicts(autofree, dict_dir) < 0) {
+	if (load_dicts(autofree, dict_dir, NULL) < 0) {
 		fr_perror("radict");
 		ret = 1;
 		goto finish;
@@ -255,6 +365,15 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
+	if (cache) {
+		if (cache_dicts() < 0) {
+			fr_perror("radict");
+			ret = 1;
+			goto finish;
+		}
+		found = true;
+	}
+
 	if (export) {
 		fr_dict_t	**dict_p = dicts;
 
@@ -268,6 +387,7 @@ int main(int argc, char *argv[])
 			DEBUG2("Memory allocd %zu (bytes)", talloc_total_size(*dict_p));
 			DEBUG2("Memory spread %zu (bytes)", (size_t) (high - low));
 		} while (++dict_p < dict_end);
+		found = true;
 	}
 
 	while (argc-- > 0) {
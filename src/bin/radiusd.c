@@ -716,8 +716,19 @@ int main(int argc, char *argv[])
 	 *	Start the network / worker threads.
 	 */
 	{
-		int networks = config->num_networks;
-		int workers = config->num_workers;
+		fr_schedule_config_t sched_config = {
+			.max_networks = config->num_networks,
+			.max_workers = config->num_workers,
+			.min_workers = config->min_workers,
+			.work_stealing = config->work_stealing,
+			.timer_wheel = config->timer_wheel,
+			.network_cpus = config->network_cpus,
+			.worker_cpus = config->worker_cpus,
+			.message_hugepages = config->message_hugepages,
+			.message_set_size = config->message_set_size,
+			.message_ring_buffer_size = config->message_ring_buffer_size,
+			.max_request_time = config->max_request_time
+		};
 		fr_event_list_t *el = NULL;
 
 		/*
@@ -725,14 +736,10 @@ int main(int argc, char *argv[])
 		 *	Otherwise, each network thread will create
 		 *	it's own event list.
 		 */
-		if (!config->spawn_workers) {
-			networks = 0;
-			workers = 0;
-			el = fr_global_event_list();
-		}
+		if (!config->spawn_workers) el = fr_global_event_list();
 
 		sc = fr_schedule_create(NULL, el, &default_log, rad_debug_lvl,
-					networks, workers,
+					el ? NULL : &sched_config,
 					thread_instantiate,
 					config->root_cs);
 		if (!sc) {
@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/radmin.h>
 
 #include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/latency.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/socket.h>
 
@@ -490,6 +491,13 @@ static int cmd_stats_memory(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_inf
 	return -1;
 }
 
+static int cmd_stats_latency(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	fr_latency_fprint(fp, (info->argc > 0) ? info->argv[0] : NULL);
+
+	return 0;
+}
+
 static int cmd_set_debug_level(UNUSED FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
 {
 	int level = atoi(info->argv[0]);
@@ -733,6 +741,32 @@ static int cmd_show_client(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info
 	return 0;
 }
 
+static int cmd_stats_client(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	int proto = IPPROTO_UDP;
+	RADCLIENT *client;
+
+	if (info->argc >= 2) {
+		if (strcmp(info->argv[1], "tcp") == 0) {
+			proto = IPPROTO_TCP;
+		}
+		/* else it MUST be "udp" */
+	}
+
+	client = client_find(NULL, &info->box[0]->vb_ip, proto);
+	if (!client) {
+		fprintf(fp_err, "No such client.");
+		return -1;
+	}
+
+	fprintf(fp, "count.shed.rate\t%" PRIu64 "\n",
+		(uint64_t) atomic_load_explicit(&client->num_shed_rate, memory_order_relaxed));
+	fprintf(fp, "count.shed.load\t%" PRIu64 "\n",
+		(uint64_t) atomic_load_explicit(&client->num_shed_load, memory_order_relaxed));
+
+	return 0;
+}
+
 //#define CMD_TEST (1)
 
 #ifdef CMD_TEST
@@ -894,6 +928,24 @@ static fr_cmd_table_t cmd_table[] = {
 		.read_only = true
 	},
 
+	{
+		.parent = "stats",
+		.name = "client",
+		.syntax = "IPADDR [(udp|tcp)]",
+		.help = "Show statistics for a given client.",
+		.func = cmd_stats_client,
+		.read_only = true
+	},
+
+	{
+		.parent = "stats",
+		.name = "latency",
+		.syntax = "[STRING]",
+		.func = cmd_stats_latency,
+		.help = "Show latency percentiles for each stage of processing, or only for STRING.",
+		.read_only = true,
+	},
+
 	{
 		.parent = "stats",
 		.name = "memory",
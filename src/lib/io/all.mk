@@ -1,6 +1,6 @@
 TARGET	:= libfreeradius-io.a
 
-SOURCES	:=	ring_buffer.c message.c atomic_queue.c queue.c time.c channel.c worker.c \
+SOURCES	:=	ring_buffer.c message.c atomic_queue.c queue.c time.c channel.c worker.c request_pool.c \
 		schedule.c network.c control.c master.c app_io.c
 
 TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-util.la
@@ -56,7 +56,11 @@ typedef struct {
 	fr_io_decode_t			decode;		//!< Translate raw bytes into VALUE_PAIRs and metadata.
 	fr_io_encode_t			encode;		//!< Pack VALUE_PAIRs back into a byte array.
 
-	fr_io_signal_t			flush;		//!< Flush the data when the socket is ready for writing.
+	fr_io_signal_t			flush;		//!< Flush any data which write() queued instead of
+							//!< writing it.  Called by the network side after
+							//!< it has processed all available replies.
+							//!< Returns >0 if data is still queued, and flush()
+							//!< should be called again when the socket is writable.
 
 	fr_io_signal_t			error;		//!< There was an error on the socket.
 	fr_io_close_t			close;		//!< Close the transport.
@@ -64,6 +68,7 @@ typedef struct {
 	fr_io_nak_t			nak;		//!< Function to send a NAK.
 
 	fr_io_data_cmp_t		compare;	//!< compare two packets
+	fr_io_data_hash_t		hash;		//!< hash a packet, consistent with compare
 
 	fr_io_connection_set_t		connection_set;	//!< set src/dst IP/port of a connection
 	fr_io_network_get_t		network_get;	//!< get dynamic network information
@@ -224,6 +224,95 @@ bool fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data)
 	return true;
 }
 
+/** Pop a run of pointers from the atomic queue
+ *
+ * All of the entries which are ready are claimed with one update of
+ * the tail, up to "num" entries.
+ *
+ * @param[in] aq	the atomic queue to retrieve data from.
+ * @param[out] data	array where the pointers are written.
+ * @param[in] num	the number of entries in the array.
+ * @return
+ *	- the number of pointers popped, 0 if the queue is empty.
+ */
+unsigned int fr_atomic_queue_pop_bulk(fr_atomic_queue_t *aq, void **data, unsigned int num)
+{
+	int64_t tail;
+	unsigned int i, avail;
+
+	if (!num) return 0;
+
+	if ((int64_t) num > aq->size) num = aq->size;
+
+	tail = load(aq->tail);
+
+	for (;;) {
+		int64_t seq, diff = 0;
+
+		/*
+		 *	Count how many consecutive entries have been
+		 *	published, starting at the current tail.
+		 */
+		for (avail = 0; avail < num; avail++) {
+			seq = aquire(aq->entry[(tail + avail) % aq->size].seq);
+			diff = (seq - (tail + avail + 1));
+
+			if (diff != 0) break;
+		}
+
+		if (!avail) {
+			if (diff > 0) {
+				tail = load(aq->tail);
+				continue;
+			}
+
+			/*
+			 *	The queue is empty.
+			 */
+			return 0;
+		}
+
+		if (atomic_compare_exchange_strong_explicit(&aq->tail, &tail, tail + avail,
+							    memory_order_release, memory_order_relaxed)) {
+			break;
+		}
+	}
+
+	/*
+	 *	Copy the pointers to the caller BEFORE marking the
+	 *	entries as unused.
+	 */
+	for (i = 0; i < avail; i++) {
+		fr_atomic_queue_entry_t *entry = &aq->entry[(tail + i) % aq->size];
+
+		data[i] = entry->data;
+		store(entry->seq, tail + i + aq->size);
+	}
+
+	return avail;
+}
+
+/** Get the number of entries in the atomic queue
+ *
+ * The result is only a hint, as other threads may be pushing or
+ * popping entries at the same time.
+ *
+ * @param[in] aq	the atomic queue to check.
+ * @return
+ *	- the number of entries in the queue.
+ */
+size_t fr_atomic_queue_depth(fr_atomic_queue_t *aq)
+{
+	int64_t head, tail;
+
+	tail = aquire(aq->tail);
+	head = aquire(aq->head);
+
+	if (head <= tail) return 0;
+
+	return (size_t) (head - tail);
+}
+
 #ifndef NDEBUG
 
 #if 0
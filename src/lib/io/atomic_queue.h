@@ -55,6 +55,8 @@ typedef struct fr_atomic_queue_t fr_atomic_queue_t;
 fr_atomic_queue_t	*fr_atomic_queue_create(TALLOC_CTX *ctx, int size);
 bool			fr_atomic_queue_push(fr_atomic_queue_t *aq, void *data);
 bool			fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data);
+unsigned int		fr_atomic_queue_pop_bulk(fr_atomic_queue_t *aq, void **data, unsigned int num);
+size_t			fr_atomic_queue_depth(fr_atomic_queue_t *aq);
 
 #ifndef NDEBUG
 void			fr_atomic_queue_debug(fr_atomic_queue_t *aq, FILE *fp);
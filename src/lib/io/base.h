@@ -177,6 +177,11 @@ typedef size_t (*fr_io_nak_t)(fr_listen_t *li, void *packet_ctx, uint8_t *const
  *
  * datagram sockets should always set '*leftover = 0'.
  *
+ * datagram sockets which read multiple packets in one system call
+ * should return one packet, and set 'li->read_pending = true'.  The
+ * network side will then call read again, until 'li->read_pending'
+ * is false.
+ *
  * stream sockets can read one packet, and set '*leftover' to how many
  * bytes are left in the buffer.  The read routine will be called
  * again, with a (possibly new) buffer, but with 'leftover' bytes left
@@ -303,6 +308,19 @@ typedef void (*fr_io_data_vnode_t)(fr_listen_t *li, uint32_t fflags);
  */
 typedef int (*fr_io_data_cmp_t)(void const *instance, void const *packet1, void const *packet2);
 
+/** Hash a packet for storing in a duplicate detection table.
+ *
+ * The hash MUST be consistent with the comparison function.  i.e. if
+ * two packets compare as identical, then they must have the same
+ * hash.  It should therefore only use the fields which are used by
+ * the comparison function.
+ *
+ * @param[in] instance		the context for this function
+ * @param[in] packet		to hash
+ * @return the hash of the packet.
+ */
+typedef uint32_t (*fr_io_data_hash_t)(void const *instance, void const *packet);
+
 /**  Handle an error on the socket.
  *
  *  In general, the only thing to do on errors is to close the
@@ -38,18 +38,9 @@ RCSID("$Id$")
 #define MPRINT(...)
 #endif
 
-/*
- *	We disable this until we fix all of the signaling issues...
- */
-#define ENABLE_SKIPS (0)
-
 #define TO_WORKER (0)
 #define FROM_WORKER (1)
 
-#if 0
-#define SIGNAL_INTERVAL (1000000)	//!< The minimum interval between worker signals.
-#endif
-
 /** Size of the atomic queues
  *
  * The queue reader MUST service the queue occasionally,
@@ -63,6 +54,20 @@ RCSID("$Id$")
  */
 #define ATOMIC_QUEUE_SIZE (1024)
 
+/** Queue depth at which we signal a reader which isn't sleeping
+ *
+ * A reader which is awake polls its queues, and doesn't need to be
+ * signalled.  But it may be busy for a while, so we still signal it
+ * every time this many messages are waiting.
+ */
+#define SIGNAL_DEPTH (ATOMIC_QUEUE_SIZE / 4)
+
+/*
+ *	The most messages we take from a queue with one atomic
+ *	update, when draining it.
+ */
+#define CHANNEL_BATCH_SIZE (32)
+
 typedef enum fr_channel_signal_t {
 	FR_CHANNEL_SIGNAL_ERROR			= FR_CHANNEL_ERROR,
 	FR_CHANNEL_SIGNAL_DATA_TO_WORKER	= FR_CHANNEL_DATA_READY_WORKER,
@@ -73,9 +78,6 @@ typedef enum fr_channel_signal_t {
 	/*
 	 *	The preceding MUST be in the same order as fr_channel_event_t
 	 */
-
-	FR_CHANNEL_SIGNAL_DATA_DONE_WORKER,
-	FR_CHANNEL_SIGNAL_WORKER_SLEEPING,
 } fr_channel_signal_t;
 
 typedef struct {
@@ -101,20 +103,21 @@ typedef struct {
 	void			*recv_ctx;	//!< context for receiving messages
 
 	int			num_outstanding; //!< Number of outstanding requests with no reply.
-	bool			must_signal;	//!< we need to signal the other end
+
+	atomic_bool		sleeping;	//!< The reader of our queue is sleeping, and must be signalled.
 
 	size_t			num_signals;	//!< Number of kevent signals we've sent.
 
-	size_t			num_resignals;	//!< Number of signals resent.
+	size_t			num_skips;	//!< Number of signals we didn't send, because the reader was awake.
 
 	size_t			num_kevents;	//!< Number of times we've looked at kevents.
 
+	uint64_t		num_stolen;	//!< Number of stolen requests we received, or replied to.
+
 	uint64_t		sequence;	//!< Sequence number for this channel.
 	uint64_t		ack;		//!< Sequence number of the other end.
 	uint64_t		their_view_of_my_sequence;	//!< Should be clear.
 
-	uint64_t		sequence_at_last_signal;	//!< When we last signaled.
-
 	uint64_t		num_packets;	//!< Number of actual data packets.
 
 	fr_time_t		last_write;	//!< Last write to the channel.
@@ -140,6 +143,8 @@ struct fr_channel_s {
 	bool			active;		//!< Whether the channel is active.
 	bool			same_thread;	//!< are both ends in the same thread?
 
+	_Atomic(uint32_t)	num_leased;	//!< Messages which the worker holds in the master's buffers.
+
 	fr_channel_end_t	end[2];		//!< Two ends of the channel.
 };
 
@@ -222,6 +227,16 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *master, fr_contro
 	ch->end[FROM_WORKER].last_read_other = when;
 	ch->end[FROM_WORKER].last_sent_signal = when;
 
+	/*
+	 *	Neither end has seen any data, so both readers are
+	 *	asleep.  The first message in each direction is
+	 *	always signalled.
+	 */
+	atomic_init(&ch->end[TO_WORKER].sleeping, true);
+	atomic_init(&ch->end[FROM_WORKER].sleeping, true);
+
+	atomic_init(&ch->num_leased, 0);
+
 	ch->active = true;
 
 	return ch;
@@ -254,7 +269,6 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 
 	end->last_sent_signal = when;
 	end->num_signals++;
-	end->must_signal = false;
 
 	cc.signal = which;
 	cc.ack = end->ack;
@@ -263,6 +277,68 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 	return fr_control_message_send(end->control, end->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+/** Check if the reader of a queue needs to be signalled
+ *
+ * The writer has just pushed a message into the queue.  If the
+ * reader is sleeping, we clear its sleeping flag, and signal it.
+ * Any further messages in the same batch then skip the signal,
+ * because the reader is now awake, and will poll the queue before
+ * it goes back to sleep.
+ *
+ * @param[in] end	of the channel that the message was written to.
+ * @return
+ *	- true if the reader should be signalled.
+ *	- false if the signal can be skipped.
+ */
+static bool fr_channel_must_signal(fr_channel_end_t *end)
+{
+	size_t depth;
+
+	/*
+	 *	Order the push before the load of the sleeping flag.
+	 *	This pairs with the fence in fr_channel_sleeping().
+	 *	Either we see that the reader is sleeping, or the
+	 *	reader sees our message.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load_explicit(&end->sleeping, memory_order_relaxed) &&
+	    atomic_exchange_explicit(&end->sleeping, false, memory_order_acq_rel)) return true;
+
+	/*
+	 *	The reader is awake, but may be busy.  Kick it
+	 *	occasionally so that the queue doesn't fill up.
+	 */
+	depth = fr_atomic_queue_depth(end->aq);
+	if (depth && ((depth % SIGNAL_DEPTH) == 0)) return true;
+
+	end->num_skips++;
+	return false;
+}
+
+/** Mark the reader of a queue as sleeping
+ *
+ * @param[in] end	of the channel whose queue we read.
+ * @return
+ *	- true if the queue is empty, and the reader can sleep.
+ *	- false if there are messages in the queue.
+ */
+static bool fr_channel_sleeping(fr_channel_end_t *end)
+{
+	atomic_store_explicit(&end->sleeping, true, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (fr_atomic_queue_depth(end->aq) == 0) return true;
+
+	/*
+	 *	We're not sleeping after all.  If the writer has
+	 *	already cleared the flag, then it's sending us a
+	 *	signal, which we will ignore.
+	 */
+	atomic_store_explicit(&end->sleeping, false, memory_order_relaxed);
+	return false;
+}
+
 #define IALPHA (8)
 #define RTT(_old, _new) ((_new + ((IALPHA - 1) * _old)) / IALPHA)
 
@@ -305,9 +381,7 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 	 */
 	if (!fr_atomic_queue_push(master->aq, cd)) {
 		fr_strerror_printf("Failed pushing to atomic queue");
-		while (fr_channel_recv_reply(ch)) {
-			/* do nothing */
-		}
+		(void) fr_channel_recv_reply_bulk(ch);
 		return -1;
 	}
 
@@ -328,32 +402,14 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	MPRINT("MASTER requests %zd, num_outstanding %zd\n", master->num_packets, master->num_outstanding);
 
-#if ENABLE_SKIPS
 	/*
-	 *	We just sent the first packet.  There can't possibly be a reply, so don't bother looking.
+	 *	The worker is awake, and will see the message before
+	 *	it goes back to sleep.
 	 */
-	if (master->num_outstanding == 1) {
-
-		/*
-		 *	There is at least one old packet which is
-		 *	outstanding, look for a reply.
-		 */
-	} else if (master->num_outstanding > 1) {
-		while (fr_channel_recv_reply(ch)) {
-			/* do nothing */
-		}
-
-		/*
-		 *	There's no reply yet, so we still have packets outstanding.
-		 *	Or, there is a reply, and there are more packets outstanding.
-		 *	Skip the signal.
-		 */
-		if (!master->must_signal && (!*p_reply || (*p_reply && (master->num_outstanding > 1)))) {
-			MPRINT("MASTER SKIPS signal\n");
-			return 0;
-		}
+	if (!fr_channel_must_signal(master)) {
+		MPRINT("MASTER SKIPS signal\n");
+		return 0;
 	}
-#endif
 
 	/*
 	 *	Tell the other end that there is new data ready.
@@ -367,28 +423,14 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 	return 0;
 }
 
-/** Receive a reply message from the channel
+/** Update the master end of a channel for one reply
  *
- * @param[in] ch	the channel to read data from.
- * @return
- *	- true if there was a message received
- *	- false if there are no more messages
+ * @param[in] ch	the channel the reply was read from.
+ * @param[in] cd	the reply.
  */
-bool fr_channel_recv_reply(fr_channel_t *ch)
+static void channel_reply_received(fr_channel_t *ch, fr_channel_data_t *cd)
 {
-	fr_channel_data_t *cd;
-	fr_channel_end_t *master;
-	fr_atomic_queue_t *aq;
-
-	rad_assert(ch->end[TO_WORKER].recv != NULL);
-
-	aq = ch->end[FROM_WORKER].aq;
-	master = &(ch->end[TO_WORKER]);
-
-	/*
-	 *	It's OK for the queue to be empty.
-	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return false;
+	fr_channel_end_t *master = &(ch->end[TO_WORKER]);
 
 	/*
 	 *	We want an exponential moving average for round trip
@@ -410,9 +452,21 @@ bool fr_channel_recv_reply(fr_channel_t *ch)
 	ch->cpu_time = cd->reply.cpu_time;
 
 	/*
-	 *	Update the outbound channel with the knowledge that
-	 *	we've received one more reply, and with the workers
-	 *	ACK.
+	 *	The request was sent to a different worker, and
+	 *	stolen by this one.  The reply isn't part of our
+	 *	sequence numbers.  The master has to update the
+	 *	channel the request was sent on, with
+	 *	fr_channel_stolen_reply_received().
+	 */
+	if (cd->stolen_from) {
+		master->num_stolen++;
+		return;
+	}
+
+	/*
+	 *	Update the outbound channel with the knowledge
+	 *	that we've received one more reply, and with
+	 *	the workers ACK.
 	 */
 	rad_assert(master->num_outstanding > 0);
 	rad_assert(cd->live.sequence > master->ack);
@@ -424,33 +478,71 @@ bool fr_channel_recv_reply(fr_channel_t *ch)
 
 	rad_assert(master->last_read_other <= cd->m.when);
 	master->last_read_other = cd->m.when;
-
-	ch->end[TO_WORKER].recv(ch->end[TO_WORKER].recv_ctx, ch, cd);
-
-	return true;
 }
 
-
-/** Receive a request message from the channel
+/** Receive a reply message from the channel
  *
- * @param[in] ch the channel
+ * @param[in] ch	the channel to read data from.
  * @return
  *	- true if there was a message received
  *	- false if there are no more messages
  */
-bool fr_channel_recv_request(fr_channel_t *ch)
+bool fr_channel_recv_reply(fr_channel_t *ch)
 {
 	fr_channel_data_t *cd;
-	fr_channel_end_t *worker;
-	fr_atomic_queue_t *aq;
 
-	aq = ch->end[TO_WORKER].aq;
-	worker = &(ch->end[FROM_WORKER]);
+	rad_assert(ch->end[TO_WORKER].recv != NULL);
 
 	/*
 	 *	It's OK for the queue to be empty.
 	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return false;
+	if (!fr_atomic_queue_pop(ch->end[FROM_WORKER].aq, (void **) &cd)) return false;
+
+	channel_reply_received(ch, cd);
+
+	ch->end[TO_WORKER].recv(ch->end[TO_WORKER].recv_ctx, ch, cd);
+
+	return true;
+}
+
+/** Receive all of the pending reply messages from the channel
+ *
+ * The replies are taken from the queue in batches, with one atomic
+ * update per batch.  The channel is updated for a whole batch before
+ * any of the replies are passed to the callback, so the callback can
+ * safely read from the channel again.
+ *
+ * @param[in] ch	the channel to read data from.
+ * @return
+ *	- the number of replies received.
+ */
+unsigned int fr_channel_recv_reply_bulk(fr_channel_t *ch)
+{
+	unsigned int i, num, total = 0;
+	fr_channel_data_t *cd[CHANNEL_BATCH_SIZE];
+
+	rad_assert(ch->end[TO_WORKER].recv != NULL);
+
+	while ((num = fr_atomic_queue_pop_bulk(ch->end[FROM_WORKER].aq, (void **) cd, CHANNEL_BATCH_SIZE)) > 0) {
+		for (i = 0; i < num; i++) channel_reply_received(ch, cd[i]);
+
+		for (i = 0; i < num; i++) ch->end[TO_WORKER].recv(ch->end[TO_WORKER].recv_ctx, ch, cd[i]);
+
+		total += num;
+	}
+
+	return total;
+}
+
+
+/** Update the worker end of a channel for one request
+ *
+ * @param[in] ch	the channel the request was read from.
+ * @param[in] cd	the request.
+ */
+static void channel_request_received(fr_channel_t *ch, fr_channel_data_t *cd)
+{
+	fr_channel_end_t *worker = &(ch->end[FROM_WORKER]);
 
 	rad_assert(cd->live.sequence > worker->ack);
 	rad_assert(cd->live.sequence >= worker->sequence); /* must have more requests than replies */
@@ -461,12 +553,57 @@ bool fr_channel_recv_request(fr_channel_t *ch)
 
 	rad_assert(worker->last_read_other <= cd->m.when);
 	worker->last_read_other = cd->m.when;
+}
+
+/** Receive a request message from the channel
+ *
+ * @param[in] ch the channel
+ * @return
+ *	- true if there was a message received
+ *	- false if there are no more messages
+ */
+bool fr_channel_recv_request(fr_channel_t *ch)
+{
+	fr_channel_data_t *cd;
+
+	/*
+	 *	It's OK for the queue to be empty.
+	 */
+	if (!fr_atomic_queue_pop(ch->end[TO_WORKER].aq, (void **) &cd)) return false;
+
+	channel_request_received(ch, cd);
 
 	ch->end[FROM_WORKER].recv(ch->end[FROM_WORKER].recv_ctx, ch, cd);
 
 	return true;
 }
 
+/** Receive all of the pending request messages from the channel
+ *
+ * As with fr_channel_recv_reply_bulk(), the requests are taken from
+ * the queue in batches, and the channel is updated for a whole batch
+ * before any of them are passed to the callback.
+ *
+ * @param[in] ch the channel
+ * @return
+ *	- the number of requests received.
+ */
+unsigned int fr_channel_recv_request_bulk(fr_channel_t *ch)
+{
+	unsigned int i, num, total = 0;
+	fr_channel_data_t *cd[CHANNEL_BATCH_SIZE];
+
+	while ((num = fr_atomic_queue_pop_bulk(ch->end[TO_WORKER].aq, (void **) cd, CHANNEL_BATCH_SIZE)) > 0) {
+		for (i = 0; i < num; i++) channel_request_received(ch, cd[i]);
+
+		for (i = 0; i < num; i++) ch->end[FROM_WORKER].recv(ch->end[FROM_WORKER].recv_ctx, ch, cd[i]);
+
+		total += num;
+	}
+
+	return total;
+}
+
 /** Send a reply message into the channel
  *
  * The message should be initialized, other than "sequence" and "ack".
@@ -501,9 +638,7 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	if (!fr_atomic_queue_push(worker->aq, cd)) {
 		fr_strerror_printf("Failed pushing to atomic queue");
-		while (fr_channel_recv_request(ch)) {
-			/* nothing */
-		}
+		(void) fr_channel_recv_request_bulk(ch);
 		return -1;
 	}
 
@@ -513,7 +648,11 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	MPRINT("\tWORKER replies %zd, num_outstanding %zd\n", worker->num_packets, worker->num_outstanding);
 
-	worker->sequence = sequence;
+	/*
+	 *	Replies to stolen requests don't use sequence
+	 *	numbers.  See fr_channel_steal_request().
+	 */
+	if (!cd->stolen_from) worker->sequence = sequence;
 	message_interval = when - worker->last_write;
 	worker->message_interval = RTT(worker->message_interval, message_interval);
 
@@ -525,53 +664,16 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 	 *	the caller may have sent us one.  Go check the input
 	 *	channel.
 	 */
-	while (fr_channel_recv_request(ch)) {
-		/* nothing */
-	}
-
-	/*
-	 *	No packets outstanding, we HAVE to signal the master
-	 *	thread.
-	 */
-	if (worker->num_outstanding == 0) {
-		(void) fr_channel_data_ready(ch, when, worker, FR_CHANNEL_SIGNAL_DATA_DONE_WORKER);
-		return 0;
-	}
-
-	MPRINT("\twhen - last_read_other = %zd - %zd = %zd\n", when, worker->last_read_other, when - worker->last_read_other);
-	MPRINT("\twhen - last signal = %zd - %zd = %zd\n", when, worker->last_sent_signal, when - worker->last_sent_signal);
-	MPRINT("\tsequence - ack = %zd - %zd = %zd\n", worker->sequence, worker->their_view_of_my_sequence, worker->sequence - worker->their_view_of_my_sequence);
-
-#ifdef __APPLE__
-	/*
-	 *	If we've sent them a signal since the last ACK, they
-	 *	will receive it, and process the packets.  So we don't
-	 *	need to signal them again.
-	 *
-	 *	But... this doesn't appear to work on the Linux
-	 *	libkqueue implementation.
-	 */
-	if (worker->sequence_at_last_signal > worker->their_view_of_my_sequence) return 0;
-#endif
+	(void) fr_channel_recv_request_bulk(ch);
 
 	/*
-	 *	If we've received a new packet in the last while, OR
-	 *	we've sent a signal in the last while, then we don't
-	 *	need to send a new signal.  But we DO send a signal if
-	 *	we haven't seen an ACK for a few packets.
-	 *
-	 *	FIXME: make these limits configurable, or include
-	 *	predictions about packet processing time?
+	 *	The network side is awake, and will see the reply
+	 *	before it goes back to sleep.
 	 */
-	rad_assert(worker->their_view_of_my_sequence <= worker->sequence);
-#if 0
-	if (((worker->sequence - worker->their_view_of_my_sequence) <= 1000) &&
-	    ((when - worker->last_read_other < SIGNAL_INTERVAL) ||
-	     ((when - worker->last_sent_signal) < SIGNAL_INTERVAL))) {
+	if (!fr_channel_must_signal(worker)) {
 		MPRINT("\tWORKER SKIPS signal\n");
 		return 0;
 	}
-#endif
 
 	MPRINT("\tWORKER SIGNALS num_outstanding %zd\n", worker->num_outstanding);
 	(void) fr_channel_data_ready(ch, when, worker, FR_CHANNEL_SIGNAL_DATA_FROM_WORKER);
@@ -579,6 +681,74 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 }
 
 
+/** Take ownership of a request which was stolen from another worker
+ *
+ * The request was received by another worker, on its channel from
+ * the same master.  The thief sends the reply on its own channel.
+ * Since the master didn't send the request on this channel, the
+ * reply doesn't use this channel's sequence numbers.
+ *
+ * The channel which the request was originally sent on is not
+ * updated here.  Only the thread which owns each end of it can do
+ * that.  The reply is tagged with the original channel, and the
+ * master updates its end of it when the reply arrives.  See
+ * fr_channel_stolen_reply_received().  The worker end of the
+ * original channel still counts the request as outstanding, but
+ * that count is only used for debugging.
+ *
+ * @param[in] ch	the thief's channel, which must have the same master
+ *			as the channel the request was received on.
+ * @param[in] cd	the stolen request.
+ */
+void fr_channel_steal_request(fr_channel_t *ch, fr_channel_data_t *cd)
+{
+	fr_channel_end_t *worker;
+
+	rad_assert(fr_channel_same_master(ch, cd->channel.ch));
+
+	worker = &(ch->end[FROM_WORKER]);
+
+	worker->num_outstanding++;
+	worker->num_stolen++;
+
+	cd->stolen_from = cd->channel.ch;
+	cd->channel.ch = ch;
+}
+
+/** Account for a reply to a request which another worker stole
+ *
+ * The reply arrived on the thief's channel, but the request was
+ * sent on this one, which still counts it as outstanding.
+ *
+ * Called only by the master.
+ *
+ * @param[in] ch	the channel the stolen request was sent on.
+ */
+void fr_channel_stolen_reply_received(fr_channel_t *ch)
+{
+	fr_channel_end_t *master = &(ch->end[TO_WORKER]);
+
+	rad_assert(master->num_outstanding > 0);
+	master->num_outstanding--;
+}
+
+
+/** Check if two channels have the same master
+ *
+ * i.e. if they connect two workers to the same network thread.
+ *
+ * @param[in] a		the first channel.
+ * @param[in] b		the second channel.
+ * @return
+ *	- true if the master is the same
+ *	- false if the master is different
+ */
+bool fr_channel_same_master(fr_channel_t const *a, fr_channel_t const *b)
+{
+	return (a->end[FROM_WORKER].control == b->end[FROM_WORKER].control);
+}
+
+
 /** Don't send a reply message into the channel
  *
  * The message should be the one we received from the network.
@@ -605,34 +775,54 @@ int fr_channel_null_reply(fr_channel_t *ch)
  * This function should be called from the workers idle loop.
  * i.e. only when it has nothing else to do.
  *
+ * The worker is marked as sleeping, and the master will signal it
+ * when the next request is sent.  If requests arrived before the
+ * worker was marked, they are received here, and the worker should
+ * not go to sleep.
+ *
  * @param[in] ch	the channel to signal we're no longer listening on.
  * @return
- *	- <0 on error
- *	- 0 on success
+ *	- 0 the worker can sleep.
+ *	- 1 requests were received, and the worker should not sleep.
  */
 int fr_channel_worker_sleeping(fr_channel_t *ch)
 {
-	fr_channel_end_t *worker;
-	fr_channel_control_t cc;
+	if (ch->same_thread) return 0;
 
-	worker = &(ch->end[FROM_WORKER]);
+	if (fr_channel_sleeping(&ch->end[TO_WORKER])) return 0;
 
-	/*
-	 *	We don't have any outstanding requests to process for
-	 *	this channel, don't signal the network thread that
-	 *	we're sleeping.  It already knows.
-	 */
-	if (worker->num_outstanding == 0) return 0;
+	MPRINT("\tWORKER NOT SLEEPING packets in %zd, packets out %zd\n",
+	       ch->end[TO_WORKER].num_packets, ch->end[FROM_WORKER].num_packets);
 
-	worker->num_signals++;
+	(void) fr_channel_recv_request_bulk(ch);
 
-	cc.signal = FR_CHANNEL_SIGNAL_WORKER_SLEEPING;
-	cc.ack = worker->ack;
-	cc.ch = ch;
+	return 1;
+}
 
-	MPRINT("\tWORKER SLEEPING num_outstanding %zd, packets in %zd, packets out %zd\n", worker->num_outstanding,
-	       ch->end[TO_WORKER].num_packets, worker->num_packets);
-	return fr_control_message_send(worker->control, worker->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
+/** Signal a channel that the network side is sleeping
+ *
+ * This function should be called by the network side, just before
+ * it waits for events.
+ *
+ * The network side is marked as sleeping, and the worker will signal
+ * it when the next reply is sent.  If replies arrived before the
+ * network side was marked, they are received here, and the network
+ * side should not go to sleep.
+ *
+ * @param[in] ch	the channel to signal we're no longer listening on.
+ * @return
+ *	- 0 the network side can sleep.
+ *	- 1 replies were received, and the network side should not sleep.
+ */
+int fr_channel_network_sleeping(fr_channel_t *ch)
+{
+	if (ch->same_thread) return 0;
+
+	if (fr_channel_sleeping(&ch->end[FROM_WORKER])) return 0;
+
+	(void) fr_channel_recv_reply_bulk(ch);
+
+	return 1;
 }
 
 
@@ -649,93 +839,25 @@ int fr_channel_worker_sleeping(fr_channel_t *ch)
  *	- FR_CHANNEL_OPEN when a channel has been opened and sent to us
  *	- FR_CHANNEL_CLOSE when a channel should be closed
  */
-fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size)
+fr_channel_event_t fr_channel_service_message(UNUSED fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size)
 {
-	int rcode;
-#if ENABLE_SKIPS
-	uint64_t ack;
-#endif
 	fr_channel_control_t cc;
-	fr_channel_signal_t cs;
-	fr_channel_event_t ce = FR_CHANNEL_ERROR;
-	fr_channel_end_t *master;
-	fr_channel_t *ch;
 
 	rad_assert(data_size == sizeof(cc));
 	memcpy(&cc, data, data_size);
 
-	cs = cc.signal;
-#if ENABLE_SKIPS
-	ack = cc.ack;
-#endif
-	*p_channel = ch = cc.ch;
-
-	switch (cs) {
-	/*
-	 *	These all have the same numbers as the channel
-	 *	events, and have no extra processing.  We just
-	 *	return them as-is.
-	 */
-	case FR_CHANNEL_SIGNAL_ERROR:
-	case FR_CHANNEL_SIGNAL_DATA_TO_WORKER:
-	case FR_CHANNEL_SIGNAL_DATA_FROM_WORKER:
-	case FR_CHANNEL_SIGNAL_OPEN:
-	case FR_CHANNEL_SIGNAL_CLOSE:
-		MPRINT("channel got %d\n", cs);
-		return (fr_channel_event_t) cs;
+	*p_channel = cc.ch;
 
 	/*
-	 *	Only sent by the worker.  Both of these
-	 *	situations are largely the same, except for
-	 *	return codes.
-	 */
-	case FR_CHANNEL_SIGNAL_DATA_DONE_WORKER:
-		MPRINT("channel got data_done_worker\n");
-		ce = FR_CHANNEL_DATA_READY_NETWORK;
-		ch->end[TO_WORKER].must_signal = true;
-		break;
-
-	case FR_CHANNEL_SIGNAL_WORKER_SLEEPING:
-		MPRINT("channel got worker_sleeping\n");
-		ce = FR_CHANNEL_NOOP;
-		ch->end[TO_WORKER].must_signal = true;
-		break;
-	}
-
-	/*
-	 *	Compare their ACK to the last sequence we
-	 *	sent.  If it's different, we signal the worker
-	 *	to wake up.
-	 */
-	master = &ch->end[TO_WORKER];
-#if ENABLE_SKIPS
-	if (!master->must_signal && (ack == master->sequence)) {
-		MPRINT("MASTER SKIPS signal AFTER CE %d num_outstanding %zd\n", cs, master->num_outstanding);
-		MPRINT("MASTER has ack %zd, my seq %zd my_view %zd\n", ack, master->sequence, master->their_view_of_my_sequence);
-		return ce;
-	}
-
-	/*
-	 *	The worker is sleeping or done.  There are more
-	 *	packets available, so we signal it to wake up again.
-	 */
-	rad_assert(ack <= master->sequence);
-#endif
-
-	/*
-	 *	We're signaling it again...
-	 */
-	master->num_resignals++;
-
-	/*
-	 *	The worker hasn't seen our last few packets.  Signal
-	 *	that there is data ready.
+	 *	The signals have the same numbers as the channel
+	 *	events, and have no extra processing.  We just return
+	 *	them as-is.
+	 *
+	 *	The reader is awake, so it will drain the queue.
+	 *	There's no need to tell the writer anything.
 	 */
-	MPRINT("MASTER SIGNALS AFTER CE %d\n", cs);
-	rcode = fr_channel_data_ready(ch, when, master, FR_CHANNEL_SIGNAL_DATA_TO_WORKER);
-	if (rcode < 0) return FR_CHANNEL_ERROR;
-
-	return ce;
+	MPRINT("channel got %d\n", cc.signal);
+	return (fr_channel_event_t) cc.signal;
 }
 
 
@@ -908,18 +1030,101 @@ int fr_channel_signal_open(fr_channel_t *ch)
 	return fr_control_message_send(ch->end[TO_WORKER].control, ch->end[TO_WORKER].rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+/** Get the signalling statistics for a channel
+ *
+ * Note that this isn't thread-safe.  The counters are updated by
+ * each end without locks, so the values may be slightly out of date.
+ *
+ * @param[in] ch		The channel.
+ * @param[out] to_worker	Statistics for requests sent to the worker.
+ * @param[out] from_worker	Statistics for replies sent to the network.
+ */
+void fr_channel_stats(fr_channel_t const *ch, fr_channel_stats_t *to_worker, fr_channel_stats_t *from_worker)
+{
+	to_worker->packets = ch->end[TO_WORKER].num_packets;
+	to_worker->signals = ch->end[TO_WORKER].num_signals;
+	to_worker->skips = ch->end[TO_WORKER].num_skips;
+
+	from_worker->packets = ch->end[FROM_WORKER].num_packets;
+	from_worker->signals = ch->end[FROM_WORKER].num_signals;
+	from_worker->skips = ch->end[FROM_WORKER].num_skips;
+}
+
+/** Take a lease on a request message in the master's buffers
+ *
+ * The worker normally decodes a request soon after receiving it, and
+ * then marks it as done.  The master can then re-use the buffers.  If
+ * the worker is busy, it instead holds on to the message, and decodes
+ * it later, in place.  While it does that, the master can't clean up
+ * that message, or any message after it.
+ *
+ * So the worker takes a lease on such messages, which the master
+ * sees via fr_channel_leases().  The master can then slow down,
+ * instead of allocating more buffers.  Once there are
+ * FR_CHANNEL_MAX_LEASES outstanding, the worker has to copy the
+ * message instead.
+ *
+ * Called only by the worker.
+ *
+ * @param[in] ch	the channel the request was received on.
+ * @return
+ *	- true if the lease was taken.
+ *	- false if there are too many leases.
+ */
+bool fr_channel_lease_acquire(fr_channel_t *ch)
+{
+	uint32_t num;
+
+	num = atomic_load_explicit(&ch->num_leased, memory_order_relaxed);
+	if (num >= FR_CHANNEL_MAX_LEASES) return false;
+
+	atomic_store_explicit(&ch->num_leased, num + 1, memory_order_relaxed);
+	return true;
+}
+
+/** Release a lease taken by fr_channel_lease_acquire()
+ *
+ * Called only by the worker.
+ *
+ * @param[in] ch	the channel the request was received on.
+ */
+void fr_channel_lease_release(fr_channel_t *ch)
+{
+	uint32_t num;
+
+	num = atomic_load_explicit(&ch->num_leased, memory_order_relaxed);
+	rad_assert(num > 0);
+
+	atomic_store_explicit(&ch->num_leased, num - 1, memory_order_relaxed);
+}
+
+/** Get the number of messages the worker holds in the master's buffers
+ *
+ * @param[in] ch	the channel.
+ * @return the number of leases.
+ */
+uint32_t fr_channel_leases(fr_channel_t const *ch)
+{
+	return atomic_load_explicit(&ch->num_leased, memory_order_relaxed);
+}
+
 void fr_channel_debug(fr_channel_t *ch, FILE *fp)
 {
 	fprintf(fp, "to worker\n");
 	fprintf(fp, "\tnum_signals sent = %zu\n", ch->end[TO_WORKER].num_signals);
-	fprintf(fp, "\tnum_signals re-sent = %zu\n", ch->end[TO_WORKER].num_resignals);
+	fprintf(fp, "\tnum_signals skipped = %zu\n", ch->end[TO_WORKER].num_skips);
+	fprintf(fp, "\tnum_packets = %"PRIu64"\n", ch->end[TO_WORKER].num_packets);
 	fprintf(fp, "\tnum_kevents checked = %zu\n", ch->end[TO_WORKER].num_kevents);
 	fprintf(fp, "\tsequence = %"PRIu64"\n", ch->end[TO_WORKER].sequence);
 	fprintf(fp, "\tack = %"PRIu64"\n", ch->end[TO_WORKER].ack);
+	fprintf(fp, "\tnum_stolen = %"PRIu64"\n", ch->end[TO_WORKER].num_stolen);
 
 	fprintf(fp, "to receive\n");
 	fprintf(fp, "\tnum_signals sent = %zu\n", ch->end[FROM_WORKER].num_signals);
+	fprintf(fp, "\tnum_signals skipped = %zu\n", ch->end[FROM_WORKER].num_skips);
+	fprintf(fp, "\tnum_packets = %"PRIu64"\n", ch->end[FROM_WORKER].num_packets);
 	fprintf(fp, "\tnum_kevents checked = %zu\n", ch->end[FROM_WORKER].num_kevents);
 	fprintf(fp, "\tsequence = %"PRIu64"\n", ch->end[FROM_WORKER].sequence);
 	fprintf(fp, "\tack = %"PRIu64"\n", ch->end[FROM_WORKER].ack);
+	fprintf(fp, "\tnum_stolen = %"PRIu64"\n", ch->end[FROM_WORKER].num_stolen);
 }
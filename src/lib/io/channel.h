@@ -25,6 +25,8 @@
  */
 RCSIDH(channel_h, "$Id$")
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -44,6 +46,18 @@ typedef struct fr_channel_s fr_channel_t;
  */
 typedef struct fr_listen fr_listen_t;
 
+/**
+ *  Signalling statistics for one direction of a channel.
+ *
+ *  Defined here, as network.h uses it, and can be included
+ *  before the rest of this file.
+ */
+typedef struct {
+	uint64_t	packets;				//!< Messages sent into the channel.
+	uint64_t	signals;				//!< Signals sent to wake up the reader.
+	uint64_t	skips;					//!< Signals skipped, because the reader was awake.
+} fr_channel_stats_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -106,6 +120,7 @@ typedef struct {
 			fr_time_t		*recv_time;	//!< time original request was received (network -> worker)
 			fr_dlist_t		entry;		//!< list of unprocessed packets for the worker
 			bool			is_dup;		//!< dup, new, etc.
+			bool			leased;		//!< the worker holds a lease on the master's buffer
 		} request;
 
 		struct {
@@ -117,6 +132,10 @@ typedef struct {
 
 	uint32_t	priority;				//!< Priority of this packet.
 
+	fr_channel_t	*stolen_from;				//!< The request was stolen from the worker it was
+								//!< sent to, on this channel, and the reply is
+								//!< sent by the thief.  NULL if not stolen.
+
 	void		*packet_ctx;				//!< Packet specific context for holding client
 								//!< information, and other proto_* specific information
 								//!< that needs to be passed to the request.
@@ -129,23 +148,37 @@ typedef struct {
 #define PRIORITY_NORMAL (1 << 14)
 #define PRIORITY_LOW    (1 << 13)
 
+/*
+ *	The maximum number of messages which a worker holds in the
+ *	master's ring buffers, after they've waited for a while.  See
+ *	fr_channel_lease_acquire().
+ */
+#define FR_CHANNEL_MAX_LEASES	(1024)
+
 extern const FR_NAME_NUMBER channel_packet_priority[];
 
 fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *master, fr_control_t *worker, bool same) CC_HINT(nonnull);
 
 int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cm) CC_HINT(nonnull);
 bool fr_channel_recv_request(fr_channel_t *ch) CC_HINT(nonnull);
+unsigned int fr_channel_recv_request_bulk(fr_channel_t *ch) CC_HINT(nonnull);
 
 int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd) CC_HINT(nonnull);
 int fr_channel_null_reply(fr_channel_t *ch) CC_HINT(nonnull);
 
 bool fr_channel_recv_reply(fr_channel_t *ch) CC_HINT(nonnull);
+unsigned int fr_channel_recv_reply_bulk(fr_channel_t *ch) CC_HINT(nonnull);
+
+void fr_channel_steal_request(fr_channel_t *ch, fr_channel_data_t *cd) CC_HINT(nonnull);
+void fr_channel_stolen_reply_received(fr_channel_t *ch) CC_HINT(nonnull);
+bool fr_channel_same_master(fr_channel_t const *a, fr_channel_t const *b) CC_HINT(nonnull);
 
 typedef void (*fr_channel_recv_callback_t)(void *ctx, fr_channel_t *ch, fr_channel_data_t *cd);
 int fr_channel_set_recv_reply(fr_channel_t *ch, void *ctx, fr_channel_recv_callback_t recv_reply) CC_HINT(nonnull(1,3));
 int fr_channel_set_recv_request(fr_channel_t *ch, void *ctx, fr_channel_recv_callback_t recv_reply) CC_HINT(nonnull(1,3));
 
 int fr_channel_worker_sleeping(fr_channel_t *ch) CC_HINT(nonnull);
+int fr_channel_network_sleeping(fr_channel_t *ch) CC_HINT(nonnull);
 
 int fr_channel_service_kevent(fr_channel_t *ch, fr_control_t *c, struct kevent const *kev) CC_HINT(nonnull);
 fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size) CC_HINT(nonnull);
@@ -163,6 +196,12 @@ void fr_channel_network_ctx_add(fr_channel_t *ch, void *ctx) CC_HINT(nonnull);
 void *fr_channel_network_ctx_get(fr_channel_t *ch) CC_HINT(nonnull);
 
 
+void fr_channel_stats(fr_channel_t const *ch, fr_channel_stats_t *to_worker, fr_channel_stats_t *from_worker) CC_HINT(nonnull);
+
+bool fr_channel_lease_acquire(fr_channel_t *ch) CC_HINT(nonnull);
+void fr_channel_lease_release(fr_channel_t *ch) CC_HINT(nonnull);
+uint32_t fr_channel_leases(fr_channel_t const *ch) CC_HINT(nonnull);
+
 void fr_channel_debug(fr_channel_t *ch, FILE *fp);
 
 #ifdef __cplusplus
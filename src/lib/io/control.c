@@ -26,6 +26,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/io/ring_buffer.h>
+#include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 
@@ -97,7 +98,6 @@ struct fr_control_t {
 fr_control_t *fr_control_create(TALLOC_CTX *ctx, int kq, fr_atomic_queue_t *aq, uintptr_t ident)
 {
 	fr_control_t *c;
-	struct kevent kev;
 
 	c = talloc_zero(ctx, fr_control_t);
 	if (!c) {
@@ -121,8 +121,7 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, int kq, fr_atomic_queue_t *aq,
 	 *	The implementation here is perhaps a bit less optimal,
 	 *	but it's clean, and it works.
 	 */
-	EV_SET(&kev, ident, EVFILT_USER, EV_ADD | EV_CLEAR, NOTE_FFNOP, 0, NULL);
-	if (kevent(c->kq, &kev, 1, NULL, 0, NULL) < 0) {
+	if (fr_event_user_arm(c->kq, ident) < 0) {
 		talloc_free(c);
 		fr_strerror_printf("Failed opening KQ for control socket: %s", fr_syserror(errno));
 		return NULL;
@@ -191,12 +190,9 @@ int fr_control_gc(UNUSED fr_control_t *c, fr_ring_buffer_t *rb)
  */
 void fr_control_free(fr_control_t *c)
 {
-	struct kevent kev;
-
 	(void) talloc_get_type_abort(c, fr_control_t);
 
-	EV_SET(&kev, c->ident, EVFILT_USER, EV_DELETE, NOTE_FFNOP, 0, NULL);
-	if (kevent(c->kq, &kev, 1, NULL, 0, NULL) < 0) {
+	if (fr_event_user_disarm(c->kq, c->ident) < 0) {
 		talloc_free(c);
 		fr_strerror_printf("Failed opening KQ for control socket: %s", fr_syserror(errno));
 	}
@@ -311,17 +307,15 @@ int fr_control_message_push(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
 int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id, void *data, size_t data_size)
 {
 	int rcode;
-	struct kevent kev;
 
 	(void) talloc_get_type_abort(c, fr_control_t);
 
 	if (fr_control_message_push(c, rb, id, data, data_size) < 0) return -1;
 
-	EV_SET(&kev, c->ident, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
-	rcode = kevent(c->kq, &kev, 1, NULL, 0, NULL);
+	rcode = fr_event_user_trigger(c->kq, c->ident);
 	if (rcode >= 0) return rcode;
 
-	fr_strerror_printf("Failed sending user event to kqueue (%i): %s", c->kq, fr_syserror(errno));
+	fr_strerror_printf("Failed sending user event (%i): %s", c->kq, fr_syserror(errno));
 	return rcode;
 }
 
@@ -16,6 +16,7 @@
  */
 #include <freeradius-devel/io/base.h>
 #include <freeradius-devel/io/application.h>
+#include <freeradius-devel/io/request_pool.h>
 
 
 /** Describes a path data takes to/from the wire to/from VALUE_PAIRs
@@ -36,8 +37,16 @@ struct fr_listen {
 	CONF_SECTION		*server_cs;		//!< CONF_SECTION of the server
 
 	bool			connected;		//!< is this for a connected socket?
+	bool			read_pending;		//!< app_io has buffered packets, and wants read() to be called again
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
+	uint32_t		max_outstanding;	//!< stop reading when this many packets are being processed,
+							//!< 0 for no limit
+
+	uint64_t		read_syscalls;		//!< number of system calls made by read()
+	uint64_t		read_packets;		//!< number of packets returned by those system calls
+	uint64_t		write_syscalls;		//!< number of system calls made by write() and flush()
+	uint64_t		write_packets;		//!< number of packets written by those system calls
 };
 
 /**
@@ -59,6 +68,9 @@ struct fr_async_t {
 						//!< and how we'll send the reply.
 	uint32_t		priority;
 	bool			detached;	//!< if detached, we don't send real replies
+	fr_channel_t		*stolen_from;	//!< stolen from another worker, see fr_channel_steal_request()
+
+	fr_request_pool_t	*request_pool;	//!< the request was allocated from, if any
 };
 
 int fr_io_listen_free(fr_listen_t *li);
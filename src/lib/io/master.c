@@ -33,11 +33,30 @@
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/syserror.h>
 
+/*
+ *	Entries in each bucket of the negative cache.
+ */
+#define NEGATIVE_CACHE_WAYS	(4)
+
+/** A source address which isn't allowed to send us packets
+ *
+ */
+typedef struct {
+	fr_ipaddr_t			ipaddr;				//!< source address of the packets
+	fr_time_t			expires;			//!< when this entry is no longer valid
+	fr_time_t			used;				//!< when this entry was last used
+} fr_io_negative_t;
+
 typedef struct {
 	fr_event_list_t			*el;				//!< event list, for the master socket.
 	fr_network_t			*nr;				//!< network for the master socket
 
 	fr_trie_t			*trie;				//!< trie of clients
+
+	fr_io_negative_t		*negative;			//!< negative cache of refused source addresses
+	uint32_t			negative_mask;			//!< number of buckets in the negative cache - 1
+	fr_time_t			negative_lifetime;		//!< of entries in the negative cache
+
 	fr_heap_t			*pending_clients;		//!< heap of pending clients
 	fr_heap_t			*alive_clients;			//!< heap of active clients
 
@@ -76,6 +95,7 @@ typedef enum {
 } fr_io_client_state_t;
 
 typedef struct fr_io_connection_t fr_io_connection_t;
+typedef struct fr_io_track_table_s fr_io_track_table_t;
 
 /** Client definitions for master IO
  *
@@ -98,13 +118,22 @@ struct fr_io_client_s {
 	fr_io_instance_t const		*inst;		//!< parent instance for master IO handler
 	fr_io_thread_t			*thread;
 	fr_event_timer_t const		*ev;		//!< when we clean up the client
-	rbtree_t			*table;		//!< tracking table for packets
+	fr_io_track_table_t		*table;		//!< tracking table for packets
+
+	fr_dlist_head_t			expiring;	//!< tracking entries waiting for cleanup_delay, oldest first
+	fr_event_timer_t const		*ev_cleanup;	//!< when we clean up the oldest tracking entry
+	fr_dlist_head_t			free_tracks;	//!< unused tracking entries
 
 	fr_heap_t			*pending;	//!< pending packets for this client
 	fr_hash_table_t			*addresses;	//!< list of src/dst addresses used by this client
 
 	pthread_mutex_t			mutex;		//!< for parent / child signaling
 	fr_hash_table_t			*ht;		//!< for tracking connected sockets
+
+	RADCLIENT			*shared;	//!< the global client definition, which counts shed packets,
+							//!< or NULL to count them on "radclient"
+	fr_io_rate_limit_t		rate;		//!< owned by the network thread which reads this client,
+							//!< connections use their parent's
 };
 
 /** Track a connection
@@ -244,6 +273,87 @@ static int connection_cmp(void const *one, void const *two)
 }
 
 
+/*
+ *	The negative cache remembers source addresses which aren't
+ *	allowed to send us packets.  More packets from them are then
+ *	discarded without looking up clients or networks, and
+ *	without allocating anything.
+ *
+ *	It's a fixed-size hash table, with NEGATIVE_CACHE_WAYS
+ *	entries in each bucket.  When a bucket is full, the least
+ *	recently used entry is replaced.  So a flood of packets from
+ *	many different addresses can't make it grow.
+ */
+static fr_io_negative_t *negative_cache_bucket(fr_io_thread_t const *thread, fr_ipaddr_t const *ipaddr)
+{
+	uint32_t hash;
+
+	if (ipaddr->af == AF_INET) {
+		hash = fr_hash(&ipaddr->addr.v4, sizeof(ipaddr->addr.v4));
+	} else {
+		hash = fr_hash(&ipaddr->addr.v6, sizeof(ipaddr->addr.v6));
+	}
+
+	return &thread->negative[(hash & thread->negative_mask) * NEGATIVE_CACHE_WAYS];
+}
+
+/** See if packets from a source address were recently refused
+ *
+ */
+static bool negative_cache_find(fr_io_thread_t const *thread, fr_ipaddr_t const *ipaddr, fr_time_t now)
+{
+	int i;
+	fr_io_negative_t *bucket;
+
+	if (!thread->negative) return false;
+
+	bucket = negative_cache_bucket(thread, ipaddr);
+
+	for (i = 0; i < NEGATIVE_CACHE_WAYS; i++) {
+		if (bucket[i].expires <= now) continue;
+
+		if (fr_ipaddr_cmp(&bucket[i].ipaddr, ipaddr) != 0) continue;
+
+		bucket[i].used = now;
+		return true;
+	}
+
+	return false;
+}
+
+/** Refuse packets from a source address for a while
+ *
+ */
+static void negative_cache_add(fr_io_thread_t const *thread, fr_ipaddr_t const *ipaddr, fr_time_t now)
+{
+	int i;
+	fr_io_negative_t *bucket, *entry;
+
+	if (!thread->negative) return;
+
+	bucket = negative_cache_bucket(thread, ipaddr);
+	entry = &bucket[0];
+
+	/*
+	 *	Re-use the entry for this address, or an expired
+	 *	one.  Otherwise replace the least recently used one.
+	 */
+	for (i = 0; i < NEGATIVE_CACHE_WAYS; i++) {
+		if ((bucket[i].expires <= now) ||
+		    (fr_ipaddr_cmp(&bucket[i].ipaddr, ipaddr) == 0)) {
+			entry = &bucket[i];
+			break;
+		}
+
+		if (bucket[i].used < entry->used) entry = &bucket[i];
+	}
+
+	entry->ipaddr = *ipaddr;
+	entry->expires = now + thread->negative_lifetime;
+	entry->used = now;
+}
+
+
 static int track_cmp(void const *one, void const *two)
 {
 	fr_io_track_t const *a = one;
@@ -276,6 +386,247 @@ static int track_cmp(void const *one, void const *two)
 }
 
 
+/*
+ *	Tracking entries are allocated in slabs, and are re-used
+ *	instead of being freed.
+ */
+#define TRACK_SLAB_SIZE		(32)
+#define TRACK_TABLE_MIN		(64)
+
+/** Open addressing hash table for tracking entries
+ *
+ *  Collisions are resolved by linear probing.  Deleted entries leave
+ *  a tombstone behind, which is cleaned up when the table is resized,
+ *  or when it becomes empty.  The table is never more than half full,
+ *  so lookups always find an empty slot.
+ */
+struct fr_io_track_table_s {
+	uint32_t			num_slots;	//!< always a power of 2
+	uint32_t			num_entries;	//!< live entries
+	uint32_t			num_used;	//!< live entries, plus tombstones
+	fr_io_track_t			**slots;
+};
+
+/** Header for a slab of tracking entries
+ *
+ */
+typedef struct {
+	uint32_t			num;		//!< number of entries in this slab
+} fr_io_track_slab_t;
+
+static fr_io_track_t track_deleted;		//!< tombstone for deleted slots
+
+static uint32_t track_hash(fr_io_track_t const *track)
+{
+	fr_io_client_t const *client = track->client;
+	fr_ipaddr_t const *ipaddr = &track->address->src_ipaddr;
+	uint32_t hash = 0;
+
+	/*
+	 *	Without a protocol specific hash, all packets from
+	 *	the same source end up in the same probe sequence.
+	 */
+	if (client->inst->app_io->hash) {
+		hash = client->inst->app_io->hash(client->inst->app_io_instance, track->packet);
+	}
+
+	/*
+	 *	Connected sockets have only one address.
+	 */
+	if (client->connection) return hash;
+
+	/*
+	 *	Only the address bytes.  The rest of the structure
+	 *	has padding, and unused space for IPv4.
+	 */
+	if (ipaddr->af == AF_INET) {
+		hash = fr_hash_update(&ipaddr->addr.v4, sizeof(ipaddr->addr.v4), hash);
+	} else {
+		hash = fr_hash_update(&ipaddr->addr.v6, sizeof(ipaddr->addr.v6), hash);
+	}
+
+	return fr_hash_update(&track->address->src_port, sizeof(track->address->src_port), hash);
+}
+
+static fr_io_track_table_t *track_table_alloc(TALLOC_CTX *ctx)
+{
+	fr_io_track_table_t *table;
+
+	MEM(table = talloc_zero(ctx, fr_io_track_table_t));
+	table->num_slots = TRACK_TABLE_MIN;
+	MEM(table->slots = talloc_zero_array(table, fr_io_track_t *, table->num_slots));
+
+	return table;
+}
+
+static void track_table_resize(fr_io_track_table_t *table, uint32_t num_slots)
+{
+	fr_io_track_t **old = table->slots;
+	uint32_t i, j, mask = num_slots - 1;
+
+	MEM(table->slots = talloc_zero_array(table, fr_io_track_t *, num_slots));
+
+	for (i = 0; i < table->num_slots; i++) {
+		if (!old[i] || (old[i] == &track_deleted)) continue;
+
+		for (j = old[i]->hash & mask; table->slots[j] != NULL; j = (j + 1) & mask) {
+			/* nothing */
+		}
+		table->slots[j] = old[i];
+	}
+
+	talloc_free(old);
+	table->num_slots = num_slots;
+	table->num_used = table->num_entries;
+}
+
+static fr_io_track_t *track_table_find(fr_io_track_table_t *table, fr_io_track_t const *my_track)
+{
+	uint32_t i, mask = table->num_slots - 1;
+
+	for (i = my_track->hash & mask; table->slots[i] != NULL; i = (i + 1) & mask) {
+		fr_io_track_t *track = table->slots[i];
+
+		if (track == &track_deleted) continue;
+		if (track->hash != my_track->hash) continue;
+
+		if (track_cmp(track, my_track) == 0) return track;
+	}
+
+	return NULL;
+}
+
+static void track_table_insert(fr_io_track_table_t *table, fr_io_track_t *track)
+{
+	uint32_t i, mask;
+
+	/*
+	 *	Keep the table at most half full.  If most of the
+	 *	used slots are tombstones, then just clean them out.
+	 */
+	if (((table->num_used + 1) * 2) > table->num_slots) {
+		if (((table->num_entries + 1) * 4) > table->num_slots) {
+			track_table_resize(table, table->num_slots * 2);
+		} else {
+			track_table_resize(table, table->num_slots);
+		}
+	}
+
+	mask = table->num_slots - 1;
+	for (i = track->hash & mask;
+	     (table->slots[i] != NULL) && (table->slots[i] != &track_deleted);
+	     i = (i + 1) & mask) {
+		/* nothing */
+	}
+
+	if (!table->slots[i]) table->num_used++;
+	table->slots[i] = track;
+	table->num_entries++;
+}
+
+static void track_table_delete(fr_io_track_table_t *table, fr_io_track_t *track)
+{
+	uint32_t i, mask = table->num_slots - 1;
+
+	for (i = track->hash & mask; table->slots[i] != NULL; i = (i + 1) & mask) {
+		if (table->slots[i] != track) continue;
+
+		table->num_entries--;
+
+		/*
+		 *	The table is empty, so we can throw away
+		 *	all of the tombstones.
+		 */
+		if (!table->num_entries) {
+			memset(table->slots, 0, sizeof(table->slots[0]) * table->num_slots);
+			table->num_used = 0;
+			return;
+		}
+
+		/*
+		 *	If the next slot is empty, then no probe
+		 *	sequence goes through this one.
+		 */
+		if (!table->slots[(i + 1) & mask]) {
+			table->slots[i] = NULL;
+			table->num_used--;
+		} else {
+			table->slots[i] = &track_deleted;
+		}
+		return;
+	}
+}
+
+/** Initialize the packet tracking for a client
+ *
+ */
+static void client_track_init(fr_io_client_t *client)
+{
+	fr_dlist_talloc_init(&client->expiring, fr_io_track_t, entry);
+	fr_dlist_talloc_init(&client->free_tracks, fr_io_track_t, entry);
+
+	if (client->inst->app_io->track_duplicates) {
+		rad_assert(client->inst->app_io->compare != NULL);
+		client->table = track_table_alloc(client);
+	}
+}
+
+/** Get an unused tracking entry
+ *
+ *  Entries are allocated a slab at a time, so that they're close
+ *  together in memory.  They remain talloc chunks, as the
+ *  protocol handlers check the type of the packet_ctx.
+ */
+static fr_io_track_t *track_alloc(fr_io_client_t *client)
+{
+	fr_io_track_t *track;
+
+	track = fr_dlist_head(&client->free_tracks);
+	if (!track) {
+		fr_io_track_slab_t *slab;
+		uint32_t i;
+
+		MEM(slab = talloc_pooled_object(client, fr_io_track_slab_t,
+						TRACK_SLAB_SIZE, TRACK_SLAB_SIZE * sizeof(fr_io_track_t)));
+		slab->num = TRACK_SLAB_SIZE;
+
+		for (i = 0; i < slab->num; i++) {
+			MEM(track = talloc_zero(slab, fr_io_track_t));
+			fr_dlist_insert_tail(&client->free_tracks, track);
+		}
+
+		track = fr_dlist_head(&client->free_tracks);
+	}
+
+	(void) fr_dlist_remove(&client->free_tracks, track);
+
+	return track;
+}
+
+/** Put a tracking entry back on the free list
+ *
+ */
+static void track_free(fr_io_client_t *client, fr_io_track_t *track)
+{
+	if (client->table) track_table_delete(client->table, track);
+
+	(void) fr_dlist_remove(&client->expiring, track);
+
+	if (track->reply) talloc_const_free(track->reply);
+
+	/*
+	 *	"entry" is the first field, and we're still using it.
+	 */
+	memset(((uint8_t *) track) + sizeof(track->entry), 0, sizeof(*track) - sizeof(track->entry));
+
+	/*
+	 *	Most recently used first, as it's more likely to
+	 *	still be in the cache.
+	 */
+	fr_dlist_insert_head(&client->free_tracks, track);
+}
+
+
 static fr_io_pending_packet_t *pending_packet_pop(fr_io_thread_t *thread)
 {
 	fr_io_client_t *client;
@@ -339,6 +690,7 @@ static RADCLIENT *radclient_clone(TALLOC_CTX *ctx, RADCLIENT const *parent)
 	COPY_FIELD(cs);
 	COPY_FIELD(proto);
 	COPY_FIELD(use_connected);
+	COPY_FIELD(limit);
 
 #ifdef WITH_TLS
 	COPY_FIELD(tls_required);
@@ -460,6 +812,7 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 	memset(connection->client, 0, sizeof(*connection->client));
 
 	MEM(connection->client->radclient = radclient = radclient_clone(connection->client, client->radclient));
+	connection->client->shared = client->shared ? client->shared : client->radclient;
 
 	talloc_set_destructor(connection, connection_free);
 
@@ -469,13 +822,8 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 
 	/*
 	 *	Create the packet tracking table for this client.
-	 *
-	 *	#todo - unify the code with static clients?
 	 */
-	if (inst->app_io->track_duplicates) {
-		MEM(connection->client->table = rbtree_talloc_create(client, track_cmp, fr_io_track_t,
-								     NULL, RBTREE_FLAG_NONE));
-	}
+	client_track_init(connection->client);
 
 	/*
 	 *	Set this radclient to be dynamic, and active.
@@ -662,6 +1010,14 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 
 		li->fd = fd;
 
+		/*
+		 *	The child may want larger reads, or a limit on
+		 *	how many packets are outstanding.  The network
+		 *	side only sees our listener, so copy them up.
+		 */
+		li->default_message_size = connection->child->default_message_size;
+		li->max_outstanding = connection->child->max_outstanding;
+
 		if (!inst->app_io->get_name) {
 			connection->name = fr_asprintf(connection, "proto_%s from client %pV port "
 						       "%u to server %pV port %u",
@@ -708,7 +1064,13 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 	}
 
 	DEBUG("proto_%s - starting connection %s", inst->app_io->name, connection->name);
-	connection->nr = fr_schedule_listen_add(thread->sc, connection->listen);
+
+	/*
+	 *	Connections are read by the same network thread as the
+	 *	parent socket.  That way all of the state for a client
+	 *	stays in one thread.
+	 */
+	if (fr_network_listen_add(thread->nr, connection->listen) == 0) connection->nr = thread->nr;
 	if (!connection->nr) {
 		ERROR("proto_%s - Failed inserting connection into scheduler.  Closing it, and diuscarding all packets for connection %s.", inst->app_io->name, connection->name);
 		pthread_mutex_lock(&client->mutex);
@@ -792,23 +1154,31 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	my_track.client = client;
 	memcpy(my_track.packet, packet, sizeof(my_track.packet));
 
-	if (client->inst->app_io->track_duplicates) track = rbtree_finddata(client->table, &my_track);
-	if (!track) {
-		MEM(track = talloc_zero(client, fr_io_track_t));
-		talloc_get_type_abort(track, fr_io_track_t);
+	if (client->table) {
+		my_track.hash = track_hash(&my_track);
+		track = track_table_find(client->table, &my_track);
+	}
 
-		MEM(track->address = talloc_zero(track, fr_io_address_t));
-		memcpy(track->address, address, sizeof(*address));
-		track->address->radclient = client->radclient;
+	if (!track) {
+		track = track_alloc(client);
 
 		track->client = client;
 		if (client->connection) {
 			track->address = client->connection->address;
+		} else {
+			memcpy(&track->my_address, address, sizeof(*address));
+			track->my_address.radclient = client->radclient;
+			track->address = &track->my_address;
 		}
 
 		memcpy(track->packet, packet, sizeof(track->packet));
 		track->timestamp = recv_time;
 		track->packets = 1;
+
+		if (client->table) {
+			track->hash = my_track.hash;
+			track_table_insert(client->table, track);
+		}
 		return track;
 	}
 
@@ -828,6 +1198,12 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 			return NULL;
 		}
 
+		/*
+		 *	Duplicates take a reference, too.  mod_read()
+		 *	releases it if we've already replied, and
+		 *	otherwise the worker releases it when it
+		 *	discards the duplicate.
+		 */
 		*is_dup = true;
 		track->packets++;
 		return track;
@@ -840,10 +1216,11 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	track->timestamp = recv_time;
 	track->packets++;
 
-	if (track->ev) {
-		(void) talloc_const_free(track->ev);
-		track->ev = NULL;
-	}
+	/*
+	 *	Stop any cleanup_delay.  This is a no-op if the entry
+	 *	isn't waiting to be cleaned up.
+	 */
+	(void) fr_dlist_remove(&client->expiring, track);
 
 	/*
 	 *	We haven't yet sent a reply, this is a conflicting
@@ -884,15 +1261,7 @@ static int pending_free(fr_io_pending_packet_t *pending)
 	 *	No more packets using this tracking entry,
 	 *	delete it.
 	 */
-	if (track->packets == 0) {
-		if (track->client->inst->app_io->track_duplicates) {
-			rad_assert(track->client->table != NULL);
-			(void) rbtree_deletebydata(track->client->table, track);
-		}
-
-		// @todo - put this into a slab allocator
-		talloc_free(track);
-	}
+	if (track->packets == 0) track_free(track->client, track);
 
 	return 0;
 }
@@ -953,6 +1322,95 @@ static int _client_free(fr_io_client_t *client)
 	return 0;
 }
 
+/** Check if a client's token bucket has room for another packet
+ *
+ *  The bucket holds one second's worth of packets.  The credit is
+ *  kept as time, and each packet costs 1/max_packets_per_second of a
+ *  second.  Lower priority packets can't use the last part of the
+ *  bucket, so a client which sends a flood of accounting packets can
+ *  still authenticate users.  That part is taken from what's left
+ *  after the cost of one packet, so that a full bucket always admits
+ *  a packet, even with very small limits.
+ *
+ * @param[in] rate			the client's token bucket.
+ * @param[in] max_packets_per_second	the client's limit, which MUST NOT be zero.
+ * @param[in] priority			of the packet.
+ * @param[in] now			when the packet was received.
+ * @return
+ *	- true if the packet is within the limit.
+ *	- false if it should be dropped.
+ */
+bool fr_io_rate_limit_admit(fr_io_rate_limit_t *rate, uint32_t max_packets_per_second,
+			    uint32_t priority, fr_time_t now)
+{
+	fr_time_t	cost, reserve;
+
+	if (!rate->last) {
+		rate->credit = NANOSEC;
+	} else if (now > rate->last) {
+		rate->credit += now - rate->last;
+		if (rate->credit > NANOSEC) rate->credit = NANOSEC;
+	}
+	rate->last = now;
+
+	cost = NANOSEC / max_packets_per_second;
+
+	if (priority >= PRIORITY_HIGH) {
+		reserve = 0;
+
+	} else if (priority >= PRIORITY_NORMAL) {
+		reserve = (NANOSEC - cost) / 4;
+
+	} else {
+		reserve = (NANOSEC - cost) / 2;
+	}
+
+	if (rate->credit < (cost + reserve)) return false;
+
+	rate->credit -= cost;
+	return true;
+}
+
+/** Check if a client is allowed to send another packet
+ *
+ *  First, the network has to have room for the packet.  Then, the
+ *  client has to be within its packet rate limit.  Connections are
+ *  limited together with the client which accepted them.
+ *
+ *  This function is only called from the network thread which reads
+ *  the client's packets.  The shed counters are on the global client
+ *  definition, which every network thread can update, so they're
+ *  atomic.
+ *
+ * @param[in] client	which sent the packet.
+ * @param[in] nr	the network which read the packet.
+ * @param[in] priority	of the packet.
+ * @param[in] now	when the packet was received.
+ * @return
+ *	- true if the packet should be processed.
+ *	- false if it should be dropped.
+ */
+static bool fr_io_client_admit(fr_io_client_t *client, fr_network_t *nr, uint32_t priority, fr_time_t now)
+{
+	RADCLIENT	*counted = client->shared ? client->shared : client->radclient;
+	fr_io_client_t	*limited = client->connection ? client->connection->parent : client;
+
+	if (nr && !fr_network_admit(nr, priority)) {
+		atomic_fetch_add_explicit(&counted->num_shed_load, 1, memory_order_relaxed);
+		return false;
+	}
+
+	if (!limited->radclient->limit.max_packets_per_second || (priority >= PRIORITY_NOW)) return true;
+
+	if (!fr_io_rate_limit_admit(&limited->rate, limited->radclient->limit.max_packets_per_second,
+				    priority, now)) {
+		atomic_fetch_add_explicit(&counted->num_shed_rate, 1, memory_order_relaxed);
+		return false;
+	}
+
+	return true;
+}
+
 /**  Implement 99% of the read routines.
  *
  *  The app_io->read does the transport-specific data read.
@@ -981,8 +1439,11 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_tim
 	 *	get the rest of it now.  We MUST do this instead of
 	 *	popping a pending packet, because the leftover bytes
 	 *	are already in the output buffer.
+	 *
+	 *	Similarly, if the child has buffered packets from a
+	 *	previous batched read, return those first.
 	 */
-	if (*leftover) goto do_read;
+	if (*leftover || child->read_pending) goto do_read;
 
 redo:
 	/*
@@ -1138,6 +1599,15 @@ do_read:
 		 */
 		packet_len = inst->app_io->read(child, (void **) &local_address, &local_recv_time,
 					  buffer, buffer_len, leftover, priority, is_dup);
+
+		/*
+		 *	Tell the network side if there are more
+		 *	packets buffered, and copy the statistics up.
+		 */
+		li->read_pending = child->read_pending;
+		li->read_syscalls = child->read_syscalls;
+		li->read_packets = child->read_packets;
+
 		if (packet_len <= 0) {
 			return packet_len;
 		}
@@ -1211,15 +1681,26 @@ do_read:
 	 *	allowed, try to define a dynamic client.
 	 */
 	if (!client) {
-		RADCLIENT *radclient = NULL;
+		RADCLIENT *radclient = NULL, *shared = NULL;
 		fr_io_client_state_t state;
 		fr_ipaddr_t const *network = NULL;
+		fr_time_t now;
 
 		/*
 		 *	We MUST be the master socket.
 		 */
 		rad_assert(!connection);
 
+		/*
+		 *	We recently refused packets from this source.
+		 *	Drop the packet without looking anything up.
+		 */
+		now = fr_time();
+		if (negative_cache_find(thread, &address.src_ipaddr, now)) {
+			if (accept_fd >= 0) close(accept_fd);
+			return 0;
+		}
+
 		radclient = inst->app_io->client_find(thread->child, &address.src_ipaddr, inst->ipproto);
 		if (radclient) {
 			state = PR_CLIENT_STATIC;
@@ -1227,6 +1708,7 @@ do_read:
 			/*
 			 *	Make our own copy that we can modify it.
 			 */
+			shared = radclient;
 			MEM(radclient = radclient_clone(thread, radclient));
 			radclient->active = true;
 
@@ -1273,6 +1755,8 @@ do_read:
 				      inst->app_io->name, fr_box_ipaddr(address.src_ipaddr));
 				close(accept_fd);
 			}
+
+			negative_cache_add(thread, &address.src_ipaddr, now);
 			return 0;
 		}
 
@@ -1293,6 +1777,7 @@ do_read:
 		client->state = state;
 		client->src_ipaddr = radclient->ipaddr;
 		client->radclient = radclient;
+		client->shared = shared;
 		client->inst = inst;
 		client->thread = thread;
 
@@ -1320,11 +1805,7 @@ do_read:
 		/*
 		 *	Create the packet tracking table for this client.
 		 */
-		if (inst->app_io->track_duplicates) {
-			rad_assert(inst->app_io->compare != NULL);
-			MEM(client->table = rbtree_talloc_create(client, track_cmp, fr_io_track_t,
-								 NULL, RBTREE_FLAG_NONE));
-		}
+		client_track_init(client);
 
 		/*
 		 *	Allow connected sockets to be set on a
@@ -1397,12 +1878,58 @@ have_client:
 		 *	"live" packets.
 		 */
 		if (!track) {
+			/*
+			 *	Drop the packet if the server or the
+			 *	client is too busy.  Pending clients
+			 *	are already limited by
+			 *	max_pending_packets.
+			 */
+			if ((client->state != PR_CLIENT_PENDING) &&
+			    !fr_io_client_admit(client, connection ? connection->nr : thread->nr, *priority, recv_time)) {
+				DEBUG2("Client %s is over its limits - discarding packet",
+				       client->radclient->shortname);
+				return 0;
+			}
+
 			track = fr_io_track_add(client, &address, buffer, recv_time, is_dup);
 			if (!track) {
 				DEBUG("Failed tracking packet from client %s - discarding it",
 				      client->radclient->shortname);
 				return 0;
 			}
+
+			/*
+			 *	We've already replied to this packet.
+			 *	Resend the cached reply, if there is
+			 *	one, instead of giving the duplicate
+			 *	to a worker.
+			 */
+			if (*is_dup && track->reply_len) {
+				if (track->reply) {
+					DEBUG2("proto_%s - Sending duplicate reply to ID %d",
+					       inst->app_io->name, track->packet[1]);
+					(void) inst->app_io->write(child, track, track->timestamp,
+								   track->reply, track->reply_len, 0);
+
+					/*
+					 *	write() may only have queued
+					 *	the reply.  The network flushes
+					 *	the queue after worker replies,
+					 *	which may never come on a quiet
+					 *	socket, so flush it here.
+					 */
+					if (inst->app_io->flush) (void) inst->app_io->flush(child);
+					li->write_syscalls = child->write_syscalls;
+					li->write_packets = child->write_packets;
+				} else {
+					DEBUG2("proto_%s - Ignoring duplicate of ID %d, as we don't respond to it",
+					       inst->app_io->name, track->packet[1]);
+				}
+
+				rad_assert(track->packets > 1);
+				track->packets--;
+				return 0;
+			}
 		}
 
 		/*
@@ -1868,6 +2395,47 @@ reset_timer:
 }
 
 
+static void packet_expiry_timer(fr_event_list_t *el, struct timeval *now, void *uctx);
+
+/** Clean up the tracking entries for a client which have expired
+ *
+ *  There is one timer per client, for the oldest entry in the expiry
+ *  list.  When it fires, we clean up all entries which have expired,
+ *  and then re-arm it for the next one.
+ */
+static void track_cleanup_timer(fr_event_list_t *el, struct timeval *now, void *uctx)
+{
+	fr_io_client_t *client = talloc_get_type_abort(uctx, fr_io_client_t);
+	fr_io_track_t *track;
+
+	while ((track = fr_dlist_head(&client->expiring)) != NULL) {
+		bool last;
+
+		if (fr_timeval_cmp(&track->expires, now) > 0) {
+			if (fr_event_timer_insert(client, el, &client->ev_cleanup,
+						  &track->expires, track_cleanup_timer, client) == 0) {
+				return;
+			}
+
+			DEBUG("proto_%s - Failed adding cleanup_delay for packet.  Discarding packet immediately",
+			      client->inst->app_io->name);
+		}
+
+		(void) fr_dlist_remove(&client->expiring, track);
+
+		/*
+		 *	Cleaning up the last packet for a dynamic
+		 *	client may free the client, so we have to
+		 *	stop here.  There are no more entries in the
+		 *	list, as each one counts as a client packet.
+		 */
+		last = (client->state != PR_CLIENT_STATIC) && (client->packets == 1);
+
+		packet_expiry_timer(el, now, track);
+		if (last) return;
+	}
+}
+
 static void packet_expiry_timer(fr_event_list_t *el, struct timeval *now, void *uctx)
 {
 	fr_io_track_t *track = talloc_get_type_abort(uctx, fr_io_track_t);
@@ -1880,17 +2448,24 @@ static void packet_expiry_timer(fr_event_list_t *el, struct timeval *now, void *
 	 */
 	if (el && !now &&
 	    ((inst->cleanup_delay.tv_sec | inst->cleanup_delay.tv_usec) != 0)) {
+		gettimeofday(&track->expires, NULL);
+		fr_timeval_add(&track->expires, &track->expires, &inst->cleanup_delay);
 
-		struct timeval when;
-
-		gettimeofday(&when, NULL);
-		fr_timeval_add(&when, &when, &inst->cleanup_delay);
+		/*
+		 *	cleanup_delay is the same for all packets, so
+		 *	the list is ordered by expiry time.  We only
+		 *	need a timer for the first entry.
+		 */
+		fr_dlist_insert_tail(&client->expiring, track);
+		if (client->ev_cleanup) return;
 
-		if (fr_event_timer_insert(client, el, &track->ev,
-					  &when, packet_expiry_timer, track) == 0) {
+		if (fr_event_timer_insert(client, el, &client->ev_cleanup,
+					  &track->expires, track_cleanup_timer, client) == 0) {
 			return;
 		}
 
+		(void) fr_dlist_remove(&client->expiring, track);
+
 		DEBUG("proto_%s - Failed adding cleanup_delay for packet.  Discarding packet immediately",
 			inst->app_io->name);
 	}
@@ -1912,8 +2487,7 @@ static void packet_expiry_timer(fr_event_list_t *el, struct timeval *now, void *
 	track->packets--;
 
 	if (track->packets == 0) {
-		if (inst->app_io->track_duplicates) (void) rbtree_deletebydata(client->table, track);
-		talloc_free(track);
+		track_free(client, track);
 
 	} else {
 		if (track->reply) {
@@ -1978,7 +2552,10 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 
 		/*
 		 *	The request later received a conflicting
-		 *	packet, so we discard this one.
+		 *	packet, so we discard this one.  The worker
+		 *	also sends us a reply with no request time
+		 *	when it discards a duplicate, so that the
+		 *	duplicate releases its reference.
 		 */
 		if (track->timestamp != request_time) {
 			rad_assert(track->packets > 0);
@@ -1987,7 +2564,17 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 			client->packets--;
 			packets--;
 
-			DEBUG3("Suppressing reply as we have a newer packet");
+			if (request_time) {
+				DEBUG3("Suppressing reply as we have a newer packet");
+			} else {
+				DEBUG3("Releasing discarded duplicate packet");
+			}
+
+			/*
+			 *	The original packet has been cleaned
+			 *	up, and we were the last reference.
+			 */
+			if (track->packets == 0) track_free(client, track);
 
 			/*
 			 *	No packets left for this client, reset
@@ -2018,9 +2605,20 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 
 		packet_len = inst->app_io->write(child, track, request_time,
 						 buffer, buffer_len, written);
+		li->write_syscalls = child->write_syscalls;
+		li->write_packets = child->write_packets;
+
+		/*
+		 *	The socket can't take the reply yet.  The
+		 *	network side keeps it, and calls us again when
+		 *	the socket is writable.  So the tracking entry
+		 *	has to stay as it is until then.
+		 */
+		if ((packet_len < 0) && (errno == EWOULDBLOCK)) return packet_len;
+
 		if (packet_len > 0) {
 			rad_assert(buffer_len == (size_t) packet_len);
-			MEM(track->reply = talloc_memdup(track, buffer, buffer_len));
+			MEM(track->reply = talloc_memdup(client, buffer, buffer_len));
 			track->reply_len = buffer_len;
 		} else {
 			track->reply_len = 1; /* don't respond */
@@ -2083,6 +2681,23 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 			return -1;
 		}
 
+		/*
+		 *	Remember the source in the negative cache,
+		 *	which is checked before we allocate anything
+		 *	for a new client.  A flood from this source
+		 *	then doesn't allocate a new client and new
+		 *	pending packets every time the NAK expires.
+		 *
+		 *	The negative cache also refuses packets while
+		 *	the NAK is in force, so we don't need to keep
+		 *	the client as a place-holder.
+		 */
+		negative_cache_add(thread, &client->src_ipaddr, fr_time());
+		if (!connection && thread->negative) {
+			talloc_free(client);
+			return buffer_len;
+		}
+
 		/*
 		 *	For connected TCP sockets, we just call the
 		 *	expiry timer, which will close and free the
@@ -2352,6 +2967,27 @@ static int mod_close(fr_listen_t *li)
 	return 0;
 }
 
+/** Flush any writes which were queued by the child
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+	int rcode;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	rcode = inst->app_io->flush(child);
+	li->write_syscalls = child->write_syscalls;
+	li->write_packets = child->write_packets;
+
+	return rcode;
+}
+
 
 static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 {
@@ -2528,7 +3164,7 @@ fr_trie_t *fr_master_io_network(TALLOC_CTX *ctx, int af, fr_ipaddr_t *allow, fr_
 	 *	And now check denied networks.
 	 */
 	num = talloc_array_length(deny);
-	if (!num) return trie;
+	if (!num) goto freeze;
 
 	/*
 	 *	Since the default is to deny, you can only add
@@ -2601,6 +3237,17 @@ fr_trie_t *fr_master_io_network(TALLOC_CTX *ctx, int af, fr_ipaddr_t *allow, fr_
 		deny[i].af = AF_UNSPEC;
 	}
 
+freeze:
+	/*
+	 *	The networks don't change after this, and the trie is
+	 *	checked for every packet from an unknown client.
+	 */
+	if (fr_trie_freeze(trie) < 0) {
+		fr_strerror_printf("Failed freezing the trie of allowed and denied networks");
+		talloc_free(trie);
+		return NULL;
+	}
+
 	return trie;
 }
 
@@ -2631,25 +3278,15 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Create a listener, and open its socket
+ *
+ */
+static fr_listen_t *fr_master_io_listen_alloc(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+					      size_t default_message_size, size_t num_messages)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		rad_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->thread_inst_size) {
-		fr_strerror_printf("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -2692,6 +3329,21 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	 */
 	MEM(thread->trie = fr_trie_alloc(thread));
 
+	/*
+	 *	Create the negative cache of refused source
+	 *	addresses.  The number of buckets is a power of 2.
+	 */
+	if (inst->negative_cache_size) {
+		uint32_t buckets = 1;
+
+		while ((buckets * NEGATIVE_CACHE_WAYS) < inst->negative_cache_size) buckets <<= 1;
+
+		MEM(thread->negative = talloc_zero_array(thread, fr_io_negative_t, buckets * NEGATIVE_CACHE_WAYS));
+		thread->negative_mask = buckets - 1;
+		thread->negative_lifetime = ((fr_time_t) inst->nak_lifetime.tv_sec * NANOSEC) +
+					    (inst->nak_lifetime.tv_usec * 1000);
+	}
+
 	MEM(thread->alive_clients = fr_heap_create(thread, pending_client_cmp,
 						 fr_io_client_t, alive_id));
 	talloc_set_destructor(thread->alive_clients, _client_heap_free);
@@ -2749,7 +3401,7 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	if (inst->app_io->open(child) < 0) {
 		cf_log_err(inst->app_io_conf, "Failed opening %s interface", inst->app_io->name);
 		talloc_free(li);
-		return -1;
+		return NULL;
 	}
 
 	li->fd = child->fd;	/* copy this back up */
@@ -2761,15 +3413,107 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	}
 	child->name = li->name;
 
+	return li;
+}
+
+/** Check if a listener can open one socket per network thread
+ *
+ *  The app_io has to have set SO_REUSEPORT on a UDP socket.  Then
+ *  every network thread can have its own socket, bound to the same
+ *  address and port.
+ */
+static bool fr_master_io_listen_shardable(fr_io_instance_t const *inst, fr_listen_t const *li)
+{
+#ifdef SO_REUSEPORT
+	int		on = 0;
+	socklen_t	len = sizeof(on);
+
+	if (inst->ipproto != IPPROTO_UDP) return false;
+
+	if (getsockopt(li->fd, SOL_SOCKET, SO_REUSEPORT, &on, &len) < 0) return false;
+
+	return (on != 0);
+#else
+	return false;
+#endif
+}
+
+int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	int		i, num_networks;
+	fr_listen_t	*li, **shards;
+
 	/*
-	 *	Add the socket to the scheduler, where it might end up
-	 *	in a different thread.
+	 *	No IO paths, so we don't initialize them.
 	 */
-	if (!fr_schedule_listen_add(sc, li)) {
-		talloc_free(li);
+	if (!inst->app_io) {
+		rad_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->thread_inst_size) {
+		fr_strerror_printf("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
 		return -1;
 	}
 
+	li = fr_master_io_listen_alloc(ctx, inst, sc, default_message_size, num_messages);
+	if (!li) return -1;
+
+	/*
+	 *	One socket is enough.  Add it to the scheduler, where
+	 *	it might end up in a different thread.
+	 */
+	num_networks = fr_schedule_num_networks(sc);
+	if ((num_networks < 2) || !fr_master_io_listen_shardable(inst, li)) {
+		if (!fr_schedule_listen_add(sc, li)) {
+			talloc_free(li);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	/*
+	 *	Open one socket per network thread.  Each one has its
+	 *	own clients and duplicate detection table, so a client
+	 *	has to always be read by the same thread.
+	 */
+	MEM(shards = talloc_zero_array(NULL, fr_listen_t *, num_networks));
+	shards[0] = li;
+
+	for (i = 1; i < num_networks; i++) {
+		shards[i] = fr_master_io_listen_alloc(ctx, inst, sc, default_message_size, num_messages);
+		if (!shards[i]) {
+			for (i = 0; i < num_networks; i++) talloc_free(shards[i]);
+			talloc_free(shards);
+			return -1;
+		}
+	}
+
+	/*
+	 *	If we can't steer packets by source IP, the kernel
+	 *	hashes on the source port, too.  Retransmissions still
+	 *	go to the same socket, so the server still works.
+	 */
+	if (fr_socket_reuseport_steer(li->fd, num_networks) < 0) {
+		cf_log_warn(inst->app_io_conf, "Clients may be read by more than one network thread: %s",
+			    fr_strerror());
+	}
+
+	/*
+	 *	The network owns the sockets which were added to it,
+	 *	so we only free the rest.
+	 */
+	for (i = 0; i < num_networks; i++) {
+		if (!fr_schedule_listen_add_network(sc, shards[i], i)) {
+			while (i < num_networks) talloc_free(shards[i++]);
+			talloc_free(shards);
+			return -1;
+		}
+	}
+
+	talloc_free(shards);
 	return 0;
 }
 
@@ -2874,6 +3618,7 @@ fr_app_io_t fr_master_app_io = {
 
 	.open			= mod_open,
 	.close			= mod_close,
+	.flush			= mod_flush,
 	.event_list_set		= mod_event_list_set,
 	.get_name		= mod_name,
 };
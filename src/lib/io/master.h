@@ -38,8 +38,18 @@ extern "C" {
 
 typedef struct fr_io_client_s fr_io_client_t;
 
+/** Token bucket for a client's packet rate limit
+ *
+ */
+typedef struct {
+	fr_time_t		credit;		//!< how much time's worth of packets we can still accept
+	fr_time_t		last;		//!< when we last added credit, 0 for a new bucket
+} fr_io_rate_limit_t;
+
 typedef struct {
-	fr_event_timer_t const		*ev;		//!< when we clean up this tracking entry
+	fr_dlist_t			entry;		//!< in the client's expiry list, or free list
+	struct timeval			expires;	//!< when we clean up this tracking entry
+	uint32_t			hash;		//!< in the client's tracking table
 	fr_time_t			timestamp;	//!< when this packet was received
 	int				packets;     	//!< number of packets using this entry
 	uint8_t				*reply;		//!< reply packet (if any)
@@ -54,6 +64,7 @@ typedef struct {
 	 */
 	fr_time_t			dynamic;	//!< timestamp for packet doing dynamic client definition
 	fr_io_address_t   		*address;	//!< of this packet.. shared between multiple packets
+	fr_io_address_t			my_address;	//!< storage for "address", when it's not a connection
 	fr_io_client_t			*client;	//!< client handling this packet.
 	uint8_t				packet[20];	//!< original request packet
 } fr_io_track_t;
@@ -77,6 +88,7 @@ typedef struct {
 	uint32_t			max_connections;		//!< maximum number of connections to allow
 	uint32_t			max_clients;			//!< maximum number of dynamic clients to allow
 	uint32_t			max_pending_packets;		//!< maximum number of pending packets
+	uint32_t			negative_cache_size;		//!< number of refused source addresses to remember
 
 	struct timeval			cleanup_delay;			//!< for Access-Request packets
 	struct timeval			idle_timeout;			//!< for dynamic clients
@@ -108,6 +120,8 @@ typedef struct {
 extern fr_app_io_t fr_master_app_io;
 
 fr_trie_t *fr_master_io_network(TALLOC_CTX *ctx, int af, fr_ipaddr_t *allow, fr_ipaddr_t *deny);
+bool fr_io_rate_limit_admit(fr_io_rate_limit_t *rate, uint32_t max_packets_per_second,
+			    uint32_t priority, fr_time_t now) CC_HINT(nonnull);
 int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *io, fr_schedule_t *sc,
 			size_t default_message_size, size_t num_messages) CC_HINT(nonnull);
 int fr_app_process_bootstrap(dl_instance_t **type_submodule, CONF_SECTION *conf, CONF_SECTION *server_cs);
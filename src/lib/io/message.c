@@ -86,6 +86,12 @@ RCSID("$Id$")
  *  2M packets, if *all* of the mr_array entries have packets stuck in
  *  them that aren't cleaned up for extended periods of time.
  *
+ *  A "fixed" message set has exactly one message array and one ring
+ *  buffer, which are allocated up front in pre-faulted huge pages.
+ *  It never grows.  When it's full, the allocation fails, and the
+ *  caller drops the packet.  This avoids the latency of allocating
+ *  (and later garbage collecting) new buffers when the load ramps up.
+ *
  *  @todo Add a flag for UDP-style protocols, where we can put the
  *  message into the ring buffer.  This helps with locality of
  *  reference, and removes the need to track two separate things.
@@ -106,23 +112,21 @@ struct fr_message_set_t {
 	int			allocated;
 	int			freed;
 
+	bool			fixed;		//!< never allocate more arrays / buffers
+
+	uint64_t		num_gc;		//!< number of times we garbage collected
+	uint64_t		num_gc_cleaned;	//!< number of messages cleaned by GC
+	uint64_t		num_grown;	//!< number of arrays / buffers added
+	uint64_t		num_alloc_failed; //!< number of failed allocations
+
 	fr_ring_buffer_t	*mr_array[MSG_ARRAY_SIZE]; //!< array of message arrays
 
 	fr_ring_buffer_t	*rb_array[MSG_ARRAY_SIZE]; //!< array of ring buffers
 };
 
 
-/** Create a message set
- *
- * @param[in] ctx the context for talloc
- * @param[in] num_messages size of the initial message array.  MUST be a power of 2.
- * @param[in] message_size the size of each message, INCLUDING fr_message_t, which MUST be at the start of the struct
- * @param[in] ring_buffer_size of the ring buffer.  MUST be a power of 2.
- * @return
- *	- NULL on error
- *	- newly allocated fr_message_set_t on success
- */
-fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_t message_size, size_t ring_buffer_size)
+static fr_message_set_t *message_set_create(TALLOC_CTX *ctx, int num_messages, size_t message_size,
+					    size_t ring_buffer_size, bool fixed)
 {
 	fr_message_set_t *ms;
 
@@ -155,15 +159,24 @@ fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_
 	message_size += 15;
 	message_size &= ~(size_t) 15;
 	ms->message_size = message_size;
+	ms->fixed = fixed;
 
-	ms->rb_array[0] = fr_ring_buffer_create(ms, ring_buffer_size);
+	if (fixed) {
+		ms->rb_array[0] = fr_ring_buffer_create_hugepage(ms, ring_buffer_size);
+	} else {
+		ms->rb_array[0] = fr_ring_buffer_create(ms, ring_buffer_size);
+	}
 	if (!ms->rb_array[0]) {
 		talloc_free(ms);
 		return NULL;
 	}
 	ms->rb_max = 0;
 
-	ms->mr_array[0] = fr_ring_buffer_create(ms, num_messages * message_size);
+	if (fixed) {
+		ms->mr_array[0] = fr_ring_buffer_create_hugepage(ms, num_messages * message_size);
+	} else {
+		ms->mr_array[0] = fr_ring_buffer_create(ms, num_messages * message_size);
+	}
 	if (!ms->mr_array[0]) {
 		talloc_free(ms);
 		return NULL;
@@ -174,6 +187,40 @@ fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_
 	return ms;
 }
 
+/** Create a message set
+ *
+ * @param[in] ctx the context for talloc
+ * @param[in] num_messages size of the initial message array.  MUST be a power of 2.
+ * @param[in] message_size the size of each message, INCLUDING fr_message_t, which MUST be at the start of the struct
+ * @param[in] ring_buffer_size of the ring buffer.  MUST be a power of 2.
+ * @return
+ *	- NULL on error
+ *	- newly allocated fr_message_set_t on success
+ */
+fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_t message_size, size_t ring_buffer_size)
+{
+	return message_set_create(ctx, num_messages, message_size, ring_buffer_size, false);
+}
+
+/** Create a fixed-size message set in pre-faulted huge pages
+ *
+ *  The message set never grows.  If all of the messages or all of the
+ *  ring buffer are in use, allocations fail.
+ *
+ * @param[in] ctx the context for talloc
+ * @param[in] num_messages size of the message array.  MUST be a power of 2.
+ * @param[in] message_size the size of each message, INCLUDING fr_message_t, which MUST be at the start of the struct
+ * @param[in] ring_buffer_size of the ring buffer.  MUST be a power of 2.
+ * @return
+ *	- NULL on error
+ *	- newly allocated fr_message_set_t on success
+ */
+fr_message_set_t *fr_message_set_create_fixed(TALLOC_CTX *ctx, int num_messages, size_t message_size,
+					      size_t ring_buffer_size)
+{
+	return message_set_create(ctx, num_messages, message_size, ring_buffer_size, true);
+}
+
 
 /** Mark a message as done
  *
@@ -357,6 +404,8 @@ static void fr_message_gc(fr_message_set_t *ms, int max_to_clean)
 	int total_cleaned;
 	size_t largest_free_size;
 
+	ms->num_gc++;
+
 	/*
 	 *	Clean up "done" messages.
 	 */
@@ -378,6 +427,8 @@ static void fr_message_gc(fr_message_set_t *ms, int max_to_clean)
 		if (total_cleaned == max_to_clean) break;
 	}
 
+	ms->num_gc_cleaned += total_cleaned;
+
 	/*
 	 *	Couldn't GC anything.  Don't do more work.
 	 */
@@ -739,12 +790,22 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 		}
 	}
 
+	/*
+	 *	A fixed message set never grows.
+	 */
+	if (ms->fixed) {
+		fr_strerror_printf("All messages are in use");
+		ms->num_alloc_failed++;
+		return NULL;
+	}
+
 	/*
 	 *	All of the arrays are full.  If we don't have
 	 *	room to allocate another array, we're dead.
 	 */
 	if ((ms->mr_max + 1) >= MSG_ARRAY_SIZE) {
 		fr_strerror_printf("All message arrays are full");
+		ms->num_alloc_failed++;
 		return NULL;
 	}
 
@@ -755,8 +816,10 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	mr = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->mr_array[ms->mr_max]) * 2);
 	if (!mr) {
 		fr_strerror_printf_push("Failed allocating ring buffer");
+		ms->num_alloc_failed++;
 		return NULL;
 	}
+	ms->num_grown++;
 
 	/*
 	 *	Set the new one as current for all new
@@ -812,9 +875,10 @@ static fr_message_t *fr_message_get_ring_buffer(fr_message_set_t *ms, fr_message
 		/*
 		 *	If we run out of room in the current ring
 		 *	buffer, AND it's our only one, then just
-		 *	double it in size.
+		 *	double it in size.  Unless we can't grow, in
+		 *	which case the GC is our only hope.
 		 */
-		if (ms->rb_max == 0) goto alloc_rb;
+		if ((ms->rb_max == 0) && !ms->fixed) goto alloc_rb;
 
 		/*
 		 *	We're using multiple ring buffers, and we
@@ -861,6 +925,11 @@ static fr_message_t *fr_message_get_ring_buffer(fr_message_set_t *ms, fr_message
 		}
 	}
 
+	if (ms->fixed) {
+		fr_strerror_printf("Ring buffer is full");
+		goto cleanup;
+	}
+
 	/*
 	 *	All of the arrays are full.  If we don't have
 	 *	room to allocate another array, we're dead.
@@ -882,6 +951,7 @@ alloc_rb:
 	}
 
 	MPRINT("RING BUFFER DOUBLES\n");
+	ms->num_grown++;
 
 	/*
 	 *	Set the new one as current for all new
@@ -901,6 +971,7 @@ alloc_rb:
 
 cleanup:
 	MPRINT("OUT OF MEMORY\n");
+	ms->num_alloc_failed++;
 
 	m->rb = NULL;
 	m->status = FR_MESSAGE_DONE;
@@ -1308,6 +1379,29 @@ void fr_message_set_gc(fr_message_set_t *ms)
 	fr_message_gc(ms, 1 << 24);
 }
 
+/** Get the statistics for a message set
+ *
+ * @param[in] ms	the message set
+ * @param[out] stats	where the statistics are written.
+ */
+void fr_message_set_stats(fr_message_set_t const *ms, fr_message_set_stats_t *stats)
+{
+	int i;
+
+	stats->num_gc = ms->num_gc;
+	stats->num_gc_cleaned = ms->num_gc_cleaned;
+	stats->num_grown = ms->num_grown;
+	stats->num_alloc_failed = ms->num_alloc_failed;
+
+	stats->num_hugepage = 0;
+	for (i = 0; i <= ms->mr_max; i++) {
+		if (fr_ring_buffer_hugepage(ms->mr_array[i])) stats->num_hugepage++;
+	}
+	for (i = 0; i <= ms->rb_max; i++) {
+		if (fr_ring_buffer_hugepage(ms->rb_array[i])) stats->num_hugepage++;
+	}
+}
+
 /** Print debug information about the message set.
  *
  * @param[in] ms the message set
@@ -51,7 +51,20 @@ typedef struct {
 	size_t			rb_size;	//!< cache-aligned size in the ring buffer
 } fr_message_t;
 
+/** Statistics for a message set
+ *
+ */
+typedef struct {
+	uint64_t		num_gc;		//!< number of times the message set was garbage collected
+	uint64_t		num_gc_cleaned;	//!< number of messages cleaned by GC
+	uint64_t		num_grown;	//!< number of arrays / buffers added under load
+	uint64_t		num_alloc_failed; //!< number of failed allocations
+	uint32_t		num_hugepage;	//!< number of arrays / buffers in explicit huge pages
+} fr_message_set_stats_t;
+
 fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_t message_size, size_t ring_buffer_size) CC_HINT(nonnull);
+fr_message_set_t *fr_message_set_create_fixed(TALLOC_CTX *ctx, int num_messages, size_t message_size,
+					      size_t ring_buffer_size) CC_HINT(nonnull);
 
 fr_message_t *fr_message_reserve(fr_message_set_t *ms, size_t reserve_size) CC_HINT(nonnull);
 fr_message_t *fr_message_alloc(fr_message_set_t *ms, fr_message_t *m, size_t actual_packet_size) CC_HINT(nonnull(1));
@@ -64,6 +77,7 @@ fr_message_t *fr_message_localize(TALLOC_CTX *ctx, fr_message_t *m, size_t messa
 
 int fr_message_set_messages_used(fr_message_set_t *ms) CC_HINT(nonnull);
 void fr_message_set_gc(fr_message_set_t *ms) CC_HINT(nonnull);
+void fr_message_set_stats(fr_message_set_t const *ms, fr_message_set_stats_t *stats) CC_HINT(nonnull);
 
 void fr_message_set_debug(fr_message_set_t *ms, FILE *fp) CC_HINT(nonnull);
 
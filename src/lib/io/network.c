@@ -27,6 +27,7 @@ RCSID("$Id$")
 #include <talloc.h>
 
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/latency.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/rbtree.h>
@@ -53,7 +54,25 @@ RCSID("$Id$")
 #define DEBUG3(fmt, ...) if (nr->lvl >= L_DBG_LVL_3) fr_log(nr->log, L_DBG, fmt, ## __VA_ARGS__)
 #define ERROR(fmt, ...) fr_log(nr->log, L_ERR, fmt, ## __VA_ARGS__)
 
-#define MAX_WORKERS 64
+/*
+ *	Initial size of the worker array.  It grows as workers are
+ *	added.
+ */
+#define NUM_WORKERS_INIT 16
+
+/*
+ *	Send requests to workers on another NUMA node only when the
+ *	chosen local worker has more than this many outstanding.
+ */
+#define NUMA_MAX_BACKLOG 32
+
+/*
+ *	The workers give up on requests after this long.  There's no
+ *	point in accepting packets which will wait longer than that.
+ *	This is the default, until fr_network_max_request_time_set()
+ *	is called with the configured value.
+ */
+#define MAX_QUEUE_DELAY ((fr_time_t) MAX_REQUEST_TIME * NANOSEC)
 
 fr_thread_local_setup(fr_ring_buffer_t *, fr_network_rb)	/* macro */
 
@@ -71,7 +90,11 @@ typedef struct {
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
+	int			numa_node;		//!< NUMA node the worker runs on, or -1 for unknown
 	fr_io_stats_t		stats;
+
+	bool			closing;		//!< we've told the worker to close its channel
+	fr_dlist_t		entry;			//!< in the list of closing workers
 } fr_network_worker_t;
 
 typedef struct {
@@ -93,6 +116,15 @@ typedef struct {
 
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
+
+	bool			flush_pending;		//!< is it in the list of sockets to flush?
+	fr_dlist_t		entry;			//!< our entry in the list of sockets to flush
+
+	bool			paused;			//!< too many outstanding packets, we've stopped reading
+	uint64_t		num_paused;		//!< how many times we've stopped reading
+	bool			read_again;		//!< is it in the list of sockets to read?
+	fr_dlist_t		read_entry;		//!< our entry in the list of sockets to read
+
 	fr_io_stats_t		stats;
 } fr_network_socket_t;
 
@@ -126,6 +158,8 @@ struct fr_network_t {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		flush;			//!< sockets which have queued writes
+	fr_dlist_head_t		read_again;		//!< sockets which have buffered packets, or have been un-paused
 
 	fr_io_stats_t		stats;
 
@@ -133,14 +167,42 @@ struct fr_network_t {
 	rbtree_t		*sockets_by_num;       	//!< ordered by number;
 
 	int			num_workers;		//!< number of active workers
-	int			max_workers;		//!< maximum number of allowed workers
+	int			max_workers;		//!< size of the worker arrays
 	int			num_sockets;		//!< actually a counter...
 
-	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
+	fr_network_worker_t	**workers; 		//!< each worker
+
+	int			numa_node;		//!< NUMA node we're running on, or -1 for unknown
+	int			num_local;		//!< number of workers on our NUMA node
+	fr_network_worker_t	**local;		//!< workers on our NUMA node
+	uint64_t		num_remote;		//!< requests sent to workers on other NUMA nodes
+
+	uint64_t		num_shed;		//!< packets refused by fr_network_admit()
+	fr_time_t		max_queue_delay;	//!< the longest a packet can wait for a worker
+
+	bool			message_set_fixed;	//!< message sets are in huge pages, and never grow
+	int			message_set_size;	//!< minimum number of messages for each socket
+	size_t			ring_buffer_size;	//!< minimum ring buffer size for each socket
+
+	fr_dlist_head_t		closing;		//!< workers which are draining their channels
+
+	fr_latency_key_t const	*latency_read;		//!< from reading a packet to sending it to a worker
+	fr_latency_key_t const	*latency_write;		//!< from the worker sending a reply to writing it
 };
 
 static void fr_network_post_event(fr_event_list_t *el, struct timeval *now, void *uctx);
 static int fr_network_pre_event(void *ctx, struct timeval *wake);
+static int fr_network_socket_events(fr_network_t *nr, fr_network_socket_t *s, bool write);
+
+static fr_event_update_t pause_read[] = {
+	FR_EVENT_SUSPEND(fr_event_io_func_t, read),
+	{ 0 }
+};
+
+static fr_event_update_t resume_read[] = {
+	FR_EVENT_RESUME(fr_event_io_func_t, read),
+	{ 0 }
+};
 
 static int reply_cmp(void const *one, void const *two)
 {
@@ -213,6 +275,34 @@ static inline fr_ring_buffer_t *fr_network_rb_init(void)
 #define IALPHA (8)
 #define RTT(_old, _new) ((_new + ((IALPHA - 1) * _old)) / IALPHA)
 
+/** Find the worker which we sent a stolen request to
+ *
+ *  The channel is only used as a key, and is never dereferenced
+ *  unless we find it.  The worker may have exited since we sent
+ *  the request.
+ *
+ * @param[in] nr the network
+ * @param[in] ch the channel the request was sent on
+ * @return
+ *	- NULL if the worker has gone away
+ *	- fr_network_worker_t the worker
+ */
+static fr_network_worker_t *fr_network_worker_by_channel(fr_network_t *nr, fr_channel_t const *ch)
+{
+	int i;
+	fr_network_worker_t *w;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (nr->workers[i]->channel == ch) return nr->workers[i];
+	}
+
+	for (w = fr_dlist_head(&nr->closing); w != NULL; w = fr_dlist_next(&nr->closing, w)) {
+		if (w->channel == ch) return w;
+	}
+
+	return NULL;
+}
+
 /** Callback which handles a message being received on the network side.
  *
  * @param[in] ctx the network
@@ -230,7 +320,6 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 	 *	Update stats for the worker.
 	 */
 	worker = fr_channel_network_ctx_get(ch);
-	worker->stats.out++;
 	worker->cpu_time = cd->reply.cpu_time;
 	if (!worker->predicted) {
 		worker->predicted = cd->reply.processing_time;
@@ -238,6 +327,24 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 		worker->predicted = RTT(worker->predicted, cd->reply.processing_time);
 	}
 
+	/*
+	 *	The request was counted against the worker we sent it
+	 *	to, so the reply has to be counted there, too.
+	 *	Otherwise the backlog of that worker never goes down,
+	 *	and the backlog of the thief goes negative.
+	 */
+	if (cd->stolen_from) {
+		fr_network_worker_t *victim;
+
+		victim = fr_network_worker_by_channel(nr, cd->stolen_from);
+		if (victim) {
+			fr_channel_stolen_reply_received(victim->channel);
+			victim->stats.out++;
+		}
+	} else {
+		worker->stats.out++;
+	}
+
 	(void) fr_heap_insert(nr->replies, cd);
 }
 
@@ -271,9 +378,7 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 	case FR_CHANNEL_DATA_READY_NETWORK:
 		rad_assert(ch != NULL);
 		DEBUG3("data <--");
-		while (fr_channel_recv_reply(ch)) {
-			/* nothing */
-		}
+		(void) fr_channel_recv_reply_bulk(ch);
 		break;
 
 	case FR_CHANNEL_DATA_READY_WORKER:
@@ -287,13 +392,63 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 		break;
 
 	case FR_CHANNEL_CLOSE:
+	{
+		fr_network_worker_t *w;
+
+		rad_assert(ch != NULL);
 		DEBUG3("close <--");
-		///
+
+		/*
+		 *	The worker has acknowledged the close, so it
+		 *	won't send any more replies.  Read the ones it
+		 *	sent before the ack, and then we're done with the
+		 *	channel.
+		 */
+		(void) fr_channel_recv_reply_bulk(ch);
+
+		w = fr_channel_network_ctx_get(ch);
+		if (!w->closing) break;
+
+		fr_dlist_remove(&nr->closing, w);
+		talloc_free(w);
+	}
 		break;
 	}
 }
 
+/** Pick the less loaded of two random workers
+ *
+ * @param workers to choose from
+ * @param num_workers the number of workers in the array
+ * @return the chosen worker
+ */
+static fr_network_worker_t *fr_network_worker_pick(fr_network_worker_t **workers, int num_workers)
+{
+	uint32_t one, two;
+
+	if (num_workers == 1) return workers[0];
+
+	if (num_workers == 2) {
+		one = 0;
+		two = 1;
+	} else {
+		one = fr_rand() % num_workers;
+		do {
+			two = fr_rand() % num_workers;
+		} while (two == one);
+	}
+
+	if (workers[one]->cpu_time < workers[two]->cpu_time) return workers[one];
+
+	return workers[two];
+}
+
 /** Send a message on the "best" channel.
+ *
+ *  If we know which NUMA node we're on, prefer workers on the same
+ *  node.  The messages then don't cross the interconnect.  We only
+ *  use workers on other nodes when the local ones are falling
+ *  behind.
  *
  * @param nr the network
  * @param cd the message we've received
@@ -304,27 +459,16 @@ static bool fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
-	if (nr->num_workers == 1) {
-		worker = nr->workers[0];
+	if ((nr->num_local > 0) && (nr->num_local < nr->num_workers)) {
+		worker = fr_network_worker_pick(nr->local, nr->num_local);
 
-	} else {
-		uint32_t one, two;
-
-		if (nr->num_workers == 2) {
-			one = 0;
-			two = 1;
-		} else {
-			one = fr_rand() % nr->num_workers;
-			do {
-				two = fr_rand() % nr->num_workers;
-			} while (two == one);
+		if ((int64_t) (worker->stats.in - worker->stats.out) > NUMA_MAX_BACKLOG) {
+			worker = fr_network_worker_pick(nr->workers, nr->num_workers);
+			if (worker->numa_node != nr->numa_node) nr->num_remote++;
 		}
 
-		if (nr->workers[one]->cpu_time < nr->workers[two]->cpu_time) {
-			worker = nr->workers[one];
-		} else {
-			worker = nr->workers[two];
-		}
+	} else {
+		worker = fr_network_worker_pick(nr->workers, nr->num_workers);
 	}
 
 	(void) talloc_get_type_abort(worker, fr_network_worker_t);
@@ -385,6 +529,68 @@ static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s)
 }
 
 
+/** Read a socket again after all other events have been serviced
+ *
+ * @param[in] nr	the network
+ * @param[in] s		the socket to read.
+ */
+static void fr_network_read_again(fr_network_t *nr, fr_network_socket_t *s)
+{
+	if (s->read_again) return;
+
+	s->read_again = true;
+	fr_dlist_insert_tail(&nr->read_again, s);
+}
+
+/** Stop reading a socket
+ *
+ *  The event filters are level triggered, so we have to remove the
+ *  read filter.  Otherwise the event loop would keep calling us for
+ *  data which we're not going to read.
+ *
+ * @param[in] nr	the network
+ * @param[in] s		the socket to pause.
+ */
+static void fr_network_pause(fr_network_t *nr, fr_network_socket_t *s)
+{
+	if (s->paused) return;
+
+	s->paused = true;
+	s->num_paused++;
+
+	if (fr_event_filter_update(nr->el, s->listen->fd, FR_EVENT_FILTER_IO, pause_read) < 0) {
+		PERROR("Failed pausing socket %d", s->listen->fd);
+	}
+}
+
+/** Start reading a paused socket again
+ *
+ *  We resume only when no writes are blocked, and once the socket is
+ *  down to half of its outstanding packets, so that we don't
+ *  flip-flop between reading and not.
+ *
+ * @param[in] nr	the network
+ * @param[in] s		the socket to resume.
+ */
+static void fr_network_resume(fr_network_t *nr, fr_network_socket_t *s)
+{
+	if (!s->paused || s->pending) return;
+
+	if (s->listen->max_outstanding && (s->outstanding > (s->listen->max_outstanding / 2))) return;
+
+	s->paused = false;
+
+	if (fr_event_filter_update(nr->el, s->listen->fd, FR_EVENT_FILTER_IO, resume_read) < 0) {
+		PERROR("Failed resuming socket %d", s->listen->fd);
+	}
+
+	/*
+	 *	Read any packets which app_io buffered before we
+	 *	paused the socket.
+	 */
+	fr_network_read_again(nr, s);
+}
+
 /** Read a packet from the network.
  *
  * @param[in] el	the event list.
@@ -399,7 +605,8 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 	fr_network_t *nr = s->nr;
 	ssize_t data_size;
 	fr_channel_data_t *cd, *next;
-	fr_time_t *recv_time;
+	fr_time_t *recv_time, when;
+	bool is_dup;
 
 	if (!fr_cond_assert(s->listen->fd == sockfd)) return;
 
@@ -426,6 +633,30 @@ next_message:
 	 */
 	if (num_messages > 16) {
 		s->cd = cd;
+
+		/*
+		 *	The event filters are level triggered, so
+		 *	we'll get another event for data which is
+		 *	still in the socket.  But the kernel doesn't
+		 *	know about packets which app_io has already
+		 *	read into its buffer.  Go get them after
+		 *	we've serviced the other sockets.
+		 */
+		if (s->listen->read_pending) fr_network_read_again(nr, s);
+		return;
+	}
+
+	/*
+	 *	Too many packets from this socket are still being
+	 *	processed, or the socket isn't taking our replies.
+	 *	Stop reading it, which puts back-pressure on the
+	 *	client.  Reading resumes once enough of the replies
+	 *	have come back, and have been written.
+	 */
+	if (s->pending ||
+	    (s->listen->max_outstanding && (s->outstanding >= s->listen->max_outstanding))) {
+		s->cd = cd;
+		fr_network_pause(nr, s);
 		return;
 	}
 
@@ -456,6 +687,11 @@ next_message:
 		 *	fr_io_socket_t, no "head of line"
 		 *	blocking issues can happen for stream sockets.
 		 */
+		if (s->listen->read_pending) {
+			num_messages++;
+			goto next_message;
+		}
+
 		s->cd = cd;
 		return;
 	}
@@ -508,6 +744,14 @@ next_message:
 		}
 	}
 
+	/*
+	 *	Duplicates have the receive time of the original
+	 *	packet, so they're not useful for latency.  And the
+	 *	worker owns "cd" once it has been sent.
+	 */
+	is_dup = cd->request.is_dup;
+	when = *recv_time;
+
 	if (!fr_network_send_request(nr, cd)) {
 		fr_log(nr->log, L_ERR, "Failed sending packet to worker");
 		fr_message_done(&cd->m);
@@ -518,6 +762,8 @@ next_message:
 		 *	One more packet sent to a worker.
 		 */
 		s->outstanding++;
+
+		if (!is_dup) fr_latency_record(nr->latency_read, fr_time() - when);
 	}
 
 	/*
@@ -533,6 +779,22 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	The app_io read multiple packets in one system call,
+	 *	and has more of them buffered.  Go get them.
+	 */
+	if (s->listen->read_pending) {
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		if (!cd) {
+			fr_log(nr->log, L_ERR, "Failed allocating message size %zd! - Closing socket", s->listen->default_message_size);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+
+		num_messages++;
+		goto next_message;
+	}
 }
 
 
@@ -597,8 +859,6 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
-	rad_assert(s->pending != NULL);
-
 	/*
 	 *	@todo - this code is much the same as in
 	 *	fr_network_post_event().  Fix it so we only have one
@@ -660,6 +920,8 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		s->pending = NULL;
 		s->written = 0;
 
+		fr_latency_record(nr->latency_write, fr_time() - cd->m.when);
+
 		/*
 		 *	Reset for the next message.
 		 */
@@ -677,18 +939,61 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		}
 	}
 
+	/*
+	 *	Write the data which the app_io queued.  If it still
+	 *	can't all be written, keep the write callback.
+	 */
+	if (li->app_io->flush) {
+		int rcode;
+
+		rcode = li->app_io->flush(li);
+		if (rcode < 0) {
+			PERROR("Failed flushing socket %d", li->fd);
+			if (li->app_io->error) li->app_io->error(li);
+
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+
+		if (rcode > 0) return;
+	}
+
 	/*
 	 *	We've successfully written all of the packets.  Remove
 	 *	the write callback.
 	 */
-	if (fr_event_fd_insert(nr, nr->el, s->listen->fd,
-			       fr_network_read,
-			       NULL,
-			       fr_network_error,
-			       s) < 0) {
+	if (fr_network_socket_events(nr, s, false) < 0) {
 		PERROR("Failed adding new socket to event loop");
 		fr_network_socket_dead(nr, s);
+		return;
 	}
+
+	fr_network_resume(nr, s);
+}
+
+/** Set the event callbacks for a socket
+ *
+ *  Inserting the callbacks clears any suspended read filter, so a
+ *  paused socket has its read filter suspended again.
+ *
+ * @param[in] nr	the network
+ * @param[in] s		the socket.
+ * @param[in] write	whether we're waiting for the socket to be writable.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int fr_network_socket_events(fr_network_t *nr, fr_network_socket_t *s, bool write)
+{
+	if (fr_event_fd_insert(nr, nr->el, s->listen->fd,
+			       fr_network_read,
+			       write ? fr_network_write : NULL,
+			       fr_network_error,
+			       s) < 0) return -1;
+
+	if (!s->paused) return 0;
+
+	return fr_event_filter_update(nr->el, s->listen->fd, FR_EVENT_FILTER_IO, pause_read);
 }
 
 static int _network_socket_free(fr_network_socket_t *s)
@@ -706,6 +1011,9 @@ static int _network_socket_free(fr_network_socket_t *s)
 	rbtree_deletebydata(nr->sockets, s);
 	rbtree_deletebydata(nr->sockets_by_num, s);
 
+	if (s->flush_pending) fr_dlist_remove(&nr->flush, s);
+	if (s->read_again) fr_dlist_remove(&nr->read_again, s);
+
 	if (s->listen->app_io->close) {
 		s->listen->app_io->close(s->listen);
 	} else {
@@ -729,6 +1037,48 @@ static int _network_socket_free(fr_network_socket_t *s)
 	return 0;
 }
 
+/** Create the message set for a socket
+ *
+ *  If the message sets are fixed, they can't grow under load.  So
+ *  they're made at least as large as the configured size.
+ *
+ *  Connected sockets always get a normal message set.  There may be
+ *  thousands of them, and each one carries only a small part of the
+ *  traffic.
+ *
+ * @param[in] nr		the network
+ * @param[in] li		the socket's listener.
+ * @param[in] ctx		to allocate the message set in.
+ * @param[in] num_messages	the socket wants.
+ * @param[in] size		of the ring buffer the socket wants.
+ * @return
+ *	- NULL on error.
+ *	- fr_message_set_t on success.
+ */
+static fr_message_set_t *network_message_set_create(fr_network_t *nr, fr_listen_t const *li, TALLOC_CTX *ctx,
+						    int num_messages, size_t size)
+{
+	fr_message_set_t *ms;
+
+	if (!nr->message_set_fixed || li->connected) {
+		return fr_message_set_create(ctx, num_messages, sizeof(fr_channel_data_t), size);
+	}
+
+	if (num_messages < nr->message_set_size) num_messages = nr->message_set_size;
+	if (size < nr->ring_buffer_size) size = nr->ring_buffer_size;
+
+	ms = fr_message_set_create_fixed(ctx, num_messages, sizeof(fr_channel_data_t), size);
+	if (ms) return ms;
+
+	/*
+	 *	Huge pages may have run out.  Fall back to a message
+	 *	set which grows.
+	 */
+	fr_log(nr->log, L_WARN, "Failed creating fixed message set, using a normal one - %s", fr_strerror());
+
+	return fr_message_set_create(ctx, num_messages, sizeof(fr_channel_data_t), size);
+}
+
 /** Handle a network control message callback for a new socket
  *
  * @param[in] ctx the network
@@ -773,9 +1123,7 @@ static void fr_network_socket_callback(void *ctx, void const *data, size_t data_
 	/*
 	 *	Allocate the ring buffer for messages and packets.
 	 */
-	s->ms = fr_message_set_create(s, num_messages,
-				      sizeof(fr_channel_data_t),
-				      size);
+	s->ms = network_message_set_create(nr, s->listen, s, num_messages, size);
 	if (!s->ms) {
 		fr_log(nr->log, L_ERR, "Failed creating message buffers for network IO: %s", fr_strerror());
 		talloc_free(s);
@@ -839,9 +1187,8 @@ static void fr_network_directory_callback(void *ctx, void const *data, size_t da
 	num_messages = s->listen->num_messages;
 	if (num_messages < 8) num_messages = 8;
 
-	s->ms = fr_message_set_create(s, num_messages,
-				      sizeof(fr_channel_data_t),
-				      s->listen->default_message_size * s->listen->num_messages);
+	s->ms = network_message_set_create(nr, s->listen, s, num_messages,
+					   s->listen->default_message_size * s->listen->num_messages);
 	if (!s->ms) {
 		fr_log(nr->log, L_ERR, "Failed creating message buffers for directory IO: %s", fr_strerror());
 		talloc_free(s);
@@ -879,7 +1226,6 @@ static void fr_network_directory_callback(void *ctx, void const *data, size_t da
  */
 static void fr_network_worker_callback(void *ctx, void const *data, size_t data_size, UNUSED fr_time_t now)
 {
-	int i;
 	fr_network_t *nr = ctx;
 	fr_worker_t *worker;
 	fr_network_worker_t *w;
@@ -892,6 +1238,7 @@ static void fr_network_worker_callback(void *ctx, void const *data, size_t data_
 	MEM(w = talloc_zero(nr, fr_network_worker_t));
 
 	w->worker = worker;
+	w->numa_node = fr_worker_numa_node(worker);
 	w->channel = fr_worker_channel_create(worker, w, nr->control);
 	if (!w->channel) fr_exit_now(1);
 
@@ -899,20 +1246,90 @@ static void fr_network_worker_callback(void *ctx, void const *data, size_t data_
 	fr_channel_set_recv_reply(w->channel, nr, fr_network_recv_reply);
 
 	/*
-	 *	Insert the worker into the array of workers.
+	 *	Grow the arrays of workers, if necessary.
 	 */
-	for (i = 0; i < nr->max_workers; i++) {
-		if (nr->workers[i]) continue;
+	if (nr->num_workers == nr->max_workers) {
+		int max_workers = nr->max_workers * 2;
 
-		nr->workers[i] = w;
-		nr->num_workers++;
-		return;
+		MEM(nr->workers = talloc_realloc(nr, nr->workers, fr_network_worker_t *, max_workers));
+		MEM(nr->local = talloc_realloc(nr, nr->local, fr_network_worker_t *, max_workers));
+		nr->max_workers = max_workers;
 	}
 
 	/*
-	 *	Run out of room to put workers!
+	 *	The array of workers is always packed, so that we can
+	 *	pick one at random.
 	 */
-	rad_assert(0 == 1);
+	nr->workers[nr->num_workers++] = w;
+
+	if ((nr->numa_node >= 0) && (w->numa_node == nr->numa_node)) {
+		nr->local[nr->num_local++] = w;
+	}
+}
+
+/** Remove a worker from an array of workers, keeping the array packed
+ *
+ */
+static bool fr_network_worker_array_remove(fr_network_worker_t **workers, int *num_workers, fr_network_worker_t *w)
+{
+	int i;
+
+	for (i = 0; i < *num_workers; i++) {
+		if (workers[i] != w) continue;
+
+		workers[i] = workers[*num_workers - 1];
+		workers[*num_workers - 1] = NULL;
+		(*num_workers)--;
+		return true;
+	}
+
+	return false;
+}
+
+/** Handle a network control message callback for a worker being removed
+ *
+ *  We stop sending requests to the worker, and tell it to close the
+ *  channel.  We keep reading replies from the channel until the
+ *  worker acknowledges the close.
+ *
+ * @param[in] ctx the network
+ * @param[in] data the message
+ * @param[in] data_size size of the data
+ * @param[in] now the current time
+ */
+static void fr_network_worker_remove_callback(void *ctx, void const *data, size_t data_size, UNUSED fr_time_t now)
+{
+	int i;
+	fr_network_t *nr = ctx;
+	fr_worker_t *worker;
+	fr_network_worker_t *w = NULL;
+
+	rad_assert(data_size == sizeof(worker));
+
+	memcpy(&worker, data, data_size);
+	(void) talloc_get_type_abort(worker, fr_worker_t);
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (nr->workers[i]->worker != worker) continue;
+
+		w = nr->workers[i];
+		break;
+	}
+
+	if (!w) {
+		DEBUG3("Asked to remove unknown worker %p", worker);
+		return;
+	}
+
+	(void) fr_network_worker_array_remove(nr->workers, &nr->num_workers, w);
+	(void) fr_network_worker_array_remove(nr->local, &nr->num_local, w);
+
+	w->closing = true;
+	fr_dlist_insert_tail(&nr->closing, w);
+
+	if (fr_channel_signal_worker_close(w->channel) < 0) {
+		DEBUG3("Failed signalling worker to close channel: %s", fr_strerror());
+	}
 }
 
 
@@ -994,8 +1411,21 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 	nr->el = el;
 	nr->log = logger;
 	nr->lvl = lvl;
-	nr->max_workers = MAX_WORKERS;
+	nr->max_workers = NUM_WORKERS_INIT;
+	nr->numa_node = -1;
+	nr->max_queue_delay = MAX_QUEUE_DELAY;
 	nr->num_workers = 0;
+	nr->latency_read = fr_latency_register("network.read", NULL);
+	nr->latency_write = fr_latency_register("network.write", NULL);
+	fr_dlist_init(&nr->closing, fr_network_worker_t, entry);
+
+	nr->workers = talloc_zero_array(nr, fr_network_worker_t *, nr->max_workers);
+	nr->local = talloc_zero_array(nr, fr_network_worker_t *, nr->max_workers);
+	if (!nr->workers || !nr->local) {
+		fr_strerror_printf("Failed allocating memory");
+		talloc_free(nr);
+		return NULL;
+	}
 
 	nr->kq = fr_event_list_kq(nr->el);
 	rad_assert(nr->kq >= 0);
@@ -1056,6 +1486,11 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 		goto fail2;
 	}
 
+	if (fr_control_callback_add(nr->control, FR_CONTROL_ID_WORKER_REMOVE, nr, fr_network_worker_remove_callback) < 0) {
+		fr_strerror_printf_push("Failed adding worker remove callback");
+		goto fail2;
+	}
+
 	if (fr_control_callback_add(nr->control, FR_CONTROL_ID_INJECT, nr, fr_network_inject_callback) < 0) {
 		fr_strerror_printf_push("Failed adding packet injection callback");
 		goto fail2;
@@ -1082,6 +1517,9 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 		goto fail2;
 	}
 
+	fr_dlist_init(&nr->flush, fr_network_socket_t, entry);
+	fr_dlist_init(&nr->read_again, fr_network_socket_t, read_entry);
+
 	if (fr_event_pre_insert(nr->el, fr_network_pre_event, nr) < 0) {
 		fr_strerror_printf("Failed adding pre-check to event list");
 		goto fail2;
@@ -1154,15 +1592,40 @@ int fr_network_destroy(fr_network_t *nr)
  * @param[in] ctx the network
  * @param[in] wake the time when the event loop will wake up.
  */
-static int fr_network_pre_event(void *ctx, UNUSED struct timeval *wake)
+static int fr_network_pre_event(void *ctx, struct timeval *wake)
 {
+	int i;
+	fr_network_worker_t *w;
 	fr_network_t *nr = talloc_get_type_abort(ctx, fr_network_t);
 
-	if (fr_heap_num_elements(nr->replies) > 0) {
+	if ((fr_heap_num_elements(nr->replies) > 0) || fr_dlist_head(&nr->read_again)) {
 		return 1;
 	}
 
-	return 0;
+	/*
+	 *	We're polling the event loop, so we're not sleeping.
+	 */
+	if (wake && ((wake->tv_sec == 0) && (wake->tv_usec == 0))) {
+		return 0;
+	}
+
+	/*
+	 *	Tell the workers that we're sleeping, so that they
+	 *	signal us when they send a reply.  If replies arrived
+	 *	in the meantime, we don't sleep, and instead go write
+	 *	them.
+	 */
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		(void) fr_channel_network_sleeping(nr->workers[i]->channel);
+	}
+
+	for (w = fr_dlist_head(&nr->closing); w != NULL; w = fr_dlist_next(&nr->closing, w)) {
+		(void) fr_channel_network_sleeping(w->channel);
+	}
+
+	return (fr_heap_num_elements(nr->replies) > 0);
 }
 
 /** Handle replies after all FD and timer events have been serviced
@@ -1173,14 +1636,30 @@ static int fr_network_pre_event(void *ctx, UNUSED struct timeval *wake)
  */
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
 {
+	int i;
+	fr_network_worker_t *w;
 	fr_channel_data_t *cd;
+	fr_network_socket_t *s, *last;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
+	/*
+	 *	The workers don't signal us while we're awake, so we
+	 *	have to go check the channels for new replies.
+	 */
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		(void) fr_channel_recv_reply_bulk(nr->workers[i]->channel);
+	}
+
+	for (w = fr_dlist_head(&nr->closing); w != NULL; w = fr_dlist_next(&nr->closing, w)) {
+		(void) fr_channel_recv_reply_bulk(w->channel);
+	}
+
 	while ((cd = fr_heap_pop(nr->replies)) != NULL) {
 		ssize_t rcode;
 		fr_listen_t *li;
 		fr_message_t *lm;
-		fr_network_socket_t *s;
 
 		li = cd->listen;
 
@@ -1218,6 +1697,12 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 			continue;
 		}
 
+		/*
+		 *	We may have stopped reading the socket
+		 *	because it had too many outstanding packets.
+		 */
+		fr_network_resume(nr, s);
+
 		/*
 		 *	No data to write to the socket, so we skip it.
 		 */
@@ -1261,11 +1746,7 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 
 			if (errno == EWOULDBLOCK) {
 			save_pending:
-				if (fr_event_fd_insert(nr, nr->el, s->listen->fd,
-						       fr_network_read,
-						       fr_network_write,
-						       fr_network_error,
-						       s) < 0) {
+				if (fr_network_socket_events(nr, s, true) < 0) {
 					PERROR("Failed adding write callback to event loop");
 					goto error;
 				}
@@ -1312,16 +1793,77 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 		}
 
 		DEBUG3("Sending reply to socket %d", s->listen->fd);
+		fr_latency_record(nr->latency_write, fr_time() - cd->m.when);
 		fr_message_done(&cd->m);
 		s->pending = NULL;
 		s->written = 0;
 
+		/*
+		 *	The write function may have queued the packet
+		 *	instead of writing it.  Flush the socket once
+		 *	we've processed all of the replies, so that
+		 *	many packets can be written at once.
+		 */
+		if (li->app_io->flush && !s->flush_pending) {
+			s->flush_pending = true;
+			fr_dlist_insert_tail(&nr->flush, s);
+		}
+
 		/*
 		 *	As a special case, allow write() to return
 		 *	"0", which means "close the socket".
 		 */
 		if (rcode == 0) fr_network_socket_dead(nr, s);
 	}
+
+	/*
+	 *	Write any packets which were queued above.
+	 */
+	while ((s = fr_dlist_head(&nr->flush)) != NULL) {
+		int rcode;
+
+		fr_dlist_remove(&nr->flush, s);
+		s->flush_pending = false;
+
+		if (s->dead) continue;
+
+		rcode = s->listen->app_io->flush(s->listen);
+		if (rcode < 0) {
+			PERROR("Failed flushing socket %d", s->listen->fd);
+			if (s->listen->app_io->error) s->listen->app_io->error(s->listen);
+
+			fr_network_socket_dead(nr, s);
+			continue;
+		}
+
+		/*
+		 *	The socket couldn't take all of the queued
+		 *	data.  Finish writing it when the socket is
+		 *	writable.
+		 */
+		if ((rcode > 0) && !s->pending &&
+		    (fr_network_socket_events(nr, s, true) < 0)) {
+			PERROR("Failed adding write callback to event loop");
+			fr_network_socket_dead(nr, s);
+		}
+	}
+
+	/*
+	 *	Read the sockets which have packets buffered, or
+	 *	which are no longer paused.  Sockets which still have
+	 *	packets buffered are added back to the end of the
+	 *	list, and are read the next time around.
+	 */
+	last = fr_dlist_tail(&nr->read_again);
+	while ((s = fr_dlist_head(&nr->read_again)) != NULL) {
+		bool done = (s == last);
+
+		fr_dlist_remove(&nr->read_again, s);
+		s->read_again = false;
+
+		if (!s->dead) fr_network_read(nr->el, s->listen->fd, 0, s);
+		if (done) break;
+	}
 }
 
 
@@ -1437,6 +1979,150 @@ int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker)
 	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_WORKER, &worker, sizeof(worker));
 }
 
+/** Remove a worker from a network
+ *
+ *  The network stops sending requests to the worker, and closes the
+ *  channel.  The worker finishes the requests it already has, and
+ *  then acknowledges the close.
+ *
+ * @param nr the network
+ * @param worker the worker to remove
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_network_worker_remove(fr_network_t *nr, fr_worker_t *worker)
+{
+	fr_ring_buffer_t *rb;
+
+	rb = fr_network_rb_init();
+	if (!rb) return -1;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+	(void) talloc_get_type_abort(worker, fr_worker_t);
+
+	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_WORKER_REMOVE, &worker, sizeof(worker));
+}
+
+/** Tell the network which NUMA node it is running on
+ *
+ *  This function MUST be called from the network thread, before any
+ *  workers are added.
+ *
+ * @param nr the network
+ * @param numa_node the NUMA node, or -1 for unknown
+ */
+void fr_network_numa_node_set(fr_network_t *nr, int numa_node)
+{
+	(void) talloc_get_type_abort(nr, fr_network_t);
+
+	rad_assert(nr->num_workers == 0);
+	nr->numa_node = numa_node;
+}
+
+/** Allocate the message sets for new sockets from pre-faulted huge pages
+ *
+ *  The message sets never grow.  This MUST be called before any
+ *  sockets are added.
+ *
+ * @param nr			the network
+ * @param num_messages		minimum number of messages for each socket.  MUST be a power of 2.
+ * @param ring_buffer_size	minimum size of the packet ring buffer for each socket.
+ */
+void fr_network_message_set_fixed(fr_network_t *nr, int num_messages, size_t ring_buffer_size)
+{
+	(void) talloc_get_type_abort(nr, fr_network_t);
+
+	rad_assert(nr->num_sockets == 0);
+	nr->message_set_fixed = true;
+	nr->message_set_size = num_messages;
+	nr->ring_buffer_size = ring_buffer_size;
+}
+
+/** Set how long packets can wait for a worker
+ *
+ *  The workers give up on requests after max_request_time, so
+ *  fr_network_admit() refuses packets which would wait longer.
+ *
+ * @param nr			the network
+ * @param max_request_time	in seconds, from the configuration.
+ */
+void fr_network_max_request_time_set(fr_network_t *nr, uint32_t max_request_time)
+{
+	(void) talloc_get_type_abort(nr, fr_network_t);
+
+	if (!max_request_time) return;
+
+	nr->max_queue_delay = (fr_time_t) max_request_time * NANOSEC;
+}
+
+/** Check if the workers have room for another packet
+ *
+ *  Called by the app_io read() function, once it knows the priority
+ *  of the packet.  We estimate how long the packet would wait before
+ *  a worker gets to it, and refuse it if that's too long.  Lower
+ *  priority packets are refused first, so that e.g. Access-Request
+ *  packets are still processed when accounting packets are not.
+ *
+ *  Packets with PRIORITY_NOW are always accepted.
+ *
+ * @param nr		the network
+ * @param priority	of the packet
+ * @return
+ *	- true if the packet should be sent to a worker.
+ *	- false if it should be dropped.
+ */
+bool fr_network_admit(fr_network_t *nr, uint32_t priority)
+{
+	int		i;
+	fr_time_t	delay = 0, limit;
+	uint64_t	leased = 0;
+
+	if ((priority >= PRIORITY_NOW) || !nr->num_workers) return true;
+
+	if (priority >= PRIORITY_HIGH) {
+		limit = nr->max_queue_delay;
+
+	} else if (priority >= PRIORITY_NORMAL) {
+		limit = nr->max_queue_delay / 2;
+
+	} else {
+		limit = nr->max_queue_delay / 4;
+	}
+
+	/*
+	 *	The wait is the work which is already queued, spread
+	 *	across all of the workers.
+	 */
+	for (i = 0; i < nr->num_workers; i++) {
+		fr_network_worker_t *w = nr->workers[i];
+		int64_t backlog = (int64_t) (w->stats.in - w->stats.out);
+
+		if (backlog > 0) delay += backlog * w->predicted;
+
+		leased += fr_channel_leases(w->channel);
+	}
+	delay /= nr->num_workers;
+
+	/*
+	 *	The workers are holding old packets in our buffers,
+	 *	which we can't clean up until they're done.  Rather
+	 *	than filling more buffers, refuse the lower priority
+	 *	packets.  Once the leases run out, the workers have
+	 *	to copy the packets, which is worse.
+	 */
+	if ((priority < PRIORITY_HIGH) &&
+	    (leased >= ((uint64_t) nr->num_workers * FR_CHANNEL_MAX_LEASES) / 2)) {
+		nr->num_shed++;
+		return false;
+	}
+
+	if (delay <= limit) return true;
+
+	nr->num_shed++;
+	return false;
+}
+
 /** Signal the network to read from a listener
  *
  * @param nr the network
@@ -1509,9 +2195,73 @@ int fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats)
 	return 5;
 }
 
+/** Get the channel statistics for all of the workers of a network
+ *
+ *  Note that this isn't thread-safe, the counters may be updated
+ *  while they're being read.
+ *
+ * @param[in] nr		the network
+ * @param[out] to_workers	statistics for packets sent to the workers.
+ * @param[out] from_workers	statistics for replies from the workers.
+ */
+void fr_network_channel_stats(fr_network_t const *nr, fr_channel_stats_t *to_workers, fr_channel_stats_t *from_workers)
+{
+	int i;
+	fr_channel_stats_t to_worker, from_worker;
+
+	memset(to_workers, 0, sizeof(*to_workers));
+	memset(from_workers, 0, sizeof(*from_workers));
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		fr_channel_stats(nr->workers[i]->channel, &to_worker, &from_worker);
+		to_workers->packets += to_worker.packets;
+		to_workers->signals += to_worker.signals;
+		to_workers->skips += to_worker.skips;
+		from_workers->packets += from_worker.packets;
+		from_workers->signals += from_worker.signals;
+		from_workers->skips += from_worker.skips;
+	}
+}
+
+typedef struct {
+	uint64_t	read_syscalls;
+	uint64_t	read_packets;
+	uint64_t	write_syscalls;
+	uint64_t	write_packets;
+
+	fr_message_set_stats_t	ms;
+} fr_network_syscall_stats_t;
+
+static int socket_syscall_stats(void *ctx, void *data)
+{
+	fr_network_syscall_stats_t *stats = ctx;
+	fr_network_socket_t *s = data;
+	fr_message_set_stats_t ms;
+
+	stats->read_syscalls += s->listen->read_syscalls;
+	stats->read_packets += s->listen->read_packets;
+	stats->write_syscalls += s->listen->write_syscalls;
+	stats->write_packets += s->listen->write_packets;
+
+	fr_message_set_stats(s->ms, &ms);
+	stats->ms.num_gc += ms.num_gc;
+	stats->ms.num_gc_cleaned += ms.num_gc_cleaned;
+	stats->ms.num_grown += ms.num_grown;
+	stats->ms.num_alloc_failed += ms.num_alloc_failed;
+	stats->ms.num_hugepage += ms.num_hugepage;
+
+	return 0;
+}
+
 static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
 {
 	fr_network_t const *nr = ctx;
+	int i;
+	uint64_t leased = 0;
+	fr_network_syscall_stats_t stats = { 0 };
+	fr_channel_stats_t out, in;
 
 	fprintf(fp, "count.in\t%" PRIu64 "\n", nr->stats.in);
 	fprintf(fp, "count.out\t%" PRIu64 "\n", nr->stats.out);
@@ -1519,6 +2269,55 @@ static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cm
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
 	fprintf(fp, "count.sockets\t%u\n", rbtree_num_elements(nr->sockets));
 
+	fr_network_channel_stats(nr, &out, &in);
+
+	fprintf(fp, "count.channel.out\t%" PRIu64 "\n", out.packets);
+	fprintf(fp, "count.channel.out.signals\t%" PRIu64 "\n", out.signals);
+	fprintf(fp, "count.channel.out.skipped\t%" PRIu64 "\n", out.skips);
+	fprintf(fp, "count.channel.in\t%" PRIu64 "\n", in.packets);
+	fprintf(fp, "count.channel.in.signals\t%" PRIu64 "\n", in.signals);
+	fprintf(fp, "count.channel.in.skipped\t%" PRIu64 "\n", in.skips);
+
+	if (nr->numa_node >= 0) {
+		fprintf(fp, "numa.node\t%d\n", nr->numa_node);
+		fprintf(fp, "numa.local_workers\t%d\n", nr->num_local);
+		fprintf(fp, "count.numa.remote\t%" PRIu64 "\n", nr->num_remote);
+	}
+
+	fprintf(fp, "count.shed\t%" PRIu64 "\n", nr->num_shed);
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		leased += fr_channel_leases(nr->workers[i]->channel);
+	}
+	fprintf(fp, "count.leased\t%" PRIu64 "\n", leased);
+
+	/*
+	 *	As with "show network socket list", this walks the
+	 *	sockets without locking them.
+	 */
+	(void) rbtree_walk(nr->sockets, RBTREE_IN_ORDER, socket_syscall_stats, &stats);
+
+	fprintf(fp, "count.syscalls.read\t%" PRIu64 "\n", stats.read_syscalls);
+	fprintf(fp, "count.syscalls.write\t%" PRIu64 "\n", stats.write_syscalls);
+
+	if (stats.read_syscalls) {
+		fprintf(fp, "packets_per_syscall.read\t%.2f\n",
+			(double) stats.read_packets / (double) stats.read_syscalls);
+	}
+
+	if (stats.write_syscalls) {
+		fprintf(fp, "packets_per_syscall.write\t%.2f\n",
+			(double) stats.write_packets / (double) stats.write_syscalls);
+	}
+
+	fprintf(fp, "count.message.gc\t%" PRIu64 "\n", stats.ms.num_gc);
+	fprintf(fp, "count.message.gc_cleaned\t%" PRIu64 "\n", stats.ms.num_gc_cleaned);
+	fprintf(fp, "count.message.grown\t%" PRIu64 "\n", stats.ms.num_grown);
+	fprintf(fp, "count.message.failed\t%" PRIu64 "\n", stats.ms.num_alloc_failed);
+	if (nr->message_set_fixed) fprintf(fp, "message.hugepage_buffers\t%u\n", stats.ms.num_hugepage);
+
 	return 0;
 }
 
@@ -1550,6 +2349,7 @@ static int cmd_stats_socket(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t con
 {
 	fr_network_t const *nr = ctx;
 	fr_network_socket_t *s;
+	fr_message_set_stats_t ms;
 
 	s = rbtree_finddata(nr->sockets_by_num, &(fr_network_socket_t){ .number = info->box[0]->vb_uint32 });
 	if (!s) {
@@ -1561,6 +2361,29 @@ static int cmd_stats_socket(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t con
 	fprintf(fp, "count.out\t%" PRIu64 "\n", s->stats.out);
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", s->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", s->stats.dropped);
+	fprintf(fp, "count.outstanding\t%zu\n", s->outstanding);
+
+	if (s->listen->max_outstanding) {
+		fprintf(fp, "count.paused\t%" PRIu64 "\n", s->num_paused);
+	}
+
+	if (s->listen->read_syscalls) {
+		fprintf(fp, "count.syscalls.read\t%" PRIu64 "\n", s->listen->read_syscalls);
+		fprintf(fp, "packets_per_syscall.read\t%.2f\n",
+			(double) s->listen->read_packets / (double) s->listen->read_syscalls);
+	}
+
+	if (s->listen->write_syscalls) {
+		fprintf(fp, "count.syscalls.write\t%" PRIu64 "\n", s->listen->write_syscalls);
+		fprintf(fp, "packets_per_syscall.write\t%.2f\n",
+			(double) s->listen->write_packets / (double) s->listen->write_syscalls);
+	}
+
+	fr_message_set_stats(s->ms, &ms);
+
+	fprintf(fp, "count.message.gc\t%" PRIu64 "\n", ms.num_gc);
+	fprintf(fp, "count.message.grown\t%" PRIu64 "\n", ms.num_grown);
+	fprintf(fp, "count.message.failed\t%" PRIu64 "\n", ms.num_alloc_failed);
 
 	return 0;
 }
@@ -35,6 +35,7 @@ typedef struct fr_network_t fr_network_t;
 }
 #endif
 
+#include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/worker.h>
 #include <freeradius-devel/util/log.h>
 
@@ -51,9 +52,16 @@ int fr_network_listen_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
 int fr_network_socket_delete(fr_network_t *nr, fr_listen_t *li);
 int fr_network_directory_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
 int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
+int fr_network_worker_remove(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
+void fr_network_numa_node_set(fr_network_t *nr, int numa_node) CC_HINT(nonnull);
+void fr_network_message_set_fixed(fr_network_t *nr, int num_messages, size_t ring_buffer_size) CC_HINT(nonnull);
+void fr_network_max_request_time_set(fr_network_t *nr, uint32_t max_request_time) CC_HINT(nonnull);
+bool fr_network_admit(fr_network_t *nr, uint32_t priority) CC_HINT(nonnull);
 void fr_network_listen_read(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
 int fr_network_listen_inject(fr_network_t *nr, fr_listen_t *li, uint8_t const *packet, size_t packet_len, fr_time_t recv_time);
 int fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats) CC_HINT(nonnull);
+void fr_network_channel_stats(fr_network_t const *nr, fr_channel_stats_t *to_workers,
+			      fr_channel_stats_t *from_workers) CC_HINT(nonnull);
 extern fr_cmd_table_t cmd_network_table[];
 
 #ifdef __cplusplus
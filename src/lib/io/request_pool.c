@@ -0,0 +1,263 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Recycled memory pools for requests.
+ * @file io/request_pool.c
+ *
+ *  Each request is allocated from its own talloc pool, so that
+ *  everything it allocates comes from one block of memory.  When
+ *  the request is freed, talloc resets the pool, and we put it on a
+ *  free list for the next request.  So in the common case,
+ *  allocating and freeing a request doesn't call malloc() or free().
+ *
+ *  The size of the pools can also be adapted to the size of the
+ *  requests which actually use them.  Requests which don't fit in
+ *  their pool still work, talloc just allocates the extra memory
+ *  from the heap.
+ *
+ *  The functions here are NOT thread-safe.  Each worker has its own
+ *  request pools.
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/request_pool.h>
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/dlist.h>
+
+#define REQUEST_POOL_MIN_SIZE		(2 * 1024)
+#define REQUEST_POOL_MAX_SIZE		(1024 * 1024)
+
+/*
+ *	Measuring the size of a request means walking all of its
+ *	children, so we only do it for some requests.  We then
+ *	re-calculate the pool size every so many samples.
+ */
+#define REQUEST_POOL_SAMPLE_RATE	(16)
+#define REQUEST_POOL_INTERVAL		(64)
+
+/*
+ *	talloc doesn't export the size of its chunk header.  This is
+ *	close enough on 64-bit systems, and we round up anyway.
+ */
+#define REQUEST_POOL_CHUNK_OVERHEAD	(96)
+
+/** The memory pool for one request
+ *
+ *  The request is the only child of this structure.
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< in the free list
+	size_t			size;		//!< of the pool
+} fr_request_pool_entry_t;
+
+struct fr_request_pool_s {
+	size_t			pool_size;	//!< for new pools
+	bool			adaptive;	//!< whether we change pool_size
+
+	uint32_t		max_free;	//!< maximum number of unused pools we keep
+	uint32_t		num_free;	//!< current number of unused pools
+	fr_dlist_head_t		free;		//!< unused pools, most recently used first
+
+	uint32_t		num_requests;	//!< since the last sample
+	uint32_t		num_samples;	//!< in this interval
+	size_t			peak;		//!< largest request in this interval
+
+	uint64_t		num_allocated;	//!< number of pools we had to allocate
+	uint64_t		num_reused;	//!< number of requests which re-used a pool
+	uint64_t		num_resized;	//!< number of times pool_size was changed
+};
+
+static int _request_pool_free(fr_request_pool_t *rp)
+{
+	fr_request_pool_entry_t *entry;
+
+	while ((entry = fr_dlist_head(&rp->free)) != NULL) {
+		(void) fr_dlist_remove(&rp->free, entry);
+		talloc_free(entry);
+	}
+
+	return 0;
+}
+
+/** Create a set of recycled request pools
+ *
+ * @param[in] ctx		to allocate the request pools in.  Note
+ *				that the pools themselves are not parented
+ *				from this, as requests are parented from NULL.
+ * @param[in] pool_size		initial size of the memory pool for each request.
+ * @param[in] max_free		the maximum number of unused pools to keep.
+ * @param[in] adaptive		change pool_size based on the size of requests.
+ * @return
+ *	- NULL on error.
+ *	- fr_request_pool_t on success.
+ */
+fr_request_pool_t *fr_request_pool_create(TALLOC_CTX *ctx, size_t pool_size, uint32_t max_free, bool adaptive)
+{
+	fr_request_pool_t *rp;
+
+	rp = talloc_zero(ctx, fr_request_pool_t);
+	if (!rp) return NULL;
+
+	if (pool_size < REQUEST_POOL_MIN_SIZE) pool_size = REQUEST_POOL_MIN_SIZE;
+	if (pool_size > REQUEST_POOL_MAX_SIZE) pool_size = REQUEST_POOL_MAX_SIZE;
+
+	rp->pool_size = pool_size;
+	rp->max_free = max_free;
+	rp->adaptive = adaptive;
+	fr_dlist_talloc_init(&rp->free, fr_request_pool_entry_t, entry);
+
+	talloc_set_destructor(rp, _request_pool_free);
+
+	return rp;
+}
+
+/** Allocate a request, re-using an old pool if possible
+ *
+ * @param[in] rp	to allocate the request from.
+ * @return
+ *	- NULL on error.
+ *	- a new REQUEST on success.
+ */
+REQUEST *fr_request_pool_alloc(fr_request_pool_t *rp)
+{
+	fr_request_pool_entry_t *entry;
+	REQUEST *request;
+
+	entry = fr_dlist_head(&rp->free);
+	if (entry) {
+		(void) fr_dlist_remove(&rp->free, entry);
+		rp->num_free--;
+		rp->num_reused++;
+
+	} else {
+		entry = talloc_pooled_object(NULL, fr_request_pool_entry_t, 1, rp->pool_size);
+		if (!entry) return NULL;
+
+		fr_dlist_entry_init(&entry->entry);
+		entry->size = rp->pool_size;
+		rp->num_allocated++;
+	}
+
+	request = request_alloc(entry);
+	if (!request) {
+		talloc_free(entry);
+		return NULL;
+	}
+
+	return request;
+}
+
+/** Recalculate the pool size from the largest request we've seen
+ *
+ */
+static void request_pool_resize(fr_request_pool_t *rp)
+{
+	fr_request_pool_entry_t *entry;
+	size_t size;
+
+	/*
+	 *	Leave some room for requests which are a bit
+	 *	larger, and round up to the nearest kilobyte.
+	 */
+	size = rp->peak + (rp->peak / 4);
+	size = (size + 1023) & ~((size_t) 1023);
+
+	if (size < REQUEST_POOL_MIN_SIZE) size = REQUEST_POOL_MIN_SIZE;
+	if (size > REQUEST_POOL_MAX_SIZE) size = REQUEST_POOL_MAX_SIZE;
+
+	rp->peak = 0;
+	rp->num_samples = 0;
+
+	/*
+	 *	Grow right away.  Only shrink when the pools are
+	 *	much too large, so that we don't flip-flop.
+	 */
+	if ((size <= rp->pool_size) && (size > (rp->pool_size / 2))) return;
+
+	rp->pool_size = size;
+	rp->num_resized++;
+
+	/*
+	 *	The unused pools are the wrong size.
+	 */
+	while ((entry = fr_dlist_head(&rp->free)) != NULL) {
+		(void) fr_dlist_remove(&rp->free, entry);
+		talloc_free(entry);
+	}
+	rp->num_free = 0;
+}
+
+/** Free a request, and keep its pool for a later request
+ *
+ * @param[in] rp	the request was allocated from.
+ * @param[in] request	to free.
+ */
+void fr_request_pool_free(fr_request_pool_t *rp, REQUEST *request)
+{
+	fr_request_pool_entry_t *entry;
+
+	entry = talloc_get_type_abort(talloc_parent(request), fr_request_pool_entry_t);
+
+	if (rp->adaptive && (++rp->num_requests >= REQUEST_POOL_SAMPLE_RATE)) {
+		size_t size;
+
+		rp->num_requests = 0;
+
+		size = talloc_total_size(request) + (talloc_total_blocks(request) * REQUEST_POOL_CHUNK_OVERHEAD);
+		if (size > rp->peak) rp->peak = size;
+
+		if (++rp->num_samples >= REQUEST_POOL_INTERVAL) request_pool_resize(rp);
+	}
+
+	/*
+	 *	Something else still holds a reference to the
+	 *	request, so we can't re-use the pool.  Leave it
+	 *	with the request.
+	 */
+	if (talloc_free(request) < 0) return;
+
+	/*
+	 *	The pool is the wrong size, or we already have
+	 *	enough unused ones.
+	 */
+	if ((entry->size != rp->pool_size) || (rp->num_free >= rp->max_free)) {
+		talloc_free(entry);
+		return;
+	}
+
+	fr_dlist_insert_head(&rp->free, entry);
+	rp->num_free++;
+}
+
+/** Get the statistics for a set of request pools
+ *
+ * @param[in] rp	to get the statistics for.
+ * @param[out] stats	where the statistics are written.
+ */
+void fr_request_pool_stats(fr_request_pool_t const *rp, fr_request_pool_stats_t *stats)
+{
+	stats->pool_size = rp->pool_size;
+	stats->peak = rp->peak;
+	stats->num_free = rp->num_free;
+	stats->num_allocated = rp->num_allocated;
+	stats->num_reused = rp->num_reused;
+	stats->num_resized = rp->num_resized;
+}
@@ -0,0 +1,57 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/request_pool.h
+ * @brief Recycled memory pools for requests.
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSIDH(request_pool_h, "$Id$")
+
+#include <freeradius-devel/server/request.h>
+
+#include <talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_request_pool_s fr_request_pool_t;
+
+/** Statistics for a request pool
+ *
+ */
+typedef struct {
+	size_t			pool_size;	//!< current size of the memory pool for each request
+	size_t			peak;		//!< largest request seen in the current interval
+	uint32_t		num_free;	//!< number of unused pools
+	uint64_t		num_allocated;	//!< number of pools we had to allocate
+	uint64_t		num_reused;	//!< number of requests which re-used a pool
+	uint64_t		num_resized;	//!< number of times pool_size was changed
+} fr_request_pool_stats_t;
+
+fr_request_pool_t	*fr_request_pool_create(TALLOC_CTX *ctx, size_t pool_size, uint32_t max_free, bool adaptive);
+REQUEST			*fr_request_pool_alloc(fr_request_pool_t *rp) CC_HINT(nonnull);
+void			fr_request_pool_free(fr_request_pool_t *rp, REQUEST *request) CC_HINT(nonnull);
+void			fr_request_pool_stats(fr_request_pool_t const *rp, fr_request_pool_stats_t *stats) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
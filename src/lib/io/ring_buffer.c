@@ -26,8 +26,17 @@ RCSID("$Id$")
 
 #include <freeradius-devel/io/ring_buffer.h>
 #include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/server/rad_assert.h>
+#include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
+
+/*
+ *	The size of a huge page.  We assume 2MB, which is the default
+ *	on x86_64 and aarch64.
+ */
+#define RING_BUFFER_HUGEPAGE_SIZE	(2 * 1024 * 1024)
 
 /*
  *	Ring buffers are allocated in a block.
@@ -43,8 +52,41 @@ struct fr_ring_buffer_t {
 	size_t		reserved;	//!< amount of reserved data at write_offset
 
 	bool		closed;		//!< whether allocations are closed
+
+	size_t		mapped;		//!< size of the mmap()ed buffer, or 0 if it's talloc'd
+	bool		hugepage;	//!< whether the buffer is in explicit huge pages
 };
 
+/** Round a ring buffer size up to the nearest power of 2
+ *
+ * @param[in] size	the requested size.
+ * @return
+ *	- 0 if the size is too large.
+ *	- the size to use.
+ */
+static size_t ring_buffer_size_round(size_t size)
+{
+	if (size < 1024) size = 1024;
+
+	if (size > (1 << 30)) {
+		fr_strerror_printf("Ring buffer size must be no more than (1 << 30)");
+		return 0;
+	}
+
+	/*
+	 *	Round up to the nearest power of 2.
+	 */
+	size--;
+	size |= size >> 1;
+	size |= size >> 2;
+	size |= size >> 4;
+	size |= size >> 8;
+	size |= size >> 16;
+	size++;
+
+	return size;
+}
+
 /** Create a ring buffer.
  *
  *  The size provided will be rounded up to the next highest power of
@@ -72,24 +114,12 @@ fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
 		return NULL;
 	}
 
-	if (size < 1024) size = 1024;
-
-	if (size > (1 << 30)) {
-		fr_strerror_printf("Ring buffer size must be no more than (1 << 30)");
+	size = ring_buffer_size_round(size);
+	if (!size) {
+		talloc_free(rb);
 		return NULL;
 	}
 
-	/*
-	 *	Round up to the nearest power of 2.
-	 */
-	size--;
-	size |= size >> 1;
-	size |= size >> 2;
-	size |= size >> 4;
-	size |= size >> 8;
-	size |= size >> 16;
-	size++;
-
 	rb->buffer = talloc_array(rb, uint8_t, size);
 	if (!rb->buffer) {
 		talloc_free(rb);
@@ -100,6 +130,85 @@ fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
 	return rb;
 }
 
+static int _ring_buffer_unmap(fr_ring_buffer_t *rb)
+{
+	if (rb->mapped) (void) munmap(rb->buffer, rb->mapped);
+
+	return 0;
+}
+
+/** Create a ring buffer in pre-faulted huge pages.
+ *
+ *  The buffer is taken from explicit huge pages if the system has
+ *  any reserved.  Otherwise, it's allocated from normal pages, and
+ *  the kernel is asked to back it with transparent huge pages.
+ *
+ *  Either way, every page of the buffer is touched before we return,
+ *  so that the page faults happen here, and not when the buffer is
+ *  first used.
+ *
+ * @param[in] ctx	a talloc context
+ * @param[in] size	of the raw ring buffer array to allocate.
+ * @return
+ *	- A new ring buffer on success.
+ *	- NULL on failure.
+ */
+fr_ring_buffer_t *fr_ring_buffer_create_hugepage(TALLOC_CTX *ctx, size_t size)
+{
+	fr_ring_buffer_t	*rb;
+	size_t			mapped;
+	void			*buffer = MAP_FAILED;
+	bool			hugepage = false;
+
+	size = ring_buffer_size_round(size);
+	if (!size) return NULL;
+
+	/*
+	 *	Explicit huge pages can only be mapped in multiples
+	 *	of the huge page size.
+	 */
+	mapped = (size + RING_BUFFER_HUGEPAGE_SIZE - 1) & ~((size_t) RING_BUFFER_HUGEPAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+	buffer = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (buffer != MAP_FAILED) hugepage = true;
+#endif
+
+	if (buffer == MAP_FAILED) {
+		mapped = size;
+
+		buffer = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buffer == MAP_FAILED) {
+			fr_strerror_printf("Failed mapping %zu bytes for ring buffer: %s", mapped, fr_syserror(errno));
+			return NULL;
+		}
+
+#ifdef MADV_HUGEPAGE
+		(void) madvise(buffer, mapped, MADV_HUGEPAGE);
+#endif
+	}
+
+	/*
+	 *	Pre-fault the pages.
+	 */
+	memset(buffer, 0, mapped);
+
+	rb = talloc_zero(ctx, fr_ring_buffer_t);
+	if (!rb) {
+		(void) munmap(buffer, mapped);
+		fr_strerror_printf("Failed allocating memory.");
+		return NULL;
+	}
+
+	rb->buffer = buffer;
+	rb->size = size;
+	rb->mapped = mapped;
+	rb->hugepage = hugepage;
+	talloc_set_destructor(rb, _ring_buffer_unmap);
+
+	return rb;
+}
+
 
 /** Reserve room in the ring buffer.
  *
@@ -495,6 +604,21 @@ int fr_ring_buffer_close(fr_ring_buffer_t *rb)
 }
 
 
+/** Check whether the ring buffer is in explicit huge pages
+ *
+ * @param[in] rb a ring buffer
+ * @return
+ *	- true if the buffer came from fr_ring_buffer_create_hugepage(),
+ *	  and the system had huge pages reserved.
+ *	- false otherwise.
+ */
+bool fr_ring_buffer_hugepage(fr_ring_buffer_t *rb)
+{
+	(void) talloc_get_type_abort(rb, fr_ring_buffer_t);
+
+	return rb->hugepage;
+}
+
 /** Get the size of the ring buffer
  *
  * @param[in] rb a ring buffer
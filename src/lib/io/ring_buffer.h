@@ -38,6 +38,8 @@ typedef struct fr_ring_buffer_t fr_ring_buffer_t;
 
 fr_ring_buffer_t	*fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size);
 
+fr_ring_buffer_t	*fr_ring_buffer_create_hugepage(TALLOC_CTX *ctx, size_t size);
+
 uint8_t			*fr_ring_buffer_reserve(fr_ring_buffer_t *rb, size_t size) CC_HINT(nonnull);
 
 uint8_t			*fr_ring_buffer_alloc(fr_ring_buffer_t *rb, size_t size);
@@ -55,6 +57,8 @@ size_t			fr_ring_buffer_size(fr_ring_buffer_t *rb) CC_HINT(nonnull);
 
 size_t 			fr_ring_buffer_used(fr_ring_buffer_t *rb) CC_HINT(nonnull);
 
+bool			fr_ring_buffer_hugepage(fr_ring_buffer_t *rb) CC_HINT(nonnull);
+
 void			fr_ring_buffer_debug(fr_ring_buffer_t *rb, FILE *fp) CC_HINT(nonnull);
 
 #ifdef __cplusplus
@@ -32,6 +32,17 @@ RCSID("$Id$")
 #include <freeradius-devel/util/syserror.h>
 
 #include <pthread.h>
+#include <dirent.h>
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#endif
+
+#ifdef CPU_SETSIZE
+#define CPU_MAX			CPU_SETSIZE
+#else
+#define CPU_MAX			(1024)
+#endif
 
 /*
  *	Other OS's have sem_init, OS X doesn't.
@@ -61,6 +72,18 @@ RCSID("$Id$")
 
 #define SEM_WAIT_INTR(_x) do {if (sem_wait(_x) == 0) break;} while (errno == EINTR)
 
+/*
+ *	How often the network thread checks the worker load, and
+ *	the thresholds it uses to add or retire workers.
+ */
+#define SCHEDULE_MANAGE_INTERVAL	((fr_time_t) 1000000000)
+#define SCHEDULE_BUSY_HIGH		(75)	//!< % busy above which we add workers
+#define SCHEDULE_BUSY_TARGET		(50)	//!< % busy we aim for when adding workers
+#define SCHEDULE_BUSY_LOW		(25)	//!< % busy below which we retire workers
+#define SCHEDULE_BACKLOG_HIGH		(16)	//!< queued requests per worker above which we add workers
+#define SCHEDULE_IDLE_INTERVALS		(30)	//!< idle intervals before we retire a worker
+#define SCHEDULE_TIMER_WHEEL_RESOLUTION	((fr_time_t) 1000000)	//!< 1ms slots, when the timer wheel is used
+
 #undef DEBUG
 #undef DEBUG2
 #undef DEBUG3
@@ -76,6 +99,7 @@ typedef enum fr_schedule_child_status_t {
 	FR_CHILD_FREE = 0,			//!< child is free
 	FR_CHILD_INITIALIZING,			//!< initialized, but not running
 	FR_CHILD_RUNNING,			//!< running, and in the running queue
+	FR_CHILD_RETIRING,			//!< closing its channels, and will exit
 	FR_CHILD_EXITED,			//!< exited, and in the exited queue
 	FR_CHILD_FAIL				//!< failed, and in the exited queue
 } fr_schedule_child_status_t;
@@ -91,6 +115,7 @@ typedef struct {
 	int		id;			//!< a unique ID
 	int		uses;			//!< how many network threads are using it
 	fr_time_t	cpu_time;		//!< how much CPU time this worker has used
+	bool		dynamic;		//!< added at run time, and may be retired
 
 	fr_dlist_t	entry;			//!< our entry into the linked list of workers
 
@@ -128,10 +153,36 @@ struct fr_schedule_t {
 
 	int		max_networks;		//!< number of network threads
 	int		max_workers;		//!< max number of worker threads
+	int		min_workers;		//!< min number of worker threads
+
+	fr_worker_steal_t *steal;		//!< for workers to steal requests from each other
+
+	bool		timer_wheel;		//!< thread event lists use a timer wheel
+
+	bool		message_hugepages;	//!< message sets are in pre-faulted huge pages
+	uint32_t	message_set_size;	//!< number of messages in each message set
+	size_t		message_ring_buffer_size; //!< size of the packet ring buffer in each message set
+
+	uint32_t	max_request_time;	//!< for fr_network_admit()
+
+	int		*network_cpus;		//!< CPUs the network threads are pinned to
+	int		num_network_cpus;	//!< number of CPUs in network_cpus
+	int		*worker_cpus;		//!< CPUs the worker threads are pinned to
+	int		num_worker_cpus;	//!< number of CPUs in worker_cpus
 
 	int		num_workers;		//!< number of worker threads
 	int		num_workers_exited;	//!< number of exited workers
 
+	int		num_dynamic;		//!< number of workers added at run time
+	int		next_id;		//!< ID for the next worker we add
+	uint64_t	num_added;		//!< total number of workers added at run time
+	uint64_t	num_retired;		//!< total number of workers retired
+	int		idle_intervals;		//!< number of intervals where the workers were mostly idle
+	fr_time_t	last_manage;		//!< when we last checked the worker load
+	fr_event_timer_t const *ev_manage;	//!< timer for checking the worker load
+
+	pthread_mutex_t	mutex;			//!< protects sw->worker for dynamic workers
+
 	sem_t		semaphore;		//!< for inter-thread signaling
 
 	fr_schedule_thread_instantiate_t	worker_thread_instantiate;	//!< thread instantiation callback
@@ -142,7 +193,9 @@ struct fr_schedule_t {
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
 
-	fr_schedule_network_t *sn;		//!< pointer to the (one) network thread
+	int		num_networks;		//!< number of network threads which were started
+	int		next_network;		//!< network to add the next listener to
+	fr_schedule_network_t **networks;	//!< the network threads
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
@@ -156,6 +209,150 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+/** Parse a list of CPUs
+ *
+ *  The list is a comma separated set of CPU numbers or ranges,
+ *  e.g. "0-3,8,10-11".
+ *
+ * @param[in] ctx	to allocate the array in.
+ * @param[out] out	array of CPU numbers.
+ * @param[in] name	of the configuration item, for error messages.
+ * @param[in] str	to parse.
+ * @return
+ *	- <0 on error.
+ *	- the number of CPUs in the list.
+ */
+static int fr_schedule_cpus_parse(TALLOC_CTX *ctx, int **out, char const *name, char const *str)
+{
+	int		num = 0;
+	int		*cpus;
+	char const	*p = str;
+
+	*out = NULL;
+
+	cpus = talloc_array(ctx, int, CPU_MAX);
+	if (!cpus) {
+		fr_strerror_printf("Failed allocating memory");
+		return -1;
+	}
+
+	while (*p) {
+		unsigned long	first, last;
+		char		*q;
+
+		first = last = strtoul(p, &q, 10);
+		if (q == p) goto invalid;
+		p = q;
+
+		if (*p == '-') {
+			p++;
+			last = strtoul(p, &q, 10);
+			if (q == p) goto invalid;
+			p = q;
+		}
+
+		if ((last < first) || (last >= CPU_MAX)) goto invalid;
+
+		if (*p == ',') {
+			p++;
+			if (!*p) goto invalid;
+		} else if (*p) {
+			goto invalid;
+		}
+
+		while ((first <= last) && (num < CPU_MAX)) cpus[num++] = first++;
+	}
+
+	if (!num) {
+	invalid:
+		fr_strerror_printf("Invalid CPU list '%s' for %s at offset %zu", str, name, (size_t) (p - str));
+		talloc_free(cpus);
+		return -1;
+	}
+
+	*out = cpus;
+	return num;
+}
+
+/** Find the NUMA node for a CPU
+ *
+ *  Linux puts a "nodeN" entry into each CPU directory.  On other
+ *  systems, the node is unknown.
+ *
+ * @param[in] cpu	to look up.
+ * @return
+ *	- -1 if the node is unknown.
+ *	- the NUMA node.
+ */
+static int fr_schedule_cpu_numa_node(int cpu)
+{
+	char		path[64];
+	DIR		*dir;
+	struct dirent	*dp;
+	int		node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+	dir = opendir(path);
+	if (!dir) return -1;
+
+	while ((dp = readdir(dir)) != NULL) {
+		char *end;
+		long value;
+
+		if (strncmp(dp->d_name, "node", 4) != 0) continue;
+
+		value = strtol(dp->d_name + 4, &end, 10);
+		if ((end == dp->d_name + 4) || *end || (value < 0)) continue;
+
+		node = value;
+		break;
+	}
+	closedir(dir);
+
+	return node;
+}
+
+/** Pin the current thread to a set of CPUs
+ *
+ *  This should be done before the thread allocates memory.  The
+ *  kernel places pages on the NUMA node of the CPU which first
+ *  touches them, so the thread's message sets and ring buffers
+ *  then live on the same node as the thread.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] name	of the thread, for log messages.
+ * @param[in] cpus	to run on.
+ * @param[in] num_cpus	number of CPUs in the array.
+ * @return
+ *	- -1 if the NUMA node is unknown.
+ *	- the NUMA node of the first CPU.
+ */
+static int fr_schedule_thread_pin(fr_schedule_t *sc, char const *name, int const *cpus, int num_cpus)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	int		i, ret;
+	cpu_set_t	set;
+
+	if (!num_cpus) return -1;
+
+	CPU_ZERO(&set);
+	for (i = 0; i < num_cpus; i++) CPU_SET(cpus[i], &set);
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		fr_log(sc->log, L_WARN, "%s - Failed setting CPU affinity: %s", name, fr_syserror(ret));
+		return -1;
+	}
+
+	return fr_schedule_cpu_numa_node(cpus[0]);
+#else
+	if (num_cpus) fr_log(sc->log, L_WARN, "%s - Setting CPU affinity is not supported on this system", name);
+
+	return -1;
+#endif
+}
+
 /** Initialize and run the worker thread.
  *
  * @param[in] arg the fr_schedule_worker_t
@@ -167,10 +364,20 @@ static void *fr_schedule_worker_thread(void *arg)
 	fr_schedule_worker_t		*sw = talloc_get_type_abort(arg, fr_schedule_worker_t);
 	fr_schedule_t			*sc = sw->sc;
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
+	fr_worker_t			*worker;
 	char buffer[32];
+	int i, numa_node;
 
 	worker_id = sw->id;		/* Store the current worker ID */
 
+	/*
+	 *	Each worker gets its own CPU, if there are enough.
+	 */
+	snprintf(buffer, sizeof(buffer), "Worker %d", sw->id);
+	numa_node = fr_schedule_thread_pin(sc, buffer,
+					   sc->num_worker_cpus ? &sc->worker_cpus[sw->id % sc->num_worker_cpus] : NULL,
+					   sc->num_worker_cpus ? 1 : 0);
+
 	sw->ctx = ctx = talloc_init("worker %d", sw->id);
 	if (!ctx) {
 		fr_log(sc->log, L_ERR, "Worker %d - Failed allocating memory", sw->id);
@@ -186,15 +393,43 @@ static void *fr_schedule_worker_thread(void *arg)
 		goto fail;
 	}
 
+	if (sc->timer_wheel && (fr_event_list_timer_wheel(sw->el, SCHEDULE_TIMER_WHEEL_RESOLUTION) < 0)) {
+		fr_log(sc->log, L_ERR, "Worker %d - Failed enabling timer wheel: %s", sw->id, fr_strerror());
+		goto fail;
+	}
+
 	snprintf(buffer, sizeof(buffer), "%d", worker_id);
-	sw->worker = fr_worker_create(ctx, buffer, sw->el, sc->log, sc->lvl);
-	if (!sw->worker) {
+	worker = fr_worker_create(ctx, buffer, sw->el, sc->log, sc->lvl);
+	if (!worker) {
 		fr_log(sc->log, L_ERR, "Worker %d - Failed creating worker: %s", sw->id, fr_strerror());
 		goto fail;
 	}
 
+	/*
+	 *	Dynamic workers may start while the scheduler is
+	 *	being destroyed.  If so, just exit.
+	 */
+	pthread_mutex_lock(&sc->mutex);
+	sw->worker = worker;
+	if (!sc->running) {
+		pthread_mutex_unlock(&sc->mutex);
+		goto fail;
+	}
+	pthread_mutex_unlock(&sc->mutex);
+
 	snprintf(buffer, sizeof(buffer), "thread %d - ", sw->id);
 	fr_worker_name(sw->worker, buffer);
+	fr_worker_numa_node_set(sw->worker, numa_node);
+
+	if (sc->message_hugepages) {
+		fr_worker_message_set_fixed(sw->worker, sc->message_set_size,
+					    sc->message_ring_buffer_size);
+	}
+
+	if (sc->steal && (fr_worker_steal_join(sw->worker, sc->steal) < 0)) {
+		fr_log(sc->log, L_ERR, "Worker %d - Failed enabling work stealing: %s", sw->id, fr_strerror());
+		goto fail;
+	}
 
 	/*
 	 *	@todo make this a registry
@@ -207,14 +442,20 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	sw->status = FR_CHILD_RUNNING;
 
-	(void) fr_network_worker_add(sc->sn->nr, sw->worker);
+	/*
+	 *	Every network thread can send packets to every worker.
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		(void) fr_network_worker_add(sc->networks[i]->nr, sw->worker);
+	}
 
 	DEBUG3("Spawned async worker %d", sw->id);
 
 	/*
 	 *	Tell the originator that the thread has started.
+	 *	Nobody waits for dynamic workers.
 	 */
-	sem_post(&sc->semaphore);
+	if (!sw->dynamic) sem_post(&sc->semaphore);
 
 	/*
 	 *	Do all of the work.
@@ -228,23 +469,203 @@ static void *fr_schedule_worker_thread(void *arg)
 	status = FR_CHILD_EXITED;
 
 fail:
-	sw->status = status;
+	/*
+	 *	The scheduler may be telling us to exit.  Ensure that
+	 *	it doesn't do that while the worker is being freed.
+	 */
+	pthread_mutex_lock(&sc->mutex);
+	worker = sw->worker;
+	sw->worker = NULL;
+	pthread_mutex_unlock(&sc->mutex);
 
-	if (sw->worker) {
-		fr_worker_destroy(sw->worker);
-		sw->worker = NULL;
-	}
+	if (worker) fr_worker_destroy(worker);
 
 	DEBUG3("Worker %d exiting\n", sw->id);
 
+	sw->status = status;
+
 	/*
 	 *	Tell the scheduler we're done.
 	 */
-	sem_post(&sc->semaphore);
+	if (!sw->dynamic) sem_post(&sc->semaphore);
 
 	return NULL;
 }
 
+/** Add a worker at run time
+ *
+ *  The worker registers itself with the network thread once it has
+ *  started.
+ *
+ * @param[in] sc	the scheduler.
+ * @return
+ *	- <0 on error.
+ *	- 0 on success.
+ */
+static int fr_schedule_worker_spawn(fr_schedule_t *sc)
+{
+	fr_schedule_worker_t *sw;
+
+	/*
+	 *	Not parented from "sc", as the main thread may be
+	 *	allocating from it.
+	 */
+	sw = talloc_zero(NULL, fr_schedule_worker_t);
+	if (!sw) {
+		fr_strerror_printf("Failed allocating memory");
+		return -1;
+	}
+
+	sw->id = sc->next_id++;
+	sw->sc = sc;
+	sw->dynamic = true;
+	sw->status = FR_CHILD_INITIALIZING;
+
+	if (fr_schedule_pthread_create(&sw->pthread_id, fr_schedule_worker_thread, sw) < 0) {
+		talloc_free(sw);
+		return -1;
+	}
+
+	fr_dlist_insert_tail(&sc->workers, sw);
+	sc->num_dynamic++;
+	sc->num_added++;
+
+	return 0;
+}
+
+/** Check the worker load, and add or retire workers
+ *
+ *  Runs in the network thread.  The load is the fraction of time
+ *  the workers spent running requests, along with the number of
+ *  requests waiting to be run.  We add workers as soon as they're
+ *  busy, but only retire workers after they've been idle for a
+ *  while.  That way short gaps in traffic don't cause us to
+ *  repeatedly add and remove workers.
+ *
+ * @param[in] el	the network event list.
+ * @param[in] now	the current time.
+ * @param[in] uctx	the scheduler.
+ */
+static void fr_schedule_manage(fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	fr_schedule_t		*sc = talloc_get_type_abort(uctx, fr_schedule_t);
+	fr_schedule_worker_t	*sw, *next, *newest = NULL;
+	fr_time_t		when, busy = 0;
+	uint64_t		backlog = 0;
+	int			i, num = 0, want;
+	struct timeval		tv;
+
+	when = fr_time();
+
+	pthread_mutex_lock(&sc->mutex);
+	for (sw = fr_dlist_head(&sc->workers);
+	     sw != NULL;
+	     sw = next) {
+		fr_time_t	cpu_time;
+		uint32_t	queued;
+
+		next = fr_dlist_next(&sc->workers, sw);
+
+		/*
+		 *	Clean up retired workers.  The thread has
+		 *	already destroyed the worker, so joining it
+		 *	won't block for long.
+		 */
+		if ((sw->status == FR_CHILD_EXITED) || (sw->status == FR_CHILD_FAIL)) {
+			if (!sw->dynamic) continue;
+
+			fr_dlist_remove(&sc->workers, sw);
+			sc->num_dynamic--;
+
+			if (pthread_join(sw->pthread_id, NULL) != 0) {
+				fr_log(sc->log, L_ERR, "Failed joining worker %i: %s", sw->id, fr_syserror(errno));
+			} else {
+				DEBUG3("Worker %i exited", sw->id);
+			}
+			talloc_free(sw->ctx);
+			talloc_free(sw);
+			continue;
+		}
+
+		if ((sw->status != FR_CHILD_RUNNING) || !sw->worker) continue;
+
+		fr_worker_load(sw->worker, &cpu_time, &queued);
+		busy += cpu_time - sw->cpu_time;
+		sw->cpu_time = cpu_time;
+		backlog += queued;
+		num++;
+
+		if (sw->dynamic) newest = sw;
+	}
+
+	/*
+	 *	The first time through we only have a baseline.
+	 */
+	if (!sc->last_manage || !num) goto done;
+
+	/*
+	 *	Total busy time as a percentage of one worker's time.
+	 */
+	busy = (busy * 100) / (when - sc->last_manage);
+
+	if (((busy / num) > SCHEDULE_BUSY_HIGH) || ((backlog / num) > SCHEDULE_BACKLOG_HIGH)) {
+		sc->idle_intervals = 0;
+
+		/*
+		 *	Add enough workers to bring the load down to
+		 *	the target, and always add at least one.
+		 */
+		want = (busy + SCHEDULE_BUSY_TARGET - 1) / SCHEDULE_BUSY_TARGET;
+		if (want <= num) want = num + 1;
+
+		/*
+		 *	Workers which are still starting count
+		 *	against the maximum.
+		 */
+		if (want > (sc->max_workers - (sc->num_workers + sc->num_dynamic - num))) {
+			want = sc->max_workers - (sc->num_workers + sc->num_dynamic - num);
+		}
+
+		while (num < want) {
+			if (fr_schedule_worker_spawn(sc) < 0) {
+				fr_log(sc->log, L_ERR, "Failed adding worker: %s", fr_strerror());
+				break;
+			}
+			num++;
+		}
+		goto done;
+	}
+
+	if (((busy / num) >= SCHEDULE_BUSY_LOW) || backlog || !newest) {
+		sc->idle_intervals = 0;
+		goto done;
+	}
+
+	if (++sc->idle_intervals < SCHEDULE_IDLE_INTERVALS) goto done;
+	sc->idle_intervals = 0;
+
+	/*
+	 *	Retire the newest worker.  The networks close their
+	 *	channels, and the worker exits once it has finished
+	 *	the requests it already has.
+	 */
+	fr_log(sc->log, L_INFO, "Worker %d retiring", newest->id);
+	newest->status = FR_CHILD_RETIRING;
+	sc->num_retired++;
+	for (i = 0; i < sc->num_networks; i++) {
+		(void) fr_network_worker_remove(sc->networks[i]->nr, newest->worker);
+	}
+
+done:
+	pthread_mutex_unlock(&sc->mutex);
+
+	sc->last_manage = when;
+
+	fr_time_to_timeval(&tv, when + SCHEDULE_MANAGE_INTERVAL);
+	if (fr_event_timer_insert(sc->networks[0]->ctx, el, &sc->ev_manage, &tv, fr_schedule_manage, sc) < 0) {
+		fr_log(sc->log, L_ERR, "Failed inserting scheduler timer: %s", fr_strerror());
+	}
+}
 
 /** Initialize and run the network thread.
  *
@@ -258,9 +679,22 @@ static void *fr_schedule_network_thread(void *arg)
 	fr_schedule_t			*sc = sn->sc;
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
 	fr_event_list_t			*el;
+	int				numa_node;
+	char				buffer[32];
 
 	fr_log(sc->log, L_INFO, "Network %d starting\n", sn->id);
 
+	/*
+	 *	Each network gets its own CPU, if there are enough.
+	 *	Otherwise, they share all of the CPUs.
+	 */
+	snprintf(buffer, sizeof(buffer), "Network %d", sn->id);
+	if (sc->num_network_cpus >= sc->max_networks) {
+		numa_node = fr_schedule_thread_pin(sc, buffer, &sc->network_cpus[sn->id], 1);
+	} else {
+		numa_node = fr_schedule_thread_pin(sc, buffer, sc->network_cpus, sc->num_network_cpus);
+	}
+
 	sn->ctx = ctx = talloc_init("network %d", sn->id);
 	if (!ctx) {
 		fr_log(sc->log, L_ERR, "Network %d - Failed allocating memory", sn->id);
@@ -274,11 +708,38 @@ static void *fr_schedule_network_thread(void *arg)
 		goto fail;
 	}
 
+	if (sc->timer_wheel && (fr_event_list_timer_wheel(el, SCHEDULE_TIMER_WHEEL_RESOLUTION) < 0)) {
+		fr_log(sc->log, L_ERR, "Network %d - Failed enabling timer wheel: %s", sn->id, fr_strerror());
+		goto fail;
+	}
+
 	sn->nr = fr_network_create(ctx, el, sc->log, sc->lvl);
 	if (!sn->nr) {
 		fr_log(sc->log, L_ERR, "Network %d - Failed creating network: %s", sn->id, fr_strerror());
 		goto fail;
 	}
+	fr_network_numa_node_set(sn->nr, numa_node);
+	fr_network_max_request_time_set(sn->nr, sc->max_request_time);
+
+	if (sc->message_hugepages) {
+		fr_network_message_set_fixed(sn->nr, sc->message_set_size,
+					     sc->message_ring_buffer_size);
+	}
+
+	/*
+	 *	Check the worker load every so often, if we're allowed
+	 *	to change the number of workers.  The first network
+	 *	does this for all of them.
+	 */
+	if ((sn->id == 0) && (sc->min_workers < sc->max_workers)) {
+		struct timeval when;
+
+		fr_time_to_timeval(&when, fr_time() + SCHEDULE_MANAGE_INTERVAL);
+		if (fr_event_timer_insert(ctx, el, &sc->ev_manage, &when, fr_schedule_manage, sc) < 0) {
+			fr_log(sc->log, L_ERR, "Network %d - Failed inserting scheduler timer: %s", sn->id, fr_strerror());
+			goto fail;
+		}
+	}
 
 	sn->status = FR_CHILD_RUNNING;
 
@@ -346,14 +807,38 @@ int fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *a
 	return 0;
 }
 
+static int cmd_stats_scheduler(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_schedule_t const *sc = ctx;
+
+	fprintf(fp, "workers.running\t%d\n", sc->num_workers + sc->num_dynamic);
+	fprintf(fp, "workers.min\t%d\n", sc->min_workers);
+	fprintf(fp, "workers.max\t%d\n", sc->max_workers);
+	fprintf(fp, "count.added\t%" PRIu64 "\n", sc->num_added);
+	fprintf(fp, "count.retired\t%" PRIu64 "\n", sc->num_retired);
+	return 0;
+}
+
+static fr_cmd_table_t cmd_schedule_table[] = {
+	{
+		.parent = "stats",
+		.name = "scheduler",
+		.func = cmd_stats_scheduler,
+		.help = "Show statistics for the scheduler.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 /** Create a scheduler and spawn the child threads.
  *
  * @param[in] ctx		talloc context.
  * @param[in] el		event list, only for single-threaded mode.
  * @param[in] logger		destination for all logging messages.
  * @param[in] lvl		log level.
- * @param[in] max_networks	number of network threads.
- * @param[in] max_workers	number of worker threads.
+ * @param[in] config		number of network and worker threads, etc.
+ *				Must be NULL for single-threaded mode.
  * @param[in] worker_thread_instantiate		callback for new worker threads.
  * @param[in] worker_thread_ctx	context for callback.
  * @return
@@ -362,13 +847,16 @@ int fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *a
  */
 fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 				  fr_log_t *logger, fr_log_lvl_t lvl,
-				  int max_networks, int max_workers,
+				  fr_schedule_config_t const *config,
 				  fr_schedule_thread_instantiate_t worker_thread_instantiate,
 				  void *worker_thread_ctx)
 {
 	int i;
 	fr_schedule_worker_t *sw, *next;
 	fr_schedule_t *sc;
+	uint32_t max_networks = config ? config->max_networks : 0;
+	uint32_t max_workers = config ? config->max_workers : 0;
+	uint32_t min_workers = config ? config->min_workers : 0;
 
 	/*
 	 *	Single-threaded mode MUST have event list, and zero
@@ -384,7 +872,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	 *	non-zero networks and workers.
 	 */
 	if (!el && (!max_networks || !max_workers)) {
-		fr_strerror_printf("Must specify the number of networks (%d >= 0) and workers (%d >= 0)",
+		fr_strerror_printf("Must specify the number of networks (%u >= 0) and workers (%u >= 0)",
 			max_networks, max_workers);
 		return NULL;
 	}
@@ -398,6 +886,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	sc->el = el;
 	sc->max_networks = max_networks;
 	sc->max_workers = max_workers;
+	sc->min_workers = ((min_workers > 0) && (min_workers < max_workers)) ? min_workers : max_workers;
 	sc->num_workers = 0;
 	sc->log = logger;
 	sc->lvl = lvl;
@@ -455,6 +944,54 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	 */
 	fr_dlist_init(&sc->workers, fr_schedule_worker_t, entry);
 
+	if (config->network_cpus && *config->network_cpus) {
+		sc->num_network_cpus = fr_schedule_cpus_parse(sc, &sc->network_cpus,
+							      "network_cpus", config->network_cpus);
+		if (sc->num_network_cpus < 0) {
+		cpu_fail:
+			fr_log(sc->log, L_ERR, "%s", fr_strerror());
+			talloc_free(sc);
+			return NULL;
+		}
+	}
+
+	if (config->worker_cpus && *config->worker_cpus) {
+		sc->num_worker_cpus = fr_schedule_cpus_parse(sc, &sc->worker_cpus,
+							     "worker_cpus", config->worker_cpus);
+		if (sc->num_worker_cpus < 0) goto cpu_fail;
+	}
+
+	/*
+	 *	Stealing needs someone to steal from.
+	 */
+	if (config->work_stealing && (max_workers > 1)) {
+		sc->steal = fr_worker_steal_create(sc, max_workers);
+		if (!sc->steal) {
+			fr_log(sc->log, L_ERR, "Failed creating steal group: %s", fr_strerror());
+			talloc_free(sc);
+			return NULL;
+		}
+	}
+
+	sc->timer_wheel = config->timer_wheel;
+
+	/*
+	 *	Fixed message sets can't grow, so they need a size.
+	 */
+	if (config->message_hugepages) {
+		if (!config->message_set_size || !config->message_ring_buffer_size) {
+			fr_log(sc->log, L_ERR, "Message sets in huge pages need a size");
+			talloc_free(sc);
+			return NULL;
+		}
+
+		sc->message_hugepages = true;
+		sc->message_set_size = config->message_set_size;
+		sc->message_ring_buffer_size = config->message_ring_buffer_size;
+	}
+
+	sc->max_request_time = config->max_request_time;
+
 	memset(&sc->semaphore, 0, sizeof(sc->semaphore));
 	if (sem_init(&sc->semaphore, 0, SEMAPHORE_LOCKED) != 0) {
 		fr_log(sc->log, L_ERR, "Failed creating semaphore: %s", fr_syserror(errno));
@@ -462,33 +999,52 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
+	pthread_mutex_init(&sc->mutex, NULL);
+
 	/*
-	 *	Create the network thread first.
-	 *	@todo - create multiple network threads
+	 *	Create the network threads first.
 	 */
-	sc->sn = talloc_zero(sc, fr_schedule_network_t);
-	sc->sn->sc = sc;
-	sc->sn->id = 0;
-
-	if (fr_schedule_pthread_create(&sc->sn->pthread_id, fr_schedule_network_thread, sc->sn) < 0) {
-		fr_log(sc->log, L_ERR, "Failed creating network thread %s", fr_strerror());
+	sc->networks = talloc_zero_array(sc, fr_schedule_network_t *, sc->max_networks);
+	if (!sc->networks) {
+		fr_log(sc->log, L_ERR, "Failed allocating memory");
 		goto fail;
 	}
 
-	SEM_WAIT_INTR(&sc->semaphore);
-	if (sc->sn->status != FR_CHILD_RUNNING) {
-	fail:
-		fr_schedule_destroy(sc);
-		if (sc->sn->ctx) TALLOC_FREE(sc->sn->ctx);
-		TALLOC_FREE(sc->sn);
-		return NULL;
+	for (i = 0; i < sc->max_networks; i++) {
+		fr_schedule_network_t *sn;
+
+		sn = talloc_zero(sc, fr_schedule_network_t);
+		if (!sn) {
+			fr_log(sc->log, L_ERR, "Network %d - Failed allocating memory", i);
+			goto fail;
+		}
+
+		sn->sc = sc;
+		sn->id = i;
+
+		if (fr_schedule_pthread_create(&sn->pthread_id, fr_schedule_network_thread, sn) < 0) {
+			fr_log(sc->log, L_ERR, "Failed creating network thread %s", fr_strerror());
+			talloc_free(sn);
+			goto fail;
+		}
+
+		SEM_WAIT_INTR(&sc->semaphore);
+		sc->networks[sc->num_networks++] = sn;
+
+		if (sn->status != FR_CHILD_RUNNING) {
+		fail:
+			fr_schedule_destroy(sc);
+			return NULL;
+		}
 	}
 
 	/*
-	 *	Create all of the workers.
+	 *	Create all of the workers.  If the number of workers
+	 *	can change, we start with the minimum, and the network
+	 *	thread adds more as necessary.
 	 */
-	for (i = 0; i < sc->max_workers; i++) {
-		DEBUG3("Creating %d/%d workers\n", i, sc->max_workers);
+	for (i = 0; i < sc->min_workers; i++) {
+		DEBUG3("Creating %d/%d workers\n", i, sc->min_workers);
 
 		/*
 		 *	Create a worker "glue" structure
@@ -511,6 +1067,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 
 		sc->num_workers++;
 	}
+	sc->next_id = sc->min_workers;
 
 
 	/*
@@ -542,7 +1099,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	/*
 	 *	Failed to start some workers, refuse to do anything!
 	 */
-	if (sc->num_workers < sc->max_workers) {
+	if (sc->num_workers < sc->min_workers) {
 		fr_schedule_destroy(sc);
 		return NULL;
 	}
@@ -561,11 +1118,27 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 	}
 
-	if (fr_command_register_hook(NULL, "0", sc->sn->nr, cmd_network_table) < 0) {
-		fr_log(sc->log, L_ERR, "Failed adding network commands: %s", fr_strerror());
+	for (i = 0; i < sc->num_networks; i++) {
+		char buffer[32];
+
+		snprintf(buffer, sizeof(buffer), "%d", i);
+		if (fr_command_register_hook(NULL, buffer, sc->networks[i]->nr, cmd_network_table) < 0) {
+			fr_log(sc->log, L_ERR, "Failed adding network commands: %s", fr_strerror());
+			goto st_fail;
+		}
+	}
+
+	if (fr_command_register_hook(NULL, NULL, sc, cmd_schedule_table) < 0) {
+		fr_log(sc->log, L_ERR, "Failed adding scheduler commands: %s", fr_strerror());
 		goto st_fail;
 	}
 
+	if (sc->min_workers < sc->max_workers) {
+		fr_log(sc->log, L_INFO, "Scheduler created successfully with %d networks and %d to %d workers",
+		       sc->max_networks, sc->min_workers, sc->max_workers);
+		return sc;
+	}
+
 	if (sc) fr_log(sc->log, L_INFO, "Scheduler created successfully with %d networks and %d workers",
 		       sc->max_networks, sc->num_workers);
 
@@ -584,7 +1157,9 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 	int i;
 	fr_schedule_worker_t *sw;
 
+	if (!sc->el) pthread_mutex_lock(&sc->mutex);
 	sc->running = false;
+	if (!sc->el) pthread_mutex_unlock(&sc->mutex);
 
 	/*
 	 *	Single threaded mode: kill the only network / worker we have.
@@ -599,34 +1174,41 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 		goto done;
 	}
 
-	rad_assert(sc->sn);
-	rad_assert(sc->num_workers > 0);
-
 	/*
-	 *	If the network thread is running, tell it to exit, and
-	 *	wait for it to do so.  Once it's exited, we know that
-	 *	this thread can use the network channels to tell the
-	 *	workers that the network side is going away.
+	 *	If the network threads are running, tell them to exit,
+	 *	and wait for them to do so.  Once they've exited, we
+	 *	know that this thread can use the network channels to
+	 *	tell the workers that the network side is going away.
 	 */
-	if (sc->sn->status == FR_CHILD_RUNNING) {
-		fr_network_exit(sc->sn->nr);
+	for (i = 0; i < sc->num_networks; i++) {
+		fr_schedule_network_t *sn = sc->networks[i];
+
+		if (sn->status != FR_CHILD_RUNNING) continue;
+
+		fr_network_exit(sn->nr);
 		SEM_WAIT_INTR(&sc->semaphore);
-		fr_network_destroy(sc->sn->nr);
+		fr_network_destroy(sn->nr);
 	}
 
 	/*
-	 *	Signal all of the workers to exit.
+	 *	Signal all of the workers to exit.  Workers which have
+	 *	already exited have no worker.
 	 */
+	pthread_mutex_lock(&sc->mutex);
 	for (sw = fr_dlist_head(&sc->workers);
 	     sw != NULL;
 	     sw = fr_dlist_next(&sc->workers, sw)) {
-		fr_worker_exit(sw->worker);
+		if (sw->worker) fr_worker_exit(sw->worker);
 	}
+	pthread_mutex_unlock(&sc->mutex);
 
 	/*
 	 *	Wait for all worker threads to finish.  THEN clean up
 	 *	modules.  Otherwise, the modules will be removed from
 	 *	underneath the workers!
+	 *
+	 *	Dynamic workers don't signal the semaphore, but we
+	 *	join them below.
 	 */
 	for (i = 0; i < sc->num_workers; i++) {
 		DEBUG3("Wait for semaphore indicating exit %d/%d\n", i, sc->num_workers);
@@ -637,7 +1219,11 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 	 *	Clean up the exited workers.
 	 */
 	while ((sw = fr_dlist_head(&sc->workers)) != NULL) {
-		sc->num_workers--;
+		if (sw->dynamic) {
+			sc->num_dynamic--;
+		} else {
+			sc->num_workers--;
+		}
 
 		fr_dlist_remove(&sc->workers, sw);
 
@@ -655,11 +1241,15 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 			DEBUG3("Worker %i exited", sw->id);
 		}
 		talloc_free(sw->ctx);
+		if (sw->dynamic) talloc_free(sw);
 	}
 
-	TALLOC_FREE(sc->sn->ctx);
+	for (i = 0; i < sc->num_networks; i++) {
+		TALLOC_FREE(sc->networks[i]->ctx);
+	}
 
 	sem_destroy(&sc->semaphore);
+	pthread_mutex_destroy(&sc->mutex);
 
 done:
 	/*
@@ -688,7 +1278,45 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 	if (sc->el) {
 		nr = sc->single_network;
 	} else {
-		nr = sc->sn->nr;
+		/*
+		 *	Spread the sockets across the network threads.
+		 */
+		nr = sc->networks[sc->next_network]->nr;
+		sc->next_network = (sc->next_network + 1) % sc->num_networks;
+	}
+
+	if (fr_network_listen_add(nr, li) < 0) return NULL;
+
+	return nr;
+}
+
+/** Add a fr_listen_t to a particular network thread
+ *
+ *  Used for listeners which open one socket per network thread, and
+ *  need to know which thread reads each socket.
+ *
+ * @param[in] sc the scheduler
+ * @param[in] li the ctx and callbacks for the transport.
+ * @param[in] id of the network thread, from 0 to fr_schedule_num_networks() - 1.
+ * @return
+ *	- NULL on error
+ *	- the fr_network_t that the socket was added to.
+ */
+fr_network_t *fr_schedule_listen_add_network(fr_schedule_t *sc, fr_listen_t *li, int id)
+{
+	fr_network_t *nr;
+
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) {
+		nr = sc->single_network;
+	} else {
+		if ((id < 0) || (id >= sc->num_networks)) {
+			fr_strerror_printf("Invalid network %d", id);
+			return NULL;
+		}
+
+		nr = sc->networks[id]->nr;
 	}
 
 	if (fr_network_listen_add(nr, li) < 0) return NULL;
@@ -696,6 +1324,18 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 	return nr;
 }
 
+/** Return the number of network threads
+ *
+ * @param[in] sc the scheduler
+ * @return the number of network threads.
+ */
+int fr_schedule_num_networks(fr_schedule_t const *sc)
+{
+	if (sc->el) return 1;
+
+	return sc->num_networks;
+}
+
 /** Add a directory NOTE_EXTEND to a scheduler.
  *
  * @param[in] sc the scheduler
@@ -713,7 +1353,7 @@ fr_network_t *fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li)
 	if (sc->el) {
 		nr = sc->single_network;
 	} else {
-		nr = sc->sn->nr;
+		nr = sc->networks[0]->nr;
 	}
 
 	if (fr_network_directory_add(nr, li) < 0) return NULL;
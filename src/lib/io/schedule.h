@@ -54,17 +54,41 @@ extern "C" {
  */
 typedef int (*fr_schedule_thread_instantiate_t)(TALLOC_CTX *ctx, fr_event_list_t *el, void *uctx);
 
+/** Configuration for the network and worker threads
+ *
+ */
+typedef struct {
+	uint32_t	max_networks;		//!< number of network threads
+	uint32_t	max_workers;		//!< number of worker threads
+	uint32_t	min_workers;		//!< number of worker threads to start with,
+						//!< 0 for a fixed number of workers
+
+	bool		work_stealing;		//!< idle workers steal requests from busy ones
+	bool		timer_wheel;		//!< use a timer wheel for the network and worker event lists
+
+	char const	*network_cpus;		//!< CPUs the network threads run on, e.g. "0-1"
+	char const	*worker_cpus;		//!< CPUs the worker threads run on, e.g. "2-7,10"
+
+	bool		message_hugepages;	//!< allocate message sets from pre-faulted huge pages
+	uint32_t	message_set_size;	//!< number of messages in each message set, a power of 2
+	size_t		message_ring_buffer_size; //!< size of the packet ring buffer in each message set
+
+	uint32_t	max_request_time;	//!< seconds, packets which would wait longer for a worker are shed
+} fr_schedule_config_t;
+
 int			fr_schedule_worker_id(void);
 
 int			fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *arg);
 fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t *log, fr_log_lvl_t lvl,
-					    int max_inputs, int max_workers,
+					    fr_schedule_config_t const *config,
 					    fr_schedule_thread_instantiate_t worker_thread_instantiate,
 					    void *worker_thread_ctx) CC_HINT(nonnull(3));
 /* schedulers are async, so there's no fr_schedule_run() */
 int			fr_schedule_destroy(fr_schedule_t *sc);
 
 fr_network_t		*fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
+fr_network_t		*fr_schedule_listen_add_network(fr_schedule_t *sc, fr_listen_t *li, int id) CC_HINT(nonnull);
+int			fr_schedule_num_networks(fr_schedule_t const *sc) CC_HINT(nonnull);
 fr_network_t		*fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 #ifdef __cplusplus
 }
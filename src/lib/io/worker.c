@@ -36,10 +36,15 @@
  *
  *  The lifecycle of a packet MUST be carefully managed.  Initially,
  *  messages are put into the "to_decode" heap.  If the messages sit
- *  in the heap for too long, they are localized and put into the
- *  "localized" heap.  Each heap is ordered by (priority, time), so
- *  that high priority packets take precedence over low priority
- *  packets.
+ *  in the heap for too long, they are put into the "localized" heap.
+ *  Each heap is ordered by (priority, time), so that high priority
+ *  packets take precedence over low priority packets.
+ *
+ *  Messages in the "localized" heap are normally left in the network
+ *  thread's ring buffer, and the worker holds a lease on them.  The
+ *  network thread sees the leases, and slows down.  Only when there
+ *  are too many leases is the message copied ("localized") into the
+ *  worker's memory.
  *
  *  Both queues have linked lists of received packets, ordered by
  *  time.  This list is used to clean up packets which have been in
@@ -66,7 +71,12 @@ RCSID("$Id$")
 #include <freeradius-devel/io/message.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/io/atomic_queue.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/latency.h>
+#include <freeradius-devel/util/rand.h>
+
+#include <sched.h>
 
 /**
  *  Track things by priority and time.
@@ -76,6 +86,48 @@ typedef struct {
 	fr_heap_t	*heap;			//!< heap, ordered by priority
 } fr_worker_heap_t;
 
+/*
+ *	Size of each worker's queue of requests which can be stolen.
+ */
+#define STEAL_QUEUE_SIZE	(1024)
+
+/*
+ *	New requests only go into the steal queue when there are at
+ *	least this many in the "to_decode" heap.  Below that, we'll
+ *	get to them soon enough ourselves.
+ */
+#define STEAL_BACKLOG		(16)
+
+/*
+ *	Number of recent queueing times we keep, for percentiles.
+ */
+#define QUEUE_TIME_SAMPLES	(1024)
+
+/**
+ *  One worker in a steal group.
+ */
+typedef struct {
+	atomic_bool		claimed;	//!< the slot belongs to a worker
+	atomic_bool		active;		//!< other workers can steal from this one
+	atomic_bool		idle;		//!< the worker is sleeping, and can be woken up to steal requests
+	atomic_uint_fast32_t	thieves;	//!< number of workers which are stealing from this one
+	atomic_uint_fast64_t	num_stolen;	//!< number of requests which other workers stole from this one
+
+	fr_atomic_queue_t	*aq;		//!< requests which the worker hasn't started to process
+	fr_atomic_queue_t	*returned;	//!< requests which a thief took from "aq", but can't reply to
+	int			kq;		//!< the worker's kq, so that we can wake it up
+	uintptr_t		ident;		//!< the worker's control-plane identifier
+} fr_worker_steal_slot_t;
+
+/**
+ *  A group of workers which steal requests from each other.
+ */
+struct fr_worker_steal_t {
+	uint32_t		max_workers;	//!< number of slots
+
+	fr_worker_steal_slot_t	slot[1];	//!< one per worker
+};
+
 #ifndef NDEBUG
 static void fr_worker_verify(fr_worker_t *worker);
 #define WORKER_VERIFY fr_worker_verify(worker)
@@ -102,6 +154,20 @@ DIAG_OFF(unused-macros)
 #define RDEBUG(fmt, ...) if (worker->lvl) fr_log(worker->log, L_DBG, "(%s)  " fmt, request->name, ## __VA_ARGS__)
 DIAG_ON(unused-macros)
 
+/*
+ *	The maximum number of unused request pools we keep, for each
+ *	virtual server.
+ */
+#define WORKER_REQUEST_POOL_FREE (128)
+
+/**
+ *  Recycled request pools for one virtual server.
+ */
+typedef struct {
+	CONF_SECTION const	*server_cs;	//!< the virtual server
+	fr_request_pool_t	*rp;		//!< the request pools
+} fr_worker_request_pool_t;
+
 /**
  *  A worker which takes packets from a master, and processes them.
  */
@@ -129,11 +195,12 @@ struct fr_worker_t {
 
 	int                     message_set_size; //!< default start number of messages
 	int                     ring_buffer_size; //!< default start size for the ring buffers
+	bool			message_set_fixed; //!< message sets are in huge pages, and never grow
 
 	int			max_request_time; //!< maximum time a request can be processed
 
-	size_t			talloc_pool_size; //!< for each REQUEST
-
+	size_t			talloc_pool_size; //!< initial size of the pool for each REQUEST
+	rbtree_t		*request_pools;	//!< recycled request pools, one per virtual server
 
 	fr_worker_heap_t	to_decode;	//!< messages from the master, to be decoded or localized
 	fr_worker_heap_t       	localized;	//!< localized messages to be decoded
@@ -145,14 +212,22 @@ struct fr_worker_t {
 	fr_io_stats_t		stats;		//!< input / output stats
 	fr_time_elapsed_t	cpu_time;	//!< histogram of total CPU time per request
 	fr_time_elapsed_t	wall_clock;	//!< histogram of wall clock time per request
+	fr_time_elapsed_t	queue_time;	//!< histogram of time requests wait before being decoded
+
+	fr_time_t		queue_sample[QUEUE_TIME_SAMPLES]; //!< recent queueing times
+	uint64_t		num_queue_samples; //!< total number of queueing times recorded
 
 	uint64_t       		num_decoded;	//!< number of messages which have been decoded
+	uint64_t		num_leased;	//!< number of messages we held in the network's buffers
+	uint64_t		num_localized;	//!< number of messages we copied out of the network's buffers
 	uint64_t    		num_timeouts;	//!< number of messages which timed out
 	uint64_t    		num_active;	//!< number of active requests
 
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
 
-	bool			was_sleeping;	//!< used to suppress multiple sleep signals in a row
+	atomic_uint_fast64_t	load_cpu_time;	//!< tracking.running, published for fr_worker_load()
+	atomic_uint_fast32_t	load_backlog;	//!< decode queue depth, published for fr_worker_load()
+
 	bool			exiting;	//!< are we exiting?
 
 	fr_time_t		checked_timeout; //!< when we last checked the tails of the queues
@@ -162,9 +237,25 @@ struct fr_worker_t {
 	fr_event_timer_t const	*ev_cleanup;	//!< timer for max_request_time
 
 	fr_channel_t		**channel;	//!< list of channels
+
+	int			num_closing;	//!< number of channels which the network has closed
+	int			num_closed;	//!< number of message sets from closed channels
+	fr_message_set_t	**closed;	//!< message sets from closed channels
+	fr_event_timer_t const	*ev_retire;	//!< to check if we can exit
+
+	int			numa_node;	//!< NUMA node we're running on, or -1 for unknown
+
+	fr_worker_steal_t	*steal;		//!< the group of workers we steal requests from
+	fr_worker_steal_slot_t	*slot;		//!< our entry in the steal group
+	uint64_t		num_stolen;	//!< number of requests we stole from other workers
+
+	fr_latency_key_t const	*latency_queue;	//!< from reading a packet to receiving it here
+	fr_latency_key_t const	*latency_decode; //!< time spent decoding packets
+	fr_latency_key_t const	*latency_encode; //!< time spent encoding replies
 };
 
 static void fr_worker_post_event(fr_event_list_t *el, struct timeval *now, void *uctx);
+static void fr_worker_steal_leave(fr_worker_t *worker);
 
 /*
  *	We need wrapper macros because we have multiple instances of
@@ -196,6 +287,24 @@ static void fr_worker_post_event(fr_event_list_t *el, struct timeval *now, void
        } while (0)
 
 
+/** Take back the requests which other workers stole, but couldn't reply to
+ *
+ *  They go into the "to_decode" heap, which orders them by priority
+ *  and time, so they're processed in the same order as if they had
+ *  never left.
+ *
+ * @param[in] worker the worker
+ */
+static void fr_worker_steal_returned(fr_worker_t *worker)
+{
+	fr_channel_data_t *cd;
+
+	while (fr_atomic_queue_pop(worker->slot->returned, (void **) &cd)) {
+		WORKER_HEAP_INSERT(to_decode, cd);
+	}
+}
+
+
 /** Callback which handles a message being received on the worker side.
  *
  * @param[in] ctx the worker
@@ -209,6 +318,32 @@ static void fr_worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_
 	worker->stats.in++;
 	DEBUG3("\t%sreceived request %" PRIu64 "", worker->name, worker->stats.in);
 	cd->channel.ch = ch;
+	cd->stolen_from = NULL;
+	cd->request.leased = false;
+
+	/*
+	 *	Let idle workers steal new requests once we have a
+	 *	backlog.  Until then, requests go into the heap, so
+	 *	that they're processed in priority order, and checked
+	 *	by fr_worker_check_timeouts().  High priority requests
+	 *	always stay here.  So do duplicates, so that they find
+	 *	the original request.  If the queue is full, we process
+	 *	the request ourselves.
+	 */
+	if (worker->slot && !cd->request.is_dup && (cd->priority <= PRIORITY_NORMAL) &&
+	    (fr_heap_num_elements(worker->to_decode.heap) >= STEAL_BACKLOG)) {
+		/*
+		 *	Empty the "returned" queue every time we add
+		 *	to "aq".  Everything in "returned" was popped
+		 *	from "aq" since then, so "returned" never
+		 *	holds more than "aq", plus one request for
+		 *	each thief.  See fr_worker_steal_create().
+		 */
+		fr_worker_steal_returned(worker);
+
+		if (fr_atomic_queue_push(worker->slot->aq, cd)) return;
+	}
+
 	WORKER_HEAP_INSERT(to_decode, cd);
 }
 
@@ -223,19 +358,12 @@ static void fr_worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_
 static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_size, fr_time_t now)
 {
 	int i;
-	bool ok, was_sleeping;
+	bool ok;
 	fr_channel_t *ch;
 	fr_message_set_t *ms;
 	fr_channel_event_t ce;
 	fr_worker_t *worker = ctx;
 
-	was_sleeping = worker->was_sleeping;
-	worker->was_sleeping = false;
-
-	/*
-	 *	We were woken up by a signal to do something.  We're
-	 *	not sleeping.
-	 */
 	ce = fr_channel_service_message(now, &ch, data, data_size);
 	switch (ce) {
 	case FR_CHANNEL_ERROR:
@@ -259,12 +387,7 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 		rad_assert(ch != NULL);
 		DEBUG3("\t--> data");
 
-		if (!fr_channel_recv_request(ch)) {
-			worker->was_sleeping = was_sleeping;
-
-		} else while (fr_channel_recv_request(ch)) {
-				/* do nothing */
-		}
+		(void) fr_channel_recv_request_bulk(ch);
 		break;
 
 	case FR_CHANNEL_OPEN:
@@ -281,9 +404,27 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 			worker->channel[i] = ch;
 			DEBUG3("\t%sreceived channel %p into array entry %d", worker->name, ch, i);
 
-			ms = fr_message_set_create(worker, worker->message_set_size,
-						   sizeof(fr_channel_data_t),
-						   worker->ring_buffer_size);
+			ms = NULL;
+			if (worker->message_set_fixed) {
+				ms = fr_message_set_create_fixed(worker, worker->message_set_size,
+								 sizeof(fr_channel_data_t),
+								 worker->ring_buffer_size);
+
+				/*
+				 *	Huge pages may have run out.  A
+				 *	message set which grows is better
+				 *	than no channel at all.
+				 */
+				if (!ms) {
+					fr_log(worker->log, L_WARN, "Failed creating fixed message set, "
+					       "using a normal one - %s", fr_strerror());
+				}
+			}
+			if (!ms) {
+				ms = fr_message_set_create(worker, worker->message_set_size,
+							   sizeof(fr_channel_data_t),
+							   worker->ring_buffer_size);
+			}
 			rad_assert(ms != NULL);
 			fr_channel_worker_ctx_add(ch, ms);
 
@@ -299,38 +440,102 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 		DEBUG3("\t--> channel close");
 
 		rad_assert(ch != NULL);
+		rad_assert(!fr_channel_active(ch));
 
-		ok = false;
-		for (i = 0; i < worker->max_channels; i++) {
-			if (!worker->channel[i]) continue;
+		/*
+		 *	Pull in the requests which the network sent
+		 *	before it closed the channel.  We acknowledge
+		 *	the close once we've replied to all of them.  See
+		 *	fr_worker_close_channels().
+		 */
+		(void) fr_channel_recv_request_bulk(ch);
 
-			if (worker->channel[i] != ch) continue;
+		/*
+		 *	Other workers which steal our requests look at
+		 *	the channel, so they have to stop first.
+		 */
+		fr_worker_steal_leave(worker);
+		worker->num_closing++;
+		break;
+	}
+}
 
-			/*
-			 *	@todo check the status, and
-			 *	put the channel into a
-			 *	"closing" list if we can't
-			 *	close it right now.  Then,
-			 *	wake up after a time and try
-			 *	to close it again.
-			 */
-			(void) fr_channel_worker_ack_close(ch);
+/** Check if the worker has exited
+ *
+ *  The network may still be writing replies which use our message
+ *  sets, so we can't exit until it's done with them.
+ *
+ * @param[in] el	the event list
+ * @param[in] when	the current time
+ * @param[in] uctx	the worker
+ */
+static void fr_worker_retire_check(UNUSED fr_event_list_t *el, UNUSED struct timeval *when, void *uctx)
+{
+	int i;
+	struct timeval next;
+	fr_worker_t *worker = talloc_get_type_abort(uctx, fr_worker_t);
 
-			ms = fr_channel_worker_ctx_get(ch);
-			rad_assert(ms != NULL);
-			fr_message_set_gc(ms);
-			talloc_free(ms);
+	for (i = 0; i < worker->num_closed; i++) {
+		fr_message_set_gc(worker->closed[i]);
 
-			worker->channel[i] = NULL;
-			rad_assert(worker->num_channels > 0);
-			worker->num_channels--;
-			ok = true;
-			break;
+		if (fr_message_set_messages_used(worker->closed[i]) > 0) {
+			fr_time_to_timeval(&next, fr_time() + (NANOSEC / 100));
+
+			if (fr_event_timer_insert(worker, worker->el, &worker->ev_retire,
+						  &next, fr_worker_retire_check, worker) < 0) {
+				ERROR("Failed inserting retire timer");
+				break;
+			}
+			return;
 		}
+	}
 
-		fr_cond_assert(ok);
-		break;
+	DEBUG("\t%sall channels are closed - exiting", worker->name);
+	fr_worker_exit(worker);
+}
+
+/** Acknowledge closed channels, once we've replied to all of their requests
+ *
+ *  A worker with no channels has nothing more to do, and exits.
+ *
+ * @param[in] worker	the worker
+ */
+static void fr_worker_close_channels(fr_worker_t *worker)
+{
+	int i;
+
+	/*
+	 *	We still have requests to reply to.
+	 */
+	if (worker->num_active ||
+	    (fr_heap_num_elements(worker->runnable) > 0) ||
+	    (fr_heap_num_elements(worker->localized.heap) > 0) ||
+	    (fr_heap_num_elements(worker->to_decode.heap) > 0)) return;
+
+	for (i = 0; i < worker->max_channels; i++) {
+		fr_channel_t *ch = worker->channel[i];
+
+		if (!ch || fr_channel_active(ch)) continue;
+
+		DEBUG3("\t%sacknowledging close of channel %p", worker->name, ch);
+		(void) fr_channel_worker_ack_close(ch);
+
+		/*
+		 *	The network may still be using replies in the
+		 *	message set, so we keep it until we exit.
+		 */
+		if (fr_cond_assert(worker->num_closed < worker->max_channels)) {
+			worker->closed[worker->num_closed++] = fr_channel_worker_ctx_get(ch);
+		}
+
+		worker->channel[i] = NULL;
+		rad_assert(worker->num_channels > 0);
+		worker->num_channels--;
+		rad_assert(worker->num_closing > 0);
+		worker->num_closing--;
 	}
+
+	if (!worker->num_channels) fr_worker_retire_check(worker->el, NULL, worker);
 }
 
 
@@ -357,6 +562,23 @@ static void fr_worker_evfilt_user(UNUSED int kq, UNUSED struct kevent const *kev
 }
 
 
+/** Mark a request message as done
+ *
+ *  If we were holding the message in the network's buffers, release
+ *  the lease, too.
+ *
+ * @param[in] cd the message
+ */
+static void fr_worker_message_done(fr_channel_data_t *cd)
+{
+	if (cd->request.leased) {
+		cd->request.leased = false;
+		fr_channel_lease_release(cd->channel.ch);
+	}
+
+	fr_message_done(&cd->m);
+}
+
 /** Send a NAK to the network thread
  *
  *  The network thread believes that a worker is running a request until that request has been NAK'd.
@@ -411,15 +633,16 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 	reply->m.when = now;
 	reply->reply.cpu_time = worker->tracking.running;
 	reply->reply.processing_time = 10; /* @todo - set to something better? */
-	reply->reply.request_time = cd->m.when;
+	reply->reply.request_time = cd->request.is_dup ? 0 : cd->m.when;
 
 	reply->listen = cd->listen;
 	reply->packet_ctx = cd->packet_ctx;
+	reply->stolen_from = cd->stolen_from;
 
 	/*
 	 *	Mark the original message as done.
 	 */
-	fr_message_done(&cd->m);
+	fr_worker_message_done(cd);
 
 	/*
 	 *	Send the reply, which also polls the request queue.
@@ -431,9 +654,88 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 	worker->stats.out++;
 }
 
+/** Release a duplicate packet which we've discarded
+ *
+ *  The master IO handler holds a reference to the tracking entry for
+ *  every duplicate it gives us.  The reference is released when the
+ *  "reply" to the duplicate is written.  The reply has no request
+ *  time, so it never matches the tracking entry, and is never sent.
+ *
+ * @param[in] worker the worker
+ * @param[in] request the duplicate request
+ */
+static void fr_worker_dup_done(fr_worker_t *worker, REQUEST *request)
+{
+	fr_channel_data_t	*reply;
+	fr_channel_t		*ch;
+	fr_message_set_t	*ms;
+
+	ch = request->async->channel;
+	ms = fr_channel_worker_ctx_get(ch);
+	rad_assert(ms != NULL);
+
+	reply = (fr_channel_data_t *) fr_message_reserve(ms, 1);
+	rad_assert(reply != NULL);
+
+	*reply->m.data = 0;
+	(void) fr_message_alloc(ms, &reply->m, 1);
+
+	reply->m.when = fr_time();
+	reply->reply.cpu_time = worker->tracking.running;
+	reply->reply.processing_time = 0;
+	reply->reply.request_time = 0;
+
+	reply->listen = request->async->listen;
+	reply->packet_ctx = request->async->packet_ctx;
+	reply->stolen_from = request->async->stolen_from;
+
+	if (fr_channel_send_reply(ch, reply) < 0) {
+		DEBUG2("\t%sfails sending reply to channel", worker->name);
+	}
+
+	worker->stats.out++;
+}
+
 static void worker_reset_timer(fr_worker_t *worker);
 
 
+/** Find the request pools for a virtual server, creating them if necessary
+ *
+ */
+static fr_request_pool_t *worker_request_pool(fr_worker_t *worker, CONF_SECTION const *server_cs)
+{
+	fr_worker_request_pool_t my_pool, *pool;
+
+	my_pool.server_cs = server_cs;
+	pool = rbtree_finddata(worker->request_pools, &my_pool);
+	if (pool) return pool->rp;
+
+	pool = talloc_zero(worker->request_pools, fr_worker_request_pool_t);
+	if (!pool) return NULL;
+
+	pool->server_cs = server_cs;
+	pool->rp = fr_request_pool_create(pool, worker->talloc_pool_size, WORKER_REQUEST_POOL_FREE, true);
+	if (!pool->rp || !rbtree_insert(worker->request_pools, pool)) {
+		talloc_free(pool);
+		return NULL;
+	}
+
+	return pool->rp;
+}
+
+/** Free a request, and recycle its memory pool
+ *
+ */
+static void worker_request_free(REQUEST *request)
+{
+	if (request->async && request->async->request_pool) {
+		fr_request_pool_free(request->async->request_pool, request);
+		return;
+	}
+
+	talloc_free(request);
+}
+
 /** Reply to a request
  *
  *  And clean it up.
@@ -485,6 +787,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	if (size) {
 		ssize_t slen = 0;
 		fr_listen_t const *listen = request->async->listen;
+		fr_time_t start = fr_time();
 
 		if (listen->app->encode) {
 			slen = listen->app->encode(listen->app_instance, request,
@@ -493,6 +796,8 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 			slen = listen->app_io->encode(listen->app_io_instance, request,
 						      reply->m.data, reply->m.rb_size);
 		}
+		fr_latency_record(worker->latency_encode, fr_time() - start);
+
 		if (slen < 0) {
 			DEBUG2("\t%sfails encode", worker->name);
 			*reply->m.data = 0;
@@ -535,6 +840,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 
 	reply->listen = request->async->listen;
 	reply->packet_ctx = request->async->packet_ctx;
+	reply->stolen_from = request->async->stolen_from;
 
 	/*
 	 *	Update the various timers.
@@ -553,10 +859,6 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 
 	worker->stats.out++;
 
-	/*
-	 *	@todo Use a talloc pool for the request.  Clean it up,
-	 *	and insert it back into a slab allocator.
-	 */
 	if (request->time_order_id >= 0) (void) fr_heap_extract(worker->time_order, request);
 	if (request->runnable_id >= 0) (void) fr_heap_extract(worker->runnable, request);
 
@@ -575,7 +877,7 @@ finished:
 #endif
 
 	DEBUG3("freeing request");
-	talloc_free(request);
+	worker_request_free(request);
 }
 
 
@@ -698,6 +1000,18 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 	fr_channel_data_t *cd;
 	fr_time_t waiting;
 
+	/*
+	 *	Requests which no other worker has stolen by now come
+	 *	back to us, so that they're checked below.
+	 */
+	if (worker->slot) {
+		fr_worker_steal_returned(worker);
+
+		while (fr_atomic_queue_pop(worker->slot->aq, (void **) &cd)) {
+			WORKER_HEAP_INSERT(to_decode, cd);
+		}
+	}
+
 	/*
 	 *	Check the "localized" queue for old packets.
 	 *
@@ -740,21 +1054,291 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 		}
 
 		/*
-		 *	0.01 to 1s.  Localize it.
+		 *	0.01 to 1s.  Hold on to it in the network's
+		 *	buffers if we can.  Otherwise, localize it.
 		 */
 		WORKER_HEAP_EXTRACT(to_decode, cd);
-		lm = fr_message_localize(worker, &cd->m, sizeof(*cd));
-		if (!lm) {
-			DEBUG3("TIMEOUT: Failed localizing message from to_decode list: %s", fr_strerror());
-			goto nak;
+		if (fr_channel_lease_acquire(cd->channel.ch)) {
+			cd->request.leased = true;
+			worker->num_leased++;
+
+		} else {
+			lm = fr_message_localize(worker, &cd->m, sizeof(*cd));
+			if (!lm) {
+				DEBUG3("TIMEOUT: Failed localizing message from to_decode list: %s", fr_strerror());
+				goto nak;
+			}
+			cd = (fr_channel_data_t *) lm;
+			worker->num_localized++;
 		}
-		cd = (fr_channel_data_t *) lm;
 
 		WORKER_HEAP_INSERT(localized, cd);
 	}
 }
 
 
+/** Find our channel to the same master as another worker's channel
+ *
+ * @param[in] worker the worker
+ * @param[in] other a channel owned by another worker
+ * @return
+ *	- NULL if we have no channel to that master
+ *	- fr_channel_t our channel
+ */
+static fr_channel_t *fr_worker_channel_find(fr_worker_t *worker, fr_channel_t *other)
+{
+	int i;
+
+	for (i = 0; i < worker->max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
+		if (fr_channel_same_master(worker->channel[i], other)) return worker->channel[i];
+	}
+
+	return NULL;
+}
+
+
+/** Get requests from our steal queue, or steal one from another worker
+ *
+ *  Requests are put into our "to_decode" heap, so that they're
+ *  processed in priority order, and fr_worker_check_timeouts()
+ *  applies the same timeouts and leases as for any other request.
+ *  We only steal from other workers when we have nothing else to do.
+ *
+ *  Only requests which the other worker hasn't started to
+ *  process can be stolen.  The reply to a stolen request is sent
+ *  on our channel to the same master.
+ *
+ *  Duplicate detection is per worker, so a stolen request is only
+ *  checked against the other requests on the thief.  That doesn't
+ *  affect which replies are sent, as master.c decides that.  It
+ *  answers duplicates of requests which have a reply from its own
+ *  cache, and discards replies to requests which have since been
+ *  replaced by a conflicting packet.  A duplicate notice which
+ *  doesn't find the stolen request is ignored, just as it is when
+ *  the network sends it to a different worker than the original.
+ *
+ * @param[in] worker the worker
+ * @param[in] now the current time
+ */
+static void fr_worker_steal(fr_worker_t *worker, fr_time_t now)
+{
+	uint32_t		i, num, start;
+	fr_channel_data_t	*cd;
+	fr_worker_steal_t	*steal = worker->steal;
+
+	fr_worker_steal_returned(worker);
+
+	while ((fr_heap_num_elements(worker->to_decode.heap) < STEAL_BACKLOG) &&
+	       fr_atomic_queue_pop(worker->slot->aq, (void **) &cd)) {
+		WORKER_HEAP_INSERT(to_decode, cd);
+	}
+
+	if ((fr_heap_num_elements(worker->to_decode.heap) > 0) ||
+	    (fr_heap_num_elements(worker->localized.heap) > 0)) return;
+
+	/*
+	 *	We can't send replies for stolen requests until we
+	 *	have a channel.
+	 */
+	if (!worker->num_channels) return;
+
+	num = steal->max_workers;
+
+	/*
+	 *	Start at a random worker, so that idle workers don't
+	 *	all pick on the same victim.
+	 */
+	start = fr_rand() % num;
+	for (i = 0; i < num; i++) {
+		fr_worker_steal_slot_t	*slot = &steal->slot[(start + i) % num];
+		fr_channel_t		*ch;
+
+		if (slot == worker->slot) continue;
+		if (!atomic_load_explicit(&slot->active, memory_order_relaxed)) continue;
+
+		/*
+		 *	Tell the victim we're looking at its channel.
+		 *	It won't close the channel until we're done.
+		 *	See fr_worker_steal_leave().
+		 */
+		atomic_fetch_add_explicit(&slot->thieves, 1, memory_order_seq_cst);
+		if (!atomic_load_explicit(&slot->active, memory_order_seq_cst) ||
+		    !fr_atomic_queue_pop(slot->aq, (void **) &cd)) {
+			atomic_fetch_sub_explicit(&slot->thieves, 1, memory_order_release);
+			continue;
+		}
+
+		ch = fr_worker_channel_find(worker, cd->channel.ch);
+		if (!ch) {
+			/*
+			 *	We're not connected to that master,
+			 *	so we can't reply.  Give the request
+			 *	back.  It goes into a separate queue,
+			 *	and not to the end of "aq", so that it
+			 *	doesn't wait behind newer requests.
+			 *	The queue is large enough that the
+			 *	push can't fail.
+			 */
+			(void) fr_atomic_queue_push(slot->returned, cd);
+			atomic_fetch_sub_explicit(&slot->thieves, 1, memory_order_release);
+			continue;
+		}
+
+		fr_channel_steal_request(ch, cd);
+		atomic_fetch_sub_explicit(&slot->thieves, 1, memory_order_release);
+
+		atomic_fetch_add_explicit(&slot->num_stolen, 1, memory_order_relaxed);
+		worker->num_stolen++;
+
+		DEBUG3("\t%sstole request %" PRIu64 "", worker->name, worker->num_stolen);
+
+		/*
+		 *	It waited too long in the other worker's
+		 *	queue.  This is the same limit as
+		 *	fr_worker_check_timeouts() uses.
+		 */
+		if ((now - cd->m.when) > NANOSEC) {
+			DEBUG3("TIMEOUT: Stolen packet waited too long");
+			fr_worker_nak(worker, cd, now);
+			continue;
+		}
+
+		WORKER_HEAP_INSERT(to_decode, cd);
+		return;
+	}
+}
+
+
+/** Wake up one idle worker, so that it can steal requests from us
+ *
+ * @param[in] worker the worker
+ */
+static void fr_worker_steal_wakeup(fr_worker_t *worker)
+{
+	uint32_t		i, num;
+	fr_worker_steal_t	*steal = worker->steal;
+
+	/*
+	 *	Pairs with the fence in fr_worker_steal_idle().
+	 *	Either the idle worker sees our queue, or we see
+	 *	that it's idle.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	num = steal->max_workers;
+
+	for (i = 0; i < num; i++) {
+		fr_worker_steal_slot_t	*slot = &steal->slot[i];
+
+		if (slot == worker->slot) continue;
+		if (!atomic_load_explicit(&slot->active, memory_order_acquire)) continue;
+		if (!atomic_load_explicit(&slot->idle, memory_order_relaxed)) continue;
+
+		/*
+		 *	Someone else woke it up.
+		 */
+		if (!atomic_exchange_explicit(&slot->idle, false, memory_order_acq_rel)) continue;
+
+		(void) fr_event_user_trigger(slot->kq, slot->ident);
+		return;
+	}
+}
+
+
+/** Mark ourselves as idle, and check if there are requests to steal
+ *
+ * @param[in] worker the worker
+ * @return
+ *	- true if we can steal a request, and shouldn't sleep
+ *	- false if we can sleep
+ */
+static bool fr_worker_steal_idle(fr_worker_t *worker)
+{
+	uint32_t		i, num;
+	fr_worker_steal_t	*steal = worker->steal;
+
+	if (!worker->num_channels) return false;
+
+	atomic_store_explicit(&worker->slot->idle, true, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	num = steal->max_workers;
+
+	for (i = 0; i < num; i++) {
+		fr_worker_steal_slot_t	*slot = &steal->slot[i];
+
+		if (slot == worker->slot) continue;
+		if (!atomic_load_explicit(&slot->active, memory_order_acquire)) continue;
+
+		if (fr_atomic_queue_depth(slot->aq) > 0) {
+			atomic_store_explicit(&worker->slot->idle, false, memory_order_relaxed);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/** Stop other workers from stealing our requests
+ *
+ *  Requests which are still in our queue are moved to the
+ *  "to_decode" heap, and we process them ourselves.
+ *
+ * @param[in] worker the worker
+ */
+static void fr_worker_steal_leave(fr_worker_t *worker)
+{
+	fr_channel_data_t	*cd;
+	fr_worker_steal_slot_t	*slot = worker->slot;
+
+	if (!slot) return;
+
+	atomic_store_explicit(&slot->idle, false, memory_order_relaxed);
+	atomic_store_explicit(&slot->active, false, memory_order_seq_cst);
+
+	/*
+	 *	Wait for thieves which saw us as active.  They only
+	 *	hold on for as long as it takes to pop one request,
+	 *	but they may have been descheduled while doing that.
+	 *	So give up the CPU instead of spinning on it.
+	 */
+	while (atomic_load_explicit(&slot->thieves, memory_order_acquire) > 0) {
+		sched_yield();
+	}
+
+	fr_worker_steal_returned(worker);
+
+	while (fr_atomic_queue_pop(slot->aq, (void **) &cd)) {
+		WORKER_HEAP_INSERT(to_decode, cd);
+	}
+
+	worker->slot = NULL;
+	worker->steal = NULL;
+
+	atomic_store_explicit(&slot->claimed, false, memory_order_release);
+}
+
+
+/** Track how long a message waited before we started processing it
+ *
+ * @param[in] worker the worker
+ * @param[in] when the message was received
+ * @param[in] now the current time
+ */
+static void fr_worker_queue_time(fr_worker_t *worker, fr_time_t when, fr_time_t now)
+{
+	fr_time_elapsed_update(&worker->queue_time, when, now);
+
+	worker->queue_sample[worker->num_queue_samples % QUEUE_TIME_SAMPLES] = (now > when) ? now - when : 0;
+	worker->num_queue_samples++;
+
+	fr_latency_record(worker->latency_queue, (now > when) ? now - when : 0);
+}
+
+
 /** Get a runnable request
  *
  * @param[in] worker the worker
@@ -770,9 +1354,8 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	fr_channel_data_t	*cd;
 	REQUEST			*request;
 	fr_listen_t const	*listen;
-#ifndef HAVE_TALLOC_POOLED_OBJECT
-	TALLOC_CTX		*ctx;
-#endif
+	fr_request_pool_t	*rp;
+	fr_time_t		start;
 
 	/*
 	 *	Grab a runnable request, and resume it.
@@ -786,6 +1369,12 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 		return request;
 	}
 
+	/*
+	 *	Refill the "to_decode" queue from our steal queue, or
+	 *	by stealing from other workers.
+	 */
+	if (worker->slot) fr_worker_steal(worker, now);
+
 	/*
 	 *	Find either a localized message, or one which is in
 	 *	the "to_decode" queue.
@@ -804,7 +1393,19 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 		worker->num_decoded++;
 	} while (!cd);
 
-	ctx = request = request_alloc(NULL);
+	fr_worker_queue_time(worker, cd->m.when, now);
+
+	/*
+	 *	Allocate the request from the recycled pools for
+	 *	this virtual server.  If that fails, fall back to a
+	 *	normal allocation.
+	 */
+	rp = worker_request_pool(worker, cd->listen->server_cs);
+	if (rp) {
+		request = fr_request_pool_alloc(rp);
+	} else {
+		request = request_alloc(NULL);
+	}
 	if (!request) goto nak;
 
 	request->el = worker->el;
@@ -816,6 +1417,7 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	rad_assert(request->reply != NULL);
 
 	request->async = talloc_zero(request, fr_async_t);
+	request->async->request_pool = rp;
 	request->server_cs = cd->listen->server_cs;
 
 	/*
@@ -834,6 +1436,7 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	 *	processing this message.
 	 */
 	request->async->channel = cd->channel.ch;
+	request->async->stolen_from = cd->stolen_from;
 
 	request->async->original_recv_time = cd->request.recv_time;
 	request->async->recv_time = *request->async->original_recv_time;
@@ -850,14 +1453,16 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	 *
 	 *	Note that this also sets the "async process" function.
 	 */
+	start = fr_time();
 	if (listen->app->decode) {
 		ret = listen->app->decode(listen->app_instance, request, cd->m.data, cd->m.data_size);
 	} else if (listen->app_io->decode) {
 		ret = listen->app_io->decode(listen->app_io_instance, request, cd->m.data, cd->m.data_size);
 	}
+	fr_latency_record(worker->latency_decode, fr_time() - start);
 
 	if (ret < 0) {
-		talloc_free(ctx);
+		worker_request_free(request);
 nak:
 		fr_worker_nak(worker, cd, now);
 		return NULL;
@@ -879,7 +1484,7 @@ nak:
 	 *	We're done with this message.
 	 */
 	is_dup = cd->request.is_dup;
-	fr_message_done(&cd->m);
+	fr_worker_message_done(cd);
 
 	/*
 	 *	Look for conflicting / duplicate packets, but only if
@@ -896,7 +1501,8 @@ nak:
 			 */
 			if (is_dup) {
 				RDEBUG("Got duplicate packet notice after we had sent a reply - ignoring");
-				fr_channel_null_reply(request->async->channel);
+				fr_worker_dup_done(worker, request);
+				worker_request_free(request);
 				return NULL;
 			}
 			goto insert_new;
@@ -925,8 +1531,12 @@ nak:
 		if (old->async->recv_time == request->async->recv_time) {
 			RWARN("Discarding duplicate of request (%"PRIu64")", old->number);
 
-			fr_channel_null_reply(request->async->channel);
-			talloc_free(request);
+			if (is_dup) {
+				fr_worker_dup_done(worker, request);
+			} else {
+				fr_channel_null_reply(request->async->channel);
+			}
+			worker_request_free(request);
 
 			/*
 			 *	Signal there's a dup, and ignore the
@@ -1084,16 +1694,15 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 	sleeping = (fr_heap_num_elements(worker->runnable) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->localized.heap) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->to_decode.heap) == 0);
+	if (sleeping && worker->slot) sleeping = ((fr_atomic_queue_depth(worker->slot->aq) == 0) &&
+						  (fr_atomic_queue_depth(worker->slot->returned) == 0));
 
 	/*
 	 *	Tell the event loop that there is new work to do.  We
 	 *	don't want to wait for events, but instead check them,
 	 *	and start processing packets immediately.
 	 */
-	if (!sleeping) {
-		worker->was_sleeping = false;
-		return 1;
-	}
+	if (!sleeping) return 1;
 
 	/*
 	 *	The application is polling the event loop, but has
@@ -1114,30 +1723,26 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 	       worker->name, worker->stats.in, worker->num_decoded,
 	       worker->stats.out, worker->num_active);
 
-	/*
-	 *	We were sleeping, don't send another signal that we
-	 *	are still sleeping.
-	 */
-	if (worker->was_sleeping) {
-		DEBUG3("Worker %i was sleeping, not re-signaling", fr_schedule_worker_id());
-		return 0;
-	}
-
 	/*
 	 *	Nothing more to do, and the event loop has us sleeping
-	 *	for a period of time.  Signal the producers that we're
-	 *	sleeping.  The fr_channel_worker_sleeping() function
-	 *	will take care of skipping the signal if there are no
-	 *	outstanding requests for it.
+	 *	for a period of time.  Tell the producers that we're
+	 *	sleeping, so that they signal us when they send a new
+	 *	request.  If a request arrived in the meantime, we
+	 *	don't sleep, and instead go process it.
 	 */
 	for (i = 0; i < worker->max_channels; i++) {
 		if (!worker->channel[i]) continue;
 
-		(void) fr_channel_worker_sleeping(worker->channel[i]);
+		if (fr_channel_worker_sleeping(worker->channel[i]) > 0) sleeping = false;
 	}
-	worker->was_sleeping = true;
 
-	return 0;
+	/*
+	 *	Let busy workers wake us up when they have requests
+	 *	for us to steal.
+	 */
+	if (sleeping && worker->slot && fr_worker_steal_idle(worker)) sleeping = false;
+
+	return !sleeping;
 }
 
 /**
@@ -1192,6 +1797,13 @@ static int worker_dedup_cmp(void const *one, void const *two)
 	return (a->async->packet_ctx > b->async->packet_ctx) - (a->async->packet_ctx < b->async->packet_ctx);
 }
 
+static int worker_request_pool_cmp(void const *one, void const *two)
+{
+	fr_worker_request_pool_t const *a = one, *b = two;
+
+	return (a->server_cs > b->server_cs) - (a->server_cs < b->server_cs);
+}
+
 /** Destroy a worker.
  *
  *  The input channels are signaled, and local messages are cleaned up.
@@ -1207,20 +1819,27 @@ void fr_worker_destroy(fr_worker_t *worker)
 
 //	WORKER_VERIFY;
 
+	/*
+	 *	Stop other workers from stealing our requests.  The
+	 *	ones they didn't steal are cleaned up below.
+	 */
+	fr_worker_steal_leave(worker);
+
 	/*
 	 *	These messages aren't in the channel, so we have to
-	 *	mark them as unused.
+	 *	mark them as unused, and release any leases we hold
+	 *	on the network's buffers.
 	 */
 	while (true) {
 		WORKER_HEAP_POP(to_decode, cd);
 		if (!cd) break;
-		fr_message_done(&cd->m);
+		fr_worker_message_done(cd);
 	}
 
 	while (true) {
 		WORKER_HEAP_POP(localized, cd);
 		if (!cd) break;
-		fr_message_done(&cd->m);
+		fr_worker_message_done(cd);
 	}
 
 	/*
@@ -1231,7 +1850,7 @@ void fr_worker_destroy(fr_worker_t *worker)
 	while ((request = fr_heap_peek(worker->time_order)) != NULL) {
 		RDEBUG("server is exiting - telling request to stop.");
 		worker_stop_request(worker, request, now);
-		talloc_free(request);
+		worker_request_free(request);
 	}
 	rad_assert(fr_heap_num_elements(worker->runnable) == 0);
 
@@ -1283,9 +1902,11 @@ nomem:
 	}
 
 	worker->name = talloc_strdup(worker, name); /* thread locality */
+	worker->numa_node = -1;
 
 	worker->channel = talloc_zero_array(worker, fr_channel_t *, max_channels);
-	if (!worker->channel) {
+	worker->closed = talloc_zero_array(worker, fr_message_set_t *, max_channels);
+	if (!worker->channel || !worker->closed) {
 		talloc_free(worker);
 		goto nomem;
 	}
@@ -1304,6 +1925,10 @@ nomem:
 	worker->ring_buffer_size = (1 << 16);
 	worker->max_request_time = 30;
 
+	worker->latency_queue = fr_latency_register("channel.queue", NULL);
+	worker->latency_decode = fr_latency_register("worker.decode", NULL);
+	worker->latency_encode = fr_latency_register("worker.encode", NULL);
+
 	if (fr_event_pre_insert(worker->el, fr_worker_pre_event, worker) < 0) {
 		fr_strerror_printf("Failed adding pre-check to event list");
 		talloc_free(worker);
@@ -1369,6 +1994,16 @@ nomem:
 		goto fail;
 	}
 
+	/*
+	 *	The stats command walks this tree from another thread.
+	 */
+	worker->request_pools = rbtree_talloc_create(worker, worker_request_pool_cmp, fr_worker_request_pool_t,
+						     NULL, RBTREE_FLAG_LOCK);
+	if (!worker->request_pools) {
+		fr_strerror_printf("Failed creating request pool tree");
+		goto fail;
+	}
+
 	if (fr_event_post_insert(worker->el, fr_worker_post_event, worker) < 0) {
 		fr_strerror_printf("Failed inserting post-processing event");
 		talloc_free(worker->runnable);
@@ -1419,6 +2054,7 @@ void fr_worker_exit(fr_worker_t *worker)
 
 static void fr_worker_post_event(UNUSED fr_event_list_t *el, UNUSED struct timeval *when, void *uctx)
 {
+	int i;
 	fr_time_t now;
 	REQUEST *request;
 	fr_worker_t *worker = uctx;
@@ -1427,6 +2063,8 @@ static void fr_worker_post_event(UNUSED fr_event_list_t *el, UNUSED struct timev
 
 	now = fr_time();
 
+	if (worker->slot) atomic_store_explicit(&worker->slot->idle, false, memory_order_relaxed);
+
 	/*
 	 *      Ten times a second, check for timeouts on incoming packets.
 	 *
@@ -1438,6 +2076,17 @@ static void fr_worker_post_event(UNUSED fr_event_list_t *el, UNUSED struct timev
 	if ((now - worker->checked_timeout) > (NANOSEC / 10)) {
 		DEBUG3("\tWorker %s checking timeouts", worker->name);
 		fr_worker_check_timeouts(worker, now);
+		worker->checked_timeout = now;
+	}
+
+	/*
+	 *	The producers don't signal us while we're awake, so
+	 *	we have to go check the channels for new requests.
+	 */
+	for (i = 0; i < worker->max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
+		(void) fr_channel_recv_request_bulk(worker->channel[i]);
 	}
 
 	/*
@@ -1448,13 +2097,31 @@ static void fr_worker_post_event(UNUSED fr_event_list_t *el, UNUSED struct timev
 	 *	for too long.
 	 */
 	request = fr_worker_get_request(worker, now);
-	if (!request) return;
+	if (!request) goto done;
+
+	/*
+	 *	We're about to be busy, and there are more requests
+	 *	waiting.  Wake up an idle worker to steal them.
+	 */
+	if (worker->slot && (fr_atomic_queue_depth(worker->slot->aq) > 0)) fr_worker_steal_wakeup(worker);
 
 	/*
 	 *	Run the request, and either track it as
 	 *	yielded, or send a reply.
 	 */
 	fr_worker_run_request(worker, request);
+
+done:
+	if (worker->num_closing) fr_worker_close_channels(worker);
+
+	/*
+	 *	Publish our load for the scheduler, which runs in
+	 *	another thread.
+	 */
+	atomic_store_explicit(&worker->load_cpu_time, worker->tracking.running, memory_order_relaxed);
+	atomic_store_explicit(&worker->load_backlog,
+			      fr_heap_num_elements(worker->to_decode.heap) + fr_heap_num_elements(worker->localized.heap),
+			      memory_order_relaxed);
 }
 
 
@@ -1566,6 +2233,67 @@ fr_channel_t *fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 }
 
 
+/** Tell the worker which NUMA node it is running on
+ *
+ * @param[in] worker the worker
+ * @param[in] numa_node the NUMA node, or -1 for unknown
+ */
+void fr_worker_numa_node_set(fr_worker_t *worker, int numa_node)
+{
+	worker->numa_node = numa_node;
+}
+
+/** Allocate the worker's message sets from pre-faulted huge pages
+ *
+ *  The message sets are created at their full size when each channel
+ *  is opened, and never grow.  This MUST be called before any channels
+ *  are opened.
+ *
+ * @param[in] worker		the worker
+ * @param[in] num_messages	in each message set.  MUST be a power of 2.
+ * @param[in] ring_buffer_size	for the replies in each message set.
+ */
+void fr_worker_message_set_fixed(fr_worker_t *worker, int num_messages, size_t ring_buffer_size)
+{
+	rad_assert(worker->num_channels == 0);
+
+	worker->message_set_fixed = true;
+	worker->message_set_size = num_messages;
+	worker->ring_buffer_size = ring_buffer_size;
+}
+
+/** Get the NUMA node a worker is running on
+ *
+ * @param[in] worker the worker
+ * @return the NUMA node, or -1 for unknown
+ */
+int fr_worker_numa_node(fr_worker_t const *worker)
+{
+	return worker->numa_node;
+}
+
+/** Get the current load of a worker
+ *
+ *  Called by the scheduler to decide when to add or retire workers.
+ *  The worker publishes its load once per pass through its event
+ *  loop, so the values may be a little out of date.
+ *
+ * @param[in] worker		the worker
+ * @param[out] cpu_time		total time spent running requests.
+ * @param[out] backlog		number of requests waiting to be run.
+ */
+void fr_worker_load(fr_worker_t const *worker, fr_time_t *cpu_time, uint32_t *backlog)
+{
+	fr_worker_t *w;
+	fr_worker_steal_slot_t *slot = worker->slot;
+
+	memcpy(&w, &worker, sizeof(w)); /* const issues */
+
+	*cpu_time = atomic_load_explicit(&w->load_cpu_time, memory_order_relaxed);
+	*backlog = atomic_load_explicit(&w->load_backlog, memory_order_relaxed);
+	if (slot) *backlog += fr_atomic_queue_depth(slot->aq);
+}
+
 /** Set the name of a worker.
  *
  *  Called by the master (i.e. network) thread when it needs to create
@@ -1638,20 +2366,223 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	return 7;
 }
 
+/** Create a group of workers which steal requests from each other
+ *
+ *  Each worker in the group puts new requests into a queue, instead
+ *  of its "to_decode" heap.  Idle workers take requests from the
+ *  queues of busy workers.
+ *
+ * @param[in] ctx the talloc context.  It must outlive the workers in the group.
+ * @param[in] max_workers the maximum number of workers in the group
+ * @return
+ *	- NULL on error
+ *	- fr_worker_steal_t on success
+ */
+fr_worker_steal_t *fr_worker_steal_create(TALLOC_CTX *ctx, uint32_t max_workers)
+{
+	uint32_t i;
+	fr_worker_steal_t *steal;
+
+	if (!max_workers) {
+		fr_strerror_printf("A steal group needs at least one worker");
+		return NULL;
+	}
+
+	steal = (fr_worker_steal_t *) talloc_zero_size(ctx, sizeof(*steal) + (max_workers - 1) * sizeof(steal->slot[0]));
+	if (!steal) {
+	nomem:
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+	talloc_set_name_const(steal, "fr_worker_steal_t");
+
+	steal->max_workers = max_workers;
+
+	for (i = 0; i < max_workers; i++) {
+		atomic_init(&steal->slot[i].claimed, false);
+		atomic_init(&steal->slot[i].active, false);
+		atomic_init(&steal->slot[i].idle, false);
+		atomic_init(&steal->slot[i].thieves, 0);
+		atomic_init(&steal->slot[i].num_stolen, 0);
+
+		steal->slot[i].aq = fr_atomic_queue_create(steal, STEAL_QUEUE_SIZE);
+
+		/*
+		 *	Requests are only returned after being popped
+		 *	from "aq", and the worker empties "returned"
+		 *	before it pushes more into "aq".  So this
+		 *	size is enough for everything in "aq", plus
+		 *	one request from each thief.
+		 */
+		steal->slot[i].returned = fr_atomic_queue_create(steal, STEAL_QUEUE_SIZE + max_workers);
+		if (!steal->slot[i].aq || !steal->slot[i].returned) {
+			talloc_free(steal);
+			goto nomem;
+		}
+	}
+
+	return steal;
+}
+
+/** Add a worker to a steal group
+ *
+ *  This function MUST be called from the worker's thread, before the
+ *  worker has any channels.
+ *
+ * @param[in] worker the worker
+ * @param[in] steal the group to join
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_worker_steal_join(fr_worker_t *worker, fr_worker_steal_t *steal)
+{
+	uint32_t id;
+	fr_worker_steal_slot_t *slot;
+
+	if (worker->slot) {
+		fr_strerror_printf("Worker is already in a steal group");
+		return -1;
+	}
+
+	/*
+	 *	Slots are re-used when workers exit.
+	 */
+	for (id = 0; id < steal->max_workers; id++) {
+		bool claimed = false;
+
+		if (atomic_compare_exchange_strong_explicit(&steal->slot[id].claimed, &claimed, true,
+							    memory_order_acq_rel, memory_order_relaxed)) break;
+	}
+
+	if (id == steal->max_workers) {
+		fr_strerror_printf("Too many workers in steal group (max %u)", steal->max_workers);
+		return -1;
+	}
+
+	slot = &steal->slot[id];
+	atomic_store_explicit(&slot->num_stolen, 0, memory_order_relaxed);
+	slot->kq = worker->kq;
+	slot->ident = worker->aq_ident;
+
+	worker->steal = steal;
+	worker->slot = slot;
+
+	atomic_store_explicit(&slot->active, true, memory_order_release);
+
+	return 0;
+}
+
+static int worker_queue_sample_cmp(void const *one, void const *two)
+{
+	fr_time_t a = *(fr_time_t const *) one;
+	fr_time_t b = *(fr_time_t const *) two;
+
+	return (a > b) - (a < b);
+}
+
+static int worker_request_pool_print(void *ctx, void *data)
+{
+	FILE *fp = ctx;
+	fr_worker_request_pool_t *pool = data;
+	fr_request_pool_stats_t stats;
+	char const *name = cf_section_name2(pool->server_cs);
+
+	fr_request_pool_stats(pool->rp, &stats);
+
+	fprintf(fp, "pool.%s.size\t\t%zu\n", name, stats.pool_size);
+	fprintf(fp, "pool.%s.free\t\t%u\n", name, stats.num_free);
+	fprintf(fp, "pool.%s.allocated\t%" PRIu64 "\n", name, stats.num_allocated);
+	fprintf(fp, "pool.%s.reused\t\t%" PRIu64 "\n", name, stats.num_reused);
+	fprintf(fp, "pool.%s.resized\t\t%" PRIu64 "\n", name, stats.num_resized);
+
+	return 0;
+}
+
 static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	fr_worker_t const *worker = ctx;
 	fr_time_t when;
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "count") == 0)) {
+		int i;
+		fr_channel_stats_t to_worker, from_worker, in = { 0 }, out = { 0 };
+		fr_message_set_stats_t ms_stats, ms_total = { 0 };
+
+		for (i = 0; i < worker->max_channels; i++) {
+			fr_message_set_t *ms;
+
+			if (!worker->channel[i]) continue;
+
+			ms = fr_channel_worker_ctx_get(worker->channel[i]);
+			if (ms) {
+				fr_message_set_stats(ms, &ms_stats);
+				ms_total.num_gc += ms_stats.num_gc;
+				ms_total.num_grown += ms_stats.num_grown;
+				ms_total.num_alloc_failed += ms_stats.num_alloc_failed;
+			}
+
+			fr_channel_stats(worker->channel[i], &to_worker, &from_worker);
+			in.packets += to_worker.packets;
+			in.signals += to_worker.signals;
+			in.skips += to_worker.skips;
+			out.packets += from_worker.packets;
+			out.signals += from_worker.signals;
+			out.skips += from_worker.skips;
+		}
+
 		fprintf(fp, "count.in\t\t\t%" PRIu64 "\n", worker->stats.in);
 		fprintf(fp, "count.out\t\t\t%" PRIu64 "\n", worker->stats.out);
 		fprintf(fp, "count.dup\t\t\t%" PRIu64 "\n", worker->stats.dup);
 		fprintf(fp, "count.dropped\t\t\t%" PRIu64 "\n", worker->stats.dropped);
 		fprintf(fp, "count.decoded\t\t\t%" PRIu64 "\n", worker->num_decoded);
+		fprintf(fp, "count.leased\t\t\t%" PRIu64 "\n", worker->num_leased);
+		fprintf(fp, "count.localized\t\t\t%" PRIu64 "\n", worker->num_localized);
 		fprintf(fp, "count.timeouts\t\t\t%" PRIu64 "\n", worker->num_timeouts);
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
+		fprintf(fp, "count.channel.in\t\t%" PRIu64 "\n", in.packets);
+		fprintf(fp, "count.channel.in.signals\t%" PRIu64 "\n", in.signals);
+		fprintf(fp, "count.channel.in.skipped\t%" PRIu64 "\n", in.skips);
+		fprintf(fp, "count.channel.out\t\t%" PRIu64 "\n", out.packets);
+		fprintf(fp, "count.channel.out.signals\t%" PRIu64 "\n", out.signals);
+		fprintf(fp, "count.channel.out.skipped\t%" PRIu64 "\n", out.skips);
+		fprintf(fp, "count.message.gc\t\t%" PRIu64 "\n", ms_total.num_gc);
+		fprintf(fp, "count.message.grown\t\t%" PRIu64 "\n", ms_total.num_grown);
+		fprintf(fp, "count.message.failed\t\t%" PRIu64 "\n", ms_total.num_alloc_failed);
+
+		if (worker->slot) {
+			fprintf(fp, "count.stolen\t\t\t%" PRIu64 "\n", worker->num_stolen);
+			fprintf(fp, "count.stolen_by_others\t\t%" PRIu64 "\n",
+				(uint64_t) atomic_load_explicit(&worker->slot->num_stolen, memory_order_relaxed));
+		}
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "queue") == 0)) {
+		uint64_t num;
+		fr_time_t *sample;
+
+		/*
+		 *	Time between the network thread reading a
+		 *	packet, and a worker starting to decode it.
+		 *	The samples may be overwritten while we copy
+		 *	them, which only skews the percentiles.
+		 */
+		num = worker->num_queue_samples;
+		if (num > QUEUE_TIME_SAMPLES) num = QUEUE_TIME_SAMPLES;
+
+		if (num > 0) {
+			sample = talloc_memdup(NULL, worker->queue_sample, num * sizeof(sample[0]));
+			if (sample) {
+				qsort(sample, num, sizeof(sample[0]), worker_queue_sample_cmp);
+
+				fprintf(fp, "queue.p50_usec\t\t\t%" PRIu64 "\n", sample[(num * 50) / 100] / 1000);
+				fprintf(fp, "queue.p99_usec\t\t\t%" PRIu64 "\n", sample[(num * 99) / 100] / 1000);
+				talloc_free(sample);
+			}
+		}
+
+		fr_time_elapsed_fprint(fp, &worker->queue_time, "queue.requests", 1);
 	}
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
@@ -1671,6 +2602,17 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fr_time_elapsed_fprint(fp, &worker->wall_clock, "time.requests", 1);
 	}
 
+	if ((info->argc == 0) || (strcmp(info->argv[0], "pool") == 0)) {
+		rbtree_t *request_pools;
+
+		/*
+		 *	The tree is locked, so the worker can't add a
+		 *	new virtual server while we walk it.
+		 */
+		memcpy(&request_pools, &worker->request_pools, sizeof(request_pools)); /* const issues */
+		(void) rbtree_walk(request_pools, RBTREE_IN_ORDER, worker_request_pool_print, fp);
+	}
+
 	return 0;
 }
 
@@ -1686,7 +2628,7 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.parent = "stats worker",
 		.add_name = true,
 		.name = "self",
-		.syntax = "[(count|cpu)]",
+		.syntax = "[(count|cpu|queue|pool)]",
 		.func = cmd_stats_worker,
 		.help = "Show statistics for a specific worker thread.",
 		.read_only = true
@@ -37,6 +37,11 @@ extern "C" {
  */
 typedef struct fr_worker_t fr_worker_t;
 
+/**
+ *  A group of workers which can steal requests from each other.
+ */
+typedef struct fr_worker_steal_t fr_worker_steal_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -75,6 +80,18 @@ void		fr_worker_name(fr_worker_t *worker, char const *name) CC_HINT(nonnull);
 fr_channel_t	*fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_control_t *master) CC_HINT(nonnull);
 
 int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HINT(nonnull);
+
+void		fr_worker_numa_node_set(fr_worker_t *worker, int numa_node) CC_HINT(nonnull);
+
+int		fr_worker_numa_node(fr_worker_t const *worker) CC_HINT(nonnull);
+
+void		fr_worker_message_set_fixed(fr_worker_t *worker, int num_messages, size_t ring_buffer_size) CC_HINT(nonnull);
+
+void		fr_worker_load(fr_worker_t const *worker, fr_time_t *cpu_time, uint32_t *backlog) CC_HINT(nonnull);
+
+fr_worker_steal_t *fr_worker_steal_create(TALLOC_CTX *ctx, uint32_t max_workers);
+
+int		fr_worker_steal_join(fr_worker_t *worker, fr_worker_steal_t *steal) CC_HINT(nonnull);
 #ifdef __cplusplus
 }
 #endif
@@ -39,7 +39,7 @@ RCSID("$Id$")
 #include <fcntl.h>
 #include <sys/stat.h>
 
-//#define WITH_TRIE (1)
+#define WITH_TRIE (1)
 
 /** Group of clients
  *
@@ -51,6 +51,8 @@ struct rad_client_list {
 	fr_trie_t	*v6_udp;
 	fr_trie_t	*v4_tcp;
 	fr_trie_t	*v6_tcp;
+	fr_trie_t	*v4_any;		//!< clients with "proto = *"
+	fr_trie_t	*v6_any;
 #else
 	rbtree_t	*tree[129];
 #endif
@@ -134,6 +136,18 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 		talloc_free(clients);
 		return NULL;
 	}
+
+	clients->v4_any = fr_trie_alloc(clients);
+	if (!clients->v4_any) {
+		talloc_free(clients);
+		return NULL;
+	}
+
+	clients->v6_any = fr_trie_alloc(clients);
+	if (!clients->v6_any) {
+		talloc_free(clients);
+		return NULL;
+	}
 #endif	/* WITH_TRIE */
 
 	return clients;
@@ -141,21 +155,18 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 
 #ifdef WITH_TRIE
 /*
- *	@todo - either support client definitions where "proto = *",
- *	or udpate this code to allow for that.  i.e. we create yet
- *	another set of v4/v6 tries, for "proto = *" clients.  And then
- *	do lookups there, too.  Or, just unify the udp/tcp tries, and
- *	instead do post-processing?  Though those two clients can have
- *	different secrets... and the trie code doesn't allow 2
- *	fr_trie_user_t nodes in a row.  So we would have to instead
- *	handle that ourselves, with a wrapper around the RADCLIENT
- *	structure that does udp/tcp/wildcard demultiplexing
+ *	Clients with "proto = *" go into their own set of tries.
+ *	Lookups check both the trie for the protocol, and the
+ *	wildcard trie, and use the client with the longest prefix.
+ *	That gives the same answers as the old per-prefix trees, but
+ *	with two trie lookups instead of up to 129 tree lookups.
  */
 static fr_trie_t *clients_trie(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 			       int proto)
 {
 	if (ipaddr->af == AF_INET) {
 		if (proto == IPPROTO_TCP) return clients->v4_tcp;
+		if (proto == IPPROTO_IP) return clients->v4_any;
 
 		return clients->v4_udp;
 	}
@@ -163,9 +174,26 @@ static fr_trie_t *clients_trie(RADCLIENT_LIST const *clients, fr_ipaddr_t const
 	rad_assert(ipaddr->af == AF_INET6);
 
 	if (proto == IPPROTO_TCP) return clients->v6_tcp;
+	if (proto == IPPROTO_IP) return clients->v6_any;
 
 	return clients->v6_udp;
 }
+
+/** Look up a client in one trie, and return it if it has a longer prefix than "best"
+ *
+ */
+static RADCLIENT *clients_trie_lookup(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
+				      int proto, RADCLIENT *best)
+{
+	RADCLIENT *client;
+
+	client = fr_trie_lookup(clients_trie(clients, ipaddr, proto), &ipaddr->addr, ipaddr->prefix);
+	if (!client) return best;
+
+	if (best && (best->ipaddr.prefix >= client->ipaddr.prefix)) return best;
+
+	return client;
+}
 #endif	/* WITH_TRIE */
 
 /** Add a client to a RADCLIENT_LIST
@@ -271,9 +299,21 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	trie = clients_trie(clients, &client->ipaddr, client->proto);
 
 	/*
-	 *	Cannot insert the same client twice.
+	 *	Cannot insert the same client twice.  A wildcard
+	 *	client is the same as a UDP or TCP client with the
+	 *	same network.
 	 */
 	old = fr_trie_match(trie, &client->ipaddr.addr, client->ipaddr.prefix);
+	if (!old && (client->proto == IPPROTO_IP)) {
+		old = fr_trie_match(clients_trie(clients, &client->ipaddr, IPPROTO_UDP),
+				    &client->ipaddr.addr, client->ipaddr.prefix);
+		if (!old) old = fr_trie_match(clients_trie(clients, &client->ipaddr, IPPROTO_TCP),
+					      &client->ipaddr.addr, client->ipaddr.prefix);
+
+	} else if (!old) {
+		old = fr_trie_match(clients_trie(clients, &client->ipaddr, IPPROTO_IP),
+				    &client->ipaddr.addr, client->ipaddr.prefix);
+	}
 
 #else  /* WITH_TRIE */
 
@@ -367,7 +407,7 @@ RADCLIENT *client_findbynumber(UNUSED const RADCLIENT_LIST *clients, UNUSED int
 RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, int proto)
 {
 #ifdef WITH_TRIE
-	fr_trie_t *trie;
+	RADCLIENT *client;
 #else
 	int i, max;
 	RADCLIENT my_client, *client;
@@ -378,9 +418,18 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 	if (!clients || !ipaddr) return NULL;
 
 #ifdef WITH_TRIE
-	trie = clients_trie(clients, ipaddr, proto);
+	client = clients_trie_lookup(clients, ipaddr, IPPROTO_IP, NULL);
 
-	return fr_trie_lookup(trie, &ipaddr->addr, ipaddr->prefix);
+	/*
+	 *	A lookup for any protocol can match UDP or TCP
+	 *	clients, too.
+	 */
+	if (proto == IPPROTO_IP) {
+		client = clients_trie_lookup(clients, ipaddr, IPPROTO_UDP, client);
+		return clients_trie_lookup(clients, ipaddr, IPPROTO_TCP, client);
+	}
+
+	return clients_trie_lookup(clients, ipaddr, proto, client);
 #else
 
 	if (proto == AF_INET) {
@@ -417,6 +466,8 @@ static CONF_PARSER limit_config[] = {
 	{ FR_CONF_OFFSET("lifetime", FR_TYPE_UINT32, RADCLIENT, limit.lifetime), .dflt = "0" },
 
 	{ FR_CONF_OFFSET("idle_timeout", FR_TYPE_UINT32, RADCLIENT, limit.idle_timeout), .dflt = "30" },
+
+	{ FR_CONF_OFFSET("max_packets_per_second", FR_TYPE_UINT32, RADCLIENT, limit.max_packets_per_second), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -71,6 +71,12 @@ typedef int (*client_value_cb_t)(char **out, CONF_PAIR const *cp, void *data);
 #include <freeradius-devel/server/stats.h>
 #include <freeradius-devel/util/inet.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /** Describes a host allowed to send packets to the server
  *
  */
@@ -117,6 +123,9 @@ struct rad_client {
 
 	int			proto;			//!< Protocol number.
 	fr_socket_limit_t	limit;			//!< Connections per client (TCP clients only).
+
+	atomic_uint_fast64_t	num_shed_rate;		//!< Packets dropped by limit.max_packets_per_second.
+	atomic_uint_fast64_t	num_shed_load;		//!< Packets dropped because the server was overloaded.
 };
 
 RADCLIENT_LIST	*client_list_init(CONF_SECTION *cs);
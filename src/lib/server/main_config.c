@@ -72,6 +72,7 @@ static int hostname_lookups_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF
 
 static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int num_workers_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int message_set_size_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 
 static int talloc_memory_limit_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int talloc_pool_size_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
@@ -133,6 +134,15 @@ static const CONF_PARSER thread_config[] = {
 	  .func = num_networks_parse },
 	{ FR_CONF_OFFSET("num_workers", FR_TYPE_UINT32, main_config_t, num_workers), .dflt = STRINGIFY(4),
 	  .func = num_workers_parse },
+	{ FR_CONF_OFFSET("min_workers", FR_TYPE_UINT32, main_config_t, min_workers), .dflt = STRINGIFY(0) },
+	{ FR_CONF_OFFSET("work_stealing", FR_TYPE_BOOL, main_config_t, work_stealing), .dflt = "no" },
+	{ FR_CONF_OFFSET("timer_wheel", FR_TYPE_BOOL, main_config_t, timer_wheel), .dflt = "no" },
+	{ FR_CONF_OFFSET("network_cpus", FR_TYPE_STRING, main_config_t, network_cpus) },
+	{ FR_CONF_OFFSET("worker_cpus", FR_TYPE_STRING, main_config_t, worker_cpus) },
+	{ FR_CONF_OFFSET("message_hugepages", FR_TYPE_BOOL, main_config_t, message_hugepages), .dflt = "no" },
+	{ FR_CONF_OFFSET("message_set_size", FR_TYPE_UINT32, main_config_t, message_set_size), .dflt = STRINGIFY(16384),
+	  .func = message_set_size_parse },
+	{ FR_CONF_OFFSET("message_ring_buffer_size", FR_TYPE_SIZE, main_config_t, message_ring_buffer_size), .dflt = "16777216" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -344,7 +354,8 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >, 0);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <, 64);
 
 	memcpy(out, &value, sizeof(value));
 
@@ -369,6 +380,35 @@ static int num_workers_parse(TALLOC_CTX *ctx, void *out, void *parent,
 	return 0;
 }
 
+static int message_set_size_parse(TALLOC_CTX *ctx, void *out, void *parent,
+				  CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	uint32_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_INTEGER_BOUND_CHECK("thread.message_set_size", value, >=, 1024);
+	FR_INTEGER_BOUND_CHECK("thread.message_set_size", value, <=, (1 << 22));
+
+	/*
+	 *	The message arrays have to be a power of 2.
+	 */
+	value--;
+	value |= value >> 1;
+	value |= value >> 2;
+	value |= value >> 4;
+	value |= value >> 8;
+	value |= value >> 16;
+	value++;
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
 /** Configured server name takes precedence over default values
  *
  */
@@ -63,6 +63,14 @@ struct main_config_s {
 
 	uint32_t	num_networks;			//!< number of network threads
 	uint32_t	num_workers;			//!< number of network threads
+	uint32_t	min_workers;			//!< minimum number of worker threads, 0 for a fixed pool
+	bool		work_stealing;			//!< idle workers steal requests from busy ones
+	bool		timer_wheel;			//!< use a timer wheel for the thread event lists
+	char const	*network_cpus;			//!< CPUs to pin the network threads to
+	char const	*worker_cpus;			//!< CPUs to pin the worker threads to
+	bool		message_hugepages;		//!< allocate message sets from pre-faulted huge pages
+	uint32_t	message_set_size;		//!< number of messages in each message set
+	size_t		message_ring_buffer_size;	//!< size of the packet ring buffer in each message set
 
 	bool		drop_requests;			//!< Administratively disable request processing.
 
@@ -34,6 +34,7 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/server/radmin.h>
 #include <freeradius-devel/server/cf_file.h>
+#include <freeradius-devel/util/latency.h>
 
 static TALLOC_CTX *instance_ctx = NULL;
 static size_t instance_num = 0;
@@ -45,6 +46,20 @@ static size_t instance_num = 0;
  */
 static _Thread_local module_thread_instance_t **module_thread_inst_array;
 
+/*
+ *	So that the statistics in the thread instances can be read
+ *	by other threads.
+ */
+typedef struct {
+	fr_dlist_t			entry;		//!< in the list of threads
+	module_thread_instance_t	**array;	//!< of thread instances for this thread
+} module_thread_stats_t;
+
+static pthread_mutex_t		module_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t		module_stats_threads;
+static bool			module_stats_init = false;
+static module_method_stats_t	*module_stats_retired;	//!< [instance_num + 1][MOD_COUNT] for exited threads
+
 static int module_instantiate(CONF_SECTION *root, char const *name);
 static fr_cmd_table_t cmd_module_table[];
 
@@ -502,6 +517,50 @@ module_thread_instance_t *module_thread_instance_find(module_instance_t *mi)
 }
 
 
+static void module_stats_add(module_method_stats_t dst[MOD_COUNT], module_method_stats_t const src[MOD_COUNT])
+{
+	int i;
+
+	for (i = 0; i < MOD_COUNT; i++) {
+		dst[i].calls += src[i].calls;
+		dst[i].yields += src[i].yields;
+		dst[i].wall_time += src[i].wall_time;
+		dst[i].cpu_time += src[i].cpu_time;
+	}
+}
+
+/** Get the statistics for a module instance, summed over all threads
+ *
+ * The workers update their counters without locking, so the totals
+ * for running threads are approximate.
+ *
+ * @param[out] stats	where the statistics are written, indexed by #rlm_components_t.
+ * @param[in] mi	to get the statistics for.
+ */
+void module_stats(module_method_stats_t stats[MOD_COUNT], module_instance_t const *mi)
+{
+	module_thread_stats_t *ts;
+
+	memset(stats, 0, sizeof(stats[0]) * MOD_COUNT);
+
+	pthread_mutex_lock(&module_stats_mutex);
+	if (module_stats_retired && (((mi->number + 1) * MOD_COUNT) <= talloc_array_length(module_stats_retired))) {
+		module_stats_add(stats, &module_stats_retired[mi->number * MOD_COUNT]);
+	}
+
+	if (module_stats_init) {
+		for (ts = fr_dlist_head(&module_stats_threads);
+		     ts != NULL;
+		     ts = fr_dlist_next(&module_stats_threads, ts)) {
+			if (mi->number >= talloc_array_length(ts->array)) continue;
+			if (!ts->array[mi->number]) continue;
+
+			module_stats_add(stats, ts->array[mi->number]->stats);
+		}
+	}
+	pthread_mutex_unlock(&module_stats_mutex);
+}
+
 /** Retrieve module/thread specific instance data for a module
  *
  * @param[in] mod_inst	Module specific instance to find thread_data for.
@@ -537,9 +596,47 @@ void *module_thread_instance_by_data(void *mod_inst)
  */
 static int _module_thread_inst_array_free(module_thread_instance_t **array)
 {
-	size_t i, len;
+	size_t i, len, retired_len;
+	module_thread_stats_t *ts;
 
 	len = talloc_array_length(array);
+
+	/*
+	 *	Keep the statistics for this thread.
+	 */
+	pthread_mutex_lock(&module_stats_mutex);
+	for (ts = fr_dlist_head(&module_stats_threads);
+	     ts != NULL;
+	     ts = fr_dlist_next(&module_stats_threads, ts)) {
+		if (ts->array != array) continue;
+
+		fr_dlist_remove(&module_stats_threads, ts);
+		break;
+	}
+
+	/*
+	 *	Each thread sizes its array by the number of module
+	 *	instances when it started, so grow the totals to fit.
+	 */
+	retired_len = module_stats_retired ? talloc_array_length(module_stats_retired) : 0;
+	if (retired_len < (len * MOD_COUNT)) {
+		module_method_stats_t *retired;
+
+		retired = talloc_realloc(NULL, module_stats_retired, module_method_stats_t, len * MOD_COUNT);
+		if (retired) {
+			memset(&retired[retired_len], 0, sizeof(retired[0]) * ((len * MOD_COUNT) - retired_len));
+			module_stats_retired = retired;
+		}
+	}
+
+	if (module_stats_retired && (len * MOD_COUNT <= talloc_array_length(module_stats_retired))) {
+		for (i = 1; i < len; i++) {
+			if (!array[i]) continue;
+
+			module_stats_add(&module_stats_retired[i * MOD_COUNT], array[i]->stats);
+		}
+	}
+	pthread_mutex_unlock(&module_stats_mutex);
 	for (i = 1; i < len; i++) {
 		module_thread_instance_t *ti;
 
@@ -633,8 +730,21 @@ int modules_thread_instantiate(TALLOC_CTX *ctx, CONF_SECTION *root, fr_event_lis
 	if (!modules) return 0;
 
 	if (!module_thread_inst_array) {
+		module_thread_stats_t *ts;
+
 		MEM(module_thread_inst_array = talloc_zero_array(ctx, module_thread_instance_t *, instance_num + 1));
 		talloc_set_destructor(module_thread_inst_array, _module_thread_inst_array_free);
+
+		MEM(ts = talloc_zero(module_thread_inst_array, module_thread_stats_t));
+		ts->array = module_thread_inst_array;
+
+		pthread_mutex_lock(&module_stats_mutex);
+		if (!module_stats_init) {
+			fr_dlist_init(&module_stats_threads, module_thread_stats_t, entry);
+			module_stats_init = true;
+		}
+		fr_dlist_insert_tail(&module_stats_threads, ts);
+		pthread_mutex_unlock(&module_stats_mutex);
 	}
 
 	uctx.el = el;
@@ -669,6 +779,8 @@ static int _module_instantiate(void *instance, UNUSED void *ctx)
 		return -1;
 	}
 
+	mi->latency = fr_latency_register("module", mi->name);
+
 	/*
 	 *	Now that ALL modules are instantiated, and ALL xlats
 	 *	are defined, go compile the config items marked as XLAT.
@@ -832,6 +944,43 @@ static int cmd_show_module_status(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUS
 	return 0;
 }
 
+static int cmd_show_module_stats(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	module_instance_t		*mi = ctx;
+	module_method_stats_t		stats[MOD_COUNT];
+	fr_latency_t			lat;
+	int				i;
+
+	module_stats(stats, mi);
+
+	for (i = 0; i < MOD_COUNT; i++) {
+		char const *name = section_type_value[i].section;
+
+		if (!stats[i].calls) continue;
+
+		fprintf(fp, "%s.calls\t%" PRIu64 "\n", name, stats[i].calls);
+		fprintf(fp, "%s.yields\t%" PRIu64 "\n", name, stats[i].yields);
+		fprintf(fp, "%s.wall_usec\t%" PRIu64 "\n", name, stats[i].wall_time / 1000);
+		fprintf(fp, "%s.cpu_usec\t%" PRIu64 "\n", name, stats[i].cpu_time / 1000);
+		fprintf(fp, "%s.avg_wall_usec\t%" PRIu64 "\n", name, stats[i].wall_time / stats[i].calls / 1000);
+		fprintf(fp, "%s.avg_cpu_usec\t%" PRIu64 "\n", name, stats[i].cpu_time / stats[i].calls / 1000);
+	}
+
+	/*
+	 *	The histogram is kept for the module instance as a
+	 *	whole, not per method.
+	 */
+	if (fr_latency_get(&lat, "module", mi->name) < 0) return 0;
+
+	fprintf(fp, "p50_usec\t%" PRIu64 "\n", fr_latency_percentile(&lat, 500) / 1000);
+	fprintf(fp, "p90_usec\t%" PRIu64 "\n", fr_latency_percentile(&lat, 900) / 1000);
+	fprintf(fp, "p99_usec\t%" PRIu64 "\n", fr_latency_percentile(&lat, 990) / 1000);
+	fprintf(fp, "p999_usec\t%" PRIu64 "\n", fr_latency_percentile(&lat, 999) / 1000);
+	fprintf(fp, "max_usec\t%" PRIu64 "\n", lat.max / 1000);
+
+	return 0;
+}
+
 static int cmd_set_module_status(UNUSED FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	module_instance_t *mi = ctx;
@@ -862,6 +1011,15 @@ static fr_cmd_table_t cmd_module_table[] = {
 		.read_only = true,
 	},
 
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "stats",
+		.func = cmd_show_module_stats,
+		.help = "Show call counts, CPU time and latency for a particular module.",
+		.read_only = true,
+	},
+
 	{
 		.parent = "show module",
 		.add_name = true,
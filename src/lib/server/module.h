@@ -49,6 +49,8 @@ typedef struct module_thread_instance_s  module_thread_instance_t;
 
 #include <freeradius-devel/unlang/base.h>
 
+#include <freeradius-devel/util/latency.h>
+
 #include <freeradius-devel/features.h>
 
 #ifdef __cplusplus
@@ -242,8 +244,21 @@ struct module_instance_s {
 
 	rlm_rcode_t			code;		//!< Code module will return when 'force' has
 							//!< has been set to true.
+
+	fr_latency_key_t const		*latency;	//!< For recording the latency of calls to the module.
 };
 
+/** Statistics for one method of a module instance
+ *
+ */
+typedef struct {
+	uint64_t			calls;		//!< Number of times the method was called.
+	uint64_t			yields;		//!< Number of times the method yielded.
+	uint64_t			wall_time;	//!< From calling the method to its final result,
+							///< in nanoseconds.
+	uint64_t			cpu_time;	//!< Thread CPU time used by the method, in nanoseconds.
+} module_method_stats_t;
+
 /** Per thread per instance data
  *
  * Stores module and thread specific data.
@@ -262,6 +277,8 @@ struct module_thread_instance_s {
 
 	uint64_t			total_calls;	//! total number of times we've been called
 	uint64_t			active_callers; //! number of active callers.  i.e. number of current yields
+
+	module_method_stats_t		stats[MOD_COUNT]; //!< Per method statistics for this thread.
 };
 
 /*
@@ -285,6 +302,7 @@ exfile_t *module_exfile_init(TALLOC_CTX *ctx,
  *	Create free and destroy module instances
  */
 module_thread_instance_t *module_thread_instance_find(module_instance_t *mi);
+void		module_stats(module_method_stats_t stats[MOD_COUNT], module_instance_t const *mi);
 void		*module_thread_instance_by_data(void *mod_data);
 int		modules_thread_instantiate(TALLOC_CTX *ctx, CONF_SECTION *root, fr_event_list_t *el) CC_HINT(nonnull);
 int		modules_instantiate(CONF_SECTION *root) CC_HINT(nonnull);
@@ -36,6 +36,7 @@ typedef struct {
 	uint32_t	num_requests;
 	uint32_t	lifetime;
 	uint32_t	idle_timeout;
+	uint32_t	max_packets_per_second;
 } fr_socket_limit_t;
 
 #ifdef __cplusplus
@@ -3019,6 +3019,7 @@ static unlang_t *compile_module(unlang_t *parent, unlang_compile_t *unlang_ctx,
 	single = talloc_zero(parent, unlang_module_t);
 	single->module_instance = inst;
 	single->method = inst->module->methods[unlang_ctx->component];
+	single->component = unlang_ctx->component;
 
 	c = unlang_module_to_generic(single);
 	c->parent = parent;
@@ -3406,6 +3407,8 @@ int unlang_compile(CONF_SECTION *cs, rlm_components_t component, vp_tmpl_rules_t
 		c->debug_name = talloc_typed_asprintf(c, "%s %s", name1, name2);
 	}
 
+	unlang_generic_to_group(c)->latency = fr_latency_register("unlang.section", c->debug_name);
+
 	if (DEBUG_ENABLED4) unlang_dump(c, 2);
 
 	/*
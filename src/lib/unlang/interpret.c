@@ -200,6 +200,7 @@ void unlang_push(unlang_stack_t *stack, unlang_t *program, rlm_rcode_t result, b
 	frame->unwind = UNLANG_TYPE_NULL;
 	frame->repeat = false;
 	frame->state = NULL;
+	frame->section = NULL;
 }
 
 /** Pop a stack frame, removing any associated dynamically allocated state
@@ -214,6 +215,7 @@ static inline void unlang_pop(unlang_stack_t *stack)
 
 	frame = &stack->frame[stack->depth];
 	if (frame->state) talloc_free(frame->state);
+	if (frame->section) fr_latency_record(frame->section, fr_latency_now() - frame->section_start);
 
 	frame = &stack->frame[--stack->depth];
 	next = frame + 1;
@@ -707,6 +709,14 @@ void unlang_push_section(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t action,
 	if (top_frame) unlang_push(stack, NULL, action, UNLANG_NEXT_STOP, UNLANG_TOP_FRAME);
 	if (instruction) unlang_push(stack, instruction, RLM_MODULE_UNKNOWN, UNLANG_NEXT_CONTINUE, UNLANG_SUB_FRAME);
 
+	/*
+	 *	Time the section, from now until its frame is popped.
+	 */
+	if (cs) {
+		stack->frame[stack->depth].section = unlang_generic_to_group(instruction)->latency;
+		stack->frame[stack->depth].section_start = fr_latency_now();
+	}
+
 	RDEBUG4("** [%i] %s - substack begins", stack->depth, __FUNCTION__);
 
 	DUMP_STACK;
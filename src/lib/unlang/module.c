@@ -49,6 +49,22 @@ static inline void safe_unlock(module_instance_t *instance)
 	if (instance->mutex) pthread_mutex_unlock(instance->mutex);
 }
 
+/*
+ *	Thread CPU time, in nanoseconds
+ */
+static inline uint64_t module_cpu_time(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) return 0;
+
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
 static unlang_action_t unlang_module(REQUEST *request,
 					  rlm_rcode_t *presult, int *priority)
 {
@@ -57,8 +73,10 @@ static unlang_action_t unlang_module(REQUEST *request,
 	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
 	unlang_t			*instruction = frame->instruction;
 	unlang_frame_state_module_t	*ms;
+	module_method_stats_t		*stats;
 	int				stack_depth = stack->depth;
 	char const 			*caller;
+	uint64_t			now;
 
 #ifndef NDEBUG
 	int unlang_indent		= request->log.unlang_indent;
@@ -94,6 +112,11 @@ static unlang_action_t unlang_module(REQUEST *request,
 	 *	For logging unresponsive children.
 	 */
 	ms->thread->total_calls++;
+	stats = &ms->thread->stats[sp->component];
+	stats->calls++;
+
+	ms->start = fr_latency_now();
+	ms->cpu_start = module_cpu_time();
 
 	caller = request->module;
 	request->module = sp->module_instance->name;
@@ -102,6 +125,8 @@ static unlang_action_t unlang_module(REQUEST *request,
 	safe_unlock(sp->module_instance);
 	request->module = caller;
 
+	stats->cpu_time += module_cpu_time() - ms->cpu_start;
+
 	/*
 	 *	Is now marked as "stop" when it wasn't before, we must have been blocked.
 	 */
@@ -112,6 +137,7 @@ static unlang_action_t unlang_module(REQUEST *request,
 
 	if (*presult == RLM_MODULE_YIELD) {
 		ms->thread->active_callers++;
+		stats->yields++;
 		goto done;
 	}
 
@@ -126,6 +152,10 @@ static unlang_action_t unlang_module(REQUEST *request,
 
 	request->rcode = *presult;
 
+	now = fr_latency_now();
+	stats->wall_time += now - ms->start;
+	fr_latency_record(sp->module_instance->latency, now - ms->start);
+
 done:
 	RDEBUG2("%s (%s)", instruction->name ? instruction->name : "",
 		fr_int2str(mod_rcode_table, *presult, "<invalid>"));
@@ -189,12 +219,15 @@ static unlang_action_t unlang_module_resume(REQUEST *request, rlm_rcode_t *presu
 	unlang_module_t		*mc = unlang_generic_to_module(mr->parent);
 	int				stack_depth = stack->depth;
 	char const			*caller;
+	module_method_stats_t		*stats;
 
 	unlang_frame_state_module_t	*ms = NULL;
 
 	rad_assert(mr->parent->type == UNLANG_TYPE_MODULE);
 
 	ms = talloc_get_type_abort(frame->state, unlang_frame_state_module_t);
+	stats = &ms->thread->stats[mc->component];
+	ms->cpu_start = module_cpu_time();
 
 	/*
 	 *	Lock is noop unless instance->mutex is set.
@@ -208,7 +241,21 @@ static unlang_action_t unlang_module_resume(REQUEST *request, rlm_rcode_t *presu
 	safe_unlock(mc->module_instance);
 	request->module = caller;
 
-	if (*presult != RLM_MODULE_YIELD) ms->thread->active_callers--;
+	stats->cpu_time += module_cpu_time() - ms->cpu_start;
+
+	if (*presult != RLM_MODULE_YIELD) {
+		uint64_t now = fr_latency_now();
+
+		ms->thread->active_callers--;
+
+		/*
+		 *	Includes the time spent waiting for I/O.
+		 */
+		stats->wall_time += now - ms->start;
+		fr_latency_record(mc->module_instance->latency, now - ms->start);
+	} else {
+		stats->yields++;
+	}
 
 	RDEBUG2("%s (%s)", instruction->name ? instruction->name : "",
 		fr_int2str(mod_rcode_table, *presult, "<invalid>"));
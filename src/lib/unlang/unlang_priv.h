@@ -29,6 +29,7 @@
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/rad_assert.h>
 #include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/latency.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -141,6 +142,8 @@ typedef struct {
 	CONF_SECTION		*cs;
 	int			num_children;
 
+	fr_latency_key_t const	*latency;	//!< For the time spent in a top level section.
+
 	/*
 	 *	Hackity-hack.  We should probably just have a common
 	 *	group header, and then have type-specific structures.
@@ -173,6 +176,7 @@ typedef struct {
 	unlang_t		self;
 	module_instance_t	*module_instance;	//!< Instance of the module we're calling.
 	module_method_t		method;
+	rlm_components_t	component;		//!< Which method this is, for statistics.
 } unlang_module_t;
 
 /** Pushed onto the interpreter stack by a yielding module, indicates the resumption point
@@ -225,6 +229,9 @@ typedef struct {
  */
 typedef struct {
 	module_thread_instance_t *thread;			//!< thread-local data for this module
+	uint64_t		start;				//!< when the module was first called
+	uint64_t		cpu_start;			//!< thread CPU time when the module was
+								///< called or resumed.
 } unlang_frame_state_module_t;
 
 /** State of a foreach loop
@@ -287,6 +294,10 @@ typedef struct {
 	unlang_type_t		unwind;				//!< Unwind to this one if it exists.
 								///< This is used for break and return.
 
+	fr_latency_key_t const	*section;			//!< Section this frame is running,
+								///< for latency statistics.
+	uint64_t		section_start;			//!< When the section was pushed.
+
 	bool			repeat : 1;			//!< Call the action callback again on our way
 								//!< back up the stack.
 	bool			top_frame : 1;			//!< are we the top frame of the stack?
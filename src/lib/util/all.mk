@@ -8,6 +8,7 @@ TARGET		:= libfreeradius-util.a
 SOURCES		:= \
 		   ascend.c \
 		   base64.c \
+		   btree.c \
 		   cursor.c \
 		   debug.c \
 		   dict.c \
@@ -19,8 +20,10 @@ SOURCES		:= \
 		   heap.c \
 		   hmac_md5.c \
 		   hmac_sha1.c \
+		   htable.c \
 		   inet.c \
 		   isaac.c \
+		   latency.c \
 		   log.c \
 		   md4.c \
 		   md5.c \
@@ -45,6 +48,7 @@ SOURCES		:= \
 		   struct.c \
 		   syserror.c \
 		   talloc.c \
+		   timer_wheel.c \
 		   token.c \
 		   trie.c \
 		   udp.c \
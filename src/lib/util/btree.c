@@ -0,0 +1,917 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Ordered maps, using B+ trees with wide nodes
+ *
+ * All of the data is in the leaves, which are linked together in
+ * order, for walks and range queries.  The inner nodes only hold
+ * separator keys, and pointers to their children.  Each separator is
+ * a copy of the smallest key in the child to its right.
+ *
+ * Each node holds up to BTREE_MAX keys.  Along with each key is an
+ * optional 64-bit prefix of it, which is ordered the same way as the
+ * keys.  Most comparisons in a search only look at the prefixes,
+ * which are in the node itself.  The comparator (and the cache miss
+ * to load the data) is only needed when the prefixes are equal.
+ *
+ * With 32 keys per node, a tree of 10M entries is 5 levels deep,
+ * compared to about 25 for a red-black tree.
+ *
+ * Splitting nodes on insert can't fail, because we keep enough
+ * spare nodes around to split every level of the tree.
+ *
+ * @file src/lib/util/btree.c
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "btree.h"
+
+#include <freeradius-devel/util/strerror.h>
+
+#include <pthread.h>
+#include <string.h>
+
+/*
+ *	Nodes (other than the root) have between BTREE_MIN and
+ *	BTREE_MAX keys.
+ */
+#define BTREE_MAX		(32)
+#define BTREE_MIN		(BTREE_MAX / 2)
+
+/*
+ *	Deeper than any tree can get, with 2^32 entries.
+ */
+#define BTREE_MAX_DEPTH		(16)
+
+typedef struct {
+	uint16_t		num;			//!< number of keys in the node.
+	bool			leaf;
+	uint64_t		prefix[BTREE_MAX];	//!< prefixes of the keys
+	void			*data[BTREE_MAX];	//!< the keys
+} fr_btree_node_t;
+
+struct fr_btree_leaf_s {
+	fr_btree_node_t		node;
+	struct fr_btree_leaf_s	*next;			//!< the next leaf, in order
+};
+
+typedef struct fr_btree_leaf_s fr_btree_leaf_t;
+
+typedef struct {
+	fr_btree_node_t		node;
+	fr_btree_node_t		*child[BTREE_MAX + 1];	//!< child[i] has keys < data[i] <= child[i + 1]
+} fr_btree_inner_t;
+
+#define LEAF(_node)		((fr_btree_leaf_t *) (_node))
+#define INNER(_node)		((fr_btree_inner_t *) (_node))
+
+struct fr_btree_s {
+	fr_btree_node_t		*root;
+	uint32_t		num_elements;
+	unsigned int		depth;			//!< number of levels of inner nodes
+
+	rb_comparator_t		compare;
+	fr_btree_prefix_t	prefix;
+	rb_free_t		free;
+	bool			replace;
+	bool			lock;
+	pthread_mutex_t		mutex;
+
+	fr_btree_node_t		*spare_leaf;
+	unsigned int		num_spare_inner;
+	fr_btree_node_t		*spare_inner[BTREE_MAX_DEPTH + 1];
+};
+
+/*
+ *	The result of inserting into a node.
+ */
+typedef enum {
+	BTREE_INSERTED = 0,
+	BTREE_SPLIT,					//!< inserted, and the node was split
+	BTREE_EXISTS
+} btree_insert_t;
+
+typedef struct {
+	uint64_t		prefix;			//!< of the separator
+	void			*data;			//!< separator, the smallest key in "right"
+	fr_btree_node_t		*right;			//!< new node, to the right of the one which was split
+} btree_split_t;
+
+/*
+ *	Compare the data we're looking for, with a key in a node.
+ */
+static inline int btree_cmp(fr_btree_t const *tree, uint64_t prefix, void const *data,
+			    fr_btree_node_t const *node, unsigned int i)
+{
+	if (prefix < node->prefix[i]) return -1;
+	if (prefix > node->prefix[i]) return +1;
+
+	return tree->compare(data, node->data[i]);
+}
+
+/*
+ *	The first key which is >= data.
+ */
+static inline unsigned int btree_lower_bound(fr_btree_t const *tree, fr_btree_node_t const *node,
+					     uint64_t prefix, void const *data)
+{
+	unsigned int lo = 0, hi = node->num;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) >> 1;
+
+		if (btree_cmp(tree, prefix, data, node, mid) > 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/*
+ *	The first key which is > data, which is also the child of an
+ *	inner node that data is in.
+ */
+static inline unsigned int btree_upper_bound(fr_btree_t const *tree, fr_btree_node_t const *node,
+					     uint64_t prefix, void const *data)
+{
+	unsigned int lo = 0, hi = node->num;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) >> 1;
+
+		if (btree_cmp(tree, prefix, data, node, mid) >= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static inline uint64_t btree_prefix(fr_btree_t const *tree, void const *data)
+{
+	if (!tree->prefix) return 0;
+
+	return tree->prefix(data);
+}
+
+/*
+ *	Get a spare node.  btree_reserve() has made sure there is one.
+ */
+static fr_btree_node_t *btree_node_get(fr_btree_t *tree, bool leaf)
+{
+	fr_btree_node_t *node;
+
+	if (leaf) {
+		node = tree->spare_leaf;
+		tree->spare_leaf = NULL;
+	} else {
+		node = tree->spare_inner[--tree->num_spare_inner];
+	}
+
+	node->num = 0;
+	node->leaf = leaf;
+
+	return node;
+}
+
+/*
+ *	Keep a node we no longer need as a spare, or free it.
+ */
+static void btree_node_release(fr_btree_t *tree, fr_btree_node_t *node)
+{
+	if (node->leaf) {
+		if (!tree->spare_leaf) {
+			tree->spare_leaf = node;
+			return;
+		}
+
+	} else if (tree->num_spare_inner <= BTREE_MAX_DEPTH) {
+		tree->spare_inner[tree->num_spare_inner++] = node;
+		return;
+	}
+
+	talloc_free(node);
+}
+
+/*
+ *	Make sure that we have enough spare nodes to split every
+ *	level of the tree, and to add a new root.
+ */
+static int btree_reserve(fr_btree_t *tree)
+{
+	if (!tree->spare_leaf) {
+		tree->spare_leaf = (fr_btree_node_t *) talloc_zero(tree, fr_btree_leaf_t);
+		if (!tree->spare_leaf) goto oom;
+	}
+
+	while (tree->num_spare_inner < (tree->depth + 1)) {
+		fr_btree_node_t *node;
+
+		if (tree->depth >= BTREE_MAX_DEPTH) goto oom;
+
+		node = (fr_btree_node_t *) talloc_zero(tree, fr_btree_inner_t);
+		if (!node) goto oom;
+
+		tree->spare_inner[tree->num_spare_inner++] = node;
+	}
+
+	return 0;
+
+oom:
+	fr_strerror_printf("No memory for new btree node");
+	return -1;
+}
+
+/*
+ *	Insert a key at position "i" of a node which isn't full.
+ */
+static inline void btree_node_insert(fr_btree_node_t *node, unsigned int i, uint64_t prefix, void *data)
+{
+	memmove(&node->prefix[i + 1], &node->prefix[i], (node->num - i) * sizeof(node->prefix[0]));
+	memmove(&node->data[i + 1], &node->data[i], (node->num - i) * sizeof(node->data[0]));
+
+	node->prefix[i] = prefix;
+	node->data[i] = data;
+	node->num++;
+}
+
+/*
+ *	Remove the key at position "i" of a node.
+ */
+static inline void btree_node_remove(fr_btree_node_t *node, unsigned int i)
+{
+	memmove(&node->prefix[i], &node->prefix[i + 1], (node->num - i - 1) * sizeof(node->prefix[0]));
+	memmove(&node->data[i], &node->data[i + 1], (node->num - i - 1) * sizeof(node->data[0]));
+
+	node->num--;
+}
+
+/*
+ *	Copy "num" keys from one node to another.
+ */
+static inline void btree_node_copy(fr_btree_node_t *dst, unsigned int to,
+				   fr_btree_node_t const *src, unsigned int from, unsigned int num)
+{
+	memcpy(&dst->prefix[to], &src->prefix[from], num * sizeof(dst->prefix[0]));
+	memcpy(&dst->data[to], &src->data[from], num * sizeof(dst->data[0]));
+}
+
+static btree_insert_t btree_insert_leaf(fr_btree_t *tree, fr_btree_node_t *node, uint64_t prefix, void *data,
+					btree_split_t *split, void ***found)
+{
+	unsigned int i, half;
+	fr_btree_node_t *right;
+
+	i = btree_lower_bound(tree, node, prefix, data);
+	if ((i < node->num) && (btree_cmp(tree, prefix, data, node, i) == 0)) {
+		*found = &node->data[i];
+		return BTREE_EXISTS;
+	}
+
+	if (node->num < BTREE_MAX) {
+		btree_node_insert(node, i, prefix, data);
+		return BTREE_INSERTED;
+	}
+
+	/*
+	 *	Move the top half of the keys to a new leaf, and
+	 *	insert the new key into whichever half it belongs in.
+	 */
+	right = btree_node_get(tree, true);
+	half = (BTREE_MAX + 1) / 2;
+
+	if (i < half) {
+		btree_node_copy(right, 0, node, half - 1, BTREE_MAX - half + 1);
+		right->num = BTREE_MAX - half + 1;
+		node->num = half - 1;
+		btree_node_insert(node, i, prefix, data);
+	} else {
+		btree_node_copy(right, 0, node, half, BTREE_MAX - half);
+		right->num = BTREE_MAX - half;
+		node->num = half;
+		btree_node_insert(right, i - half, prefix, data);
+	}
+
+	LEAF(right)->next = LEAF(node)->next;
+	LEAF(node)->next = LEAF(right);
+
+	split->prefix = right->prefix[0];
+	split->data = right->data[0];
+	split->right = right;
+
+	return BTREE_SPLIT;
+}
+
+static btree_insert_t btree_insert_node(fr_btree_t *tree, fr_btree_node_t *node, uint64_t prefix, void *data,
+					btree_split_t *split, void ***found)
+{
+	unsigned int i, half;
+	btree_insert_t rcode;
+	btree_split_t child_split;
+	fr_btree_inner_t *inner = INNER(node), *right;
+	uint64_t prefixes[BTREE_MAX + 1];
+	void *keys[BTREE_MAX + 1];
+	fr_btree_node_t *children[BTREE_MAX + 2];
+
+	if (node->leaf) return btree_insert_leaf(tree, node, prefix, data, split, found);
+
+	i = btree_upper_bound(tree, node, prefix, data);
+
+	rcode = btree_insert_node(tree, inner->child[i], prefix, data, &child_split, found);
+	if (rcode != BTREE_SPLIT) return rcode;
+
+	/*
+	 *	The child was split.  Add the separator at "i", and
+	 *	the new child to the right of it.
+	 */
+	if (node->num < BTREE_MAX) {
+		memmove(&inner->child[i + 2], &inner->child[i + 1], (node->num - i) * sizeof(inner->child[0]));
+		inner->child[i + 1] = child_split.right;
+		btree_node_insert(node, i, child_split.prefix, child_split.data);
+		return BTREE_INSERTED;
+	}
+
+	/*
+	 *	The node is full, so split it, too.  Build the full
+	 *	set of keys and children, and then divide them.  The
+	 *	key in the middle moves up to the parent.
+	 */
+	memcpy(prefixes, node->prefix, i * sizeof(prefixes[0]));
+	memcpy(keys, node->data, i * sizeof(keys[0]));
+	prefixes[i] = child_split.prefix;
+	keys[i] = child_split.data;
+	memcpy(&prefixes[i + 1], &node->prefix[i], (BTREE_MAX - i) * sizeof(prefixes[0]));
+	memcpy(&keys[i + 1], &node->data[i], (BTREE_MAX - i) * sizeof(keys[0]));
+
+	memcpy(children, inner->child, (i + 1) * sizeof(children[0]));
+	children[i + 1] = child_split.right;
+	memcpy(&children[i + 2], &inner->child[i + 1], (BTREE_MAX - i) * sizeof(children[0]));
+
+	right = INNER(btree_node_get(tree, false));
+	half = (BTREE_MAX + 1) / 2;
+
+	memcpy(node->prefix, prefixes, half * sizeof(prefixes[0]));
+	memcpy(node->data, keys, half * sizeof(keys[0]));
+	memcpy(inner->child, children, (half + 1) * sizeof(children[0]));
+	node->num = half;
+
+	memcpy(right->node.prefix, &prefixes[half + 1], (BTREE_MAX - half) * sizeof(prefixes[0]));
+	memcpy(right->node.data, &keys[half + 1], (BTREE_MAX - half) * sizeof(keys[0]));
+	memcpy(right->child, &children[half + 1], (BTREE_MAX - half + 1) * sizeof(children[0]));
+	right->node.num = BTREE_MAX - half;
+
+	split->prefix = prefixes[half];
+	split->data = keys[half];
+	split->right = &right->node;
+
+	return BTREE_SPLIT;
+}
+
+/** Insert data into the tree
+ *
+ * @param[in] tree	to insert into.
+ * @param[in] data	to insert.
+ * @return
+ *	- true on success.
+ *	- false if the data already exists (and FR_BTREE_FLAG_REPLACE
+ *	  wasn't set), or on error.
+ */
+bool fr_btree_insert(fr_btree_t *tree, void const *data)
+{
+	uint64_t prefix;
+	void *my_data, **found = NULL;
+	btree_split_t split;
+	fr_btree_inner_t *root;
+
+	if (!tree || !data) return false;
+
+	memcpy(&my_data, &data, sizeof(my_data));
+	prefix = btree_prefix(tree, data);
+
+	if (tree->lock) pthread_mutex_lock(&tree->mutex);
+
+	if (btree_reserve(tree) < 0) {
+		if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+		return false;
+	}
+
+	if (!tree->root) tree->root = btree_node_get(tree, true);
+
+	switch (btree_insert_node(tree, tree->root, prefix, my_data, &split, &found)) {
+	case BTREE_INSERTED:
+		break;
+
+	case BTREE_SPLIT:
+		root = INNER(btree_node_get(tree, false));
+		root->node.prefix[0] = split.prefix;
+		root->node.data[0] = split.data;
+		root->node.num = 1;
+		root->child[0] = tree->root;
+		root->child[1] = split.right;
+
+		tree->root = &root->node;
+		tree->depth++;
+		break;
+
+	case BTREE_EXISTS:
+		if (!tree->replace) {
+			if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+			return false;
+		}
+
+		if (tree->free) tree->free(*found);
+		*found = my_data;
+
+		if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+		return true;
+	}
+
+	tree->num_elements++;
+
+	if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+	return true;
+}
+
+/*
+ *	Remove the key and the child to the right of it from an inner node.
+ */
+static inline void btree_inner_remove(fr_btree_node_t *node, unsigned int i)
+{
+	fr_btree_inner_t *inner = INNER(node);
+
+	memmove(&inner->child[i + 1], &inner->child[i + 2], (node->num - i - 1) * sizeof(inner->child[0]));
+	btree_node_remove(node, i);
+}
+
+/*
+ *	Child "i" of an inner node has too few keys.  Move a key to it
+ *	from one of its siblings, or merge it with one of them.
+ */
+static void btree_rebalance(fr_btree_t *tree, fr_btree_node_t *parent, unsigned int i)
+{
+	fr_btree_inner_t *inner = INNER(parent);
+	fr_btree_node_t *child = inner->child[i];
+	fr_btree_node_t *left = (i > 0) ? inner->child[i - 1] : NULL;
+	fr_btree_node_t *right = (i < parent->num) ? inner->child[i + 1] : NULL;
+
+	if (child->leaf) {
+		if (left && (left->num > BTREE_MIN)) {
+			btree_node_insert(child, 0, left->prefix[left->num - 1], left->data[left->num - 1]);
+			left->num--;
+
+			parent->prefix[i - 1] = child->prefix[0];
+			parent->data[i - 1] = child->data[0];
+			return;
+		}
+
+		if (right && (right->num > BTREE_MIN)) {
+			btree_node_insert(child, child->num, right->prefix[0], right->data[0]);
+			btree_node_remove(right, 0);
+
+			parent->prefix[i] = right->prefix[0];
+			parent->data[i] = right->data[0];
+			return;
+		}
+
+		/*
+		 *	Merge the right node of the pair into the left
+		 *	one.
+		 */
+		if (left) {
+			right = child;
+			child = left;
+			i--;
+		}
+
+		btree_node_copy(child, child->num, right, 0, right->num);
+		child->num += right->num;
+		LEAF(child)->next = LEAF(right)->next;
+
+		btree_inner_remove(parent, i);
+		btree_node_release(tree, right);
+		return;
+	}
+
+	if (left && (left->num > BTREE_MIN)) {
+		memmove(&INNER(child)->child[1], &INNER(child)->child[0], (child->num + 1) * sizeof(inner->child[0]));
+		INNER(child)->child[0] = INNER(left)->child[left->num];
+		btree_node_insert(child, 0, parent->prefix[i - 1], parent->data[i - 1]);
+
+		parent->prefix[i - 1] = left->prefix[left->num - 1];
+		parent->data[i - 1] = left->data[left->num - 1];
+		left->num--;
+		return;
+	}
+
+	if (right && (right->num > BTREE_MIN)) {
+		INNER(child)->child[child->num + 1] = INNER(right)->child[0];
+		btree_node_insert(child, child->num, parent->prefix[i], parent->data[i]);
+
+		parent->prefix[i] = right->prefix[0];
+		parent->data[i] = right->data[0];
+
+		memmove(&INNER(right)->child[0], &INNER(right)->child[1], right->num * sizeof(inner->child[0]));
+		btree_node_remove(right, 0);
+		return;
+	}
+
+	if (left) {
+		right = child;
+		child = left;
+		i--;
+	}
+
+	/*
+	 *	The separator moves down, between the keys of the two
+	 *	nodes.
+	 */
+	child->prefix[child->num] = parent->prefix[i];
+	child->data[child->num] = parent->data[i];
+	btree_node_copy(child, child->num + 1, right, 0, right->num);
+	memcpy(&INNER(child)->child[child->num + 1], &INNER(right)->child[0],
+	       (right->num + 1) * sizeof(inner->child[0]));
+	child->num += right->num + 1;
+
+	btree_inner_remove(parent, i);
+	btree_node_release(tree, right);
+}
+
+/*
+ *	Remove data from the subtree, and return the data which was
+ *	stored in the tree.
+ */
+static void *btree_remove(fr_btree_t *tree, fr_btree_node_t *node, uint64_t prefix, void const *data, bool *first)
+{
+	unsigned int i;
+	void *old;
+
+	if (node->leaf) {
+		i = btree_lower_bound(tree, node, prefix, data);
+		if ((i == node->num) || (btree_cmp(tree, prefix, data, node, i) != 0)) return NULL;
+
+		old = node->data[i];
+		*first = (i == 0);
+		btree_node_remove(node, i);
+		return old;
+	}
+
+	i = btree_upper_bound(tree, node, prefix, data);
+
+	old = btree_remove(tree, INNER(node)->child[i], prefix, data, first);
+	if (old && (INNER(node)->child[i]->num < BTREE_MIN)) btree_rebalance(tree, node, i);
+
+	return old;
+}
+
+/** Delete data from the tree, and call the free function for it
+ *
+ * @param[in] tree	to delete from.
+ * @param[in] data	to find, and delete.
+ * @return
+ *	- true if the data was found, and deleted.
+ *	- false if the data wasn't found.
+ */
+bool fr_btree_deletebydata(fr_btree_t *tree, void const *data)
+{
+	uint64_t prefix;
+	void *old;
+	bool first = false;
+	fr_btree_node_t *node;
+
+	if (!tree || !data) return false;
+
+	prefix = btree_prefix(tree, data);
+
+	if (tree->lock) pthread_mutex_lock(&tree->mutex);
+
+	if (!tree->root) goto not_found;
+
+	old = btree_remove(tree, tree->root, prefix, data, &first);
+	if (!old) {
+	not_found:
+		if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+		return false;
+	}
+
+	/*
+	 *	The root has no keys.  Its only child (if any)
+	 *	becomes the new root.
+	 */
+	if (!tree->root->num) {
+		node = tree->root;
+
+		if (node->leaf) {
+			tree->root = NULL;
+		} else {
+			tree->root = INNER(node)->child[0];
+			tree->depth--;
+		}
+
+		btree_node_release(tree, node);
+	}
+
+	/*
+	 *	If the data was the smallest key in its leaf, it may
+	 *	also be a separator in an inner node.  Replace the
+	 *	separator with the smallest key to the right of it,
+	 *	so that we don't keep a pointer to data which is
+	 *	about to be freed.  The separator is still on the
+	 *	search path for the data.
+	 */
+	if (first) for (node = tree->root; node && !node->leaf; ) {
+		unsigned int i;
+		fr_btree_node_t *min;
+
+		i = btree_upper_bound(tree, node, prefix, data);
+		if ((i == 0) || (node->data[i - 1] != old)) {
+			node = INNER(node)->child[i];
+			continue;
+		}
+
+		for (min = INNER(node)->child[i]; !min->leaf; min = INNER(min)->child[0]);
+
+		node->prefix[i - 1] = min->prefix[0];
+		node->data[i - 1] = min->data[0];
+		break;
+	}
+
+	tree->num_elements--;
+
+	if (tree->free) tree->free(old);
+
+	if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+	return true;
+}
+
+/*
+ *	Find the leaf which may contain data, and the position in it
+ *	of the first key >= data.
+ */
+static fr_btree_leaf_t *btree_find_leaf(fr_btree_t const *tree, uint64_t prefix, void const *data,
+					unsigned int *pos)
+{
+	fr_btree_node_t *node = tree->root;
+
+	if (!node) return NULL;
+
+	while (!node->leaf) node = INNER(node)->child[btree_upper_bound(tree, node, prefix, data)];
+
+	*pos = btree_lower_bound(tree, node, prefix, data);
+
+	return LEAF(node);
+}
+
+/** Find data in the tree
+ *
+ * @return
+ *	- the data which matches.
+ *	- NULL if nothing matches.
+ */
+void *fr_btree_finddata(fr_btree_t *tree, void const *data)
+{
+	uint64_t prefix;
+	unsigned int pos;
+	fr_btree_leaf_t *leaf;
+	void *found = NULL;
+
+	if (!tree || !data) return NULL;
+
+	prefix = btree_prefix(tree, data);
+
+	if (tree->lock) pthread_mutex_lock(&tree->mutex);
+
+	leaf = btree_find_leaf(tree, prefix, data, &pos);
+	if (leaf && (pos < leaf->node.num) && (btree_cmp(tree, prefix, data, &leaf->node, pos) == 0)) {
+		found = leaf->node.data[pos];
+	}
+
+	if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+
+	return found;
+}
+
+uint32_t fr_btree_num_elements(fr_btree_t *tree)
+{
+	if (!tree) return 0;
+
+	return tree->num_elements;
+}
+
+/*
+ *	Walk the leaves from a position, until the end, or until the
+ *	data is >= "end".
+ */
+static int btree_walk_leaves(fr_btree_t *tree, fr_btree_leaf_t *leaf, unsigned int pos,
+			     void const *end, rb_walker_t callback, void *ctx)
+{
+	int rcode;
+	uint64_t prefix = end ? btree_prefix(tree, end) : 0;
+
+	for (; leaf != NULL; leaf = leaf->next, pos = 0) {
+		for (; pos < leaf->node.num; pos++) {
+			if (end && (btree_cmp(tree, prefix, end, &leaf->node, pos) <= 0)) return 0;
+
+			rcode = callback(ctx, leaf->node.data[pos]);
+			if (rcode != 0) return rcode;
+		}
+	}
+
+	return 0;
+}
+
+static fr_btree_leaf_t *btree_first_leaf(fr_btree_t const *tree)
+{
+	fr_btree_node_t *node = tree->root;
+
+	if (!node) return NULL;
+
+	while (!node->leaf) node = INNER(node)->child[0];
+
+	return LEAF(node);
+}
+
+/** Call a function for all of the data in the tree, in order
+ *
+ *  The callback should return 0 to continue walking.  Any other
+ *  value stops the walk, and is returned.
+ */
+int fr_btree_walk(fr_btree_t *tree, rb_walker_t callback, void *ctx)
+{
+	int rcode;
+
+	if (!tree || !callback) return 0;
+
+	if (tree->lock) pthread_mutex_lock(&tree->mutex);
+
+	rcode = btree_walk_leaves(tree, btree_first_leaf(tree), 0, NULL, callback, ctx);
+
+	if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+
+	return rcode;
+}
+
+/** Call a function for the data in a range, in order
+ *
+ * @param[in] tree	to walk.
+ * @param[in] start	the smallest data to call the callback for, or NULL.
+ * @param[in] end	the callback is called for data < end.  Or NULL,
+ *			for everything after start.
+ * @param[in] callback	to call.
+ * @param[in] ctx	to pass to the callback.
+ * @return
+ *	- 0 if the callback returned 0 for all of the data.
+ *	- the first non-zero value which the callback returned.
+ */
+int fr_btree_walk_range(fr_btree_t *tree, void const *start, void const *end,
+			rb_walker_t callback, void *ctx)
+{
+	int rcode;
+	unsigned int pos = 0;
+	fr_btree_leaf_t *leaf;
+
+	if (!tree || !callback) return 0;
+
+	if (tree->lock) pthread_mutex_lock(&tree->mutex);
+
+	if (start) {
+		leaf = btree_find_leaf(tree, btree_prefix(tree, start), start, &pos);
+	} else {
+		leaf = btree_first_leaf(tree);
+	}
+
+	rcode = btree_walk_leaves(tree, leaf, pos, end, callback, ctx);
+
+	if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+
+	return rcode;
+}
+
+/** Return the next data in the tree
+ *
+ * @return
+ *	- the next data.
+ *	- NULL if there's no more data.
+ */
+void *fr_btree_iter_next(UNUSED fr_btree_t *tree, fr_btree_iter_t *iter)
+{
+	if (!iter->leaf) return NULL;
+
+	if (++iter->pos < iter->leaf->node.num) return iter->leaf->node.data[iter->pos];
+
+	iter->leaf = iter->leaf->next;
+	iter->pos = 0;
+	if (!iter->leaf) return NULL;
+
+	return iter->leaf->node.data[0];
+}
+
+/** Start iterating over the tree
+ *
+ * @param[in] tree	to iterate over.
+ * @param[out] iter	the iterator.
+ * @param[in] start	the first data returned is the smallest which
+ *			is >= start.  Or NULL, to start from the beginning.
+ * @return
+ *	- the first data.
+ *	- NULL if there's no data.
+ */
+void *fr_btree_iter_init(fr_btree_t *tree, fr_btree_iter_t *iter, void const *start)
+{
+	iter->pos = 0;
+
+	if (start) {
+		iter->leaf = btree_find_leaf(tree, btree_prefix(tree, start), start, &iter->pos);
+	} else {
+		iter->leaf = btree_first_leaf(tree);
+	}
+
+	if (!iter->leaf) return NULL;
+
+	/*
+	 *	All of the keys in the leaf are < start.  The next
+	 *	leaf has the next one.
+	 */
+	if (iter->pos >= iter->leaf->node.num) {
+		iter->pos--;
+		return fr_btree_iter_next(tree, iter);
+	}
+
+	return iter->leaf->node.data[iter->pos];
+}
+
+/*
+ *	Call the free function for all of the data.  The nodes are
+ *	talloc'd from the tree, and are freed with it.
+ */
+static int _btree_free(fr_btree_t *tree)
+{
+	fr_btree_leaf_t *leaf;
+	unsigned int i;
+
+	if (tree->free) for (leaf = btree_first_leaf(tree); leaf != NULL; leaf = leaf->next) {
+		for (i = 0; i < leaf->node.num; i++) tree->free(leaf->node.data[i]);
+	}
+
+	tree->root = NULL;
+	tree->num_elements = 0;
+
+	if (tree->lock) pthread_mutex_destroy(&tree->mutex);
+
+	return 0;
+}
+
+/** Create a new B+ tree
+ *
+ * @param[in] ctx	to tie the tree lifetime to.
+ *			If ctx is freed, the tree will free any nodes, calling the
+ *			free function if set.
+ * @param[in] compare	Comparator used to compare nodes.
+ * @param[in] prefix	Optional function returning an order preserving prefix of the data.
+ * @param[in] node_free	Optional function used to free data if tree nodes are
+ *			deleted or replaced.
+ * @param[in] flags	FR_BTREE_FLAG_REPLACE and / or FR_BTREE_FLAG_LOCK.
+ * @return
+ *	- A new tree on success.
+ *	- NULL on failure.
+ */
+fr_btree_t *fr_btree_create(TALLOC_CTX *ctx, rb_comparator_t compare, fr_btree_prefix_t prefix,
+			    rb_free_t node_free, int flags)
+{
+	fr_btree_t *tree;
+
+	if (!compare) return NULL;
+
+	tree = talloc_zero(ctx, fr_btree_t);
+	if (!tree) return NULL;
+
+	tree->compare = compare;
+	tree->prefix = prefix;
+	tree->free = node_free;
+	tree->replace = (flags & FR_BTREE_FLAG_REPLACE) != 0;
+	tree->lock = (flags & FR_BTREE_FLAG_LOCK) != 0;
+	if (tree->lock) pthread_mutex_init(&tree->mutex, NULL);
+
+	talloc_set_destructor(tree, _btree_free);
+
+	return tree;
+}
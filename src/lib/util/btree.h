@@ -0,0 +1,88 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Ordered maps, using B+ trees with wide nodes
+ *
+ * @file src/lib/util/btree.h
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSIDH(btree_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/rbtree.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <talloc.h>
+
+typedef struct fr_btree_s fr_btree_t;
+
+#define FR_BTREE_FLAG_NONE	(0)
+#define FR_BTREE_FLAG_REPLACE	(1 << 0)
+#define FR_BTREE_FLAG_LOCK	(1 << 1)
+
+/** Return an order preserving prefix of the key
+ *
+ *  If prefix(a) < prefix(b), then the comparator MUST say that a < b.
+ *  If the prefixes are equal, the comparator is called.  e.g. the
+ *  first 8 bytes of a string key, in big endian order.
+ */
+typedef uint64_t (*fr_btree_prefix_t)(void const *data);
+
+/** Stores the state of the current iteration operation
+ *
+ */
+typedef struct {
+	struct fr_btree_leaf_s	*leaf;
+	unsigned int		pos;
+} fr_btree_iter_t;
+
+fr_btree_t	*fr_btree_create(TALLOC_CTX *ctx, rb_comparator_t compare, fr_btree_prefix_t prefix,
+				 rb_free_t node_free, int flags);
+
+bool		fr_btree_insert(fr_btree_t *tree, void const *data);
+bool		fr_btree_deletebydata(fr_btree_t *tree, void const *data);
+void		*fr_btree_finddata(fr_btree_t *tree, void const *data);
+uint32_t	fr_btree_num_elements(fr_btree_t *tree);
+
+/*
+ *	The callbacks are the same as for rbtree_walk(), and CANNOT
+ *	modify the tree.  They're called in order.
+ *
+ *	fr_btree_walk_range() calls the callback for all data >= start,
+ *	and < end.  Either can be NULL, for no limit.
+ */
+int		fr_btree_walk(fr_btree_t *tree, rb_walker_t callback, void *ctx);
+int		fr_btree_walk_range(fr_btree_t *tree, void const *start, void const *end,
+				    rb_walker_t callback, void *ctx);
+
+/*
+ *	The iterators don't lock the tree, and are invalidated by any
+ *	insert or delete.
+ */
+void		*fr_btree_iter_init(fr_btree_t *tree, fr_btree_iter_t *iter, void const *start);
+void		*fr_btree_iter_next(fr_btree_t *tree, fr_btree_iter_t *iter);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,6 +6,7 @@
 
 #define FR_DICTIONARY_FILE		"dictionary"
 #define FR_DICTIONARY_INTERNAL_DIR	"freeradius"
+#define FR_DICTIONARY_IMAGE_FILE	"dictionary.image"
 #define RADIUS_CLIENTS			"clients"
 #define RADIUS_NASLIST			"naslist"
 #define RADIUS_REALMS			"realms"
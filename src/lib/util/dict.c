@@ -37,8 +37,12 @@ RCSID("$Id$")
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/version.h>
 
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #ifdef HAVE_SYS_STAT_H
 #  include <sys/stat.h>
 #endif
@@ -48,6 +52,16 @@ RCSID("$Id$")
 #define DICT_POOL_SIZE		(1024 * 1024 * 2)
 #define DICT_FIXUP_POOL_SIZE	(1024 * 1024 * 1)
 
+#define DICT_INDEX_DIRECT_MIN	(256)	//!< Children spanning fewer numbers than this always
+					///< get a direct index.
+#define DICT_INDEX_BATCH	(16)	//!< How many lookups to have in flight at once.
+
+#ifdef __GNUC__
+#  define DICT_PREFETCH(_x)	__builtin_prefetch(_x)
+#else
+#  define DICT_PREFETCH(_x)
+#endif
+
 static TALLOC_CTX	*dict_ctx;
 static fr_hash_table_t	*protocol_by_name = NULL;	//!< Hash containing names of all the registered protocols.
 static fr_hash_table_t	*protocol_by_num = NULL;	//!< Hash containing numbers of all the registered protocols.
@@ -78,6 +92,43 @@ struct dict_enum_fixup_s {
 	dict_enum_fixup_t	*next;			//!< Next in the linked list of fixups.
 };
 
+/** Children of a structural attribute, indexed by attribute number
+ *
+ * Built by fr_dict_finalise(), and read only after that.
+ */
+struct dict_attr_index {
+	bool			direct;			//!< slot is indexed by (attr - min).
+							///< Otherwise it's a perfect hash.
+
+	uint32_t		min;			//!< Lowest child number, for direct indexes.
+
+	uint32_t		num_slots;		//!< Number of entries in slot.
+	uint32_t		slot_mask;		//!< num_slots - 1, for hashed indexes.
+	uint32_t		bucket_mask;		//!< Number of entries in disp - 1.
+
+	uint32_t		*disp;			//!< Per bucket displacement, for hashed indexes.
+	fr_dict_attr_t const	**slot;			//!< Children, or NULL for unused slots.
+
+	bool			fallback;		//!< Children were added which don't fit in the
+							///< index, so misses must check the bins.
+};
+
+/** A file a dictionary was read from
+ *
+ * Recorded so that binary images of the dictionary can be checked
+ * against the files they were made from.
+ */
+typedef struct {
+	char const		*file;			//!< Full path of the file.
+	int64_t			size;			//!< -1 if an optional $INCLUDE- was missing.
+	int64_t			mtime;			//!< Modification time.
+} dict_source_t;
+
+static dict_source_t	*dict_sources;			//!< Where _dict_from_file() records the files
+							///< it reads, when not NULL.
+static bool		dict_image_enabled = true;	//!< Whether fr_dict_protocol_afrom_file() uses
+							///< binary images.
+
 /** Vendors and attribute names
  *
  * It's very likely that the same vendors will operate in multiple
@@ -114,6 +165,9 @@ struct fr_dict {
 
 	fr_dict_attr_t const	*last_attr;		//!< Cache of last attribute to speed up
 							///< value processing.
+
+	dict_source_t		*sources;		//!< Files the dictionary was read from.  NULL
+							///< if we don't know, and so can't write an image.
 };
 
 /** Map data types to min / max data sizes
@@ -1296,6 +1350,8 @@ static int dict_vendor_add(fr_dict_t *dict, char const *name, unsigned int num)
 	return 0;
 }
 
+static void dict_attr_index_add(fr_dict_attr_t *parent, fr_dict_attr_t const *child);
+
 /** Add a child to a parent.
  *
  * @param[in] parent	we're adding a child to.
@@ -1381,6 +1437,316 @@ static inline int dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t *ch
 	child->next = *this;
 	*this = child;
 
+	dict_attr_index_add(parent, child);
+
+	return 0;
+}
+
+/** Mix the bits of an attribute number, for the child index
+ *
+ */
+static inline uint32_t dict_attr_index_mix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+/** Find the slot in the child index that attr would be in
+ *
+ * For a direct index, attr must be in range.
+ */
+static inline uint32_t dict_attr_index_slot(fr_dict_attr_index_t const *index, unsigned int attr)
+{
+	uint32_t b;
+
+	if (index->direct) return attr - index->min;
+
+	b = dict_attr_index_mix(attr) & index->bucket_mask;
+
+	return dict_attr_index_mix(attr ^ index->disp[b]) & index->slot_mask;
+}
+
+static inline fr_dict_attr_t const *dict_attr_index_find(fr_dict_attr_index_t const *index, unsigned int attr)
+{
+	fr_dict_attr_t const *da;
+
+	if (index->direct) {
+		if ((attr - index->min) >= index->num_slots) return NULL;	/* also catches attr < min */
+
+		return index->slot[attr - index->min];
+	}
+
+	da = index->slot[dict_attr_index_slot(index, attr)];
+	if (da && (da->attr == attr)) return da;
+
+	return NULL;
+}
+
+/** Update the child index of a parent, after a child has been added to its bins
+ *
+ * This happens at run time, e.g. for unknown attributes, so other
+ * threads may be using the index.  We only ever replace or fill in
+ * slots.  If the child doesn't fit, lookups which miss in the index
+ * go on to check the bins.
+ *
+ * @param[in] parent	the child was added to.
+ * @param[in] child	which was added.
+ */
+static void dict_attr_index_add(fr_dict_attr_t *parent, fr_dict_attr_t const *child)
+{
+	fr_dict_attr_index_t	*index = parent->child_index;
+	fr_dict_attr_t const	*first;
+	uint32_t		slot;
+
+	if (!index) return;
+
+	/*
+	 *	The child may shadow an existing child with the same
+	 *	number, or be shadowed by one.  Index whichever the
+	 *	bin walk would return.
+	 */
+	for (first = parent->children[child->attr & 0xff]; first->attr != child->attr; first = first->next);
+
+	if (index->direct) {
+		if ((child->attr - index->min) >= index->num_slots) {
+			index->fallback = true;
+			return;
+		}
+		index->slot[child->attr - index->min] = first;
+		return;
+	}
+
+	/*
+	 *	A hashed slot can be used if it's empty, or already
+	 *	holds a child with the same number.
+	 */
+	slot = dict_attr_index_slot(index, child->attr);
+	if (index->slot[slot] && (index->slot[slot]->attr != child->attr)) {
+		index->fallback = true;
+		return;
+	}
+	index->slot[slot] = first;
+}
+
+typedef struct {
+	uint32_t		count;			//!< Number of children which hash to the bucket.
+	uint32_t		bucket;
+} dict_attr_index_bucket_t;
+
+static int dict_attr_index_bucket_cmp(void const *one, void const *two)
+{
+	dict_attr_index_bucket_t const *a = one, *b = two;
+
+	/*
+	 *	Largest buckets first.
+	 */
+	if (a->count != b->count) return (a->count < b->count) - (a->count > b->count);
+
+	return (a->bucket > b->bucket) - (a->bucket < b->bucket);
+}
+
+/** Place the children in a minimal perfect-ish hash table
+ *
+ * Hash and displace.  Each child is put into a bucket by the hash of
+ * its number.  Then, largest bucket first, we search for a
+ * displacement which puts every child in the bucket into an empty slot.
+ * Lookups are then one bucket read and one slot read, with no probing.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if no displacement could be found for a bucket.
+ */
+static int dict_attr_index_hash(fr_dict_attr_index_t *index, fr_dict_attr_t const **children, uint32_t count)
+{
+	uint32_t			i, j, k, num_buckets;
+	uint32_t			*order, *slots;
+	dict_attr_index_bucket_t	*buckets;
+
+	num_buckets = 1;
+	while (num_buckets < ((count + 3) / 4)) num_buckets <<= 1;
+	index->num_slots = 1;
+	while (index->num_slots < (count * 2)) index->num_slots <<= 1;
+
+	index->bucket_mask = num_buckets - 1;
+	index->slot_mask = index->num_slots - 1;
+
+	index->disp = talloc_zero_array(index, uint32_t, num_buckets);
+	index->slot = talloc_zero_array(index, fr_dict_attr_t const *, index->num_slots);
+	buckets = talloc_zero_array(index, dict_attr_index_bucket_t, num_buckets);
+	order = talloc_array(index, uint32_t, count);
+	slots = talloc_array(index, uint32_t, count);
+	if (!index->disp || !index->slot || !buckets || !order || !slots) {
+		fr_strerror_printf("Out of memory");
+	error:
+		talloc_free(buckets);
+		talloc_free(order);
+		talloc_free(slots);
+		return -1;
+	}
+
+	for (i = 0; i < num_buckets; i++) buckets[i].bucket = i;
+	for (i = 0; i < count; i++) buckets[dict_attr_index_mix(children[i]->attr) & index->bucket_mask].count++;
+
+	qsort(buckets, num_buckets, sizeof(buckets[0]), dict_attr_index_bucket_cmp);
+
+	for (i = 0; i < num_buckets; i++) {
+		uint32_t b = buckets[i].bucket;
+		uint32_t members = 0;
+		uint32_t d;
+
+		if (!buckets[i].count) break;
+
+		for (j = 0; j < count; j++) {
+			if ((dict_attr_index_mix(children[j]->attr) & index->bucket_mask) == b) order[members++] = j;
+		}
+
+		/*
+		 *	With the table at most half full, a
+		 *	displacement is almost always found in the
+		 *	first few tries.
+		 */
+		for (d = 0; d < (1 << 20); d++) {
+			for (j = 0; j < members; j++) {
+				slots[j] = dict_attr_index_mix(children[order[j]]->attr ^ d) & index->slot_mask;
+				if (index->slot[slots[j]]) break;
+
+				for (k = 0; k < j; k++) if (slots[k] == slots[j]) break;
+				if (k < j) break;
+			}
+			if (j == members) break;
+		}
+		if (d == (1 << 20)) {
+			fr_strerror_printf("Failed finding displacement for child index bucket");
+			goto error;
+		}
+
+		index->disp[b] = d;
+		for (j = 0; j < members; j++) index->slot[slots[j]] = children[order[j]];
+	}
+
+	talloc_free(buckets);
+	talloc_free(order);
+	talloc_free(slots);
+
+	return 0;
+}
+
+/** Build the child index for an attribute
+ *
+ * The index gives the same answers as walking the bins in
+ * #fr_dict_attr_t.children.  Where a bin holds more than one child with
+ * the same number, only the first, i.e. the one the bin walk would have
+ * returned, is indexed.
+ *
+ * Children which are numbered densely get a direct array, indexed by
+ * (number - lowest number).  Sparse children, e.g. vendors under
+ * Vendor-Specific, or large vendor trees, get a perfect hash.
+ *
+ * @param[in] da	to build the index for.
+ * @return
+ *	- 0 on success, or if no index is needed.
+ *	- -1 on failure.
+ */
+static int dict_attr_index_build(fr_dict_attr_t *da)
+{
+	fr_dict_attr_index_t	*index;
+	fr_dict_attr_t const	**children, *p, *q;
+	uint32_t		count = 0, i, min = UINT32_MAX, max = 0;
+	size_t			len;
+
+	len = talloc_array_length(da->children);
+	for (i = 0; i < len; i++) for (p = da->children[i]; p; p = p->next) count++;
+	if (!count) return 0;
+
+	children = talloc_array(NULL, fr_dict_attr_t const *, count);
+	if (!children) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	count = 0;
+	for (i = 0; i < len; i++) for (p = da->children[i]; p; p = p->next) {
+		for (q = da->children[i]; q != p; q = q->next) if (q->attr == p->attr) break;
+		if (q != p) continue;	/* Shadowed by an earlier child */
+
+		children[count++] = p;
+		if (p->attr < min) min = p->attr;
+		if (p->attr > max) max = p->attr;
+	}
+
+	index = talloc_zero(da, fr_dict_attr_index_t);
+	if (!index) {
+		fr_strerror_printf("Out of memory");
+	error:
+		talloc_free(children);
+		talloc_free(index);
+		return -1;
+	}
+	talloc_set_name_const(index, "fr_dict_attr_index_t");
+
+	/*
+	 *	RADIUS, DHCPv4 and TACACS attributes, and most vendor
+	 *	trees, are in the dense case.
+	 */
+	if (((uint64_t) max - min) < DICT_INDEX_DIRECT_MIN ||
+	    ((uint64_t) max - min) < ((uint64_t) count * 4)) {
+		index->direct = true;
+		index->min = min;
+		index->num_slots = (max - min) + 1;
+		index->slot = talloc_zero_array(index, fr_dict_attr_t const *, index->num_slots);
+		if (!index->slot) {
+			fr_strerror_printf("Out of memory");
+			goto error;
+		}
+
+		for (i = 0; i < count; i++) index->slot[children[i]->attr - min] = children[i];
+	} else if (dict_attr_index_hash(index, children, count) < 0) {
+		goto error;
+	}
+
+	talloc_free(children);
+	da->child_index = index;
+
+	return 0;
+}
+
+/** Build child indexes for da and its descendents, where they're missing
+ *
+ */
+static int dict_attr_index_build_all(fr_dict_attr_t *da)
+{
+	size_t			i, len;
+	fr_dict_attr_t const	*p;
+
+	if (!da->children) return 0;
+
+	switch (da->type) {
+	case FR_TYPE_STRUCTURAL:
+		break;
+
+	default:
+		return 0;
+	}
+
+	/*
+	 *	Rebuild indexes which children were added to after
+	 *	they were built, and no longer cover all of them.
+	 */
+	if ((!da->child_index || da->child_index->fallback) && (dict_attr_index_build(da) < 0)) return -1;
+
+	len = talloc_array_length(da->children);
+	for (i = 0; i < len; i++) for (p = da->children[i]; p; p = p->next) {
+		fr_dict_attr_t *mutable;
+
+		memcpy(&mutable, &p, sizeof(mutable));
+		if (dict_attr_index_build_all(mutable) < 0) return -1;
+	}
+
 	return 0;
 }
 
@@ -3456,6 +3822,11 @@ inline fr_dict_attr_t const *fr_dict_attr_child_by_num(fr_dict_attr_t const *par
 		break;
 	}
 
+	if (parent->child_index) {
+		bin = dict_attr_index_find(parent->child_index, attr);
+		if (bin || !parent->child_index->fallback) return bin;
+	}
+
 	/*
 	 *	Child arrays may be trimmed back to save memory.
 	 *	Check that so we don't SEGV.
@@ -3472,6 +3843,64 @@ inline fr_dict_attr_t const *fr_dict_attr_child_by_num(fr_dict_attr_t const *par
 	return NULL;
 }
 
+/** Look up several children of the same parent by attribute number
+ *
+ * Gives the same results as calling fr_dict_attr_child_by_num() for
+ * each number, but issues the memory loads for a group of numbers before
+ * using any of them.  Decoders which know the numbers of several sibling
+ * attributes, e.g. from a first pass over a packet, should use this.
+ *
+ * @param[out] out		Array of num children.  Entries are NULL
+ *				where there is no child with that number.
+ * @param[in] parent		to look for children in.
+ * @param[in] attr		Array of num attribute numbers.
+ * @param[in] num		of numbers to look up.
+ * @return the number of children found.
+ */
+size_t fr_dict_attr_child_by_num_batch(fr_dict_attr_t const **out, fr_dict_attr_t const *parent,
+				       unsigned int const *attr, size_t num)
+{
+	fr_dict_attr_index_t const	*index = parent->child_index;
+	uint32_t			slot[DICT_INDEX_BATCH];
+	size_t				i, j, group, found = 0;
+
+	if (!index) {
+		for (i = 0; i < num; i++) if ((out[i] = fr_dict_attr_child_by_num(parent, attr[i]))) found++;
+		return found;
+	}
+
+	for (i = 0; i < num; i += group) {
+		group = num - i;
+		if (group > DICT_INDEX_BATCH) group = DICT_INDEX_BATCH;
+
+		if (!index->direct) for (j = 0; j < group; j++) {
+			DICT_PREFETCH(&index->disp[dict_attr_index_mix(attr[i + j]) & index->bucket_mask]);
+		}
+
+		for (j = 0; j < group; j++) {
+			if (index->direct && ((attr[i + j] - index->min) >= index->num_slots)) {
+				slot[j] = UINT32_MAX;
+				continue;
+			}
+			slot[j] = dict_attr_index_slot(index, attr[i + j]);
+			DICT_PREFETCH(&index->slot[slot[j]]);
+		}
+
+		for (j = 0; j < group; j++) {
+			fr_dict_attr_t const *da;
+
+			da = (slot[j] == UINT32_MAX) ? NULL : index->slot[slot[j]];
+			if (da && (da->attr != attr[i + j])) da = NULL;
+			if (!da && index->fallback) da = fr_dict_attr_child_by_num(parent, attr[i + j]);
+
+			out[i + j] = da;
+			if (da) found++;
+		}
+	}
+
+	return found;
+}
+
 /** Lookup the structure representing an enum value in a #fr_dict_attr_t
  *
  * @param[in] da		to search in.
@@ -4522,9 +4951,48 @@ static int fr_dict_finalise(fr_dict_t *dict)
 	fr_hash_table_walk(dict->values_by_da, hash_null_callback, NULL);
 	fr_hash_table_walk(dict->values_by_alias, hash_null_callback, NULL);
 
+	/*
+	 *	The decoders look up children by number for every
+	 *	attribute of every packet, so index them now that
+	 *	they're all known.
+	 */
+	if (dict_attr_index_build_all(dict->root) < 0) return -1;
+
 	return 0;
 }
 
+/** Record a file we've read, if we're recording
+ *
+ * @param[in] fn	Full path of the file.
+ * @param[in] statbuf	of the file, or NULL if it doesn't exist.
+ */
+static void dict_source_record(char const *fn, struct stat const *statbuf)
+{
+	size_t		len;
+	dict_source_t	*sources;
+
+	if (!dict_sources) return;
+
+	/*
+	 *	If we run out of memory, stop recording.  The
+	 *	dictionary still loads, but we can't write an image
+	 *	of it.
+	 */
+	len = talloc_array_length(dict_sources);
+	sources = talloc_realloc(talloc_parent(dict_sources), dict_sources, dict_source_t, len + 1);
+	if (!sources) {
+	oom:
+		TALLOC_FREE(dict_sources);
+		return;
+	}
+	dict_sources = sources;
+
+	dict_sources[len].file = talloc_typed_strdup(dict_sources, fn);
+	if (!dict_sources[len].file) goto oom;
+	dict_sources[len].size = statbuf ? statbuf->st_size : -1;
+	dict_sources[len].mtime = statbuf ? statbuf->st_mtime : 0;
+}
+
 /** Parse a dictionary file
  *
  * @param[in] ctx	Contains the current state of the dictionary parser.
@@ -4608,6 +5076,8 @@ static int _dict_from_file(dict_from_file_ctx_t *ctx,
 	}
 
 	if ((fp = fopen(fn, "r")) == NULL) {
+		dict_source_record(fn, NULL);
+
 		if (!src_file) {
 			fr_strerror_printf_push("Couldn't open dictionary %s: %s", fr_syserror(errno), fn);
 		} else {
@@ -4645,6 +5115,8 @@ static int _dict_from_file(dict_from_file_ctx_t *ctx,
 	}
 #endif
 
+	dict_source_record(fn, &statbuf);
+
 	/*
 	 *	Seed the random pool with data.
 	 */
@@ -5073,56 +5545,781 @@ static int dict_from_file(fr_dict_t *dict,
 			       dir_name, filename, src_file, src_line);
 }
 
-/** (Re-)Initialize the special internal dictionary
- *
- * This dictionary has additional programatically generated attributes added to it,
- * and is checked in addition to the protocol specific dictionaries.
- *
- * @note The dictionary pointer returned in out must have its reference counter
- *	 decremented with #fr_dict_free when no longer used.
- *
- * @param[out] out		Where to write pointer to the internal dictionary.
- * @param[in] dict_subdir	name of the internal dictionary dir (may be NULL).
- * @return
- *	- 0 on success.
- *	- -1 on failure.
+/*
+ *	Binary dictionary images
+ *
+ *	An image holds everything needed to rebuild a protocol
+ *	dictionary, without reading, tokenizing or validating the
+ *	text files it was made from.  Images are only read by the same
+ *	version of the server, on the same platform, that wrote them,
+ *	so records are in host byte order, and flags are copied as-is.
+ *
+ *	Layout is a dict_image_hdr_t, then the source, vendor,
+ *	attribute and enum records, then a block of NUL terminated
+ *	strings and enum values.  Records refer to strings by their
+ *	offset in that block.  Offset 0 is always "".
  */
-int fr_dict_internal_afrom_file(fr_dict_t **out, char const *dict_subdir)
-{
-	fr_dict_t		*dict;
-	char			*dict_path = NULL;
-	char			*tmp;
-	FR_NAME_NUMBER const	*p;
-	fr_dict_attr_flags_t	flags = { .internal = true };
-	char			*type_name;
+#define DICT_IMAGE_MAGIC	"FRDICTIM"
+#define DICT_IMAGE_VERSION	(1)
+#define DICT_IMAGE_BYTE_ORDER	(0x01020304)
 
-	if (unlikely(!protocol_by_name || !protocol_by_num)) {
-		fr_strerror_printf("fr_dict_global_init() must be called before loading dictionary files");
-		return -1;
-	}
+typedef struct {
+	char			magic[8];		//!< DICT_IMAGE_MAGIC.
+	uint32_t		version;		//!< DICT_IMAGE_VERSION.
+	uint32_t		byte_order;		//!< DICT_IMAGE_BYTE_ORDER, in the writer's byte order.
+	uint64_t		lib_magic;		//!< RADIUSD_MAGIC_NUMBER of the writer.
+	uint32_t		sizeof_flags;		//!< sizeof(fr_dict_attr_flags_t) for the writer.
+	uint32_t		num_sources;
+	uint32_t		num_vendors;
+	uint32_t		num_attrs;		//!< Including the root, which is first.
+	uint32_t		num_enums;
+	uint32_t		strings_len;
+} dict_image_hdr_t;
 
-	/*
-	 *	Increase the reference count of the internal dictionary.
-	 */
-	if (fr_dict_internal) {
-		 talloc_increase_ref_count(fr_dict_internal);
-		 *out = fr_dict_internal;
-		 return 0;
-	}
+typedef struct {
+	int64_t			size;			//!< -1 if the file must not exist.
+	int64_t			mtime;
+	uint32_t		file;
+	uint32_t		pad;
+} dict_image_source_t;
 
-	memcpy(&tmp, &default_dict_dir, sizeof(tmp));
-	dict_path = dict_subdir ? talloc_asprintf(NULL, "%s%c%s", default_dict_dir, FR_DIR_SEP, dict_subdir) : tmp;
+typedef struct {
+	uint32_t		pen;
+	uint32_t		type;
+	uint32_t		length;
+	uint32_t		flags;
+	uint32_t		name;
+	uint32_t		by_num;			//!< Whether lookups by number find this vendor.
+} dict_image_vendor_t;
 
-	dict = dict_alloc(dict_ctx);
-	if (!dict) {
-	error:
-		if (!fr_dict_internal) talloc_free(dict);
-		talloc_free(dict_path);
-		return -1;
-	}
+typedef struct {
+	uint32_t		parent;			//!< Index of the parent.  Always less than
+							///< the index of this attribute.
+	uint32_t		attr;
+	uint32_t		type;
+	uint32_t		name;
+	uint32_t		by_name;		//!< Whether lookups by name find this attribute.
+	uint32_t		ref_proto;		//!< Protocol a reference attribute points into.
+							///< 0 if this isn't a reference.
+	uint32_t		ref_oid;		//!< OID the reference points to, "" for the root.
+	fr_dict_attr_flags_t	flags;
+} dict_image_attr_t;
 
-	/*
-	 *	Set the root name of the dictionary
+typedef struct {
+	uint32_t		da;			//!< Index of the attribute.
+	uint32_t		type;
+	uint32_t		alias;
+	uint32_t		value;			//!< Value, in network format.
+	uint32_t		value_len;
+	uint32_t		by_value;		//!< Whether lookups by value find this alias.
+} dict_image_enum_t;
+
+typedef struct {
+	fr_dict_attr_t const	*da;
+	uint32_t		index;
+} dict_image_index_t;
+
+/** Image writer state
+ *
+ */
+typedef struct {
+	fr_dict_t const		*dict;
+
+	dict_image_attr_t	*attrs;
+	uint32_t		num_attrs;
+
+	dict_image_vendor_t	*vendors;
+	uint32_t		num_vendors;
+
+	dict_image_enum_t	*enums;
+	uint32_t		num_enums;
+
+	dict_image_index_t	*index;			//!< Attribute indexes, sorted by pointer.
+
+	uint8_t			*strings;
+	uint32_t		strings_len;
+
+	bool			failed;
+} dict_image_ctx_t;
+
+/** Add data to the string block, followed by a NUL
+ *
+ */
+static uint32_t dict_image_string_add(dict_image_ctx_t *ctx, void const *data, size_t len)
+{
+	uint32_t	offset = ctx->strings_len;
+	size_t		size = talloc_array_length(ctx->strings);
+
+	if (!len) return 0;
+
+	if ((ctx->strings_len + len + 1) > size) {
+		uint8_t *strings;
+
+		while ((ctx->strings_len + len + 1) > size) size *= 2;
+
+		strings = talloc_realloc(NULL, ctx->strings, uint8_t, size);
+		if (!strings) {
+			fr_strerror_printf("Out of memory");
+			ctx->failed = true;
+			return 0;
+		}
+		ctx->strings = strings;
+	}
+
+	memcpy(ctx->strings + ctx->strings_len, data, len);
+	ctx->strings[ctx->strings_len + len] = '\0';
+	ctx->strings_len += len + 1;
+
+	return offset;
+}
+
+static inline uint32_t dict_image_str_add(dict_image_ctx_t *ctx, char const *str)
+{
+	return dict_image_string_add(ctx, str, strlen(str));
+}
+
+static uint32_t dict_image_attr_count(fr_dict_attr_t const *da)
+{
+	size_t			i, len;
+	uint32_t		count = 1;
+	fr_dict_attr_t const	*p;
+
+	len = talloc_array_length(da->children);
+	for (i = 0; i < len; i++) for (p = da->children[i]; p; p = p->next) count += dict_image_attr_count(p);
+
+	return count;
+}
+
+static int dict_image_attr_add(dict_image_ctx_t *ctx, fr_dict_attr_t const *da, uint32_t parent);
+
+/** Add the children in a bin, last first
+ *
+ * dict_attr_child_add() puts a child before any siblings it ties with,
+ * so adding them in reverse gives the same order when the image is
+ * loaded.
+ */
+static int dict_image_bin_add(dict_image_ctx_t *ctx, fr_dict_attr_t const *bin, uint32_t parent)
+{
+	if (!bin) return 0;
+
+	if (dict_image_bin_add(ctx, bin->next, parent) < 0) return -1;
+
+	return dict_image_attr_add(ctx, bin, parent);
+}
+
+static int dict_image_attr_add(dict_image_ctx_t *ctx, fr_dict_attr_t const *da, uint32_t parent)
+{
+	uint32_t		i = ctx->num_attrs++;
+	dict_image_attr_t	*rec = &ctx->attrs[i];
+	size_t			j, len;
+
+	rec->parent = parent;
+	rec->attr = da->attr;
+	rec->type = da->type;
+	rec->name = dict_image_str_add(ctx, da->name);
+	rec->by_name = (fr_dict_attr_by_name(ctx->dict, da->name) == da);
+	rec->flags = da->flags;
+
+	ctx->index[i].da = da;
+	ctx->index[i].index = i;
+
+	if (da->flags.is_reference) {
+		fr_dict_attr_ref_t const	*ref = talloc_get_type_abort_const(da, fr_dict_attr_ref_t);
+		char				oid[FR_DICT_MAX_TLV_STACK * 11];
+
+		/*
+		 *	References are added after everything
+		 *	else, so they can't have children.
+		 */
+		if (da->children) {
+			fr_strerror_printf("Reference attribute \"%s\" has children", da->name);
+			return -1;
+		}
+
+		oid[0] = '\0';
+		if (!ref->to->flags.is_root) fr_dict_print_attr_oid(oid, sizeof(oid), NULL, ref->to);
+
+		rec->ref_proto = dict_image_str_add(ctx, fr_dict_root(ref->dict)->name);
+		rec->ref_oid = dict_image_str_add(ctx, oid);
+		return 0;
+	}
+
+	len = talloc_array_length(da->children);
+	for (j = 0; j < len; j++) if (dict_image_bin_add(ctx, da->children[j], i) < 0) return -1;
+
+	return 0;
+}
+
+static int dict_image_index_cmp(void const *one, void const *two)
+{
+	dict_image_index_t const *a = one, *b = two;
+
+	return (a->da > b->da) - (a->da < b->da);
+}
+
+static int _dict_image_vendor_add(void *uctx, void *data)
+{
+	dict_image_ctx_t	*ctx = uctx;
+	fr_dict_vendor_t const	*dv = data;
+	dict_image_vendor_t	*rec = &ctx->vendors[ctx->num_vendors++];
+
+	rec->pen = dv->pen;
+	rec->type = dv->type;
+	rec->length = dv->length;
+	rec->flags = dv->flags;
+	rec->name = dict_image_str_add(ctx, dv->name);
+	rec->by_num = (fr_dict_vendor_by_num(ctx->dict, dv->pen) == dv);
+
+	return 0;
+}
+
+static int _dict_image_enum_add(void *uctx, void *data)
+{
+	dict_image_ctx_t	*ctx = uctx;
+	fr_dict_enum_t const	*enumv = data;
+	dict_image_enum_t	*rec = &ctx->enums[ctx->num_enums];
+	dict_image_index_t	*found, key = { .da = enumv->da };
+	uint8_t			buffer[256];
+	size_t			need = 0;
+	ssize_t			slen;
+
+	found = bsearch(&key, ctx->index, ctx->num_attrs, sizeof(ctx->index[0]), dict_image_index_cmp);
+	if (!found) {
+		fr_strerror_printf("VALUE \"%s\" is for an attribute which isn't in the dictionary", enumv->alias);
+		return -1;
+	}
+
+	slen = fr_value_box_to_network(&need, buffer, sizeof(buffer), enumv->value);
+	if (slen < 0) {
+		fr_strerror_printf_push("Can't store VALUE \"%s\" of \"%s\"", enumv->alias, enumv->da->name);
+		return -1;
+	}
+
+	rec->da = found->index;
+	rec->type = enumv->value->type;
+	rec->alias = dict_image_str_add(ctx, enumv->alias);
+	rec->value = dict_image_string_add(ctx, buffer, slen);
+	rec->value_len = slen;
+	rec->by_value = (fr_dict_enum_by_value(enumv->da, enumv->value) == enumv);
+	ctx->num_enums++;
+
+	return 0;
+}
+
+static int dict_image_write_all(int fd, void const *data, size_t len)
+{
+	uint8_t const *p = data;
+
+	while (len > 0) {
+		ssize_t slen;
+
+		slen = write(fd, p, len);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += slen;
+		len -= slen;
+	}
+
+	return 0;
+}
+
+/** Write a binary image of a protocol dictionary
+ *
+ * The image can be loaded with #fr_dict_protocol_afrom_image, and is
+ * loaded automatically by #fr_dict_protocol_afrom_file, as long as none
+ * of the files the dictionary was read from have changed.
+ *
+ * @param[in] dict	to write.  Must have been loaded with
+ *			#fr_dict_protocol_afrom_file, and not have had
+ *			attributes added since.
+ * @param[in] filename	to write the image to.  If NULL, the image is written
+ *			next to the protocol's dictionary file.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dict_image_write(fr_dict_t const *dict, char const *filename)
+{
+	dict_image_ctx_t	ctx = { .dict = dict };
+	dict_image_hdr_t	hdr;
+	dict_image_source_t	*sources = NULL;
+	uint32_t		i, num_sources;
+	char			*path = NULL, *tmp = NULL;
+	int			fd = -1;
+	int			ret = -1;
+
+	if (!dict->sources) {
+		fr_strerror_printf("Can't write an image of dictionary \"%s\".  It wasn't read from files, "
+				   "or reading it changed other dictionaries", dict->root->name);
+		return -1;
+	}
+	num_sources = talloc_array_length(dict->sources);
+
+	/*
+	 *	The first file read is the protocol's dictionary file.
+	 */
+	if (!filename) {
+		char const	*file = dict->sources[0].file;
+		char const	*p;
+
+		p = strrchr(file, FR_DIR_SEP);
+		if (p) {
+			path = talloc_asprintf(NULL, "%.*s%c%s", (int) (p - file), file,
+					       FR_DIR_SEP, FR_DICTIONARY_IMAGE_FILE);
+		} else {
+			path = talloc_typed_strdup(NULL, FR_DICTIONARY_IMAGE_FILE);
+		}
+		if (!path) goto oom;
+		filename = path;
+	}
+
+	ctx.strings = talloc_zero_array(NULL, uint8_t, 64 * 1024);
+	ctx.strings_len = 1;	/* Offset 0 is "" */
+
+	i = dict_image_attr_count(dict->root);
+	ctx.attrs = talloc_zero_array(NULL, dict_image_attr_t, i);
+	ctx.index = talloc_zero_array(NULL, dict_image_index_t, i);
+	ctx.vendors = talloc_zero_array(NULL, dict_image_vendor_t, fr_hash_table_num_elements(dict->vendors_by_name));
+	ctx.enums = talloc_zero_array(NULL, dict_image_enum_t, fr_hash_table_num_elements(dict->values_by_alias));
+	sources = talloc_zero_array(NULL, dict_image_source_t, num_sources);
+	if (!ctx.strings || !ctx.attrs || !ctx.index || !ctx.vendors || !ctx.enums || !sources) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		goto done;
+	}
+
+	for (i = 0; i < num_sources; i++) {
+		sources[i].size = dict->sources[i].size;
+		sources[i].mtime = dict->sources[i].mtime;
+		sources[i].file = dict_image_str_add(&ctx, dict->sources[i].file);
+	}
+
+	if (dict_image_attr_add(&ctx, dict->root, 0) < 0) goto done;
+	qsort(ctx.index, ctx.num_attrs, sizeof(ctx.index[0]), dict_image_index_cmp);
+
+	if (fr_hash_table_walk(dict->vendors_by_name, _dict_image_vendor_add, &ctx) < 0) goto done;
+	if (fr_hash_table_walk(dict->values_by_alias, _dict_image_enum_add, &ctx) < 0) goto done;
+	if (ctx.failed) goto done;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DICT_IMAGE_MAGIC, sizeof(hdr.magic));
+	hdr.version = DICT_IMAGE_VERSION;
+	hdr.byte_order = DICT_IMAGE_BYTE_ORDER;
+	hdr.lib_magic = RADIUSD_MAGIC_NUMBER;
+	hdr.sizeof_flags = sizeof(fr_dict_attr_flags_t);
+	hdr.num_sources = num_sources;
+	hdr.num_vendors = ctx.num_vendors;
+	hdr.num_attrs = ctx.num_attrs;
+	hdr.num_enums = ctx.num_enums;
+	hdr.strings_len = ctx.strings_len;
+
+	/*
+	 *	Write to a temporary file, and rename it, so that
+	 *	nothing ever sees a partial image.
+	 */
+	tmp = talloc_asprintf(NULL, "%s.%u", filename, (unsigned int) getpid());
+	if (!tmp) goto oom;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening \"%s\": %s", tmp, fr_syserror(errno));
+		goto done;
+	}
+
+	if ((dict_image_write_all(fd, &hdr, sizeof(hdr)) < 0) ||
+	    (dict_image_write_all(fd, sources, sizeof(sources[0]) * num_sources) < 0) ||
+	    (dict_image_write_all(fd, ctx.vendors, sizeof(ctx.vendors[0]) * ctx.num_vendors) < 0) ||
+	    (dict_image_write_all(fd, ctx.attrs, sizeof(ctx.attrs[0]) * ctx.num_attrs) < 0) ||
+	    (dict_image_write_all(fd, ctx.enums, sizeof(ctx.enums[0]) * ctx.num_enums) < 0) ||
+	    (dict_image_write_all(fd, ctx.strings, ctx.strings_len) < 0)) {
+		fr_strerror_printf("Failed writing \"%s\": %s", tmp, fr_syserror(errno));
+		goto done;
+	}
+
+	if (close(fd) < 0) {
+		fd = -1;
+		fr_strerror_printf("Failed writing \"%s\": %s", tmp, fr_syserror(errno));
+		goto done;
+	}
+	fd = -1;
+
+	if (rename(tmp, filename) < 0) {
+		fr_strerror_printf("Failed renaming \"%s\" to \"%s\": %s", tmp, filename, fr_syserror(errno));
+		goto done;
+	}
+
+	ret = 0;
+
+done:
+	if (fd >= 0) close(fd);
+	if ((ret < 0) && tmp) unlink(tmp);
+
+	talloc_free(tmp);
+	talloc_free(path);
+	talloc_free(sources);
+	talloc_free(ctx.strings);
+	talloc_free(ctx.attrs);
+	talloc_free(ctx.index);
+	talloc_free(ctx.vendors);
+	talloc_free(ctx.enums);
+
+	return ret;
+}
+
+/** Rebuild a dictionary from a mapped image
+ *
+ * @param[out] out	the new dictionary.
+ * @param[in] map	image, which has passed dict_image_check().
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int dict_image_build(fr_dict_t **out, uint8_t const *map)
+{
+	dict_image_hdr_t const		*hdr = (dict_image_hdr_t const *) map;
+	dict_image_vendor_t const	*vendors;
+	dict_image_attr_t const		*attrs;
+	dict_image_enum_t const		*enums;
+	char const			*strings;
+	fr_dict_t			*dict;
+	fr_dict_attr_t			**da;
+	uint32_t			i, pass;
+
+	vendors = (dict_image_vendor_t const *) (map + sizeof(*hdr) +
+						  (sizeof(dict_image_source_t) * hdr->num_sources));
+	attrs = (dict_image_attr_t const *) (vendors + hdr->num_vendors);
+	enums = (dict_image_enum_t const *) (attrs + hdr->num_attrs);
+	strings = (char const *) (enums + hdr->num_enums);
+
+	if (fr_dict_by_protocol_name(strings + attrs[0].name) || fr_dict_by_protocol_num(attrs[0].attr)) {
+		fr_strerror_printf("Protocol \"%s\" is already loaded", strings + attrs[0].name);
+		return -1;
+	}
+
+	dict = dict_alloc(NULL);
+	if (!dict) return -1;
+
+	da = talloc_zero_array(dict->fixup_pool, fr_dict_attr_t *, hdr->num_attrs);
+	if (!da) {
+		fr_strerror_printf("Out of memory");
+	error:
+		talloc_free(dict);
+		return -1;
+	}
+
+	if (dict_root_set(dict, strings + attrs[0].name, attrs[0].attr) < 0) goto error;
+	dict->root->flags = attrs[0].flags;
+	da[0] = dict->root;
+
+	if (dict_protocol_add(dict) < 0) goto error;
+
+	/*
+	 *	Vendors found by number go last, so they replace any
+	 *	others with the same number.
+	 */
+	for (pass = 0; pass < 2; pass++) for (i = 0; i < hdr->num_vendors; i++) {
+		fr_dict_vendor_t const	*dv;
+		fr_dict_vendor_t	*mutable;
+
+		if (vendors[i].by_num != pass) continue;
+
+		if (dict_vendor_add(dict, strings + vendors[i].name, vendors[i].pen) < 0) goto error;
+
+		dv = fr_dict_vendor_by_name(dict, strings + vendors[i].name);
+		if (!dv) goto error;
+
+		memcpy(&mutable, &dv, sizeof(mutable));
+		mutable->type = vendors[i].type;
+		mutable->length = vendors[i].length;
+		mutable->flags = vendors[i].flags;
+	}
+
+	/*
+	 *	References may point anywhere in the dictionary, so
+	 *	they're added after everything else.
+	 */
+	for (pass = 0; pass < 2; pass++) for (i = 1; i < hdr->num_attrs; i++) {
+		dict_image_attr_t const	*rec = &attrs[i];
+		fr_dict_attr_t		*parent = da[rec->parent];
+		fr_dict_attr_t		*n;
+
+		if ((rec->ref_proto != 0) != (pass == 1)) continue;
+
+		if (!parent) {
+			fr_strerror_printf("Parent of \"%s\" is a reference", strings + rec->name);
+			goto error;
+		}
+
+		if (!rec->ref_proto) {
+			n = dict_attr_alloc(dict->pool, parent, strings + rec->name, rec->attr, rec->type, &rec->flags);
+		} else {
+			fr_dict_t const		*ref_dict;
+			fr_dict_attr_t const	*ref;
+			char const		*oid = strings + rec->ref_oid;
+
+			ref_dict = (strcasecmp(strings + rec->ref_proto, dict->root->name) == 0) ?
+				   dict : fr_dict_by_protocol_name(strings + rec->ref_proto);
+			if (!ref_dict) {
+				fr_strerror_printf("Reference to protocol \"%s\", which isn't loaded",
+						   strings + rec->ref_proto);
+				goto error;
+			}
+
+			ref = ref_dict->root;
+			while (*oid) {
+				unsigned int num;
+
+				if ((fr_dict_oid_component(&num, &oid) < 0) ||
+				    !(ref = fr_dict_attr_child_by_num(ref, num))) {
+					fr_strerror_printf("Failed resolving reference %s.%s",
+							   strings + rec->ref_proto, strings + rec->ref_oid);
+					goto error;
+				}
+				if (*oid == '.') oid++;
+			}
+
+			n = dict_attr_ref_alloc(dict, parent, strings + rec->name, rec->attr, rec->type,
+						&rec->flags, ref);
+		}
+		if (!n) goto error;
+
+		if (rec->by_name && (dict_attr_add_by_name(dict, n) < 0)) goto error;
+		if (dict_attr_child_add(parent, n) < 0) goto error;
+
+		if (!rec->ref_proto) da[i] = n;
+	}
+
+	for (i = 0; i < hdr->num_enums; i++) {
+		dict_image_enum_t const	*rec = &enums[i];
+		fr_value_box_t		value;
+		int			ret;
+
+		if (!da[rec->da]) {
+			fr_strerror_printf("VALUE \"%s\" is for a reference attribute", strings + rec->alias);
+			goto error;
+		}
+
+		if (fr_value_box_from_network(dict->fixup_pool, &value, rec->type, NULL,
+					      (uint8_t const *) strings + rec->value, rec->value_len, false) < 0) {
+			goto error;
+		}
+
+		ret = fr_dict_enum_add_alias(da[rec->da], strings + rec->alias, &value, false, rec->by_value);
+		fr_value_box_clear(&value);
+		if (ret < 0) goto error;
+	}
+
+	talloc_free(da);
+
+	if (fr_dict_finalise(dict) < 0) goto error;
+
+	*out = dict;
+
+	return 0;
+}
+
+/** Check that an image is one we can use, and isn't out of date
+ *
+ */
+static int dict_image_check(uint8_t const *map, size_t len)
+{
+	dict_image_hdr_t const		*hdr = (dict_image_hdr_t const *) map;
+	dict_image_source_t const	*sources;
+	dict_image_vendor_t const	*vendors;
+	dict_image_attr_t const		*attrs;
+	dict_image_enum_t const		*enums;
+	char const			*strings;
+	uint64_t			need;
+	uint32_t			i;
+
+	if ((len < sizeof(*hdr)) || (memcmp(hdr->magic, DICT_IMAGE_MAGIC, sizeof(hdr->magic)) != 0)) {
+		fr_strerror_printf("Not a dictionary image");
+		return -1;
+	}
+
+	if ((hdr->version != DICT_IMAGE_VERSION) || (hdr->byte_order != DICT_IMAGE_BYTE_ORDER) ||
+	    (hdr->lib_magic != RADIUSD_MAGIC_NUMBER) || (hdr->sizeof_flags != sizeof(fr_dict_attr_flags_t))) {
+		fr_strerror_printf("Dictionary image was written by a different version of the server");
+		return -1;
+	}
+
+	need = sizeof(*hdr) +
+	       ((uint64_t) sizeof(*sources) * hdr->num_sources) +
+	       ((uint64_t) sizeof(*vendors) * hdr->num_vendors) +
+	       ((uint64_t) sizeof(*attrs) * hdr->num_attrs) +
+	       ((uint64_t) sizeof(*enums) * hdr->num_enums) +
+	       hdr->strings_len;
+	if ((need != len) || !hdr->num_attrs || !hdr->strings_len) {
+	truncated:
+		fr_strerror_printf("Dictionary image is truncated or corrupt");
+		return -1;
+	}
+
+	sources = (dict_image_source_t const *) (map + sizeof(*hdr));
+	vendors = (dict_image_vendor_t const *) (sources + hdr->num_sources);
+	attrs = (dict_image_attr_t const *) (vendors + hdr->num_vendors);
+	enums = (dict_image_enum_t const *) (attrs + hdr->num_attrs);
+	strings = (char const *) (enums + hdr->num_enums);
+
+	/*
+	 *	With the last byte being NUL, any offset inside the
+	 *	block is a valid string.
+	 */
+	if (strings[hdr->strings_len - 1] != '\0') goto truncated;
+
+#define STR_OK(_x) ((_x) < hdr->strings_len)
+
+	for (i = 0; i < hdr->num_vendors; i++) {
+		if (!STR_OK(vendors[i].name) || (vendors[i].by_num > 1)) goto truncated;
+	}
+
+	for (i = 0; i < hdr->num_attrs; i++) {
+		if (!STR_OK(attrs[i].name) || !STR_OK(attrs[i].ref_proto) || !STR_OK(attrs[i].ref_oid) ||
+		    (attrs[i].type >= FR_TYPE_MAX) || ((i > 0) && (attrs[i].parent >= i))) goto truncated;
+	}
+
+	for (i = 0; i < hdr->num_enums; i++) {
+		if (!STR_OK(enums[i].alias) || (enums[i].da >= hdr->num_attrs) || (enums[i].type >= FR_TYPE_MAX) ||
+		    (((uint64_t) enums[i].value + enums[i].value_len) > hdr->strings_len)) goto truncated;
+	}
+
+	/*
+	 *	Finally, check that the files the image was made from
+	 *	haven't changed.
+	 */
+	for (i = 0; i < hdr->num_sources; i++) {
+		struct stat	statbuf;
+		char const	*file;
+
+		if (!STR_OK(sources[i].file)) goto truncated;
+		file = strings + sources[i].file;
+
+		if (stat(file, &statbuf) < 0) {
+			if (sources[i].size < 0) continue;
+
+			fr_strerror_printf("Dictionary image is out of date.  Failed reading \"%s\": %s",
+					   file, fr_syserror(errno));
+			return -1;
+		}
+
+		if ((sources[i].size != statbuf.st_size) || (sources[i].mtime != statbuf.st_mtime)) {
+			fr_strerror_printf("Dictionary image is out of date.  \"%s\" has changed", file);
+			return -1;
+		}
+	}
+
+#undef STR_OK
+
+	return 0;
+}
+
+/** Map an image, check it, and rebuild the dictionary from it
+ *
+ */
+static int dict_image_load(fr_dict_t **out, char const *filename)
+{
+	int		fd;
+	struct stat	statbuf;
+	void		*map;
+	int		ret;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening \"%s\": %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &statbuf) < 0) {
+		fr_strerror_printf("Failed reading \"%s\": %s", filename, fr_syserror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (statbuf.st_size < (off_t) sizeof(dict_image_hdr_t)) {
+		fr_strerror_printf("Dictionary image \"%s\" is truncated", filename);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping \"%s\": %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	ret = dict_image_check(map, statbuf.st_size);
+	if (ret == 0) ret = dict_image_build(out, map);
+	if (ret < 0) fr_strerror_printf_push("Can't use \"%s\"", filename);
+
+	munmap(map, statbuf.st_size);
+
+	return ret;
+}
+
+/** Turn automatic loading of dictionary images on or off
+ *
+ * @param[in] enable	whether #fr_dict_protocol_afrom_file should load
+ *			protocol dictionaries from binary images where
+ *			they're available.
+ */
+void fr_dict_image_enable(bool enable)
+{
+	dict_image_enabled = enable;
+}
+
+/** (Re-)Initialize the special internal dictionary
+ *
+ * This dictionary has additional programatically generated attributes added to it,
+ * and is checked in addition to the protocol specific dictionaries.
+ *
+ * @note The dictionary pointer returned in out must have its reference counter
+ *	 decremented with #fr_dict_free when no longer used.
+ *
+ * @param[out] out		Where to write pointer to the internal dictionary.
+ * @param[in] dict_subdir	name of the internal dictionary dir (may be NULL).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dict_internal_afrom_file(fr_dict_t **out, char const *dict_subdir)
+{
+	fr_dict_t		*dict;
+	char			*dict_path = NULL;
+	char			*tmp;
+	FR_NAME_NUMBER const	*p;
+	fr_dict_attr_flags_t	flags = { .internal = true };
+	char			*type_name;
+
+	if (unlikely(!protocol_by_name || !protocol_by_num)) {
+		fr_strerror_printf("fr_dict_global_init() must be called before loading dictionary files");
+		return -1;
+	}
+
+	/*
+	 *	Increase the reference count of the internal dictionary.
+	 */
+	if (fr_dict_internal) {
+		 talloc_increase_ref_count(fr_dict_internal);
+		 *out = fr_dict_internal;
+		 return 0;
+	}
+
+	memcpy(&tmp, &default_dict_dir, sizeof(tmp));
+	dict_path = dict_subdir ? talloc_asprintf(NULL, "%s%c%s", default_dict_dir, FR_DIR_SEP, dict_subdir) : tmp;
+
+	dict = dict_alloc(dict_ctx);
+	if (!dict) {
+	error:
+		if (!fr_dict_internal) talloc_free(dict);
+		talloc_free(dict_path);
+		return -1;
+	}
+
+	/*
+	 *	Set the root name of the dictionary
 	 */
 	dict_root_set(dict, "internal", 0);
 
@@ -5197,6 +6394,7 @@ int fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name)
 	char		*proto_dir;
 	char		*p;
 	fr_dict_t	*dict;
+	int		num_protocols, num_internal;
 
 	if (unlikely(!protocol_by_name || !protocol_by_num)) {
 		fr_strerror_printf("fr_dict_global_init() must be called before loading dictionary files");
@@ -5226,6 +6424,36 @@ int fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name)
 	for (p = proto_dir; *p; p++) if ((*p == '_') || (*p == '-')) *p = FR_DIR_SEP;
 	dir = talloc_asprintf(proto_dir, "%s%c%s", default_dict_dir, FR_DIR_SEP, proto_dir);
 
+	/*
+	 *	Use the binary image if there's a usable one.
+	 *	Otherwise, quietly fall back to the text files.
+	 */
+	if (dict_image_enabled && !dict) {
+		char *image = talloc_asprintf(proto_dir, "%s%c%s", dir, FR_DIR_SEP, FR_DICTIONARY_IMAGE_FILE);
+
+		if (image && (access(image, R_OK) == 0) && (dict_image_load(&dict, image) == 0)) {
+			if (strcasecmp(dict->root->name, proto_name) == 0) {
+				talloc_free(proto_dir);
+				goto done;
+			}
+			talloc_free(dict);
+			dict = NULL;
+		}
+		fr_strerror_printf(NULL);	/* delete all errors */
+	}
+
+	/*
+	 *	Record the files we read, so that an image can be
+	 *	written later.  That's only possible if they don't
+	 *	also change the internal dictionary, or define other
+	 *	protocols.
+	 */
+	num_protocols = fr_hash_table_num_elements(protocol_by_name);
+	num_internal = fr_hash_table_num_elements(fr_dict_internal->attributes_by_name) +
+		       fr_hash_table_num_elements(fr_dict_internal->vendors_by_name) +
+		       fr_hash_table_num_elements(fr_dict_internal->values_by_alias);
+	dict_sources = talloc_array(proto_dir, dict_source_t, 0);
+
 	/*
 	 *	Start in the context of the internal dictionary,
 	 *	and switch to the context of a protocol dictionary
@@ -5237,6 +6465,7 @@ int fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name)
 	 */
 	if (dict_from_file(fr_dict_internal, dir, FR_DICTIONARY_FILE, NULL, 0) < 0) {
 	error:
+		dict_sources = NULL;
 		talloc_free(proto_dir);
 		return -1;
 	}
@@ -5258,8 +6487,18 @@ int fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name)
 	 */
 	if (fr_dict_finalise(dict) < 0) goto error;
 
+	if (dict_sources && !dict->sources &&
+	    (fr_hash_table_num_elements(protocol_by_name) == (num_protocols + 1)) &&
+	    (num_internal == (fr_hash_table_num_elements(fr_dict_internal->attributes_by_name) +
+			      fr_hash_table_num_elements(fr_dict_internal->vendors_by_name) +
+			      fr_hash_table_num_elements(fr_dict_internal->values_by_alias)))) {
+		dict->sources = talloc_steal(dict, dict_sources);
+	}
+	dict_sources = NULL;
+
 	talloc_free(proto_dir);
 
+done:
 	/*
 	 *	If we're autoloading a previously defined dictionary,
 	 *	then mark up the dictionary as now autoloaded.
@@ -5274,6 +6513,59 @@ int fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name)
 	return 0;
 }
 
+/** Load a protocol dictionary from a binary image
+ *
+ * Unlike #fr_dict_protocol_afrom_file, this doesn't fall back to the
+ * text files if the image can't be used.
+ *
+ * @param[out] out		Where to write a pointer to the new dictionary.
+ * @param[in] proto_name	that we're loading the dictionary for.
+ * @param[in] filename		of the image.  If NULL, the image next to the
+ *				protocol's dictionary file is used.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dict_protocol_afrom_image(fr_dict_t **out, char const *proto_name, char const *filename)
+{
+	char		*proto_dir = NULL;
+	char		*p;
+	fr_dict_t	*dict;
+
+	if (unlikely(!protocol_by_name || !protocol_by_num)) {
+		fr_strerror_printf("fr_dict_global_init() must be called before loading dictionary files");
+		return -1;
+	}
+
+	if (fr_dict_by_protocol_name(proto_name)) {
+		fr_strerror_printf("Protocol \"%s\" is already loaded", proto_name);
+		return -1;
+	}
+
+	if (!filename) {
+		proto_dir = talloc_strdup(dict_ctx, proto_name);
+		for (p = proto_dir; *p; p++) if ((*p == '_') || (*p == '-')) *p = FR_DIR_SEP;
+		filename = talloc_asprintf(proto_dir, "%s%c%s%c%s", default_dict_dir, FR_DIR_SEP, proto_dir,
+					   FR_DIR_SEP, FR_DICTIONARY_IMAGE_FILE);
+	}
+
+	if (dict_image_load(&dict, filename) < 0) {
+		talloc_free(proto_dir);
+		return -1;
+	}
+	talloc_free(proto_dir);
+
+	if (strcasecmp(dict->root->name, proto_name) != 0) {
+		fr_strerror_printf("Image is for protocol \"%s\", not \"%s\"", dict->root->name, proto_name);
+		talloc_free(dict);
+		return -1;
+	}
+
+	*out = dict;
+
+	return 0;
+}
+
 /** Read supplementary attribute definitions into an existing dictionary
  *
  * @param[in] dict	Existing dictionary.
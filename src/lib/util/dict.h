@@ -39,6 +39,7 @@ extern "C" {
  *	Avoid circular type references.
  */
 typedef struct dict_attr fr_dict_attr_t;
+typedef struct dict_attr_index fr_dict_attr_index_t;
 typedef struct fr_dict fr_dict_t;
 
 #include <freeradius-devel/util/value.h>
@@ -93,6 +94,8 @@ struct dict_attr {
 	fr_dict_attr_t const	*parent;			//!< Immediate parent of this attribute.
 	fr_dict_attr_t const	**children;			//!< Children of this attribute.
 	fr_dict_attr_t const	*next;				//!< Next child in bin.
+	fr_dict_attr_index_t	*child_index;			//!< Children indexed by number, built when
+								///< the dictionary is finalised.
 
 	unsigned int		depth;				//!< Depth of nesting for this attribute.
 
@@ -342,6 +345,9 @@ fr_dict_attr_t const	*fr_dict_attr_child_by_da(fr_dict_attr_t const *parent, fr_
 
 fr_dict_attr_t const	*fr_dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned int attr);
 
+size_t			fr_dict_attr_child_by_num_batch(fr_dict_attr_t const **out, fr_dict_attr_t const *parent,
+							unsigned int const *attr, size_t num) CC_HINT(nonnull);
+
 fr_dict_enum_t		*fr_dict_enum_by_value(fr_dict_attr_t const *da, fr_value_box_t const *value);
 
 char const		*fr_dict_enum_alias_by_value(fr_dict_attr_t const *da, fr_value_box_t const *value);
@@ -360,6 +366,17 @@ int			fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name);
 int			fr_dict_read(fr_dict_t *dict, char const *dict_dir, char const *filename);
 /** @} */
 
+/** @name Binary dictionary images
+ *
+ * @{
+ */
+int			fr_dict_image_write(fr_dict_t const *dict, char const *filename);
+
+int			fr_dict_protocol_afrom_image(fr_dict_t **out, char const *proto_name, char const *filename);
+
+void			fr_dict_image_enable(bool enable);
+/** @} */
+
 /** @name Autoloader interface
  *
  * @{
@@ -18,6 +18,13 @@
  *
  * Non-thread-safe event handling specific to FreeRADIUS.
  *
+ * On Linux, I/O filters and user events are serviced natively with
+ * epoll and eventfd, instead of going through the libkqueue emulation
+ * layer.  Filters epoll can't provide (vnode, proc, and I/O on regular
+ * files) are still passed to a kqueue, which is created on first use,
+ * and whose descriptor is itself watched by the epoll instance.
+ * Define WITH_EVENT_KQUEUE to use kqueue for everything.
+ *
  * By non-thread-safe we mean multiple threads can't insert/delete
  * events concurrently into the same event list without synchronization.
  *
@@ -40,12 +47,48 @@ RCSID("$Id$")
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/timer_wheel.h>
 #include <freeradius-devel/util/token.h>
 
 #include <sys/stat.h>
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H) && !defined(WITH_EVENT_KQUEUE)
+#  define WITH_EVENT_EPOLL 1
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#endif
+
 #define FR_EV_BATCH_FDS (256)
 
+#ifdef WITH_EVENT_EPOLL
+/*
+ *	Each epoll event can expand into a read and a write kevent,
+ *	the rest of el->events is left for the nested kqueue.
+ */
+#  define FR_EV_BATCH_EPOLL	(FR_EV_BATCH_FDS / 4)
+
+/*
+ *	Low bits of epoll_event.data.u64 say what the event is for.
+ *	All of the pointers we store are talloc'd, so are suitably
+ *	aligned.
+ */
+#  define FR_EV_EPOLL_FD	(0)		//!< data is an fr_event_fd_t.
+#  define FR_EV_EPOLL_USER	(1)		//!< data is an fr_event_user_t.
+#  define FR_EV_EPOLL_KQ	(2)		//!< The nested kqueue is readable.
+#  define FR_EV_EPOLL_EXIT	(3)		//!< The exit eventfd was written to.
+#  define FR_EV_EPOLL_MASK	((uintptr_t) 3)
+
+/*
+ *	Set in idents returned by fr_event_user_insert(), which are
+ *	signalled by writing to an eventfd instead of a kqueue.
+ *	User space pointers never have the top bit set, and neither
+ *	do the small integer idents callers use with their own kqueues.
+ */
+#  define FR_EV_USER_EVENTFD	((uintptr_t) 1 << ((sizeof(uintptr_t) * 8) - 1))
+#else
+#  define FR_EV_USER_EVENTFD	((uintptr_t) 0)
+#endif
+
 #undef USEC
 #define USEC (1000000)
 
@@ -91,6 +134,7 @@ struct fr_event_timer {
 
 	fr_event_timer_t const	**parent;		//!< Previous timer.
 	int32_t			heap_id;	       	//!< Where to store opaque heap data.
+	fr_timer_wheel_entry_t	wheel;			//!< Where to store timer wheel data.
 };
 
 typedef enum {
@@ -252,6 +296,10 @@ struct fr_event_fd {
 							///< kevent.  Mostly for debugging.
 	bool			in_fd_to_free;		//!< Whether this event is in the fd_to_free list.
 
+#ifdef WITH_EVENT_EPOLL
+	uint32_t		ep_events;		//!< Events currently registered with epoll.
+#endif
+
 	void			*uctx;			//!< Context pointer to pass to each file descriptor callback.
 	TALLOC_CTX		*linked_ctx;		//!< talloc ctx this event was bound to.
 
@@ -292,6 +340,10 @@ typedef struct {
 	uintptr_t		ident;			//!< The identifier of this event.
 	fr_event_user_handler_t callback;		//!< The callback to call.
 	void			*uctx;			//!< Context for the callback.
+#ifdef WITH_EVENT_EPOLL
+	fr_event_list_t		*el;			//!< Event list we're registered with.
+	int			fd;			//!< eventfd used to signal this event.
+#endif
 } fr_event_user_t;
 
 /** Stores all information relating to an event list
@@ -299,6 +351,7 @@ typedef struct {
  */
 struct fr_event_list {
 	fr_heap_t		*times;			//!< of timer events to be executed.
+	fr_timer_wheel_t	*wheel;			//!< of timer events, used instead of times if set.
 	rbtree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 
 	int			exit;			//!< If non-zero, the event loop will exit after its current
@@ -312,6 +365,12 @@ struct fr_event_list {
 
 	int			kq;			//!< instance associated with this event list.
 
+#ifdef WITH_EVENT_EPOLL
+	int			epfd;			//!< epoll instance servicing I/O and user events.
+	int			exit_fd;		//!< eventfd used to wake the loop on exit.
+	struct epoll_event	ep_events[FR_EV_BATCH_EPOLL];
+#endif
+
 	fr_dlist_head_t		pre_callbacks;		//!< callbacks when we may be idle...
 	fr_dlist_head_t		user_callbacks;		//!< EVFILT_USER callbacks
 	fr_dlist_head_t		post_callbacks;		//!< post-processing callbacks
@@ -379,10 +438,91 @@ int fr_event_list_num_timers(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
+	if (el->wheel) return fr_timer_wheel_num_elements(el->wheel);
+
 	return fr_heap_num_elements(el->times);
 }
 
+/** Convert a struct timeval to nanoseconds, for the timer wheel
+ *
+ */
+static inline fr_time_t fr_event_timeval_to_time(struct timeval const *tv)
+{
+	return (((fr_time_t) tv->tv_sec) * NANOSEC) + (((fr_time_t) tv->tv_usec) * 1000);
+}
+
+/** Find when the first timer event should run
+ *
+ * With a timer wheel, this may be earlier than the actual time
+ * of the first event, in which case the caller will find nothing
+ * to run, and ask again.
+ *
+ * @param[in] el	to check.
+ * @param[out] when	the first event should run.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there are no timer events.
+ */
+static int fr_event_timer_next(fr_event_list_t *el, struct timeval *when)
+{
+	fr_event_timer_t	*ev;
+	fr_time_t		next;
+
+	if (el->wheel) {
+		if (fr_timer_wheel_next(el->wheel, &next) < 0) return -1;
+
+		when->tv_sec = next / NANOSEC;
+		when->tv_usec = (next % NANOSEC) / 1000;
+		return 0;
+	}
+
+	ev = fr_heap_peek(el->times);
+	if (!ev) return -1;
+
+	*when = ev->when;
+	return 0;
+}
+
+/** Use a timer wheel instead of a heap for timer events
+ *
+ * Timer insert and delete become O(1), instead of O(log n).  Timers
+ * which are due within the same resolution period may run in insert
+ * order, instead of strict time order.
+ *
+ * Must be called before any timers are inserted.
+ *
+ * @param[in] el		to change.
+ * @param[in] resolution	of the wheel, in nanoseconds.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_event_list_timer_wheel(fr_event_list_t *el, fr_time_t resolution)
+{
+	struct timeval now;
+
+	if (el->wheel) return 0;
+
+	if (fr_heap_num_elements(el->times) > 0) {
+		fr_strerror_printf("Can't use a timer wheel once timers have been inserted");
+		return -1;
+	}
+
+	gettimeofday(&now, NULL);
+
+	el->wheel = fr_timer_wheel_create(el, resolution, fr_event_timeval_to_time(&now), fr_event_timer_t, wheel);
+	if (!el->wheel) {
+		fr_strerror_printf("Failed allocating timer wheel");
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Return the kq associated with an event list.
+ *
+ * When built with the epoll backend, this is the epoll descriptor.
+ * It should only be passed to the fr_event_user_* signalling functions.
  *
  * @param[in] el to return timer events for.
  * @return kq
@@ -391,7 +531,11 @@ int fr_event_list_kq(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
+#ifdef WITH_EVENT_EPOLL
+	return el->epfd;
+#else
 	return el->kq;
+#endif
 }
 
 /** Get the current time according to the event list
@@ -603,6 +747,104 @@ static int fr_event_fd_type_set(fr_event_fd_t *ef, int fd)
 	return 0;
 }
 
+#ifdef WITH_EVENT_EPOLL
+/** Create the kqueue used for the filters epoll can't service
+ *
+ * The kqueue descriptor is added to the epoll set, so we know when
+ * to collect events from it.
+ *
+ * @param[in] el	to create the kqueue for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int fr_event_kq_init(fr_event_list_t *el)
+{
+	struct epoll_event	ev = { .events = EPOLLIN, .data.u64 = FR_EV_EPOLL_KQ };
+	int			kq;
+
+	if (el->kq >= 0) return 0;
+
+	kq = kqueue();
+	if (kq < 0) return -1;
+
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, kq, &ev) < 0) {
+		int err = errno;
+
+		close(kq);
+		errno = err;
+		return -1;
+	}
+	el->kq = kq;
+
+	return 0;
+}
+
+/** Make the epoll registration of an fd match its active I/O functions
+ *
+ * Registrations are level triggered, the same as kevent filters
+ * without EV_CLEAR.
+ *
+ * @param[in] el	the fd is registered with.
+ * @param[in] ef	to update.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int fr_event_epoll_update(fr_event_list_t *el, fr_event_fd_t *ef)
+{
+	struct epoll_event	ev = { .events = 0, .data.ptr = ef };
+	int			op;
+
+	if (ef->active.io.read) ev.events |= EPOLLIN | EPOLLRDHUP;
+	if (ef->active.io.write) ev.events |= EPOLLOUT;
+
+	if (ev.events == ef->ep_events) return 0;
+
+	if (!ev.events) {
+		op = EPOLL_CTL_DEL;
+	} else if (!ef->ep_events) {
+		op = EPOLL_CTL_ADD;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	if (epoll_ctl(el->epfd, op, ef->fd, &ev) < 0) return -1;
+	ef->ep_events = ev.events;
+
+	return 0;
+}
+#endif
+
+/** Apply filter changes built by #fr_event_build_evset
+ *
+ * With the epoll backend, I/O filters on anything other than
+ * regular files are serviced by epoll, and the evset is ignored.
+ *
+ * @param[in] el	the fd is registered with.
+ * @param[in] ef	the changes are for.
+ * @param[in] evset	changes to apply.
+ * @param[in] count	number of changes in evset.
+ * @return
+ *	- >= 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+#ifdef WITH_EVENT_EPOLL
+static int fr_event_fd_kevent(fr_event_list_t *el, fr_event_fd_t *ef, struct kevent evset[], int count)
+{
+	if ((ef->filter == FR_EVENT_FILTER_IO) && (ef->type != FR_EVENT_FD_FILE)) return fr_event_epoll_update(el, ef);
+
+	if (fr_event_kq_init(el) < 0) return -1;
+
+	return kevent(el->kq, evset, count, NULL, 0, NULL);
+}
+#else
+static int fr_event_fd_kevent(fr_event_list_t *el, UNUSED fr_event_fd_t *ef, struct kevent evset[], int count)
+{
+	return kevent(el->kq, evset, count, NULL, 0, NULL);
+}
+#endif
+
 /** Remove a file descriptor from the event loop and rbtree but don't explicitly free it
  *
  *
@@ -636,7 +878,7 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 			/*
 			 *	If this fails, assert on debug builds.
 			 */
-			ret = kevent(el->kq, evset, count, NULL, 0, NULL);
+			ret = fr_event_fd_kevent(el, ef, evset, count);
 			if (!fr_cond_assert_msg(ret >= 0,
 						"FD was closed without being removed from the KQ: %s",
 						fr_syserror(errno))) {
@@ -792,7 +1034,7 @@ int fr_event_filter_update(fr_event_list_t *el, int fd, fr_event_filter_t filter
 		return -1;
 	}
 
-	if (count && unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+	if (count && unlikely(fr_event_fd_kevent(el, ef, evset, count) < 0)) {
 		fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
 		goto error;
 	}
@@ -883,15 +1125,15 @@ int fr_event_filter_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 			fr_strerror_printf("Filter %i not supported", filter);
 			goto free;
 		}
+		ef->filter = filter;
 
 		count = fr_event_build_evset(evset, sizeof(evset)/sizeof(*evset), &ef->active, ef, funcs, &ef->active);
 		if (count < 0) goto free;
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(fr_event_fd_kevent(el, ef, evset, count) < 0))) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto free;
 		}
 
-		ef->filter = filter;
 		el->num_fds++;
 		rbtree_insert(el->fds, ef);
 		ef->is_registered = true;
@@ -916,7 +1158,7 @@ int fr_event_filter_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 			memcpy(&ef->active, &active, sizeof(ef->active));
 			return -1;
 		}
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(fr_event_fd_kevent(el, ef, evset, count) < 0))) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto error;
 		}
@@ -995,7 +1237,11 @@ static int _event_timer_free(fr_event_timer_t *ev)
 	fr_event_timer_t const **ev_p;
 	int		ret;
 
-	ret = fr_heap_extract(el->times, ev);
+	if (el->wheel) {
+		ret = fr_timer_wheel_extract(el->wheel, ev);
+	} else {
+		ret = fr_heap_extract(el->times, ev);
+	}
 
 	ev_p = ev->parent;
 	rad_assert(*(ev->parent) == ev);
@@ -1100,7 +1346,11 @@ int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t
 		 *	Event may have fired, in which case the
 		 *	event will no longer be in the event loop.
 		 */
-		(void) fr_heap_extract(el->times, ev);
+		if (el->wheel) {
+			(void) fr_timer_wheel_extract(el->wheel, ev);
+		} else {
+			(void) fr_heap_extract(el->times, ev);
+		}
 	}
 
 	ev->el = el;
@@ -1110,7 +1360,12 @@ int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t
 	ev->linked_ctx = ctx;
 	ev->parent = ev_p;
 
-	if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
+	if (el->wheel) {
+		if (unlikely(fr_timer_wheel_insert(el->wheel, ev, fr_event_timeval_to_time(when)) < 0)) {
+			talloc_free(ev);
+			return -1;
+		}
+	} else if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
 		talloc_free(ev);
 		return -1;
 	}
@@ -1130,6 +1385,7 @@ static int _event_pid_free(fr_event_pid_t *ev)
 	struct kevent evset;
 
 	if (ev->pid == 0) return 0; /* already deleted from kevent */
+	if (ev->el->kq < 0) return 0;
 
 	EV_SET(&evset, ev->pid, EVFILT_PROC, EV_DELETE, NOTE_EXIT, 0, ev);
 
@@ -1162,7 +1418,15 @@ int fr_event_pid_wait(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_pid_t const
 	fr_event_pid_t *ev;
 	struct kevent evset;
 
+#ifdef WITH_EVENT_EPOLL
+	if (unlikely(fr_event_kq_init(el) < 0)) {
+		fr_strerror_printf("Failed allocating kqueue: %s", fr_syserror(errno));
+		return -1;
+	}
+#endif
+
 	ev = talloc(ctx, fr_event_pid_t);
+	ev->el = el;
 	ev->pid = pid;
 	ev->callback = wait_fn;
 	ev->uctx = uctx;
@@ -1179,7 +1443,25 @@ int fr_event_pid_wait(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_pid_t const
 	return 0;
 }
 
+#ifdef WITH_EVENT_EPOLL
+/** Remove a user event's eventfd from epoll, and close it
+ *
+ * @param[in] user	being freed.
+ * @return 0
+ */
+static int _event_user_free(fr_event_user_t *user)
+{
+	(void) epoll_ctl(user->el->epfd, EPOLL_CTL_DEL, user->fd, NULL);
+	close(user->fd);
+
+	return 0;
+}
+#endif
+
 /** Add a user callback to the event list.
+ *
+ * The returned ident should be passed to #fr_event_user_arm, and
+ * then to #fr_event_user_trigger to signal the event.
  *
  * @param[in] el	Containing the timer events.
  * @param[in] callback	for EVFILT_USER.
@@ -1197,9 +1479,33 @@ uintptr_t fr_event_user_insert(fr_event_list_t *el, fr_event_user_handler_t call
 	user->uctx = uctx;
 	user->ident = (uintptr_t) user;
 
+#ifdef WITH_EVENT_EPOLL
+	{
+		struct epoll_event ev = { .events = EPOLLIN, .data.u64 = (uintptr_t) user | FR_EV_EPOLL_USER };
+
+		user->el = el;
+		user->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (user->fd < 0) {
+			fr_strerror_printf("Failed creating eventfd: %s", fr_syserror(errno));
+			talloc_free(user);
+			return 0;
+		}
+
+		if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, user->fd, &ev) < 0) {
+			fr_strerror_printf("Failed adding eventfd to epoll: %s", fr_syserror(errno));
+			close(user->fd);
+			talloc_free(user);
+			return 0;
+		}
+		talloc_set_destructor(user, _event_user_free);
+
+		user->ident |= FR_EV_USER_EVENTFD;
+	}
+#endif
+
 	fr_dlist_insert_tail(&el->user_callbacks, user);
 
-	return user->ident;;
+	return user->ident;
 }
 
 /** Delete a user callback to the event list.
@@ -1231,6 +1537,80 @@ int fr_event_user_delete(fr_event_list_t *el, fr_event_user_handler_t callback,
 	return -1;
 }
 
+/** Start listening for a user event
+ *
+ * Idents returned by #fr_event_user_insert may be signalled with an
+ * eventfd, in which case they are already registered, and this is a
+ * no-op.  Any other ident is added to the kqueue as an EVFILT_USER
+ * filter.
+ *
+ * @param[in] kq	to add the filter to.
+ * @param[in] ident	of the user event.
+ * @return
+ *	- < 0 on error, with errno set.
+ *	- 0 on success.
+ */
+int fr_event_user_arm(int kq, uintptr_t ident)
+{
+	struct kevent kev;
+
+	if (ident & FR_EV_USER_EVENTFD) return 0;
+
+	EV_SET(&kev, ident, EVFILT_USER, EV_ADD | EV_CLEAR, NOTE_FFNOP, 0, NULL);
+	return kevent(kq, &kev, 1, NULL, 0, NULL);
+}
+
+/** Stop listening for a user event
+ *
+ * @param[in] kq	to remove the filter from.
+ * @param[in] ident	of the user event.
+ * @return
+ *	- < 0 on error, with errno set.
+ *	- 0 on success.
+ */
+int fr_event_user_disarm(int kq, uintptr_t ident)
+{
+	struct kevent kev;
+
+	if (ident & FR_EV_USER_EVENTFD) return 0;
+
+	EV_SET(&kev, ident, EVFILT_USER, EV_DELETE, NOTE_FFNOP, 0, NULL);
+	return kevent(kq, &kev, 1, NULL, 0, NULL);
+}
+
+/** Signal a user event
+ *
+ * May be called from any thread.
+ *
+ * @param[in] kq	the user event was armed with.
+ * @param[in] ident	of the user event.
+ * @return
+ *	- < 0 on error, with errno set.
+ *	- >= 0 on success.
+ */
+int fr_event_user_trigger(int kq, uintptr_t ident)
+{
+	struct kevent kev;
+
+#ifdef WITH_EVENT_EPOLL
+	if (ident & FR_EV_USER_EVENTFD) {
+		fr_event_user_t	*user = (fr_event_user_t *)(ident & ~FR_EV_USER_EVENTFD);
+		uint64_t	one = 1;
+
+		/*
+		 *	EAGAIN means the counter is saturated, so
+		 *	the event is already pending.
+		 */
+		if ((write(user->fd, &one, sizeof(one)) < 0) && (errno != EAGAIN)) return -1;
+
+		return 0;
+	}
+#endif
+
+	EV_SET(&kev, ident, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
+	return kevent(kq, &kev, 1, NULL, 0, NULL);
+}
+
 /** Add a pre-event callback to the event list.
  *
  *  Events are serviced in insert order.  i.e. insert A, B, we then
@@ -1355,6 +1735,18 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 
 	if (unlikely(!el)) return 0;
 
+	if (el->wheel) {
+		ev = fr_timer_wheel_peek(el->wheel, fr_event_timeval_to_time(when));
+		if (!ev) {
+			if (fr_event_timer_next(el, when) < 0) {
+				when->tv_sec = 0;
+				when->tv_usec = 0;
+			}
+			return 0;
+		}
+		goto run;
+	}
+
 	if (fr_heap_num_elements(el->times) == 0) {
 		when->tv_sec = 0;
 		when->tv_usec = 0;
@@ -1378,6 +1770,8 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 		return 0;
 	}
 
+run:
+
 	callback = ev->callback;
 	memcpy(&uctx, &ev->uctx, sizeof(uctx));
 
@@ -1393,6 +1787,119 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 	return 1;
 }
 
+#ifdef WITH_EVENT_EPOLL
+/** Wait for epoll events, and translate them into kevents
+ *
+ * Readiness of an I/O fd becomes a separate EVFILT_READ and
+ * EVFILT_WRITE kevent, so #fr_event_service doesn't need to know
+ * which backend produced the events.
+ *
+ * @param[in] el	to wait on.
+ * @param[in] ts_wake	how long to wait for, NULL to wait forever.
+ * @return
+ *	- < 0 on error, with errno set.
+ *	- the number of kevents written to el->events.
+ */
+static int fr_event_epoll_wait(fr_event_list_t *el, struct timespec const *ts_wake)
+{
+	static struct timespec const	ts_poll = { 0, 0 };
+	int				timeout = -1;
+	int				i, num, out = 0;
+	bool				kq_ready = false;
+	uint64_t			count;
+
+	/*
+	 *	epoll only does milliseconds, round up so we
+	 *	don't wake before the next timer is due.
+	 */
+	if (ts_wake) {
+		if (ts_wake->tv_sec >= (INT_MAX / 1000) - 1) {
+			timeout = INT_MAX;
+		} else {
+			timeout = (ts_wake->tv_sec * 1000) + ((ts_wake->tv_nsec + 999999) / 1000000);
+		}
+	}
+
+	num = epoll_wait(el->epfd, el->ep_events, FR_EV_BATCH_EPOLL, timeout);
+	if (num < 0) return -1;
+
+	for (i = 0; i < num; i++) {
+		uint32_t	events = el->ep_events[i].events;
+		uintptr_t	data = (uintptr_t) el->ep_events[i].data.u64;
+
+		switch (data & FR_EV_EPOLL_MASK) {
+		case FR_EV_EPOLL_FD:
+		{
+			fr_event_fd_t	*ef = (fr_event_fd_t *) data;
+			uint16_t	flags = 0;
+			int		fd_errno = 0;
+
+			/*
+			 *	kqueue reports socket errors as EV_EOF,
+			 *	with the error in fflags.
+			 */
+			if (events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+				flags |= EV_EOF;
+
+				if (events & EPOLLERR) {
+					socklen_t len = sizeof(fd_errno);
+
+					(void) getsockopt(ef->fd, SOL_SOCKET, SO_ERROR, &fd_errno, &len);
+				}
+			}
+
+			if (ef->active.io.read && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+				EV_SET(&el->events[out++], ef->fd, EVFILT_READ, flags, fd_errno, 0, ef);
+			}
+
+			if (ef->active.io.write && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+				EV_SET(&el->events[out++], ef->fd, EVFILT_WRITE, flags, fd_errno, 0, ef);
+			}
+		}
+			break;
+
+		/*
+		 *	Reading the eventfd resets it, which is the
+		 *	equivalent of EV_CLEAR.  A failed read means
+		 *	another wakeup already drained it.
+		 */
+		case FR_EV_EPOLL_USER:
+		{
+			fr_event_user_t *user = (fr_event_user_t *)(data & ~FR_EV_EPOLL_MASK);
+
+			if (read(user->fd, &count, sizeof(count)) != sizeof(count)) break;
+
+			EV_SET(&el->events[out++], user->ident, EVFILT_USER, EV_CLEAR, NOTE_FFNOP, count, NULL);
+		}
+			break;
+
+		case FR_EV_EPOLL_KQ:
+			kq_ready = true;
+			break;
+
+		/*
+		 *	Just a wakeup, el->exit is already set,
+		 *	so there's nothing to service.
+		 */
+		case FR_EV_EPOLL_EXIT:
+			if (read(el->exit_fd, &count, sizeof(count)) < 0) continue;
+			break;
+		}
+	}
+
+	/*
+	 *	Collect whatever the kqueue has, without blocking.
+	 */
+	if (kq_ready) {
+		num = kevent(el->kq, NULL, 0, el->events + out, FR_EV_BATCH_FDS - out, &ts_poll);
+		if (num < 0) return -1;
+		out += num;
+	}
+
+	return out;
+}
+#endif
+
 /** Gather outstanding timer and file descriptor events
  *
  * @param[in] el	to process events for.
@@ -1425,11 +1932,10 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 	wake = &when;
 
 	if (wait) {
-		if (fr_heap_num_elements(el->times) > 0) {
-			fr_event_timer_t *ev;
+		if (fr_event_list_num_timers(el) > 0) {
+			struct timeval next;
 
-			ev = fr_heap_peek(el->times);
-			if (!fr_cond_assert(ev)) {
+			if (!fr_cond_assert(fr_event_timer_next(el, &next) == 0)) {
 				fr_strerror_printf("Timer heap says it is non-empty, but there are no entries in it");
 				return -1;
 			}
@@ -1440,7 +1946,7 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 			 *	Next event is in the future, get the time
 			 *	between now and that event.
 			 */
-			if (fr_timeval_cmp(&ev->when, &el->now) > 0) fr_timeval_subtract(&when, &ev->when, &el->now);
+			if (fr_timeval_cmp(&next, &el->now) > 0) fr_timeval_subtract(&when, &next, &el->now);
 
 			wake = &when;
 			num_timer_events = 1;
@@ -1478,7 +1984,11 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 	 *	that occurred since this function was last called
 	 *	or wait for the next timer event.
 	 */
+#ifdef WITH_EVENT_EPOLL
+	num_fd_events = fr_event_epoll_wait(el, ts_wake);
+#else
 	num_fd_events = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
+#endif
 
 	/*
 	 *	Interrupt is different from timeout / FD events.
@@ -1530,12 +2040,12 @@ void fr_event_service(fr_event_list_t *el)
 			 */
 			if (el->events[i].ident == 0) continue;
 
-			user = (fr_event_user_t *)el->events[i].ident;
+			user = (fr_event_user_t *)(el->events[i].ident & ~FR_EV_USER_EVENTFD);
 
 			(void) talloc_get_type_abort(user, fr_event_user_t);
 			rad_assert(user->ident == el->events[i].ident);
 
-			user->callback(el->kq, &el->events[i], user->uctx);
+			user->callback(fr_event_list_kq(el), &el->events[i], user->uctx);
 			continue;
 		}
 
@@ -1705,7 +2215,7 @@ service:
 	/*
 	 *	Run all of the timer events.
 	 */
-	if (fr_heap_num_elements(el->times) > 0) {
+	if (fr_event_list_num_timers(el) > 0) {
 		do {
 			when = el->now;
 		} while (fr_event_timer_run(el, &when) == 1);
@@ -1732,7 +2242,9 @@ service:
  */
 void fr_event_loop_exit(fr_event_list_t *el, int code)
 {
+#ifndef WITH_EVENT_EPOLL
 	struct kevent kev;
+#endif
 
 	if (unlikely(!el)) return;
 
@@ -1741,8 +2253,16 @@ void fr_event_loop_exit(fr_event_list_t *el, int code)
 	/*
 	 *	Signal the control plane to exit.
 	 */
+#ifdef WITH_EVENT_EPOLL
+	{
+		uint64_t one = 1;
+
+		if (write(el->exit_fd, &one, sizeof(one)) < 0) return;
+	}
+#else
 	EV_SET(&kev, 0, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
 	(void) kevent(el->kq, &kev, 1, NULL, 0, NULL);
+#endif
 }
 
 /** Check to see whether the event loop is in the process of exiting
@@ -1784,11 +2304,19 @@ static int _event_list_free(fr_event_list_t *el)
 {
 	fr_event_timer_t const *ev;
 
-	while ((ev = fr_heap_peek(el->times)) != NULL) fr_event_timer_delete(el, &ev);
+	if (el->wheel) {
+		while ((ev = fr_timer_wheel_head(el->wheel)) != NULL) fr_event_timer_delete(el, &ev);
+	} else {
+		while ((ev = fr_heap_peek(el->times)) != NULL) fr_event_timer_delete(el, &ev);
+	}
 
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
+#ifdef WITH_EVENT_EPOLL
+	if (el->exit_fd >= 0) close(el->exit_fd);
+	if (el->epfd >= 0) close(el->epfd);
+#endif
 
 	return 0;
 }
@@ -1805,7 +2333,11 @@ static int _event_list_free(fr_event_list_t *el)
 fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t status, void *status_uctx)
 {
 	fr_event_list_t	*el;
+#ifdef WITH_EVENT_EPOLL
+	struct epoll_event ev;
+#else
 	struct kevent	kev;
+#endif
 
 	el = talloc_zero(ctx, fr_event_list_t);
 	if (!fr_cond_assert(el)) {
@@ -1813,6 +2345,10 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		return NULL;
 	}
 	el->kq = -1;	/* So destructor can be used before kqueue() provides us with fd */
+#ifdef WITH_EVENT_EPOLL
+	el->epfd = -1;
+	el->exit_fd = -1;
+#endif
 	talloc_set_destructor(el, _event_list_free);
 
 	el->times = fr_heap_talloc_create(el, fr_event_timer_cmp, fr_event_timer_t, heap_id);
@@ -1829,11 +2365,23 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		goto error;
 	}
 
+#ifdef WITH_EVENT_EPOLL
+	/*
+	 *	The kqueue is only created if something needs
+	 *	a filter epoll can't provide.
+	 */
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		fr_strerror_printf("Failed allocating epoll instance: %s", fr_syserror(errno));
+		goto error;
+	}
+#else
 	el->kq = kqueue();
 	if (el->kq < 0) {
 		fr_strerror_printf("Failed allocating kqueue: %s", fr_syserror(errno));
 		goto error;
 	}
+#endif
 
 	fr_dlist_init(&el->pre_callbacks, fr_event_pre_t, entry);
 	fr_dlist_init(&el->post_callbacks, fr_event_post_t, entry);
@@ -1841,6 +2389,23 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 
 	if (status) (void) fr_event_pre_insert(el, status, status_uctx);
 
+#ifdef WITH_EVENT_EPOLL
+	/*
+	 *	Our "exit" wakeup is an eventfd.
+	 */
+	el->exit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (el->exit_fd < 0) {
+		fr_strerror_printf("Failed creating exit eventfd: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u64 = FR_EV_EPOLL_EXIT;
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->exit_fd, &ev) < 0) {
+		fr_strerror_printf("Failed adding exit callback to epoll: %s", fr_syserror(errno));
+		goto error;
+	}
+#else
 	/*
 	 *	Set our "exit" callback as ident 0.
 	 */
@@ -1849,6 +2414,7 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		fr_strerror_printf("Failed adding exit callback to kqueue: %s", fr_syserror(errno));
 		goto error;
 	}
+#endif
 
 	return el;
 }
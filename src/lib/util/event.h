@@ -30,6 +30,7 @@ extern "C" {
 
 #include <freeradius-devel/build.h>
 #include <freeradius-devel/missing.h>
+#include <freeradius-devel/io/time.h>
 
 #include <stdbool.h>
 #include <sys/event.h>
@@ -191,6 +192,7 @@ typedef union {
 int		fr_event_list_num_fds(fr_event_list_t *el);
 int		fr_event_list_num_timers(fr_event_list_t *el);
 int		fr_event_list_kq(fr_event_list_t *el);
+int		fr_event_list_timer_wheel(fr_event_list_t *el, fr_time_t resolution);
 int		fr_event_list_time(struct timeval *when, fr_event_list_t *el);
 
 int		fr_event_fd_delete(fr_event_list_t *el, int fd, fr_event_filter_t filter);
@@ -220,6 +222,9 @@ int		fr_event_timer_run(fr_event_list_t *el, struct timeval *when);
 
 uintptr_t      	fr_event_user_insert(fr_event_list_t *el, fr_event_user_handler_t user, void *uctx) CC_HINT(nonnull(1,2));
 int		fr_event_user_delete(fr_event_list_t *el, fr_event_user_handler_t user, void *uctx) CC_HINT(nonnull(1,2));
+int		fr_event_user_arm(int kq, uintptr_t ident);
+int		fr_event_user_disarm(int kq, uintptr_t ident);
+int		fr_event_user_trigger(int kq, uintptr_t ident);
 
 int		fr_event_pre_insert(fr_event_list_t *el, fr_event_status_cb_t callback, void *uctx) CC_HINT(nonnull(1,2));
 int		fr_event_pre_delete(fr_event_list_t *el, fr_event_status_cb_t callback, void *uctx) CC_HINT(nonnull(1,2));
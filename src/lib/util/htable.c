@@ -0,0 +1,557 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Open addressing hash tables, with control bytes which are probed a group at a time
+ *
+ * The design follows the "Swiss table".  Each slot holds a pointer
+ * to the user data, and has a one byte control value.  The control
+ * byte is either EMPTY, DELETED, or the low 7 bits of the hash of
+ * the data in the slot.  A lookup loads a group of 16 control bytes,
+ * and compares them all at once (with SSE2, where available) to the
+ * 7 bits of the hash it's looking for.  The comparison callback is
+ * only called for slots which match, which is almost always just
+ * the one we want.  The lookup stops at the first group which has
+ * an EMPTY slot.
+ *
+ * Unlike fr_hash_table_t, there are no per-entry allocations, and
+ * no chains of pointers to follow.  The cost is about 9 bytes per
+ * slot, and the table is kept no more than 7/8 full.
+ *
+ * The first group of control bytes is copied to the end of the
+ * array, so that a group can be loaded from any slot without
+ * wrapping around.
+ *
+ * Inserting into, or resizing, the table moves the data around.  So
+ * the iterators and walk functions are only stable if the table
+ * isn't modified, other than deleting the current entry.
+ *
+ * @file src/lib/util/htable.c
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "htable.h"
+
+#include <freeradius-devel/util/talloc.h>
+
+#include <string.h>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+/*
+ *	The number of control bytes which are checked at once, and
+ *	the initial number of slots.  Both are powers of 2, and there
+ *	must be at least one group of slots.
+ */
+#define HTABLE_GROUP		(16)
+#define HTABLE_MIN_SLOTS	(16)
+
+#define CTRL_EMPTY		((int8_t) -128)
+#define CTRL_DELETED		((int8_t) -2)
+
+/*
+ *	The high bits of the hash choose where to start probing, and
+ *	the low 7 bits go into the control byte.
+ */
+#define H1(_hash)		((_hash) >> 7)
+#define H2(_hash)		((int8_t) ((_hash) & 0x7f))
+
+struct fr_htable_s {
+	uint32_t		num_elements;
+	uint32_t		num_deleted;	//!< number of DELETED control bytes
+	uint32_t		mask;		//!< number of slots - 1
+	uint32_t		next_grow;	//!< resize when num_elements + num_deleted reaches this
+
+	fr_hash_table_hash_t	hash;
+	fr_hash_table_cmp_t	cmp;
+	fr_hash_table_free_t	free;
+
+	int8_t			*ctrl;		//!< one control byte per slot, plus a copy of the first group
+	void			**slots;
+};
+
+/*
+ *	Many of the hash functions used by callers are weak in the
+ *	low bits, which we use for the control bytes.  So mix the
+ *	hash (with the murmur3 finaliser) before using it.
+ */
+static inline uint32_t htable_mix(uint32_t hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+#ifdef __SSE2__
+/*
+ *	Return a bitmask of the control bytes in a group which are
+ *	equal to "c".
+ */
+static inline uint32_t group_match(int8_t const *ctrl, int8_t c)
+{
+	__m128i group = _mm_loadu_si128((__m128i const *) ctrl);
+
+	return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(c), group));
+}
+
+/*
+ *	Return a bitmask of the control bytes in a group which are
+ *	EMPTY or DELETED.  They're the only ones with the high bit set.
+ */
+static inline uint32_t group_match_free(int8_t const *ctrl)
+{
+	__m128i group = _mm_loadu_si128((__m128i const *) ctrl);
+
+	return (uint32_t) _mm_movemask_epi8(group);
+}
+#else
+/*
+ *	The compiler can usually vectorize these loops.
+ */
+static inline uint32_t group_match(int8_t const *ctrl, int8_t c)
+{
+	int i;
+	uint32_t mask = 0;
+
+	for (i = 0; i < HTABLE_GROUP; i++) {
+		if (ctrl[i] == c) mask |= ((uint32_t) 1) << i;
+	}
+
+	return mask;
+}
+
+static inline uint32_t group_match_free(int8_t const *ctrl)
+{
+	int i;
+	uint32_t mask = 0;
+
+	for (i = 0; i < HTABLE_GROUP; i++) {
+		if (ctrl[i] < 0) mask |= ((uint32_t) 1) << i;
+	}
+
+	return mask;
+}
+#endif
+
+/*
+ *	Set a control byte, and its copy if it's in the first group.
+ */
+static inline void htable_set_ctrl(fr_htable_t *ht, uint32_t slot, int8_t c)
+{
+	ht->ctrl[slot] = c;
+	ht->ctrl[((slot - HTABLE_GROUP) & ht->mask) + HTABLE_GROUP] = c;
+}
+
+/*
+ *	Find the slot which holds the data.
+ *
+ *	The probe sequence moves by 1, 2, 3... groups.  Since the
+ *	number of slots is a power of 2, that visits every group.
+ *	And there's always at least one EMPTY slot, so the loop ends.
+ */
+static void **htable_find(fr_htable_t *ht, uint32_t hash, void const *data)
+{
+	uint32_t pos = H1(hash) & ht->mask;
+	uint32_t step = 0;
+	int8_t h2 = H2(hash);
+
+	for (;;) {
+		uint32_t match, slot;
+
+		match = group_match(&ht->ctrl[pos], h2);
+		while (match) {
+			slot = (pos + __builtin_ctz(match)) & ht->mask;
+
+			if (ht->cmp(data, ht->slots[slot]) == 0) return &ht->slots[slot];
+
+			match &= match - 1;
+		}
+
+		if (group_match(&ht->ctrl[pos], CTRL_EMPTY)) return NULL;
+
+		step += HTABLE_GROUP;
+		pos = (pos + step) & ht->mask;
+	}
+}
+
+/*
+ *	Find the first EMPTY or DELETED slot for a hash.
+ */
+static uint32_t htable_find_free(fr_htable_t const *ht, uint32_t hash)
+{
+	uint32_t pos = H1(hash) & ht->mask;
+	uint32_t step = 0;
+
+	for (;;) {
+		uint32_t match;
+
+		match = group_match_free(&ht->ctrl[pos]);
+		if (match) return (pos + __builtin_ctz(match)) & ht->mask;
+
+		step += HTABLE_GROUP;
+		pos = (pos + step) & ht->mask;
+	}
+}
+
+/*
+ *	Move all of the data to new arrays of "num_slots" slots.
+ *	This also gets rid of all of the DELETED control bytes.
+ */
+static int htable_resize(fr_htable_t *ht, uint32_t num_slots)
+{
+	int8_t		*old_ctrl = ht->ctrl;
+	void		**old_slots = ht->slots;
+	uint32_t	i, old_num_slots = old_ctrl ? ht->mask + 1 : 0;
+
+	ht->ctrl = talloc_array(ht, int8_t, num_slots + HTABLE_GROUP);
+	ht->slots = talloc_array(ht, void *, num_slots);
+	if (!ht->ctrl || !ht->slots) {
+		talloc_free(ht->ctrl);
+		talloc_free(ht->slots);
+		ht->ctrl = old_ctrl;
+		ht->slots = old_slots;
+		return -1;
+	}
+	memset(ht->ctrl, CTRL_EMPTY, num_slots + HTABLE_GROUP);
+
+	ht->mask = num_slots - 1;
+	ht->num_deleted = 0;
+	ht->next_grow = num_slots - (num_slots >> 3);
+
+	for (i = 0; i < old_num_slots; i++) {
+		uint32_t hash, slot;
+
+		if (old_ctrl[i] < 0) continue;
+
+		hash = htable_mix(ht->hash(old_slots[i]));
+		slot = htable_find_free(ht, hash);
+
+		htable_set_ctrl(ht, slot, H2(hash));
+		ht->slots[slot] = old_slots[i];
+	}
+
+	talloc_free(old_ctrl);
+	talloc_free(old_slots);
+
+	return 0;
+}
+
+/** Create a hash table
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @param[in] hash	function for the data.
+ * @param[in] cmp	function for the data.  Returns 0 if they're the same.
+ * @param[in] free_data	function for the data, or NULL.  Called when data is
+ *			deleted or replaced, and when the table is freed
+ *			with fr_htable_free().
+ * @return
+ *	- the new table.
+ *	- NULL on error.
+ */
+fr_htable_t *fr_htable_create(TALLOC_CTX *ctx,
+			      fr_hash_table_hash_t hash,
+			      fr_hash_table_cmp_t cmp,
+			      fr_hash_table_free_t free_data)
+{
+	fr_htable_t *ht;
+
+	if (!hash || !cmp) return NULL;
+
+	ht = talloc_zero(ctx, fr_htable_t);
+	if (!ht) return NULL;
+
+	ht->hash = hash;
+	ht->cmp = cmp;
+	ht->free = free_data;
+
+	if (htable_resize(ht, HTABLE_MIN_SLOTS) < 0) {
+		talloc_free(ht);
+		return NULL;
+	}
+
+	return ht;
+}
+
+/** Free a hash table, and call the free function for all of the data
+ *
+ */
+void fr_htable_free(fr_htable_t *ht)
+{
+	uint32_t i;
+
+	if (!ht) return;
+
+	if (ht->free) {
+		for (i = 0; i <= ht->mask; i++) {
+			if (ht->ctrl[i] >= 0) ht->free(ht->slots[i]);
+		}
+	}
+
+	talloc_free(ht);
+}
+
+/** Insert data into a hash table
+ *
+ * @return
+ *	- 1 on success.
+ *	- 0 if the data already exists, or on error.
+ */
+int fr_htable_insert(fr_htable_t *ht, void const *data)
+{
+	uint32_t hash, slot;
+
+	if (!ht || !data) return 0;
+
+	hash = htable_mix(ht->hash(data));
+
+	if (htable_find(ht, hash, data)) return 0;
+
+	if ((ht->num_elements + ht->num_deleted) >= ht->next_grow) {
+		uint32_t num_slots = ht->mask + 1;
+
+		/*
+		 *	If the table is mostly DELETED slots, just
+		 *	clean them out.  Otherwise double its size.
+		 */
+		if (ht->num_elements >= (ht->next_grow >> 1)) num_slots <<= 1;
+
+		if (htable_resize(ht, num_slots) < 0) return 0;
+	}
+
+	slot = htable_find_free(ht, hash);
+	if (ht->ctrl[slot] == CTRL_DELETED) ht->num_deleted--;
+
+	htable_set_ctrl(ht, slot, H2(hash));
+	memcpy(&ht->slots[slot], &data, sizeof(ht->slots[slot]));
+	ht->num_elements++;
+
+	return 1;
+}
+
+/** Find data in a hash table
+ *
+ * @return
+ *	- the matching data.
+ *	- NULL if nothing matches.
+ */
+void *fr_htable_finddata(fr_htable_t *ht, void const *data)
+{
+	void **slot;
+
+	if (!ht || !data) return NULL;
+
+	slot = htable_find(ht, htable_mix(ht->hash(data)), data);
+	if (!slot) return NULL;
+
+	return *slot;
+}
+
+/** Find data in a hash table, when the caller has already hashed it
+ *
+ *  This avoids calling the hash function through a pointer, so
+ *  callers can hash the data inline.
+ *
+ * @param[in] ht	to search.
+ * @param[in] hash	of the data.  This MUST be the same value which
+ *			the hash function returns for the data.
+ * @param[in] data	to find.
+ * @return
+ *	- the matching data.
+ *	- NULL if nothing matches.
+ */
+void *fr_htable_finddata_by_hash(fr_htable_t *ht, uint32_t hash, void const *data)
+{
+	void **slot;
+
+	if (!ht || !data) return NULL;
+
+	slot = htable_find(ht, htable_mix(hash), data);
+	if (!slot) return NULL;
+
+	return *slot;
+}
+
+/** Remove data from a hash table, without freeing it
+ *
+ * @return
+ *	- the data which was removed.
+ *	- NULL if nothing matches.
+ */
+void *fr_htable_yank(fr_htable_t *ht, void const *data)
+{
+	void **slot, *old;
+	uint32_t i, before, empty_before, empty_after;
+
+	if (!ht || !data) return NULL;
+
+	slot = htable_find(ht, htable_mix(ht->hash(data)), data);
+	if (!slot) return NULL;
+
+	old = *slot;
+	i = slot - ht->slots;
+	before = (i - HTABLE_GROUP) & ht->mask;
+
+	/*
+	 *	If every group which contains this slot also contains
+	 *	an EMPTY slot, then no lookup can have probed past
+	 *	this slot, and it can be marked EMPTY.  Otherwise it
+	 *	has to be marked DELETED.
+	 */
+	empty_before = group_match(&ht->ctrl[before], CTRL_EMPTY);
+	empty_after = group_match(&ht->ctrl[i], CTRL_EMPTY);
+
+	if (empty_before && empty_after &&
+	    (((__builtin_clz(empty_before) - (32 - HTABLE_GROUP)) + __builtin_ctz(empty_after)) < HTABLE_GROUP)) {
+		htable_set_ctrl(ht, i, CTRL_EMPTY);
+	} else {
+		htable_set_ctrl(ht, i, CTRL_DELETED);
+		ht->num_deleted++;
+	}
+
+	ht->num_elements--;
+
+	return old;
+}
+
+/** Delete data from a hash table, and call the free function for it
+ *
+ * @return
+ *	- 1 on success.
+ *	- 0 if nothing matches.
+ */
+int fr_htable_delete(fr_htable_t *ht, void const *data)
+{
+	void *old;
+
+	old = fr_htable_yank(ht, data);
+	if (!old) return 0;
+
+	if (ht->free) ht->free(old);
+
+	return 1;
+}
+
+/** Replace matching data in a hash table, or insert it if there's no match
+ *
+ * @return
+ *	- 1 on success.
+ *	- 0 on error.
+ */
+int fr_htable_replace(fr_htable_t *ht, void const *data)
+{
+	void **slot;
+
+	if (!ht || !data) return 0;
+
+	slot = htable_find(ht, htable_mix(ht->hash(data)), data);
+	if (!slot) return fr_htable_insert(ht, data);
+
+	if (ht->free) ht->free(*slot);
+
+	memcpy(slot, &data, sizeof(*slot));
+
+	return 1;
+}
+
+/** Return the number of elements in a hash table
+ *
+ */
+uint32_t fr_htable_num_elements(fr_htable_t const *ht)
+{
+	if (!ht) return 0;
+
+	return ht->num_elements;
+}
+
+/** Return the memory used by a hash table, in bytes
+ *
+ *  This doesn't include the talloc headers, or the data.
+ */
+size_t fr_htable_memory(fr_htable_t const *ht)
+{
+	size_t num_slots;
+
+	if (!ht) return 0;
+
+	num_slots = (size_t) ht->mask + 1;
+
+	return sizeof(*ht) + num_slots + HTABLE_GROUP + (num_slots * sizeof(ht->slots[0]));
+}
+
+/** Call a function for all of the data in a hash table
+ *
+ *  The callback may delete the data it's called for, but it
+ *  MUST NOT insert data.
+ *
+ * @return
+ *	- 0 if the callback returned 0 for all of the data.
+ *	- the first non-zero value which the callback returned.
+ */
+int fr_htable_walk(fr_htable_t *ht, fr_hash_table_walk_t callback, void *ctx)
+{
+	uint32_t i;
+	int rcode;
+
+	if (!ht || !callback) return 0;
+
+	for (i = 0; i <= ht->mask; i++) {
+		if (ht->ctrl[i] < 0) continue;
+
+		rcode = callback(ctx, ht->slots[i]);
+		if (rcode != 0) return rcode;
+	}
+
+	return 0;
+}
+
+/** Return the next data in a hash table
+ *
+ * @return
+ *	- the next data.
+ *	- NULL if there's no more data.
+ */
+void *fr_htable_iter_next(fr_htable_t *ht, fr_htable_iter_t *iter)
+{
+	if (unlikely(!ht)) return NULL;
+
+	while (iter->slot <= ht->mask) {
+		uint32_t i = iter->slot++;
+
+		if (ht->ctrl[i] >= 0) return ht->slots[i];
+	}
+
+	return NULL;
+}
+
+/** Start iterating over a hash table
+ *
+ * @return
+ *	- the first data.
+ *	- NULL if the table is empty.
+ */
+void *fr_htable_iter_init(fr_htable_t *ht, fr_htable_iter_t *iter)
+{
+	iter->slot = 0;
+
+	return fr_htable_iter_next(ht, iter);
+}
@@ -0,0 +1,78 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Open addressing hash tables, with control bytes which are probed a group at a time
+ *
+ * @file src/lib/util/htable.h
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSIDH(htable_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/hash.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <talloc.h>
+
+typedef struct fr_htable_s fr_htable_t;
+
+/** Stores the state of the current iteration operation
+ *
+ */
+typedef struct {
+	uint32_t		slot;
+} fr_htable_iter_t;
+
+fr_htable_t	*fr_htable_create(TALLOC_CTX *ctx,
+				  fr_hash_table_hash_t hash,
+				  fr_hash_table_cmp_t cmp,
+				  fr_hash_table_free_t free_data);
+
+void		fr_htable_free(fr_htable_t *ht);
+
+int		fr_htable_insert(fr_htable_t *ht, void const *data);
+
+int		fr_htable_delete(fr_htable_t *ht, void const *data);
+
+void		*fr_htable_yank(fr_htable_t *ht, void const *data);
+
+int		fr_htable_replace(fr_htable_t *ht, void const *data);
+
+void		*fr_htable_finddata(fr_htable_t *ht, void const *data);
+
+void		*fr_htable_finddata_by_hash(fr_htable_t *ht, uint32_t hash, void const *data);
+
+uint32_t	fr_htable_num_elements(fr_htable_t const *ht);
+
+size_t		fr_htable_memory(fr_htable_t const *ht);
+
+int		fr_htable_walk(fr_htable_t *ht, fr_hash_table_walk_t callback, void *ctx);
+
+void		*fr_htable_iter_init(fr_htable_t *ht, fr_htable_iter_t *iter);
+
+void		*fr_htable_iter_next(fr_htable_t *ht, fr_htable_iter_t *iter);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,489 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Latency histograms, recorded per thread
+ *
+ * Values are recorded into log-linear histograms, in the style of
+ * HdrHistogram.  The histograms are grouped by a "stage", and an
+ * optional name within that stage.  e.g. stage "module", name "pap".
+ * Callers register each stage and name once, and then record values
+ * against the key which fr_latency_register() returns.
+ *
+ * Each thread records into its own histograms, so recording needs no
+ * locks.  A thread only ever appends histograms to its list, and
+ * publishes the new length after the histogram has been initialised.
+ * So another thread can read the histograms while they're being
+ * updated.  The results are approximate, but consistent enough for
+ * statistics.
+ *
+ * The histograms of all threads are aggregated on demand.  When a
+ * thread exits, its histograms are added to a set of totals, so that
+ * they aren't lost.
+ *
+ * @file src/lib/util/latency.c
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "latency.h"
+
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/thread_local.h>
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#define LATENCY_SUB_BUCKETS	(1 << FR_LATENCY_SUB_BITS)
+#define LATENCY_MAX_ENTRIES	(256)
+
+/** A stage and name, shared by all threads
+ *
+ */
+struct fr_latency_key_s {
+	char const		*stage;		//!< e.g. "module"
+	char const		*name;		//!< e.g. "pap", or NULL
+	uint32_t		index;		//!< of the histogram in each thread
+};
+
+/** One histogram
+ *
+ */
+typedef struct {
+	char const		*stage;		//!< e.g. "module"
+	char const		*name;		//!< e.g. "pap", or NULL
+	fr_latency_t		lat;
+} fr_latency_entry_t;
+
+/** The histograms for one thread
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< in the list of threads
+	fr_latency_entry_t	*by_key[LATENCY_MAX_ENTRIES];	//!< only used by the owning thread
+
+	_Atomic(uint32_t)	num_entries;	//!< which other threads may read
+	fr_latency_entry_t	*entries[LATENCY_MAX_ENTRIES];
+} fr_latency_thread_t;
+
+static pthread_mutex_t		latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_latency_key_t		*latency_keys[LATENCY_MAX_ENTRIES];
+static uint32_t			latency_num_keys;
+static bool			latency_threads_init = false;
+static fr_dlist_head_t		latency_threads;	//!< of fr_latency_thread_t
+static fr_latency_thread_t	*latency_retired;	//!< totals for threads which have exited
+
+fr_thread_local_setup(fr_latency_thread_t *, latency_thread)	/* macro */
+
+static unsigned int latency_bucket(uint64_t nsec)
+{
+	unsigned int exp;
+
+	if (nsec < LATENCY_SUB_BUCKETS) return nsec;
+
+	if (nsec >= ((uint64_t) 1 << FR_LATENCY_MAX_BITS)) return FR_LATENCY_BUCKETS - 1;
+
+	exp = 63 - __builtin_clzll(nsec);
+
+	return ((exp - FR_LATENCY_SUB_BITS + 1) << FR_LATENCY_SUB_BITS) +
+		((nsec >> (exp - FR_LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+/** The largest value which goes into a bucket
+ *
+ */
+static uint64_t latency_bucket_max(unsigned int bucket)
+{
+	unsigned int exp, sub;
+
+	if (bucket < LATENCY_SUB_BUCKETS) return bucket;
+
+	exp = (bucket >> FR_LATENCY_SUB_BITS) + FR_LATENCY_SUB_BITS - 1;
+	sub = bucket & (LATENCY_SUB_BUCKETS - 1);
+
+	return (((uint64_t) (LATENCY_SUB_BUCKETS + sub + 1)) << (exp - FR_LATENCY_SUB_BITS)) - 1;
+}
+
+/** Add a value to a histogram
+ *
+ * @param[in] lat	to add the value to.
+ * @param[in] nsec	the latency.
+ */
+void fr_latency_add(fr_latency_t *lat, uint64_t nsec)
+{
+	lat->bucket[latency_bucket(nsec)]++;
+	lat->count++;
+	if (nsec > lat->max) lat->max = nsec;
+}
+
+/** Add all of the values in one histogram to another
+ *
+ * @param[in] dst	where the values are added.
+ * @param[in] src	the values to add.
+ */
+void fr_latency_merge(fr_latency_t *dst, fr_latency_t const *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < FR_LATENCY_BUCKETS; i++) dst->bucket[i] += src->bucket[i];
+
+	dst->count += src->count;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+/** Get a percentile from a histogram
+ *
+ * @param[in] lat	to look at.
+ * @param[in] permille	the percentile, in tenths of a percent.  e.g. 999 for p99.9.
+ * @return
+ *	- the largest value which is at that percentile.
+ *	- 0 if the histogram is empty.
+ */
+uint64_t fr_latency_percentile(fr_latency_t const *lat, unsigned int permille)
+{
+	unsigned int i;
+	uint64_t total = 0, target, seen = 0;
+
+	/*
+	 *	The histogram may be updated while we're reading it,
+	 *	so don't trust "count".
+	 */
+	for (i = 0; i < FR_LATENCY_BUCKETS; i++) total += lat->bucket[i];
+	if (!total) return 0;
+
+	if (permille > 1000) permille = 1000;
+
+	target = ((total * permille) + 999) / 1000;
+	if (!target) target = 1;
+
+	for (i = 0; i < FR_LATENCY_BUCKETS; i++) {
+		uint64_t max;
+
+		seen += lat->bucket[i];
+		if (seen < target) continue;
+
+		max = latency_bucket_max(i);
+		return (max < lat->max) ? max : lat->max;
+	}
+
+	return lat->max;
+}
+
+static bool latency_match(char const *a_stage, char const *a_name, char const *stage, char const *name)
+{
+	if (strcmp(a_stage, stage) != 0) return false;
+	if (!a_name != !name) return false;
+
+	return !a_name || (strcmp(a_name, name) == 0);
+}
+
+static bool latency_entry_match(fr_latency_entry_t const *entry, char const *stage, char const *name)
+{
+	return latency_match(entry->stage, entry->name, stage, name);
+}
+
+/** Add a histogram to a set of totals, matching them by name
+ *
+ *  Only called with latency_mutex held.
+ */
+static void latency_entry_merge(fr_latency_thread_t *totals, fr_latency_entry_t const *src)
+{
+	uint32_t i, num = atomic_load_explicit(&totals->num_entries, memory_order_relaxed);
+	fr_latency_entry_t *entry;
+
+	for (i = 0; i < num; i++) {
+		entry = totals->entries[i];
+
+		if (!latency_entry_match(entry, src->stage, src->name)) continue;
+
+		fr_latency_merge(&entry->lat, &src->lat);
+		return;
+	}
+
+	if (num >= LATENCY_MAX_ENTRIES) return;
+
+	entry = talloc_zero(totals, fr_latency_entry_t);
+	if (!entry) return;
+
+	entry->stage = talloc_strdup(entry, src->stage);
+	if (src->name) entry->name = talloc_strdup(entry, src->name);
+	fr_latency_merge(&entry->lat, &src->lat);
+
+	totals->entries[num] = entry;
+	atomic_store_explicit(&totals->num_entries, num + 1, memory_order_relaxed);
+}
+
+/** Keep the histograms of a thread which is exiting
+ *
+ */
+static void _latency_thread_free(void *arg)
+{
+	fr_latency_thread_t *thread = arg;
+	uint32_t i, num;
+
+	pthread_mutex_lock(&latency_mutex);
+	fr_dlist_remove(&latency_threads, thread);
+
+	if (!latency_retired) latency_retired = talloc_zero(NULL, fr_latency_thread_t);
+	if (latency_retired) {
+		num = atomic_load_explicit(&thread->num_entries, memory_order_relaxed);
+		for (i = 0; i < num; i++) latency_entry_merge(latency_retired, thread->entries[i]);
+	}
+	pthread_mutex_unlock(&latency_mutex);
+
+	talloc_free(thread);
+	latency_thread = NULL;
+}
+
+static fr_latency_thread_t *latency_thread_init(void)
+{
+	fr_latency_thread_t *thread;
+
+	thread = talloc_zero(NULL, fr_latency_thread_t);
+	if (!thread) return NULL;
+
+	fr_dlist_entry_init(&thread->entry);
+
+	pthread_mutex_lock(&latency_mutex);
+	if (!latency_threads_init) {
+		fr_dlist_init(&latency_threads, fr_latency_thread_t, entry);
+		latency_threads_init = true;
+	}
+	fr_dlist_insert_tail(&latency_threads, thread);
+	pthread_mutex_unlock(&latency_mutex);
+
+	fr_thread_local_set_destructor(latency_thread, _latency_thread_free, thread);
+
+	return thread;
+}
+
+/** Get a monotonic time, in nanoseconds
+ *
+ *  For code which can't use fr_time(), because it doesn't link to
+ *  libfreeradius-io.  Only the difference between two values is
+ *  meaningful.
+ *
+ * @return the current time.
+ */
+uint64_t fr_latency_now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/** Register a stage and name for recording latencies
+ *
+ *  The strings are copied, so they only need to be valid for the
+ *  duration of the call.  Registering the same stage and name again
+ *  returns the same key.  Keys are shared by all threads, and are
+ *  never freed.
+ *
+ * @param[in] stage	of processing which the latencies are for.
+ * @param[in] name	within that stage, or NULL.
+ * @return
+ *	- the key to pass to fr_latency_record().
+ *	- NULL if there are too many keys, or on allocation failure.
+ */
+fr_latency_key_t const *fr_latency_register(char const *stage, char const *name)
+{
+	fr_latency_key_t *key = NULL;
+	uint32_t i;
+
+	pthread_mutex_lock(&latency_mutex);
+	for (i = 0; i < latency_num_keys; i++) {
+		if (latency_match(latency_keys[i]->stage, latency_keys[i]->name, stage, name)) {
+			key = latency_keys[i];
+			goto done;
+		}
+	}
+
+	if (latency_num_keys >= LATENCY_MAX_ENTRIES) goto done;
+
+	key = talloc_zero(NULL, fr_latency_key_t);
+	if (!key) goto done;
+
+	key->stage = talloc_strdup(key, stage);
+	if (name) key->name = talloc_strdup(key, name);
+	if (!key->stage || (name && !key->name)) {
+		talloc_free(key);
+		key = NULL;
+		goto done;
+	}
+
+	key->index = latency_num_keys;
+	latency_keys[latency_num_keys++] = key;
+
+done:
+	pthread_mutex_unlock(&latency_mutex);
+
+	return key;
+}
+
+/** Record a latency for the current thread
+ *
+ * @param[in] key	from fr_latency_register().  If NULL, nothing
+ *			is recorded.
+ * @param[in] nsec	the latency.
+ */
+void fr_latency_record(fr_latency_key_t const *key, uint64_t nsec)
+{
+	fr_latency_thread_t *thread = latency_thread;
+	fr_latency_entry_t *entry;
+	uint32_t num;
+
+	if (!key) return;
+
+	if (!thread) {
+		thread = latency_thread_init();
+		if (!thread) return;
+	}
+
+	entry = thread->by_key[key->index];
+	if (!entry) {
+		num = atomic_load_explicit(&thread->num_entries, memory_order_relaxed);
+
+		entry = talloc_zero(thread, fr_latency_entry_t);
+		if (!entry) return;
+
+		entry->stage = key->stage;
+		entry->name = key->name;
+		thread->by_key[key->index] = entry;
+
+		/*
+		 *	Publish the histogram only after it has been
+		 *	initialised.
+		 */
+		thread->entries[num] = entry;
+		atomic_store_explicit(&thread->num_entries, num + 1, memory_order_release);
+	}
+
+	fr_latency_add(&entry->lat, nsec);
+}
+
+/** Get one histogram, summed over all threads
+ *
+ * @param[out] out	where the histogram is written.
+ * @param[in] stage	of the histogram.
+ * @param[in] name	of the histogram, or NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 if nothing has been recorded for that stage and name.
+ */
+int fr_latency_get(fr_latency_t *out, char const *stage, char const *name)
+{
+	fr_latency_thread_t *thread;
+	uint32_t i, num;
+	bool found = false;
+
+	memset(out, 0, sizeof(*out));
+
+	pthread_mutex_lock(&latency_mutex);
+	if (latency_retired) {
+		num = atomic_load_explicit(&latency_retired->num_entries, memory_order_relaxed);
+		for (i = 0; i < num; i++) {
+			if (!latency_entry_match(latency_retired->entries[i], stage, name)) continue;
+
+			fr_latency_merge(out, &latency_retired->entries[i]->lat);
+			found = true;
+		}
+	}
+
+	if (latency_threads_init) {
+		for (thread = fr_dlist_head(&latency_threads);
+		     thread != NULL;
+		     thread = fr_dlist_next(&latency_threads, thread)) {
+			num = atomic_load_explicit(&thread->num_entries, memory_order_acquire);
+			for (i = 0; i < num; i++) {
+				if (!latency_entry_match(thread->entries[i], stage, name)) continue;
+
+				fr_latency_merge(out, &thread->entries[i]->lat);
+				found = true;
+			}
+		}
+	}
+	pthread_mutex_unlock(&latency_mutex);
+
+	return found ? 0 : -1;
+}
+
+/** Print the histograms of all threads, aggregated by stage and name
+ *
+ * @param[in] fp	where the output is written.
+ * @param[in] stage	to print, or NULL for all stages.
+ */
+void fr_latency_fprint(FILE *fp, char const *stage)
+{
+	fr_latency_thread_t *totals, *thread;
+	uint32_t i, num;
+
+	totals = talloc_zero(NULL, fr_latency_thread_t);
+	if (!totals) return;
+
+	pthread_mutex_lock(&latency_mutex);
+	if (latency_retired) {
+		num = atomic_load_explicit(&latency_retired->num_entries, memory_order_relaxed);
+		for (i = 0; i < num; i++) {
+			if (stage && (strcmp(latency_retired->entries[i]->stage, stage) != 0)) continue;
+
+			latency_entry_merge(totals, latency_retired->entries[i]);
+		}
+	}
+
+	if (latency_threads_init) {
+		for (thread = fr_dlist_head(&latency_threads);
+		     thread != NULL;
+		     thread = fr_dlist_next(&latency_threads, thread)) {
+			num = atomic_load_explicit(&thread->num_entries, memory_order_acquire);
+			for (i = 0; i < num; i++) {
+				if (stage && (strcmp(thread->entries[i]->stage, stage) != 0)) continue;
+
+				latency_entry_merge(totals, thread->entries[i]);
+			}
+		}
+	}
+	pthread_mutex_unlock(&latency_mutex);
+
+	num = atomic_load_explicit(&totals->num_entries, memory_order_relaxed);
+	for (i = 0; i < num; i++) {
+		fr_latency_entry_t *entry = totals->entries[i];
+		char const *sep = entry->name ? "." : "";
+		char const *name = entry->name ? entry->name : "";
+
+		fprintf(fp, "%s%s%s.count\t%" PRIu64 "\n", entry->stage, sep, name, entry->lat.count);
+		fprintf(fp, "%s%s%s.p50_usec\t%" PRIu64 "\n", entry->stage, sep, name,
+			fr_latency_percentile(&entry->lat, 500) / 1000);
+		fprintf(fp, "%s%s%s.p90_usec\t%" PRIu64 "\n", entry->stage, sep, name,
+			fr_latency_percentile(&entry->lat, 900) / 1000);
+		fprintf(fp, "%s%s%s.p99_usec\t%" PRIu64 "\n", entry->stage, sep, name,
+			fr_latency_percentile(&entry->lat, 990) / 1000);
+		fprintf(fp, "%s%s%s.p999_usec\t%" PRIu64 "\n", entry->stage, sep, name,
+			fr_latency_percentile(&entry->lat, 999) / 1000);
+		fprintf(fp, "%s%s%s.max_usec\t%" PRIu64 "\n", entry->stage, sep, name, entry->lat.max / 1000);
+	}
+
+	talloc_free(totals);
+}
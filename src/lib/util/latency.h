@@ -0,0 +1,71 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Latency histograms, recorded per thread
+ *
+ * @file src/lib/util/latency.h
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSIDH(latency_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ *	Each power of two is split into 16 buckets, so values are
+ *	recorded with a precision of about 6%.  Values of 2^40ns
+ *	(about 18 minutes) or more go into the last bucket.
+ */
+#define FR_LATENCY_SUB_BITS	(4)
+#define FR_LATENCY_MAX_BITS	(40)
+#define FR_LATENCY_BUCKETS	(((FR_LATENCY_MAX_BITS - FR_LATENCY_SUB_BITS) + 1) << FR_LATENCY_SUB_BITS)
+
+/** A log-linear histogram of latencies, in nanoseconds
+ *
+ */
+typedef struct {
+	uint64_t	count;				//!< number of values recorded
+	uint64_t	max;				//!< largest value recorded
+	uint64_t	bucket[FR_LATENCY_BUCKETS];
+} fr_latency_t;
+
+void		fr_latency_add(fr_latency_t *lat, uint64_t nsec) CC_HINT(nonnull);
+void		fr_latency_merge(fr_latency_t *dst, fr_latency_t const *src) CC_HINT(nonnull);
+uint64_t	fr_latency_percentile(fr_latency_t const *lat, unsigned int permille) CC_HINT(nonnull);
+
+/** A registered stage and name
+ *
+ */
+typedef struct fr_latency_key_s fr_latency_key_t;
+
+uint64_t	fr_latency_now(void);
+fr_latency_key_t const *fr_latency_register(char const *stage, char const *name) CC_HINT(nonnull(1));
+void		fr_latency_record(fr_latency_key_t const *key, uint64_t nsec);
+int		fr_latency_get(fr_latency_t *out, char const *stage, char const *name) CC_HINT(nonnull(1,2));
+void		fr_latency_fprint(FILE *fp, char const *stage) CC_HINT(nonnull(1));
+
+#ifdef __cplusplus
+}
+#endif
@@ -36,6 +36,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef HAVE_LINUX_FILTER_H
+#  include <linux/filter.h>
+#endif
+
 /*
  *	This is used during binding ports less than 1024
  *	which is a privilege that processes don't
@@ -1021,3 +1025,79 @@ skip_cap:
 #endif
 	return 0;
 }
+
+/** Steer packets to the sockets in a SO_REUSEPORT group by source IP
+ *
+ *  By default, the kernel picks a socket in the group using a hash of
+ *  the source and destination addresses and ports.  Instead, we hash
+ *  only the source IP address, so that all packets from one client
+ *  go to the same socket, no matter which source port they use.
+ *
+ *  The sockets are numbered in the order in which they were bound.
+ *  The program is attached to one socket, and applies to all of them.
+ *
+ * @param[in] sockfd	a bound socket in the group.
+ * @param[in] num	number of sockets in the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_socket_reuseport_steer(int sockfd, uint32_t num)
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+	struct sockaddr_storage	salocal;
+	socklen_t		salen = sizeof(salocal);
+	struct sock_filter	code[] = {
+		/* A = source IP, or the last 4 octets of an IPv6 address */
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, 0 },
+
+		/* A ^= A >> 16, so that the high octets count, too */
+		{ BPF_MISC | BPF_TAX, 0, 0, 0 },
+		{ BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16 },
+		{ BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 },
+
+		/* return A % num */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, num },
+		{ BPF_RET | BPF_A, 0, 0, 0 }
+	};
+	struct sock_fprog	prog = { .len = NUM_ELEMENTS(code), .filter = code };
+
+	if (num < 2) return 0;
+
+	if (getsockname(sockfd, (struct sockaddr *) &salocal, &salen) < 0) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	The program runs with the packet data pointing to the
+	 *	UDP payload, so we load the source address relative to
+	 *	the IP header.
+	 */
+	switch (salocal.ss_family) {
+	case AF_INET:
+		code[0].k = SKF_NET_OFF + 12;
+		break;
+
+#ifdef HAVE_STRUCT_SOCKADDR_IN6
+	case AF_INET6:
+		code[0].k = SKF_NET_OFF + 20;
+		break;
+#endif
+
+	default:
+		fr_strerror_printf("Unsupported address family %d", salocal.ss_family);
+		return -1;
+	}
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport program: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+#else
+	fr_strerror_printf("Steering packets in a SO_REUSEPORT group is not supported on this system");
+	return -1;
+#endif
+}
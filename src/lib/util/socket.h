@@ -52,6 +52,8 @@ int		fr_socket_server_udp(fr_ipaddr_t const *ipaddr, uint16_t *port, char const
 int		fr_socket_server_tcp(fr_ipaddr_t const *ipaddr, uint16_t *port, char const *port_name, bool async);
 int		fr_socket_bind(int sockfd, fr_ipaddr_t const *ipaddr, uint16_t *port, char const *interface);
 
+int		fr_socket_reuseport_steer(int sockfd, uint32_t num);
+
 #ifdef __cplusplus
 }
 #endif
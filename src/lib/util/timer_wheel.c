@@ -0,0 +1,458 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Hierarchical timer wheel
+ *
+ * Insert and extract are O(1).  Elements are placed into a slot of
+ * the lowest level which can represent their expiry time, relative
+ * to the current tick.  As time moves forward, the slots of the
+ * higher levels are cascaded down into the lower ones.
+ *
+ * Elements are only ordered to the resolution of the wheel.  Elements
+ * which expire within the same tick are returned in insert order.
+ *
+ * @file src/lib/util/timer_wheel.c
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "timer_wheel.h"
+
+#include <freeradius-devel/util/strerror.h>
+
+#include <string.h>
+
+#define TW_LEVELS	(4)			//!< Covers 2^32 ticks, the rest go into the overflow list.
+#define TW_BITS		(8)
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_WORDS	(TW_SLOTS / 64)
+
+#define TW_ENTRY(_tw, _data) ((fr_timer_wheel_entry_t *)(((uint8_t *) (_data)) + (_tw)->offset))
+
+struct fr_timer_wheel_s {
+	fr_time_t	resolution;		//!< Width of a level 0 slot.
+	uint64_t	tick;			//!< Next tick to be processed.
+	size_t		offset;			//!< Of the fr_timer_wheel_entry_t in each element.
+
+	uint32_t	num_elements;		//!< Number of elements in the wheel.
+
+	fr_dlist_head_t	expired;		//!< Elements which have expired, but haven't been popped.
+	fr_dlist_head_t	overflow;		//!< Elements too far in the future for the top level.
+
+	uint64_t	used[TW_LEVELS][TW_WORDS];	//!< Slots which may be non-empty.  Bits are
+							///< cleared lazily, when we next look at the slot.
+	fr_dlist_head_t	slot[TW_LEVELS][TW_SLOTS];
+};
+
+fr_timer_wheel_t *_fr_timer_wheel_create(TALLOC_CTX *ctx, fr_time_t resolution, fr_time_t now, size_t offset)
+{
+	fr_timer_wheel_t	*tw;
+	int			i, j;
+
+	if (!resolution) return NULL;
+
+	tw = talloc_zero(ctx, fr_timer_wheel_t);
+	if (!tw) return NULL;
+
+	tw->resolution = resolution;
+	tw->tick = now / resolution;
+	tw->offset = offset;
+
+	_fr_dlist_init(&tw->expired, offset, NULL);
+	_fr_dlist_init(&tw->overflow, offset, NULL);
+
+	for (i = 0; i < TW_LEVELS; i++) {
+		for (j = 0; j < TW_SLOTS; j++) _fr_dlist_init(&tw->slot[i][j], offset, NULL);
+	}
+
+	return tw;
+}
+
+static inline void tw_slot_set(fr_timer_wheel_t *tw, unsigned int level, unsigned int s)
+{
+	tw->used[level][s / 64] |= ((uint64_t) 1) << (s % 64);
+}
+
+static inline void tw_slot_clear(fr_timer_wheel_t *tw, unsigned int level, unsigned int s)
+{
+	tw->used[level][s / 64] &= ~(((uint64_t) 1) << (s % 64));
+}
+
+/** Find the first slot at or after s which may be in use
+ *
+ * @return the slot number, or TW_SLOTS if there are none.
+ */
+static unsigned int tw_slot_next(fr_timer_wheel_t const *tw, unsigned int level, unsigned int s)
+{
+	unsigned int	word;
+	uint64_t	bits;
+
+	if (s >= TW_SLOTS) return TW_SLOTS;
+
+	word = s / 64;
+	bits = tw->used[level][word] & (~((uint64_t) 0) << (s % 64));
+
+	for (;;) {
+		if (bits) return (word * 64) + __builtin_ctzll(bits);
+		if (++word >= TW_WORDS) return TW_SLOTS;
+		bits = tw->used[level][word];
+	}
+}
+
+/** Place an element in the slot matching its expiry time
+ *
+ */
+static void tw_link(fr_timer_wheel_t *tw, void *data)
+{
+	uint64_t	t = TW_ENTRY(tw, data)->when / tw->resolution;
+	unsigned int	level;
+
+	if (t < tw->tick) {
+		fr_dlist_insert_tail(&tw->expired, data);
+		return;
+	}
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		unsigned int	shift = TW_BITS * level;
+		unsigned int	s;
+
+		if ((t >> (shift + TW_BITS)) != (tw->tick >> (shift + TW_BITS))) continue;
+
+		s = (t >> shift) & TW_MASK;
+		fr_dlist_insert_tail(&tw->slot[level][s], data);
+		tw_slot_set(tw, level, s);
+		return;
+	}
+
+	fr_dlist_insert_tail(&tw->overflow, data);
+}
+
+/** Re-place all of the elements in a list, relative to the current tick
+ *
+ */
+static void tw_relink(fr_timer_wheel_t *tw, fr_dlist_head_t *list)
+{
+	fr_dlist_head_t	tmp;
+	void		*data;
+
+	if (fr_dlist_empty(list)) return;
+
+	_fr_dlist_init(&tmp, tw->offset, NULL);
+	fr_dlist_move(&tmp, list);
+
+	while ((data = fr_dlist_head(&tmp)) != NULL) {
+		fr_dlist_remove(&tmp, data);
+		tw_link(tw, data);
+	}
+}
+
+/** Move the wheel forward to a new tick
+ *
+ * Any slots we skip over must be empty.  Slots of higher levels
+ * which now cover the current tick are cascaded down, highest
+ * level first.
+ */
+static void tw_jump(fr_timer_wheel_t *tw, uint64_t tick)
+{
+	uint64_t	prev = tw->tick;
+	unsigned int	level;
+
+	tw->tick = tick;
+
+	if ((prev >> (TW_BITS * TW_LEVELS)) != (tick >> (TW_BITS * TW_LEVELS))) tw_relink(tw, &tw->overflow);
+
+	for (level = TW_LEVELS - 1; level > 0; level--) {
+		unsigned int	shift = TW_BITS * level;
+		unsigned int	s;
+
+		if ((prev >> shift) == (tick >> shift)) continue;
+
+		s = (tick >> shift) & TW_MASK;
+		tw_slot_clear(tw, level, s);
+		tw_relink(tw, &tw->slot[level][s]);
+	}
+}
+
+/** Find the earliest tick which may have elements
+ *
+ * @return the tick, or UINT64_MAX if the wheel is empty.
+ */
+static uint64_t tw_next_tick(fr_timer_wheel_t *tw)
+{
+	unsigned int level;
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		unsigned int	shift = TW_BITS * level;
+		unsigned int	idx = (tw->tick >> shift) & TW_MASK;
+		unsigned int	s;
+		uint64_t	t;
+
+		/*
+		 *	The current slot of the higher levels has
+		 *	already been cascaded down.
+		 */
+		s = tw_slot_next(tw, level, (level == 0) ? idx : idx + 1);
+		if (s == TW_SLOTS) continue;
+
+		t = (tw->tick >> (shift + TW_BITS)) << (shift + TW_BITS);
+		t += ((uint64_t) s) << shift;
+
+		return (t > tw->tick) ? t : tw->tick;
+	}
+
+	if (!fr_dlist_empty(&tw->overflow)) {
+		return ((tw->tick >> (TW_BITS * TW_LEVELS)) + 1) << (TW_BITS * TW_LEVELS);
+	}
+
+	return UINT64_MAX;
+}
+
+/** Move everything which expired before now_tick to the expired list
+ *
+ */
+static void tw_advance(fr_timer_wheel_t *tw, uint64_t now_tick)
+{
+	while (tw->tick < now_tick) {
+		uint64_t	next = tw_next_tick(tw);
+		unsigned int	s;
+
+		if (next > tw->tick) {
+			tw_jump(tw, (next < now_tick) ? next : now_tick);
+			continue;
+		}
+
+		/*
+		 *	fr_dlist_move() can't deal with empty lists,
+		 *	and bits are cleared lazily.
+		 */
+		s = tw->tick & TW_MASK;
+		tw_slot_clear(tw, 0, s);
+		if (!fr_dlist_empty(&tw->slot[0][s])) fr_dlist_move(&tw->expired, &tw->slot[0][s]);
+		tw_jump(tw, tw->tick + 1);
+	}
+}
+
+/** Insert an element into the wheel
+ *
+ * @param[in] tw	to insert into.
+ * @param[in] data	to insert.  Must not already be in a wheel.
+ * @param[in] when	the element expires.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the element is already in a wheel.
+ */
+int fr_timer_wheel_insert(fr_timer_wheel_t *tw, void *data, fr_time_t when)
+{
+	fr_timer_wheel_entry_t *e = TW_ENTRY(tw, data);
+
+	if (e->entry.next && (e->entry.next != &e->entry)) {
+		fr_strerror_printf("Element is already in a timer wheel");
+		return -1;
+	}
+
+	e->when = when;
+	tw_link(tw, data);
+	tw->num_elements++;
+
+	return 0;
+}
+
+/** Remove an element from the wheel
+ *
+ * @param[in] tw	to remove the element from.
+ * @param[in] data	to remove.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the element is not in the wheel.
+ */
+int fr_timer_wheel_extract(fr_timer_wheel_t *tw, void *data)
+{
+	fr_timer_wheel_entry_t *e = TW_ENTRY(tw, data);
+
+	if (!e->entry.next || (e->entry.next == &e->entry)) return -1;
+
+	/*
+	 *	The head is only used to find the offset of
+	 *	the entry, which is the same for every list.
+	 */
+	(void) fr_dlist_remove(&tw->expired, data);
+	tw->num_elements--;
+
+	return 0;
+}
+
+/** Return an element which expired at or before now, without removing it
+ *
+ * @param[in] tw	to check.
+ * @param[in] now	the current time.
+ * @return
+ *	- An expired element.
+ *	- NULL if no elements have expired.
+ */
+void *fr_timer_wheel_peek(fr_timer_wheel_t *tw, fr_time_t now)
+{
+	uint64_t	now_tick = now / tw->resolution;
+	fr_dlist_head_t	*head;
+	void		*data;
+
+	/*
+	 *	Nothing to move through, so skip straight to now.
+	 */
+	if (!tw->num_elements) {
+		if (now_tick > tw->tick) {
+			memset(tw->used, 0, sizeof(tw->used));
+			tw->tick = now_tick;
+		}
+		return NULL;
+	}
+
+	data = fr_dlist_head(&tw->expired);
+	if (data) return data;
+
+	tw_advance(tw, now_tick);
+
+	data = fr_dlist_head(&tw->expired);
+	if (data) return data;
+
+	/*
+	 *	The slot for the current tick may contain
+	 *	elements which have expired, and some which
+	 *	haven't.
+	 */
+	if (tw->tick != now_tick) return NULL;
+
+	head = &tw->slot[0][tw->tick & TW_MASK];
+	for (data = fr_dlist_head(head);
+	     data != NULL;
+	     data = fr_dlist_next(head, data)) {
+		if (TW_ENTRY(tw, data)->when <= now) return data;
+	}
+
+	return NULL;
+}
+
+/** Remove and return an element which expired at or before now
+ *
+ * @param[in] tw	to pop from.
+ * @param[in] now	the current time.
+ * @return
+ *	- An expired element.
+ *	- NULL if no elements have expired.
+ */
+void *fr_timer_wheel_pop(fr_timer_wheel_t *tw, fr_time_t now)
+{
+	void *data;
+
+	data = fr_timer_wheel_peek(tw, now);
+	if (!data) return NULL;
+
+	(void) fr_timer_wheel_extract(tw, data);
+
+	return data;
+}
+
+/** Return any element in the wheel
+ *
+ * Mainly useful for freeing all the elements.
+ *
+ * @param[in] tw	to return an element from.
+ * @return
+ *	- An element, which is not necessarily the one expiring first.
+ *	- NULL if the wheel is empty.
+ */
+void *fr_timer_wheel_head(fr_timer_wheel_t *tw)
+{
+	unsigned int	level, s;
+	void		*data;
+
+	if (!tw->num_elements) return NULL;
+
+	data = fr_dlist_head(&tw->expired);
+	if (data) return data;
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		for (s = tw_slot_next(tw, level, 0);
+		     s < TW_SLOTS;
+		     s = tw_slot_next(tw, level, s + 1)) {
+			data = fr_dlist_head(&tw->slot[level][s]);
+			if (data) return data;
+
+			tw_slot_clear(tw, level, s);
+		}
+	}
+
+	return fr_dlist_head(&tw->overflow);
+}
+
+/** Return a time at or before the expiry time of the first element
+ *
+ * The time is exact if the first element expires in the current
+ * tick, otherwise it's the start of the first slot which may be
+ * in use.
+ *
+ * @param[in] tw	to check.
+ * @param[out] when	Where to write the time.  0 if elements have
+ *			already expired.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the wheel is empty.
+ */
+int fr_timer_wheel_next(fr_timer_wheel_t *tw, fr_time_t *when)
+{
+	uint64_t	tick;
+
+	if (!tw->num_elements) return -1;
+
+	if (!fr_dlist_empty(&tw->expired)) {
+		*when = 0;
+		return 0;
+	}
+
+	tick = tw_next_tick(tw);
+	if (tick == tw->tick) {
+		fr_dlist_head_t	*head = &tw->slot[0][tick & TW_MASK];
+		fr_time_t	first = 0;
+		void		*data;
+
+		for (data = fr_dlist_head(head);
+		     data != NULL;
+		     data = fr_dlist_next(head, data)) {
+			fr_time_t expires = TW_ENTRY(tw, data)->when;
+
+			if (!first || (expires < first)) first = expires;
+		}
+
+		if (first) {
+			*when = first;
+			return 0;
+		}
+
+		tick++;
+	}
+
+	*when = tick * tw->resolution;
+	return 0;
+}
+
+/** Return the number of elements in the wheel
+ *
+ */
+uint32_t fr_timer_wheel_num_elements(fr_timer_wheel_t *tw)
+{
+	return tw->num_elements;
+}
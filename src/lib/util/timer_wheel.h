@@ -0,0 +1,76 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Structures and prototypes for hierarchical timer wheels
+ *
+ * @file src/lib/util/timer_wheel.h
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSIDH(timer_wheel_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/util/dlist.h>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <talloc.h>
+
+/** Embedded in each element stored in a timer wheel
+ *
+ */
+typedef struct {
+	fr_dlist_t	entry;			//!< Entry in a wheel slot.  Must be first.
+	fr_time_t	when;			//!< When the element expires.
+} fr_timer_wheel_entry_t;
+
+typedef struct fr_timer_wheel_s fr_timer_wheel_t;
+
+/** Creates a timer wheel
+ *
+ * @param[in] _ctx		Talloc ctx to allocate the wheel in.
+ * @param[in] _resolution	Width of a slot in the lowest level of the wheel.
+ * @param[in] _now		Time the wheel starts at.
+ * @param[in] _type		Of elements.
+ * @param[in] _field		#fr_timer_wheel_entry_t in each element.
+ * @return
+ *	- A new timer wheel.
+ *	- NULL on error.
+ */
+#define fr_timer_wheel_create(_ctx, _resolution, _now, _type, _field) \
+	_fr_timer_wheel_create(_ctx, _resolution, _now, (size_t)offsetof(_type, _field))
+
+fr_timer_wheel_t	*_fr_timer_wheel_create(TALLOC_CTX *ctx, fr_time_t resolution, fr_time_t now, size_t offset);
+
+int			fr_timer_wheel_insert(fr_timer_wheel_t *tw, void *data, fr_time_t when) CC_HINT(nonnull);
+int			fr_timer_wheel_extract(fr_timer_wheel_t *tw, void *data) CC_HINT(nonnull);
+void			*fr_timer_wheel_peek(fr_timer_wheel_t *tw, fr_time_t now) CC_HINT(nonnull);
+void			*fr_timer_wheel_pop(fr_timer_wheel_t *tw, fr_time_t now) CC_HINT(nonnull);
+void			*fr_timer_wheel_head(fr_timer_wheel_t *tw) CC_HINT(nonnull);
+int			fr_timer_wheel_next(fr_timer_wheel_t *tw, fr_time_t *when) CC_HINT(nonnull);
+
+uint32_t		fr_timer_wheel_num_elements(fr_timer_wheel_t *tw) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
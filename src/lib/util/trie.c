@@ -23,6 +23,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/latency.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/trie.h>
@@ -50,9 +51,11 @@ RCSID("$Id$")
  *	after deleting 10/8, the trie should contain only the 0/0
  *	network and associated destination.
  *
- *	As of yet, it does not do level compression.  This can be
- *	added without (hopefully) too much work.  That would require
- *	an additional step to "normalize" the trie.
+ *	The trie itself does not do level compression.  Instead, once
+ *	a trie has been built, it can be "frozen" via fr_trie_freeze().
+ *	That creates a level compressed copy of the trie, which is
+ *	used for all subsequent lookups.  The frozen copy uses array
+ *	indexes instead of pointers, and is read-only.
  *
  *	This code could be extended to do packet matching, through the
  *	inclusion of "don't care" paths.  e.g. parsing an IP header,
@@ -86,10 +89,15 @@ RCSID("$Id$")
  *  manipulation functions.  If the trie manipulation has a bug, the
  *  verification routines are likely to catch some of the more
  *  egregious issues.
+ *
+ *  The checks are also run on every lookup, so the "bench" test
+ *  command is built with NO_TRIE_VERIFY.
  */
 DIAG_OFF(unused-macros)
 #ifdef TESTING
-#  define WITH_TRIE_VERIFY
+#  ifndef NO_TRIE_VERIFY
+#    define WITH_TRIE_VERIFY
+#  endif
 #  define MPRINT(...) fprintf(stderr, ## __VA_ARGS__)
 #else
 #  define MPRINT(...)
@@ -103,19 +111,8 @@ DIAG_OFF(unused-macros)
 #  endif
 #endif
 
-// @todo - do level compression
-// stop merging nodes if a key ends at the top of the level
-// otherwise merge so we have at least 2^4 way fan-out, but no more than 2^8
-// that should be a decent trade-off between memory and speed
-
-// @todo - generalized function to normalize the trie.
-
 // @todo - add tests to run with / without path compression
 
-// @todo add "depth" for test, which shows how many nodes deep the trie is
-
-// @todo add "nodes" for test, which shows how many nodes are in the trie
-
 // @todo - make this configurable in fr_trie_t, and pass fr_trei_t to
 // all internal function.
 
@@ -166,10 +163,13 @@ typedef struct {
 /** The main trie data structure.
  *
  */
+typedef struct fr_trie_frozen_s fr_trie_frozen_t;
+
 struct fr_trie_t {
 	int		number;			//!< for walking back up the trie
 	int		default_size;		//!< for trie nodes
 	void		*trie;			//!< the first node
+	fr_trie_frozen_t *frozen;		//!< level compressed copy, for lookups
 };
 
 
@@ -194,6 +194,8 @@ static int fr_trie_merge(fr_trie_t *ft, TALLOC_CTX *ctx, void **parent_p, void *
 
 static int fr_trie_key_insert(fr_trie_t *ft, TALLOC_CTX *ctx, void **parent_p, uint8_t const *key, int start_bit, int end_bit, void *trie) CC_HINT(nonnull);
 
+static void *fr_trie_frozen_lookup(fr_trie_t const *ft, uint8_t const *key, int end_bit) CC_HINT(nonnull);
+
 static void *reparent(TALLOC_CTX *ctx, void *trie)
 {
 	/*
@@ -318,23 +320,6 @@ static void fr_trie_path_verify(fr_trie_path_t const *path)
 	fr_cond_assert(path->key != NULL);
 	fr_cond_assert(talloc_parent(path->key) == path);
 
-	if ((path->start_bit == 0) && (path->length >= 8)) {
-		fr_cond_assert(path->key[0] > ' ');
-		fr_cond_assert(path->key[0] < 0x7f);
-	}
-
-	/*
-	 *	This is only for testing...
-	 */
-	if (BYTEOF(path->end_bit) > 2) {
-		int i;
-
-		for (i = 1; i < BYTEOF(path->end_bit); i++) {
-			fr_cond_assert(path->key[i] > ' ');
-			fr_cond_assert(path->key[i] < 0x7f);
-		}
-	}
-
 	fr_cond_assert(trie_parent(path->trie) == path);
 }
 #endif	/* WITH_PATH_COMPRESSION */
@@ -498,6 +483,12 @@ static int fr_trie_path_lcp(uint8_t const *key1, int keylen1, uint8_t const *key
 		 */
 		if (!lcp) return 0;
 
+		/*
+		 *	The keys differ in the first byte.  The
+		 *	following bytes don't matter.
+		 */
+		if (lcp < (e2 - s2)) goto done;
+
 		/*
 		 *	We only have one byte, and we've checked that.
 		 *	Return the longest prefix.
@@ -811,10 +802,10 @@ static void *fr_trie_path_merge_paths(fr_trie_t *ft, TALLOC_CTX *ctx, fr_trie_pa
 	fr_cond_assert(path1->start_bit == path2->start_bit);
 
 	/*
-	 *	path1 is from the existing trie.  path2 is the path we're trying to insert.
+	 *	path1 is from the existing trie.  path2 is either the
+	 *	path we're trying to insert, or part of a node which
+	 *	is being merged into the trie.
 	 */
-	fr_cond_assert(IS_USER(path2->trie));
-
 	(void) talloc_get_type_abort(path1, fr_trie_path_t);
 
 	prefix_len = fr_trie_path_lcp(path1->key, path1->length, path2->key, path2->length, path1->start_bit);
@@ -858,7 +849,7 @@ static void *fr_trie_path_merge_paths(fr_trie_t *ft, TALLOC_CTX *ctx, fr_trie_pa
 		/*
 		 *	We can insert, but we can't over-write an entry.
 		 */
-		if (IS_USER(path1->trie)) {
+		if (IS_USER(path1->trie) && IS_USER(path2->trie)) {
 			MPRINT("FAILED %d prefix %d\n", __LINE__, (int)prefix_len);
 			return NULL;
 		}
@@ -1017,7 +1008,7 @@ static uint16_t get_chunk(uint8_t const *key, int num_bits, int start_bit, int e
 
 	fr_cond_assert(num_bits > 0);
 	fr_cond_assert(num_bits <= 8);
-	fr_cond_assert(start_bit < end_bit);
+	fr_cond_assert((start_bit + num_bits) <= end_bit);
 
 	/*
 	 *	Load the byte
@@ -1025,7 +1016,11 @@ static uint16_t get_chunk(uint8_t const *key, int num_bits, int start_bit, int e
 	chunk = key[BYTEOF(start_bit)];
 	chunk <<= 8;
 
-	if ((start_bit + 8) < end_bit) {
+	/*
+	 *	Load the next byte, if the chunk crosses a byte
+	 *	boundary.
+	 */
+	if (((start_bit & 0x07) + num_bits) > 8) {
 		chunk |= key[BYTEOF(start_bit) + 1];
 	}
 
@@ -1152,7 +1147,7 @@ static int fr_trie_merge(fr_trie_t *ft, TALLOC_CTX *ctx, void **parent_p, void *
 #endif
 
 	if (IS_NODE(a) && IS_NODE(b)) {
-		int i, bits;
+		int i, bits, incr;
 		fr_trie_node_t *node1 = a;
 		fr_trie_node_t *node2 = b;
 
@@ -1163,10 +1158,14 @@ static int fr_trie_merge(fr_trie_t *ft, TALLOC_CTX *ctx, void **parent_p, void *
 			for (i = 0; i < (1 << node1->size); i++) {
 				if (!node1->trie[i] && !node2->trie[i]) continue;
 
+				incr = (node1->trie[i] == NULL);
+
 				if (fr_trie_merge(ft, node1, &node1->trie[i], node1->trie[i],
-						  node2->trie[i], depth) < 0) {
+						  node2->trie[i], depth + node1->size) < 0) {
 					return -1;
 				}
+
+				node1->used += incr;
 			}
 
 			talloc_free(node2);
@@ -1213,13 +1212,17 @@ static int fr_trie_merge(fr_trie_t *ft, TALLOC_CTX *ctx, void **parent_p, void *
 				 *	information.
 				 */
 				subtrie = fr_trie_path_prefix_add(ft, node1, node2->trie[(i << bits) | j],
-								  bits, j, depth);
+								  bits, j, depth + node1->size);
 				if (!fr_cond_assert(subtrie != NULL)) return -1;
 
+				incr = (node1->trie[i] == NULL);
+
 				if (fr_trie_merge(ft, node1, &node1->trie[i],
-						  node1->trie[i], subtrie, depth) < 0) {
+						  node1->trie[i], subtrie, depth + node1->size) < 0) {
 					return -1;
 				}
+
+				node1->used += incr;
 #else
 				fr_trie_node_t	*subnode;
 
@@ -1230,6 +1233,7 @@ static int fr_trie_merge(fr_trie_t *ft, TALLOC_CTX *ctx, void **parent_p, void *
 				if (!node1->trie[i]) {
 					subnode = node1->trie[i] = fr_trie_node_alloc(ft, node1, bits);
 					if (!fr_cond_assert(subnode != NULL)) return -1;
+					node1->used++;
 
 				} else if (IS_NODE(node1->trie[i])) {
 					subnode = node1->trie[i];
@@ -1256,10 +1260,14 @@ static int fr_trie_merge(fr_trie_t *ft, TALLOC_CTX *ctx, void **parent_p, void *
 					}
 				}
 
+				incr = (subnode->trie[j] == NULL);
+
 				if (fr_trie_merge(ft, subnode, &subnode->trie[j], subnode->trie[j],
-						  node2->trie[(i << bits) | j], depth) < 0) {
+						  node2->trie[(i << bits) | j], depth + node2->size) < 0) {
 					return -1;
 				}
+
+				subnode->used += incr;
 #endif
 			}
 		}
@@ -1281,6 +1289,8 @@ static int fr_trie_merge(fr_trie_t *ft, TALLOC_CTX *ctx, void **parent_p, void *
  *  The key may be LONGER than entries in the trie.  In which case the
  *  closest match is returned.
  *
+ *  If the trie has been frozen, the lookup uses the frozen copy.
+ *
  * @param trie	 	the trie
  * @param key	 	the key
  * @param start_bit	the start bit
@@ -1603,7 +1613,11 @@ insert_node:
 		fr_trie_node_t *node2;
 		int size = end_bit - start_bit;
 
-		node2 = fr_trie_node_alloc(ft, node, size);
+		/*
+		 *	The merge frees the larger node, so the
+		 *	new node can't be one of its children.
+		 */
+		node2 = fr_trie_node_alloc(ft, ctx, size);
 		if (!node2) {
 			fr_cond_assert(0 == 1);
 			MPRINT("FAILED %d\n", __LINE__);
@@ -1898,7 +1912,7 @@ fr_trie_t *fr_trie_alloc(TALLOC_CTX *ctx)
  * @param keylen key length in bits
  * @param data	 user ctx information to associated with the key
  * @return
- *	- <0 on error
+ *	- <0 on error, or if the trie has been frozen
  *	- 0 on success
  */
 int fr_trie_insert(fr_trie_t *ft, void const *key, size_t keylen, void *data)
@@ -1907,6 +1921,11 @@ int fr_trie_insert(fr_trie_t *ft, void const *key, size_t keylen, void *data)
 
 	if (keylen > MAX_KEY_BITS) return -1;
 
+	/*
+	 *	Frozen tries are read-only.
+	 */
+	if (ft->frozen) return -1;
+
 	/*
 	 *	Do a lookup before insertion.  If we tried to insert
 	 *	the key with new nodes and then discovered a conflict,
@@ -1943,14 +1962,14 @@ int fr_trie_insert(fr_trie_t *ft, void const *key, size_t keylen, void *data)
  * @param key	 the key
  * @param keylen key length in bits
  * @return
- *	- NULL on not found
+ *	- NULL on not found, or if the trie has been frozen
  *	- user ctx data on success
  */
 void *fr_trie_remove(fr_trie_t *ft, void const *key, size_t keylen)
 {
 	if (keylen > MAX_KEY_BITS) return NULL;
 
-	if (!ft->trie) return NULL;
+	if (!ft->trie || ft->frozen) return NULL;
 
 	return fr_trie_key_remove(ft, ft, (void **) &ft->trie, key, 0, (int) keylen);
 }
@@ -1960,6 +1979,8 @@ void *fr_trie_remove(fr_trie_t *ft, void const *key, size_t keylen)
  *  The key may be LONGER than entries in the trie.  In which case the
  *  closest match is returned.
  *
+ *  If the trie has been frozen, the lookup uses the frozen copy.
+ *
  * @param ft	 the trie
  * @param key	 the key bytes
  * @param keylen length in bits of the key
@@ -1971,6 +1992,8 @@ void *fr_trie_lookup(fr_trie_t const *ft, void const *key, size_t keylen)
 {
 	if (keylen > MAX_KEY_BITS) return NULL;
 
+	if (ft->frozen) return fr_trie_frozen_lookup(ft, key, keylen);
+
 	if (!ft->trie) return NULL;
 
 	return fr_trie_key_match(ft->trie, key, 0, keylen, false);
@@ -2325,6 +2348,438 @@ int fr_trie_walk(fr_trie_t *ft, void *ctx, fr_trie_walk_t callback)
 	return fr_trie_key_walk(ft->trie, &my_cb, 0, false);
 }
 
+/*
+ *	Frozen tries.
+ *
+ *	A frozen trie is a level compressed copy of the trie, which is
+ *	built once, and is then used for lookups.  Each node consumes
+ *	between 1 and 16 bits of the key, and is stored as a run of
+ *	2^N slots in one contiguous array.  A key which ends in the
+ *	middle of a node is expanded into all of the slots it covers,
+ *	and longer keys take precedence over shorter ones.  A lookup
+ *	is then one array access per node, and the longest prefix
+ *	match is the last data we saw on the way down.
+ *
+ *	Nodes refer to each other by array index, not by pointer.
+ *	There are no per-node allocations, and nothing in the arrays
+ *	changes after the trie has been frozen.
+ */
+#define FROZEN_MIN_BITS		(4)	//!< always have at least 2^4 way fan-out
+#define FROZEN_MAX_BITS		(16)	//!< but no more than 2^16
+#define FROZEN_BITS_MASK	(0x1f)
+#define FROZEN_SLOT_SHIFT	(5)
+#define FROZEN_MAX_SLOTS	((uint32_t) 1 << (32 - FROZEN_SLOT_SHIFT))
+
+/** One slot of a node in a frozen trie
+ *
+ */
+typedef struct {
+	uint32_t		next;		//!< first slot of the child << 5 | bits used by the child.  0 for none.
+	uint32_t		data;		//!< index + 1 of the longest match covering this slot.  0 for none.
+} fr_trie_slot_t;
+
+/** User ctx data in a frozen trie
+ *
+ */
+typedef struct {
+	void			*data;		//!< user ctx
+	int			keylen;		//!< length in bits of the key it was inserted with
+} fr_trie_frozen_data_t;
+
+/** The level compressed copy of a trie
+ *
+ */
+struct fr_trie_frozen_s {
+	uint32_t		root;		//!< the first node, encoded as for fr_trie_slot_t.next
+	uint32_t		root_data;	//!< the zero length key, encoded as for fr_trie_slot_t.data
+
+	fr_trie_slot_t		*slot;		//!< all of the nodes
+	uint32_t		num_slots;
+
+	fr_trie_frozen_data_t	*data;		//!< all of the user ctx data
+	uint32_t		num_data;
+
+	uint32_t		num_nodes;	//!< number of nodes in "slot"
+	int			depth;		//!< maximum number of nodes we go through for one lookup
+};
+
+/** A key which is being added to a frozen trie
+ *
+ */
+typedef struct {
+	uint8_t			*key;
+	int			keylen;
+	void			*data;
+} fr_trie_frozen_entry_t;
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	fr_trie_frozen_entry_t	*entry;
+	uint32_t		num_entries;
+} fr_trie_freeze_ctx_t;
+
+/** Get up to 16 bits from a key
+ *
+ *  Unlike get_chunk(), this function never reads past the byte which
+ *  holds the last bit it returns.
+ */
+static inline CC_HINT(always_inline) uint32_t get_bits(uint8_t const *key, int start_bit, int num_bits)
+{
+	uint8_t const	*p = key + BYTEOF(start_bit);
+	int		end_bit = (start_bit & 0x07) + num_bits;
+	uint32_t	chunk = p[0];
+
+	if (end_bit > 8) chunk = (chunk << 8) | p[1];
+	if (end_bit > 16) chunk = (chunk << 8) | p[2];
+
+	chunk >>= BITSOF(BYTES(end_bit)) - end_bit;
+
+	return chunk & ((1 << num_bits) - 1);
+}
+
+/** Copy one key from the trie
+ *
+ */
+static int fr_trie_freeze_cb(void *ctx, uint8_t const *key, int keylen, void *data)
+{
+	fr_trie_freeze_ctx_t	*my_freeze = ctx;
+	fr_trie_frozen_entry_t	*entry;
+	uint32_t		size = talloc_array_length(my_freeze->entry);
+
+	if (my_freeze->num_entries == size) {
+		entry = talloc_realloc(my_freeze->ctx, my_freeze->entry, fr_trie_frozen_entry_t, size ? (size * 2) : 64);
+		if (!entry) return -1;
+
+		my_freeze->entry = entry;
+	}
+
+	entry = &my_freeze->entry[my_freeze->num_entries++];
+	entry->keylen = keylen;
+	entry->data = data;
+
+	entry->key = talloc_array(my_freeze->ctx, uint8_t, BYTES(keylen) + 1);
+	if (!entry->key) return -1;
+
+	memcpy(entry->key, key, BYTES(keylen));
+
+	/*
+	 *	Clear any bits past the end of the key, so that they
+	 *	don't affect the sorting.
+	 */
+	if ((keylen & 0x07) != 0) entry->key[BYTEOF(keylen)] &= 0xff << (8 - (keylen & 0x07));
+
+	return 0;
+}
+
+/** Sort keys by their bits, with shorter keys before longer ones
+ *
+ *  This puts a key before all of the keys it is a prefix of, and
+ *  puts all of the keys which share a prefix next to each other.
+ */
+static int fr_trie_frozen_entry_cmp(void const *one, void const *two)
+{
+	fr_trie_frozen_entry_t const *a = one, *b = two;
+	int i, num_bits, keylen;
+
+	keylen = (a->keylen < b->keylen) ? a->keylen : b->keylen;
+
+	for (i = 0; i < keylen; i += num_bits) {
+		uint32_t chunk_a, chunk_b;
+
+		num_bits = keylen - i;
+		if (num_bits > FROZEN_MAX_BITS) num_bits = FROZEN_MAX_BITS;
+
+		chunk_a = get_bits(a->key, i, num_bits);
+		chunk_b = get_bits(b->key, i, num_bits);
+		if (chunk_a != chunk_b) return (chunk_a > chunk_b) - (chunk_a < chunk_b);
+	}
+
+	return (a->keylen > b->keylen) - (a->keylen < b->keylen);
+}
+
+/** Add user ctx data to a frozen trie
+ *
+ * @return
+ *	- 0 on error
+ *	- index + 1 of the data on success
+ */
+static uint32_t fr_trie_frozen_data_add(fr_trie_frozen_t *fz, fr_trie_frozen_entry_t const *entry)
+{
+	uint32_t size = talloc_array_length(fz->data);
+
+	if (fz->num_data == size) {
+		fr_trie_frozen_data_t *data;
+
+		data = talloc_realloc(fz, fz->data, fr_trie_frozen_data_t, size ? (size * 2) : 64);
+		if (!data) return 0;
+
+		fz->data = data;
+	}
+
+	fz->data[fz->num_data].data = entry->data;
+	fz->data[fz->num_data].keylen = entry->keylen;
+
+	return ++fz->num_data;
+}
+
+/** Count the slots in a node which would have distinct contents
+ *
+ *  i.e. one for each child, and one for each key which ends in the
+ *  node.  The slots which are filled by expanding a short key don't
+ *  count, otherwise one short key would make every node look full.
+ *
+ *  The keys are sorted, so all of the keys which go to the same
+ *  child are next to each other.
+ */
+static uint32_t fr_trie_frozen_used(fr_trie_frozen_entry_t const *entry, uint32_t num, int start_bit, int bits)
+{
+	uint32_t i, used = 0, chunk = 0;
+	bool child = false;
+
+	for (i = 0; i < num; i++) {
+		if ((entry[i].keylen - start_bit) < bits) {
+			used++;
+			continue;
+		}
+
+		if (child && (get_bits(entry[i].key, start_bit, bits) == chunk)) continue;
+
+		chunk = get_bits(entry[i].key, start_bit, bits);
+		child = true;
+		used++;
+	}
+
+	return used;
+}
+
+/** Build one node of a frozen trie, and all of its children
+ *
+ * @param fz		the frozen trie
+ * @param[out] out	where the node is written, encoded as for fr_trie_slot_t.next
+ * @param entry		the sorted keys, which all share the first "start_bit" bits
+ *			and are all longer than "start_bit"
+ * @param num		the number of keys
+ * @param start_bit	the first bit this node uses
+ * @param depth		how many nodes deep this node is
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int fr_trie_frozen_build(fr_trie_frozen_t *fz, uint32_t *out, fr_trie_frozen_entry_t const *entry,
+				uint32_t num, int start_bit, int depth)
+{
+	uint32_t	i, j, slot, size;
+	int		bits, keylen = 0;
+
+	for (i = 0; i < num; i++) {
+		if (entry[i].keylen > keylen) keylen = entry[i].keylen;
+	}
+
+	/*
+	 *	Level compression.  Use the widest node where at
+	 *	least half of the slots are used.  Sparse parts of the
+	 *	trie get 2^4 way nodes, which are small, and dense
+	 *	parts get wide nodes, which are fast.
+	 */
+	bits = keylen - start_bit;
+	if (bits > FROZEN_MAX_BITS) bits = FROZEN_MAX_BITS;
+
+	while (bits > FROZEN_MIN_BITS) {
+		if ((fr_trie_frozen_used(entry, num, start_bit, bits) * 2) >= ((uint32_t) 1 << bits)) break;
+		bits--;
+	}
+
+	if ((fz->num_slots + (1 << bits)) > FROZEN_MAX_SLOTS) {
+		MPRINT("FAILED %d - %u slots\n", __LINE__, fz->num_slots);
+		return -1;
+	}
+
+	size = talloc_array_length(fz->slot);
+	if ((fz->num_slots + (1 << bits)) > size) {
+		fr_trie_slot_t *array;
+
+		while ((fz->num_slots + (1 << bits)) > size) size = size ? (size * 2) : 256;
+
+		array = talloc_realloc(fz, fz->slot, fr_trie_slot_t, size);
+		if (!array) return -1;
+
+		fz->slot = array;
+	}
+
+	slot = fz->num_slots;
+	memset(&fz->slot[slot], 0, sizeof(fz->slot[0]) << bits);
+
+	fz->num_slots += 1 << bits;
+	fz->num_nodes++;
+	if (depth > fz->depth) fz->depth = depth;
+
+	for (i = 0; i < num; i = j) {
+		uint32_t chunk, next;
+		int len = entry[i].keylen - start_bit;
+
+		/*
+		 *	The key ends in this node.  Expand it to all
+		 *	of the slots it covers.  Any longer key which
+		 *	covers the same slots is sorted after this one,
+		 *	and so will overwrite it.
+		 */
+		if (len <= bits) {
+			uint32_t k, data, first;
+
+			data = fr_trie_frozen_data_add(fz, &entry[i]);
+			if (!data) return -1;
+
+			first = get_bits(entry[i].key, start_bit, len) << (bits - len);
+
+			for (k = first; k < (first + (1 << (bits - len))); k++) {
+				fz->slot[slot + k].data = data;
+			}
+
+			j = i + 1;
+			continue;
+		}
+
+		/*
+		 *	The key continues past this node.  Find all of
+		 *	the other keys which go to the same child.
+		 */
+		chunk = get_bits(entry[i].key, start_bit, bits);
+
+		for (j = i + 1; j < num; j++) {
+			if ((entry[j].keylen - start_bit) <= bits) break;
+			if (get_bits(entry[j].key, start_bit, bits) != chunk) break;
+		}
+
+		if (fr_trie_frozen_build(fz, &next, &entry[i], j - i, start_bit + bits, depth + 1) < 0) return -1;
+
+		/*
+		 *	fz->slot may have been moved by the child.
+		 */
+		fz->slot[slot + chunk].next = next;
+	}
+
+	*out = (slot << FROZEN_SLOT_SHIFT) | bits;
+
+	return 0;
+}
+
+/** Freeze a trie
+ *
+ *  Builds a level compressed, read-only copy of the trie, which is
+ *  then used by fr_trie_lookup().  The trie should be frozen once all
+ *  of the keys have been inserted.  After it has been frozen, all
+ *  insertions and removals fail.
+ *
+ *  fr_trie_match() and fr_trie_walk() still use the original trie.
+ *
+ * @param ft	the trie
+ * @return
+ *	- <0 on error.  The trie is left as it was.
+ *	- 0 on success
+ */
+int fr_trie_freeze(fr_trie_t *ft)
+{
+	fr_trie_frozen_t	*fz;
+	fr_trie_freeze_ctx_t	my_freeze;
+	uint32_t		i = 0;
+
+	if (ft->frozen) return 0;
+
+	fz = talloc_zero(ft, fr_trie_frozen_t);
+	if (!fz) return -1;
+
+	memset(&my_freeze, 0, sizeof(my_freeze));
+	my_freeze.ctx = talloc_new(fz);
+	if (!my_freeze.ctx) goto fail;
+
+	if (ft->trie && (fr_trie_walk(ft, &my_freeze, fr_trie_freeze_cb) < 0)) goto fail;
+
+	if (my_freeze.num_entries > 0) {
+		qsort(my_freeze.entry, my_freeze.num_entries, sizeof(my_freeze.entry[0]), fr_trie_frozen_entry_cmp);
+
+		/*
+		 *	The zero length key matches everything.
+		 */
+		if (my_freeze.entry[0].keylen == 0) {
+			fz->root_data = fr_trie_frozen_data_add(fz, &my_freeze.entry[0]);
+			if (!fz->root_data) goto fail;
+			i++;
+		}
+
+		if ((i < my_freeze.num_entries) &&
+		    (fr_trie_frozen_build(fz, &fz->root, &my_freeze.entry[i], my_freeze.num_entries - i, 0, 1) < 0)) {
+			goto fail;
+		}
+	}
+
+	talloc_free(my_freeze.ctx);
+
+	/*
+	 *	Trim the arrays to their final size.
+	 */
+	if (fz->num_slots) fz->slot = talloc_realloc(fz, fz->slot, fr_trie_slot_t, fz->num_slots);
+	if (fz->num_data) fz->data = talloc_realloc(fz, fz->data, fr_trie_frozen_data_t, fz->num_data);
+
+	ft->frozen = fz;
+	return 0;
+
+fail:
+	talloc_free(fz);
+	return -1;
+}
+
+/** Look up a key in a frozen trie
+ *
+ *  This is the same as fr_trie_key_match() with exact=false, but
+ *  uses the frozen copy.
+ */
+static void *fr_trie_frozen_lookup(fr_trie_t const *ft, uint8_t const *key, int end_bit)
+{
+	fr_trie_frozen_t const	*fz = ft->frozen;
+	fr_trie_slot_t const	*slot;
+	uint32_t		next = fz->root;
+	uint32_t		found = fz->root_data;
+	int			start_bit = 0;
+
+	while (next) {
+		int bits = next & FROZEN_BITS_MASK;
+		int len = end_bit - start_bit;
+
+		/*
+		 *	The key ends in the middle of this node.  The
+		 *	slot where the rest of the key is all zeros is
+		 *	covered by every key which can match.  If the
+		 *	longest of those is no longer than our key, it's
+		 *	the match.
+		 */
+		if (len < bits) {
+			if (!len) break;
+
+			slot = &fz->slot[(next >> FROZEN_SLOT_SHIFT) + (get_bits(key, start_bit, len) << (bits - len))];
+			if (!slot->data) break;
+
+			if (fz->data[slot->data - 1].keylen <= end_bit) return fz->data[slot->data - 1].data;
+
+			/*
+			 *	A longer key hides the one we want.
+			 *	This should be rare, so just use the
+			 *	original trie.
+			 */
+			return fr_trie_key_match(ft->trie, key, 0, end_bit, false);
+		}
+
+		slot = &fz->slot[(next >> FROZEN_SLOT_SHIFT) + get_bits(key, start_bit, bits)];
+		if (slot->data) found = slot->data;
+
+		next = slot->next;
+		start_bit += bits;
+	}
+
+	if (!found) return NULL;
+
+	return fz->data[found - 1].data;
+}
+
 #ifdef TESTING
 static bool print_lineno = false;
 
@@ -2535,6 +2990,8 @@ static int command_dump(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, char
  */
 static int command_clear(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, UNUSED char *out, UNUSED size_t outlen)
 {
+	TALLOC_FREE(ft->frozen);
+
 	if (!ft->trie) return 0;
 
 	if (IS_USER(ft->trie)) {
@@ -2819,6 +3276,249 @@ static int command_lcp(UNUSED fr_trie_t *ft, int argc, char **argv, char *out, s
 }
 
 
+/**  Count the nodes in a trie, and find how deep it is
+ *
+ */
+typedef struct {
+	int		nodes;			//!< 2^N way nodes
+	int		paths;			//!< path-compressed nodes
+	int		users;			//!< user ctx nodes
+	int		depth;			//!< maximum number of nodes (of any kind) to a key
+} fr_trie_stats_t;
+
+static void fr_trie_stats(void *trie, int depth, fr_trie_stats_t *stats)
+{
+	int i;
+	fr_trie_node_t *node;
+
+	if (!trie) return;
+
+	depth++;
+	if (depth > stats->depth) stats->depth = depth;
+
+	if (IS_USER(trie)) {
+		stats->users++;
+		fr_trie_stats(GET_USER(trie)->trie, depth, stats);
+		return;
+	}
+
+#ifdef WITH_PATH_COMPRESSION
+	if (IS_PATH(trie)) {
+		stats->paths++;
+		fr_trie_stats(GET_PATH(trie)->trie, depth, stats);
+		return;
+	}
+#endif
+
+	node = trie;
+	stats->nodes++;
+
+	for (i = 0; i < (1 << node->size); i++) {
+		fr_trie_stats(node->trie[i], depth, stats);
+	}
+}
+
+
+/**  Print how many nodes deep the trie is.
+ *
+ *  If the trie is frozen, print the depth of the frozen copy.
+ */
+static int command_depth(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, char *out, size_t outlen)
+{
+	fr_trie_stats_t stats;
+
+	if (ft->frozen) {
+		snprintf(out, outlen, "%d", ft->frozen->depth);
+		return 0;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	fr_trie_stats(ft->trie, 0, &stats);
+
+	snprintf(out, outlen, "%d", stats.depth);
+	return 0;
+}
+
+
+/**  Print how many nodes are in the trie.
+ *
+ *  User ctx nodes are not counted.  If the trie is frozen, print the
+ *  number of nodes in the frozen copy.
+ */
+static int command_nodes(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, char *out, size_t outlen)
+{
+	fr_trie_stats_t stats;
+
+	if (ft->frozen) {
+		snprintf(out, outlen, "%u", ft->frozen->num_nodes);
+		return 0;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	fr_trie_stats(ft->trie, 0, &stats);
+
+	snprintf(out, outlen, "%d", stats.nodes + stats.paths);
+	return 0;
+}
+
+
+/**  Freeze the trie.
+ *
+ */
+static int command_freeze(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, UNUSED char *out, UNUSED size_t outlen)
+{
+	return fr_trie_freeze(ft);
+}
+
+
+static uint32_t bench_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+static void bench_key(uint8_t *key, uint32_t addr)
+{
+	key[0] = addr >> 24;
+	key[1] = addr >> 16;
+	key[2] = addr >> 8;
+	key[3] = addr;
+}
+
+/**  Compare lookups in a mutable trie and a frozen trie.
+ *
+ *  bench <networks> <lookups>
+ *
+ *  Inserts random IPv4 networks into a new trie, and times lookups of
+ *  random addresses.  The trie is then frozen, and the same lookups
+ *  are timed again.  The results are printed to stdout.
+ *
+ *  The lookups in the frozen trie MUST return the same answers as
+ *  the lookups in the mutable trie.  Keys of every length are also
+ *  checked, not just full addresses.
+ */
+static int command_bench(UNUSED fr_trie_t *ft, UNUSED int argc, char **argv, UNUSED char *out, UNUSED size_t outlen)
+{
+	int		i, num_networks, num_lookups, inserted = 0;
+	uint32_t	state = 0x12345678;
+	uint32_t	*networks, *addrs;
+	void		**answer;
+	uint64_t	start, t_mutable, t_frozen;
+	size_t		memory;
+	fr_trie_t	*bench;
+	fr_trie_stats_t	stats;
+	TALLOC_CTX	*ctx;
+
+	num_networks = atoi(argv[0]);
+	num_lookups = atoi(argv[1]);
+	if ((num_networks <= 0) || (num_lookups <= 0)) {
+		MPRINT("Invalid number of networks or lookups\n");
+		return -1;
+	}
+
+	ctx = talloc_init("bench");
+	networks = talloc_array(ctx, uint32_t, num_networks);
+	addrs = talloc_array(ctx, uint32_t, num_lookups);
+	answer = talloc_array(ctx, void *, num_lookups);
+	bench = fr_trie_alloc(ctx);
+	if (!networks || !addrs || !answer || !bench) {
+		MPRINT("OOM\n");
+		goto fail;
+	}
+
+	/*
+	 *	Roughly like a routing table.  Half of the networks
+	 *	are /24, and the rest are anything from /8 to /32.
+	 *	Duplicates are ignored.
+	 */
+	for (i = 0; i < num_networks; i++) {
+		int		bits;
+		uint8_t		key[4];
+
+		bits = (bench_rand(&state) & 0x01) ? 24 : (8 + (bench_rand(&state) % 25));
+		networks[i] = bench_rand(&state) & ~(uint32_t) (((uint64_t) 1 << (32 - bits)) - 1);
+
+		bench_key(key, networks[i]);
+		if (fr_trie_match(bench, key, bits)) continue;
+
+		if (fr_trie_insert(bench, key, bits, &networks[i]) < 0) {
+			MPRINT("Failed inserting network %08x/%d\n", networks[i], bits);
+			goto fail;
+		}
+		inserted++;
+	}
+
+	/*
+	 *	Half of the lookups are for addresses inside of one of
+	 *	the networks, and the rest are random.
+	 */
+	for (i = 0; i < num_lookups; i++) {
+		addrs[i] = bench_rand(&state);
+		if ((i & 0x01) != 0) addrs[i] = networks[bench_rand(&state) % num_networks] | (addrs[i] & 0xff);
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	fr_trie_stats(bench->trie, 0, &stats);
+	memory = talloc_total_size(bench);
+
+	start = fr_latency_now();
+	for (i = 0; i < num_lookups; i++) {
+		uint8_t key[4];
+
+		bench_key(key, addrs[i]);
+		answer[i] = fr_trie_lookup(bench, key, 32);
+	}
+	t_mutable = fr_latency_now() - start;
+
+	if (fr_trie_freeze(bench) < 0) {
+		MPRINT("Failed freezing trie\n");
+		goto fail;
+	}
+
+	start = fr_latency_now();
+	for (i = 0; i < num_lookups; i++) {
+		uint8_t key[4];
+
+		bench_key(key, addrs[i]);
+		if (fr_trie_lookup(bench, key, 32) != answer[i]) {
+			MPRINT("Frozen lookup of %08x returned the wrong answer\n", addrs[i]);
+			goto fail;
+		}
+	}
+	t_frozen = fr_latency_now() - start;
+
+	for (i = 0; i < num_lookups; i++) {
+		int	bits = i % 33;
+		uint8_t	key[4];
+
+		bench_key(key, addrs[i]);
+		if (fr_trie_lookup(bench, key, bits) != fr_trie_key_match(bench->trie, key, 0, bits, false)) {
+			MPRINT("Frozen lookup of %08x/%d returned the wrong answer\n", addrs[i], bits);
+			goto fail;
+		}
+	}
+
+	printf("%d networks, %d lookups\n", inserted, num_lookups);
+	printf("\tmutable  depth %3d  nodes %8d  %10zu bytes  %7.1f ns/lookup\n",
+	       stats.depth, stats.nodes + stats.paths, memory, (double) t_mutable / num_lookups);
+	printf("\tfrozen   depth %3d  nodes %8u  %10zu bytes  %7.1f ns/lookup\n",
+	       bench->frozen->depth, bench->frozen->num_nodes, talloc_total_size(bench->frozen),
+	       (double) t_frozen / num_lookups);
+
+	talloc_free(ctx);
+	return 0;
+
+fail:
+	talloc_free(ctx);
+	return -1;
+}
+
+
 /**  A function to parse a trie command line.
  *
  */
@@ -2852,6 +3552,10 @@ static fr_trie_command_t commands[] = {
 	{ "verify",	command_verify,	0, 0, false },
 	{ "lineno",	command_lineno, 1, 1, false },
 	{ "clear",	command_clear,	0, 0, false },
+	{ "depth",	command_depth,	0, 0, true },
+	{ "nodes",	command_nodes,	0, 0, true },
+	{ "freeze",	command_freeze,	0, 0, false },
+	{ "bench",	command_bench,	2, 2, false },
 	{ NULL, NULL, 0, 0}
 };
 
@@ -44,6 +44,7 @@ void		*fr_trie_lookup(fr_trie_t const *ft, void const *key, size_t keylen) CC_HI
 void		*fr_trie_match(fr_trie_t const *ft, void const *key, size_t keylen) CC_HINT(nonnull);
 void		*fr_trie_remove(fr_trie_t *ft, void const *key, size_t keylen) CC_HINT(nonnull);
 int		fr_trie_walk(fr_trie_t *ft, void *ctx, fr_trie_walk_t callback) CC_HINT(nonnull(1,3));
+int		fr_trie_freeze(fr_trie_t *ft) CC_HINT(nonnull);
 
 #ifdef __cplusplus
 }
@@ -256,3 +256,223 @@ done:
 
 	return received;
 }
+
+/** Read multiple UDP packets in one system call
+ *
+ * Uses recvmmsg() where available, and otherwise falls back to
+ * calling udp_recv() repeatedly.  The source and destination
+ * addresses are filled in exactly as for udp_recv(), including any
+ * IP_PKTINFO / IPV6_PKTINFO data when the socket was initialised with
+ * udpfromto_init().
+ *
+ * @note UDP_FLAGS_PEEK is not supported.
+ *
+ * @param[in] sockfd we're reading from.
+ * @param[in,out] msgs array of datagrams.  On input, "data" and
+ *	"data_len" describe the buffer for each datagram.  On output,
+ *	"data_len" is the size of the received packet, and the
+ *	address fields are filled in.  A "data_len" of zero, with a
+ *	"src_ipaddr.af" of AF_UNSPEC, means that the packet was from an
+ *	unknown address family, and should be treated as a read error.
+ * @param[in] num the number of entries in msgs.
+ * @param[in] flags for things
+ * @return
+ *	- > 0 number of packets read.
+ *	- 0 no packets are available.
+ *	- < 0 on failure.
+ */
+int udp_recv_mmsg(int sockfd, fr_udp_mmsg_t *msgs, int num, int flags)
+{
+#ifdef HAVE_RECVMMSG
+	int			i, received;
+	struct mmsghdr		mmsg[UDP_MMSG_MAX];
+	struct iovec		iov[UDP_MMSG_MAX];
+	struct sockaddr_storage	src[UDP_MMSG_MAX];
+	struct sockaddr_storage	dst;
+	socklen_t		sizeof_dst = sizeof(dst);
+	uint16_t		port;
+#ifdef WITH_UDPFROMTO
+	char			cbuf[UDP_MMSG_MAX][256];
+#endif
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	memset(mmsg, 0, sizeof(mmsg[0]) * num);
+
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = msgs[i].data;
+		iov[i].iov_len = msgs[i].data_len;
+
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+
+		/*
+		 *	Connected sockets already know src/dst IP/port
+		 */
+		if ((flags & UDP_FLAGS_CONNECTED) != 0) continue;
+
+		mmsg[i].msg_hdr.msg_name = &src[i];
+		mmsg[i].msg_hdr.msg_namelen = sizeof(src[i]);
+#ifdef WITH_UDPFROMTO
+		mmsg[i].msg_hdr.msg_control = cbuf[i];
+		mmsg[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+#endif
+	}
+
+	received = recvmmsg(sockfd, mmsg, num, 0, NULL);
+	if (received < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return received;
+	}
+
+	/*
+	 *	recvmsg() doesn't provide the destination port, or the
+	 *	destination IP when we don't have udpfromto.  So we
+	 *	get them once for the whole batch.
+	 */
+	if (((flags & UDP_FLAGS_CONNECTED) == 0) &&
+	    (getsockname(sockfd, (struct sockaddr *)&dst, &sizeof_dst) < 0)) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < received; i++) {
+		msgs[i].data_len = mmsg[i].msg_len;
+		msgs[i].if_index = 0;
+
+		if ((flags & UDP_FLAGS_CONNECTED) != 0) continue;
+
+		if (fr_ipaddr_from_sockaddr(&src[i], mmsg[i].msg_hdr.msg_namelen,
+					    &msgs[i].src_ipaddr, &port) < 0) {
+			msgs[i].src_ipaddr.af = AF_UNSPEC;
+			msgs[i].data_len = 0;
+			continue;
+		}
+		msgs[i].src_port = port;
+
+#ifdef WITH_UDPFROMTO
+		{
+			struct sockaddr_storage	to = dst;
+			socklen_t		sizeof_to = sizeof_dst;
+
+			udpfromto_cmsg_parse(&mmsg[i].msg_hdr, (struct sockaddr *)&to, &sizeof_to,
+					     &msgs[i].if_index, NULL);
+
+			fr_ipaddr_from_sockaddr(&to, sizeof_to, &msgs[i].dst_ipaddr, &port);
+		}
+#else
+		fr_ipaddr_from_sockaddr(&dst, sizeof_dst, &msgs[i].dst_ipaddr, &port);
+#endif
+		msgs[i].dst_port = port;
+	}
+
+	return received;
+#else
+	int			i;
+	ssize_t			received;
+
+	for (i = 0; i < num; i++) {
+		received = udp_recv(sockfd, msgs[i].data, msgs[i].data_len, flags & ~UDP_FLAGS_PEEK,
+				    &msgs[i].src_ipaddr, &msgs[i].src_port,
+				    &msgs[i].dst_ipaddr, &msgs[i].dst_port,
+				    &msgs[i].if_index, NULL);
+		if (received < 0) {
+			if (i > 0) break;
+			return -1;
+		}
+
+		if (received == 0) break;
+
+		msgs[i].data_len = received;
+	}
+
+	return i;
+#endif
+}
+
+/** Send multiple UDP packets in one system call
+ *
+ * Uses sendmmsg() where available, and otherwise falls back to
+ * calling udp_send() repeatedly.  The source address and interface
+ * of each packet are set exactly as for udp_send().
+ *
+ * If fewer than "num" packets are sent, the caller should retry the
+ * remaining packets, or send them individually.
+ *
+ * @param[in] sockfd we're writing to.
+ * @param[in] msgs array of datagrams to send.
+ * @param[in] num the number of entries in msgs.
+ * @param[in] flags for things
+ * @return
+ *	- >= 0 number of packets sent.
+ *	- < 0 on failure, where no packets were sent.
+ */
+int udp_send_mmsg(int sockfd, fr_udp_mmsg_t *msgs, int num, int flags)
+{
+#ifdef HAVE_SENDMMSG
+	int			i, sent;
+	struct mmsghdr		mmsg[UDP_MMSG_MAX];
+	struct iovec		iov[UDP_MMSG_MAX];
+	struct sockaddr_storage	dst[UDP_MMSG_MAX];
+	socklen_t		sizeof_dst;
+#ifdef WITH_UDPFROMTO
+	char			cbuf[UDP_MMSG_MAX][256];
+#endif
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	memset(mmsg, 0, sizeof(mmsg[0]) * num);
+
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = msgs[i].data;
+		iov[i].iov_len = msgs[i].data_len;
+
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+
+		if ((flags & UDP_FLAGS_CONNECTED) != 0) continue;
+
+		if (fr_ipaddr_to_sockaddr(&msgs[i].dst_ipaddr, msgs[i].dst_port, &dst[i], &sizeof_dst) < 0) return -1;
+
+		mmsg[i].msg_hdr.msg_name = &dst[i];
+		mmsg[i].msg_hdr.msg_namelen = sizeof_dst;
+
+#ifdef WITH_UDPFROMTO
+		/*
+		 *	And if they don't specify a source IP address, don't
+		 *	use udpfromto.
+		 */
+		if ((msgs[i].src_ipaddr.af != AF_UNSPEC) && (msgs[i].dst_ipaddr.af != AF_UNSPEC) &&
+		    !fr_ipaddr_is_inaddr_any(&msgs[i].src_ipaddr)) {
+			struct sockaddr_storage	src;
+			socklen_t		sizeof_src;
+
+			fr_ipaddr_to_sockaddr(&msgs[i].src_ipaddr, msgs[i].src_port, &src, &sizeof_src);
+
+			memset(cbuf[i], 0, sizeof(cbuf[i]));
+			udpfromto_cmsg_build(&mmsg[i].msg_hdr, cbuf[i], (struct sockaddr *) &src, msgs[i].if_index);
+		}
+#endif
+	}
+
+	sent = sendmmsg(sockfd, mmsg, num, 0);
+	if (sent < 0) fr_strerror_printf("udp_sendmmsg failed: %s", fr_syserror(errno));
+
+	return sent;
+#else
+	int			i;
+
+	for (i = 0; i < num; i++) {
+		if (udp_send(sockfd, msgs[i].data, msgs[i].data_len, flags,
+			     &msgs[i].src_ipaddr, msgs[i].src_port, msgs[i].if_index,
+			     &msgs[i].dst_ipaddr, msgs[i].dst_port) < 0) {
+			if (i > 0) break;
+			return -1;
+		}
+	}
+
+	return i;
+#endif
+}
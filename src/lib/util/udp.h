@@ -38,6 +38,25 @@ extern "C" {
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+/** Maximum number of datagrams which are read or written in one system call
+ *
+ */
+#define UDP_MMSG_MAX		(64)
+
+/** One datagram for udp_recv_mmsg() or udp_send_mmsg()
+ *
+ */
+typedef struct {
+	uint8_t			*data;		//!< where the packet is written.
+	size_t			data_len;	//!< size of the buffer on input, size of the packet on output.
+
+	fr_ipaddr_t		src_ipaddr;	//!< src address of the packet.
+	uint16_t		src_port;	//!< src port of the packet.
+	fr_ipaddr_t		dst_ipaddr;	//!< dst address of the packet.
+	uint16_t		dst_port;	//!< dst port of the packet.
+	int			if_index;	//!< interface which received the packet.
+} fr_udp_mmsg_t;
+
 ssize_t udp_send(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t const *src_ipaddr, uint16_t src_port, int if_index,
 		 fr_ipaddr_t const *dst_ipaddr, uint16_t dst_port);
@@ -51,6 +70,10 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
 		 struct timeval *when);
 
+int udp_recv_mmsg(int sockfd, fr_udp_mmsg_t *msgs, int num, int flags);
+
+int udp_send_mmsg(int sockfd, fr_udp_mmsg_t *msgs, int num, int flags);
+
 #ifdef __cplusplus
 }
 #endif
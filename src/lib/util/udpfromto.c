@@ -164,6 +164,82 @@ int udpfromto_init(int s)
 	return setsockopt(s, proto, flag, &opt, sizeof(opt));
 }
 
+/** Process the auxiliary data returned by recvmsg() or recvmmsg()
+ *
+ * @param[in] msgh	as filled in by recvmsg().
+ * @param[in,out] to	Where to write the destination address.  Should
+ *			be initialised with the local address of the socket,
+ *			as it may be INADDR_ANY.
+ * @param[out] to_len	Length of the structure pointed to by to.
+ * @param[out] if_index	The interface which received the datagram (may be NULL).
+ * @param[out] when	the packet was received (may be NULL).  Will be zero
+ *			if SO_TIMESTAMP is not available.
+ */
+void udpfromto_cmsg_parse(struct msghdr *msgh, struct sockaddr *to, socklen_t *to_len,
+			  int *if_index, struct timeval *when)
+{
+	struct cmsghdr		*cmsg;
+
+	if (if_index) *if_index = 0;
+	if (when) {
+		when->tv_sec = 0;
+		when->tv_usec = 0;
+	}
+
+	/* Process auxiliary received data in msgh */
+	for (cmsg = CMSG_FIRSTHDR(msgh);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+
+#ifdef IP_PKTINFO
+		if ((cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == IP_PKTINFO)) {
+			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
+			*to_len = sizeof(struct sockaddr_in);
+
+			if (if_index) *if_index = i->ipi_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef IP_RECVDSTADDR
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = *i;
+
+			*to_len = sizeof(struct sockaddr_in);
+
+			break;
+		}
+#endif
+
+#ifdef IPV6_PKTINFO
+		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
+			*to_len = sizeof(struct sockaddr_in6);
+
+			if (if_index) *if_index = i->ipi6_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef SO_TIMESTAMP
+		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
+			memcpy(when, CMSG_DATA(cmsg), sizeof(*when));
+		}
+#endif
+	}
+}
+
 /** Read a packet from a file descriptor, retrieving additional header information
  *
  * Abstracts away the complexity of using the complexity of using recvmsg().
@@ -197,7 +273,6 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	       int *if_index, struct timeval *when)
 {
 	struct msghdr		msgh;
-	struct cmsghdr		*cmsg;
 	struct iovec		iov;
 	char			cbuf[256];
 	int			ret;
@@ -300,68 +375,86 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 
 	if (from_len) *from_len = msgh.msg_namelen;
 
-	if (if_index) *if_index = 0;
-	if (when) {
-		when->tv_sec = 0;
-		when->tv_usec = 0;
-	}
+	udpfromto_cmsg_parse(&msgh, to, to_len, if_index, when);
 
-	/* Process auxiliary received data in msgh */
-	for (cmsg = CMSG_FIRSTHDR(&msgh);
-	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
+	if (when && !when->tv_sec) gettimeofday(when, NULL);
 
-#ifdef IP_PKTINFO
-		if ((cmsg->cmsg_level == SOL_IP) &&
-		    (cmsg->cmsg_type == IP_PKTINFO)) {
-			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+	return ret;
+}
 
-			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
-			*to_len = sizeof(struct sockaddr_in);
+/** Add the source address and outbound interface to a msghdr
+ *
+ * Used by sendfromto(), and by callers which use sendmmsg().
+ *
+ * @param[in,out] msgh	to add the auxiliary data to.
+ * @param[in] cbuf	where the auxiliary data is written.  Must be
+ *			at least 256 bytes, and zeroed.
+ * @param[in] from	The source address.
+ * @param[in] if_index	The interface on which to send the datagram.
+ *			If automatic interface selection is desired, value should be 0.
+ */
+void udpfromto_cmsg_build(struct msghdr *msgh, char *cbuf, struct sockaddr *from, int if_index)
+{
+# if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
+	if (from->sa_family == AF_INET) {
+		struct sockaddr_in *s4 = (struct sockaddr_in *) from;
 
-			if (if_index) *if_index = i->ipi_ifindex;
+#  ifdef IP_PKTINFO
+		struct cmsghdr *cmsg;
+		struct in_pktinfo *pkt;
 
-			break;
-		}
-#endif
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
 
-#ifdef IP_RECVDSTADDR
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
-			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = SOL_IP;
+		cmsg->cmsg_type = IP_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
 
-			((struct sockaddr_in *)to)->sin_addr = *i;
+		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi_spec_dst = s4->sin_addr;
+		pkt->ipi_ifindex = if_index;
 
-			*to_len = sizeof(struct sockaddr_in);
+#  elif defined(IP_SENDSRCADDR)
+		struct cmsghdr *cmsg;
+		struct in_addr *in;
 
-			break;
-		}
-#endif
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*in));
 
-#ifdef IPV6_PKTINFO
-		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
-		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
-			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_SENDSRCADDR;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
 
-			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
-			*to_len = sizeof(struct sockaddr_in6);
+		in = (struct in_addr *) CMSG_DATA(cmsg);
+		*in = s4->sin_addr;
+#  endif
+	}
+#endif
 
-			if (if_index) *if_index = i->ipi6_ifindex;
+#  if defined(IPV6_PKTINFO)
+	if (from->sa_family == AF_INET6) {
+		struct sockaddr_in6 *s6 = (struct sockaddr_in6 *) from;
 
-			break;
-		}
-#endif
+		struct cmsghdr *cmsg;
+		struct in6_pktinfo *pkt;
 
-#ifdef SO_TIMESTAMP
-		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
-			memcpy(when, CMSG_DATA(cmsg), sizeof(*when));
-		}
-#endif
-	}
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
 
-	if (when && !when->tv_sec) gettimeofday(when, NULL);
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IPV6;
+		cmsg->cmsg_type = IPV6_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
 
-	return ret;
+		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi6_addr = s6->sin6_addr;
+		pkt->ipi6_ifindex = if_index;
+	}
+#  endif	/* IPV6_PKTINFO */
 }
 
 /** Send packet via a file descriptor, setting the src address and outbound interface
@@ -458,66 +551,7 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 	msgh.msg_name = to;
 	msgh.msg_namelen = to_len;
 
-# if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
-	if (from->sa_family == AF_INET) {
-		struct sockaddr_in *s4 = (struct sockaddr_in *) from;
-
-#  ifdef IP_PKTINFO
-		struct cmsghdr *cmsg;
-		struct in_pktinfo *pkt;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = SOL_IP;
-		cmsg->cmsg_type = IP_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
-
-		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi_spec_dst = s4->sin_addr;
-		pkt->ipi_ifindex = if_index;
-
-#  elif defined(IP_SENDSRCADDR)
-		struct cmsghdr *cmsg;
-		struct in_addr *in;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*in));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IP;
-		cmsg->cmsg_type = IP_SENDSRCADDR;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
-
-		in = (struct in_addr *) CMSG_DATA(cmsg);
-		*in = s4->sin_addr;
-#  endif
-	}
-#endif
-
-#  if defined(IPV6_PKTINFO)
-	if (from->sa_family == AF_INET6) {
-		struct sockaddr_in6 *s6 = (struct sockaddr_in6 *) from;
-
-		struct cmsghdr *cmsg;
-		struct in6_pktinfo *pkt;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IPV6;
-		cmsg->cmsg_type = IPV6_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
-
-		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi6_addr = s6->sin6_addr;
-		pkt->ipi6_ifindex = if_index;
-	}
-#  endif	/* IPV6_PKTINFO */
+	udpfromto_cmsg_build(&msgh, cbuf, from, if_index);
 
 	return sendmsg(fd, &msgh, flags);
 }
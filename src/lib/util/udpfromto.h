@@ -34,6 +34,7 @@ extern "C" {
 #include <freeradius-devel/missing.h>
 
 #include <netinet/in.h>
+#include <sys/socket.h>
 #include <stddef.h>
 #include <stdlib.h>
 
@@ -44,6 +45,11 @@ int	recvfromto(int s, void *buf, size_t len, int flags,
 		   struct sockaddr *to, socklen_t *tolen,
 		   int *if_index, struct timeval *when);
 
+void	udpfromto_cmsg_parse(struct msghdr *msgh, struct sockaddr *to, socklen_t *to_len,
+			     int *if_index, struct timeval *when);
+
+void	udpfromto_cmsg_build(struct msghdr *msgh, char *cbuf, struct sockaddr *from, int if_index);
+
 int	sendfromto(int s, void *buf, size_t len, int flags,
 		   struct sockaddr *from, socklen_t fromlen,
 		   struct sockaddr *to, socklen_t tolen,
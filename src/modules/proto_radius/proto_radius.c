@@ -43,6 +43,7 @@ static CONF_PARSER const limit_config[] = {
 	{ FR_CONF_OFFSET("max_connections", FR_TYPE_UINT32, proto_radius_t, io.max_connections), .dflt = "1024" } ,
 	{ FR_CONF_OFFSET("max_clients", FR_TYPE_UINT32, proto_radius_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", FR_TYPE_UINT32, proto_radius_t, io.max_pending_packets), .dflt = "256" } ,
+	{ FR_CONF_OFFSET("negative_cache_size", FR_TYPE_UINT32, proto_radius_t, io.negative_cache_size), .dflt = "4096" } ,
 
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
@@ -802,6 +803,8 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	FR_TIMEVAL_BOUND_CHECK("nak_lifetime", &inst->io.nak_lifetime, >=, 1, 0);
 	FR_TIMEVAL_BOUND_CHECK("nak_lifetime", &inst->io.nak_lifetime, <=, 600, 0);
 
+	FR_INTEGER_BOUND_CHECK("negative_cache_size", inst->io.negative_cache_size, <=, 1 << 20);
+
 	FR_TIMEVAL_BOUND_CHECK("cleanup_delay", &inst->io.cleanup_delay, <=, 30, 0);
 
 	/*
@@ -23,6 +23,7 @@
  * @copyright 2016 Alan DeKok (aland@deployingradius.com)
  */
 #include <netdb.h>
+#include <sys/uio.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/server/tcp.h>
@@ -37,12 +38,25 @@
 
 extern fr_app_io_t proto_radius_tcp;
 
+/*
+ *	How much reply data we queue for one connection.  When the
+ *	queue is full, the network side keeps the replies, and stops
+ *	reading the connection until they have been written.
+ */
+#define TCP_SEND_QUEUE_SIZE	(4 * MAX_PACKET_LEN)
+
 typedef struct proto_radius_tcp_thread_t {
 	char const			*name;			//!< socket name
 	int				sockfd;
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	struct iovec			*send;			//!< replies queued for the next flush.
+	uint8_t				*send_buffer;		//!< where the queued replies are stored.
+	size_t				send_used;		//!< bytes of queued replies in send_buffer.
+	int				send_num;		//!< number of queued replies.
+	int				send_max;		//!< number of entries in the send array.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 } proto_radius_tcp_thread_t;
 
@@ -59,6 +73,11 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			read_size;		//!< How much data to read in one system call.
+	uint32_t			send_batch;		//!< How many replies to write in one system call.
+	uint32_t			max_outstanding;	//!< Stop reading a connection which has this
+								//!< many packets being processed.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a receive
@@ -96,29 +115,70 @@ static const CONF_PARSER tcp_listen_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_radius_tcp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_radius_tcp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("read_size", FR_TYPE_UINT32, proto_radius_tcp_t, read_size), .dflt = "16384" } ,
+	{ FR_CONF_OFFSET("send_batch", FR_TYPE_UINT32, proto_radius_tcp_t, send_batch), .dflt = "16" } ,
+	{ FR_CONF_OFFSET("max_outstanding", FR_TYPE_UINT32, proto_radius_tcp_t, max_outstanding), .dflt = "128" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
 
+/** See if there's a complete RADIUS packet in the buffer
+ *
+ */
+static inline bool tcp_packet_complete(uint8_t const *buffer, size_t data_size)
+{
+	if (data_size < 20) return false;
+
+	return (data_size >= (size_t) ((buffer[2] << 8) | buffer[3]));
+}
+
 static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover, UNUSED uint32_t *priority, UNUSED bool *is_dup)
 {
 	proto_radius_tcp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_tcp_t);
 	proto_radius_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_tcp_thread_t);
 	ssize_t				data_size;
-	size_t				packet_len;
+	size_t				available, packet_len;
 	decode_fail_t			reason;
 
 	fr_time_t			*recv_time_p;
 
 	recv_time_p = *recv_time;
+	available = *leftover;
 
 	/*
-	 *      Read data into the buffer.
+	 *	Only read more data if there isn't already a complete
+	 *	packet left over from the last read.  When the client
+	 *	pipelines requests, one read() can then return many
+	 *	packets.
 	 */
-	data_size = read(thread->sockfd, buffer + *leftover, buffer_len - *leftover);
-	if (data_size < 0) {
-		DEBUG2("proto_radius_tcp got read error %zd: %s", data_size, fr_strerror());
-		return data_size;
+	if (!tcp_packet_complete(buffer, available)) {
+		data_size = read(thread->sockfd, buffer + available, buffer_len - available);
+		if (data_size < 0) {
+			/*
+			 *	Nothing more to read.  Any partial
+			 *	packet stays in the buffer until the
+			 *	rest of it arrives.
+			 */
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN) || (errno == EINTR)) {
+				li->read_pending = false;
+				return 0;
+			}
+
+			DEBUG2("proto_radius_tcp got read error %zd: %s", data_size, fr_syserror(errno));
+			return data_size;
+		}
+		li->read_syscalls++;
+
+		/*
+		 *	TCP read of zero means the socket is dead.
+		 */
+		if (!data_size) {
+			DEBUG2("proto_radius_tcp - other side closed the socket.");
+			return -1;
+		}
+
+		available += data_size;
 	}
 
 	/*
@@ -127,14 +187,6 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **r
 	 *	connection which isn't sending us RADIUS packets.
 	 */
 
-	/*
-	 *	TCP read of zero means the socket is dead.
-	 */
-	if (!data_size) {
-		DEBUG2("proto_radius_tcp - other side closed the socket.");
-		return -1;
-	}
-
 	/*
 	 *	We MUST always start with a known RADIUS packet.
 	 */
@@ -147,8 +199,9 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **r
 	/*
 	 *	Not enough for one packet.  Tell the caller that we need to read more.
 	 */
-	if (data_size < 20) {
-		*leftover = data_size;
+	if (available < 20) {
+		*leftover = available;
+		li->read_pending = false;
 		return 0;
 	}
 
@@ -157,22 +210,37 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **r
 	 */
 	packet_len = (buffer[2] << 8) | buffer[3];
 
+	/*
+	 *	A packet which can't fit into the buffer will never
+	 *	be completely read.
+	 */
+	if ((packet_len < 20) || (packet_len > inst->max_packet_size)) {
+		DEBUG2("proto_radius_tcp got invalid packet length %zu", packet_len);
+		thread->stats.total_malformed_requests++;
+		return -1;
+	}
+
 	/*
 	 *	We don't have a complete RADIUS packet.  Tell the
 	 *	caller that we need to read more.
 	 */
-	if ((size_t) data_size < packet_len) {
-		*leftover = data_size;
+	if (available < packet_len) {
+		*leftover = available;
+		li->read_pending = false;
 		return 0;
 	}
 
 	/*
 	 *	We've read more than one packet.  Tell the caller that
 	 *	there's more data available, and return only one packet.
+	 *
+	 *	If there's another complete packet in the buffer,
+	 *	the network side has to come back for it, even if it
+	 *	doesn't get another event for this socket.
 	 */
-	if ((size_t) data_size > packet_len) {
-		*leftover = data_size - packet_len;
-	}
+	*leftover = available - packet_len;
+	li->read_pending = tcp_packet_complete(buffer + packet_len, *leftover);
+	li->read_packets++;
 
 	/*
 	 *      If it's not a RADIUS packet, ignore it.
@@ -204,9 +272,142 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **r
 }
 
 
+/** Write the queued replies, using writev() to write many at once
+ *
+ *  If the socket can't take all of the data, the rest is moved to
+ *  the start of the queue, and we tell the network side to call us
+ *  again when the socket is writable.
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	proto_radius_tcp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_tcp_t);
+	proto_radius_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_tcp_thread_t);
+	ssize_t				sent;
+	int				i, j, num;
+	bool				blocked;
+	uint8_t				*start;
+	size_t				offset;
+
+	while (thread->send_num > 0) {
+		num = thread->send_num;
+		if (num > (int) inst->send_batch) num = inst->send_batch;
+
+		sent = writev(thread->sockfd, thread->send, num);
+		li->write_syscalls++;
+		if (sent < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN) || (errno == EINTR)) return 1;
+
+			fr_strerror_printf("proto_radius_tcp got write error: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		/*
+		 *	Skip the replies which were completely written.
+		 */
+		for (i = 0; i < num; i++) {
+			if ((size_t) sent < thread->send[i].iov_len) break;
+
+			sent -= thread->send[i].iov_len;
+		}
+		li->write_packets += i;
+		blocked = (i < num);
+
+		/*
+		 *	Move the rest of the data to the start of the
+		 *	buffer.  The replies are stored back to back,
+		 *	so one memmove() is enough.
+		 */
+		if (i < thread->send_num) {
+			start = ((uint8_t *) thread->send[i].iov_base) + sent;
+			offset = start - thread->send_buffer;
+
+			thread->send_used -= offset;
+			memmove(thread->send_buffer, start, thread->send_used);
+		} else {
+			offset = 0;
+			thread->send_used = 0;
+		}
+
+		for (j = 0; i < thread->send_num; i++, j++) {
+			thread->send[j].iov_base = ((uint8_t *) thread->send[i].iov_base) + sent - offset;
+			thread->send[j].iov_len = thread->send[i].iov_len - sent;
+			sent = 0;
+		}
+		thread->send_num = j;
+
+		/*
+		 *	Short write.  The socket is full.
+		 */
+		if (blocked) return 1;
+	}
+
+	return 0;
+}
+
+/** Queue a reply, to be written by mod_flush()
+ *
+ *  The queue holds at most TCP_SEND_QUEUE_SIZE bytes.  When the
+ *  reply doesn't fit, even after a flush, we return EWOULDBLOCK.
+ *  The network side then keeps the reply, and stops reading the
+ *  connection until the client has read enough of its replies.
+ */
+static ssize_t mod_write_queue(fr_listen_t *li, proto_radius_tcp_t const *inst, proto_radius_tcp_thread_t *thread,
+			       uint8_t const *buffer, size_t buffer_len)
+{
+	struct iovec			*iov;
+
+	if (buffer_len > MAX_PACKET_LEN) {
+		fr_strerror_printf("proto_radius_tcp - reply of %zu bytes is too large", buffer_len);
+		return -1;
+	}
+
+	if (!thread->send_buffer) MEM(thread->send_buffer = talloc_array(thread, uint8_t, TCP_SEND_QUEUE_SIZE));
+
+	/*
+	 *	The queue is full.  Write what we can, and tell the
+	 *	caller to try again later if there still isn't room.
+	 */
+	if ((thread->send_used + buffer_len) > TCP_SEND_QUEUE_SIZE) {
+		if (mod_flush(li) < 0) return -1;
+
+		if ((thread->send_used + buffer_len) > TCP_SEND_QUEUE_SIZE) {
+			errno = EWOULDBLOCK;
+			return -1;
+		}
+	}
+
+	/*
+	 *	No more iovecs.  The buffer limits how many replies
+	 *	we queue, so the array stays small.
+	 */
+	if (thread->send_num == thread->send_max) {
+		thread->send_max = thread->send_max ? (thread->send_max * 2) : (int) inst->send_batch;
+		MEM(thread->send = talloc_realloc(thread, thread->send, struct iovec, thread->send_max));
+	}
+
+	iov = &thread->send[thread->send_num];
+	iov->iov_base = thread->send_buffer + thread->send_used;
+	iov->iov_len = buffer_len;
+	memcpy(iov->iov_base, buffer, buffer_len);
+	thread->send_used += buffer_len;
+
+	/*
+	 *	Write a full batch now.  If the socket is full, the
+	 *	rest is written when the network side calls
+	 *	mod_flush().
+	 */
+	if (++thread->send_num >= (int) inst->send_batch) {
+		if (mod_flush(li) < 0) return -1;
+	}
+
+	return buffer_len;
+}
+
+
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, size_t written)
 {
+	proto_radius_tcp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_tcp_t);
 	proto_radius_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_tcp_thread_t);
 	fr_io_track_t			*track = talloc_get_type_abort(packet_ctx, fr_io_track_t);
 	ssize_t				data_size;
@@ -239,15 +440,11 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	rad_assert(written < buffer_len);
 
 	/*
-	 *	Only write replies if they're RADIUS packets.
-	 *	sometimes we want to NOT send a reply...
-	 */
-	data_size = write(thread->sockfd, buffer + written, buffer_len - written);
-
-	/*
-	 *	This socket is dead.  That's an error...
+	 *	Queue the reply.  Partial writes are handled by the
+	 *	queue, so the caller always sees a complete write.
 	 */
-	if (data_size <= 0) return data_size;
+	data_size = mod_write_queue(li, inst, thread, buffer + written, buffer_len - written);
+	if (data_size < 0) return data_size;
 
 	/*
 	 *	Root through the reply to determine any
@@ -349,6 +546,23 @@ static int mod_fd_set(fr_listen_t *li, int fd)
 
 	thread->sockfd = fd;
 
+	/*
+	 *	We read as much data as we can, and the network side
+	 *	calls us again until it's gone.  So the socket must
+	 *	not block.
+	 */
+	if (fr_nonblock(fd) < 0) {
+		PERROR("Failed setting socket to non-blocking");
+		return -1;
+	}
+
+	/*
+	 *	Read many pipelined packets at once, and stop reading
+	 *	when too many of them are being processed.
+	 */
+	li->default_message_size = inst->read_size;
+	li->max_outstanding = inst->max_outstanding;
+
 	thread->name = fr_app_io_socket_name(thread, &proto_radius_tcp,
 					     &thread->connection->src_ipaddr, thread->connection->src_port,
 					     &inst->ipaddr, inst->port,
@@ -377,6 +591,18 @@ static int mod_compare(UNUSED void const *instance, void const *one, void const
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+static uint32_t mod_hash(UNUSED void const *instance, void const *packet)
+{
+	uint8_t const *p = packet;
+
+	/*
+	 *	The same fields as mod_compare(), so that
+	 *	conflicting packets end up in the same place.
+	 *	Code, then ID.
+	 */
+	return fr_hash(p, 2);
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -409,6 +635,18 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	/*
+	 *	The read buffer must be able to hold at least one
+	 *	complete packet.
+	 */
+	FR_INTEGER_BOUND_CHECK("read_size", inst->read_size, >=, inst->max_packet_size);
+	FR_INTEGER_BOUND_CHECK("read_size", inst->read_size, <=, (1 << 20));
+
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, <=, 256);
+
+	FR_INTEGER_BOUND_CHECK("max_outstanding", inst->max_outstanding, <=, 65536);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -596,8 +834,10 @@ fr_app_io_t proto_radius_tcp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
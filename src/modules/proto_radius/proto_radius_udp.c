@@ -43,6 +43,16 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	fr_udp_mmsg_t			*batch;			//!< packets from the last batched read.
+	uint8_t				*batch_buffer;		//!< where packets 1..N of the batch are received.
+	int				batch_num;		//!< number of packets in the batch.
+	int				batch_next;		//!< next packet in the batch to return.
+	fr_time_t			batch_time;		//!< when the batch was read.
+
+	fr_udp_mmsg_t			*send;			//!< replies queued for the next flush.
+	uint8_t				*send_buffer;		//!< where the queued replies are stored.
+	int				send_num;		//!< number of queued replies.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 } proto_radius_udp_thread_t;
 
@@ -60,6 +70,9 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			recv_batch;		//!< How many packets to read in one system call.
+	uint32_t			send_batch;		//!< How many packets to write in one system call.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
@@ -101,10 +114,97 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_radius_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_radius_udp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("recv_batch", FR_TYPE_UINT32, proto_radius_udp_t, recv_batch), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("send_batch", FR_TYPE_UINT32, proto_radius_udp_t, send_batch), .dflt = "1" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
 
+/** Read one packet, using recvmmsg() to read many packets at a time
+ *
+ *  The first packet of each batch is received directly into the
+ *  callers buffer.  The rest are received into a per-thread buffer,
+ *  and copied out on subsequent calls.  We can't leave them in the
+ *  message set, as the master IO handler may discard any packet, and
+ *  datagram sockets can't use the "leftover" API.
+ *
+ *  All packets in a batch are given the time at which the batch
+ *  was read.
+ */
+static ssize_t mod_read_batch(fr_listen_t *li, proto_radius_udp_t const *inst, proto_radius_udp_thread_t *thread,
+			      int flags, fr_io_address_t *address, fr_time_t *recv_time,
+			      uint8_t *buffer, size_t buffer_len)
+{
+	int			i, num;
+	fr_udp_mmsg_t		*msg;
+	size_t			packet_len;
+
+	if (thread->batch_next < thread->batch_num) {
+		msg = &thread->batch[thread->batch_next++];
+
+		packet_len = msg->data_len;
+		if (packet_len > buffer_len) packet_len = buffer_len;
+
+		memcpy(buffer, msg->data, packet_len);
+		goto done;
+	}
+
+	if (!thread->batch) {
+		MEM(thread->batch = talloc_zero_array(thread, fr_udp_mmsg_t, inst->recv_batch));
+		MEM(thread->batch_buffer = talloc_array(thread, uint8_t, (inst->recv_batch - 1) * inst->max_packet_size));
+	}
+
+	thread->batch[0].data = buffer;
+	thread->batch[0].data_len = buffer_len;
+
+	for (i = 1; i < (int) inst->recv_batch; i++) {
+		thread->batch[i].data = thread->batch_buffer + ((i - 1) * inst->max_packet_size);
+		thread->batch[i].data_len = inst->max_packet_size;
+	}
+
+	num = udp_recv_mmsg(thread->sockfd, thread->batch, inst->recv_batch, flags);
+	li->read_syscalls++;
+	if (num <= 0) {
+		thread->batch_num = thread->batch_next = 0;
+		li->read_pending = false;
+		return num;
+	}
+	li->read_packets += num;
+
+	thread->batch_num = num;
+	thread->batch_next = 1;
+	thread->batch_time = fr_time();
+
+	msg = &thread->batch[0];
+	packet_len = msg->data_len;
+
+done:
+	li->read_pending = (thread->batch_next < thread->batch_num);
+	*recv_time = thread->batch_time;
+
+	/*
+	 *	Connected sockets already know src/dst IP/port
+	 */
+	if (flags & UDP_FLAGS_CONNECTED) return packet_len;
+
+	/*
+	 *	Same as udp_recv(), which returns an error for these.
+	 */
+	if (msg->src_ipaddr.af == AF_UNSPEC) {
+		fr_strerror_printf("Unknown address family");
+		return -1;
+	}
+
+	address->src_ipaddr = msg->src_ipaddr;
+	address->src_port = msg->src_port;
+	address->dst_ipaddr = msg->dst_ipaddr;
+	address->dst_port = msg->dst_port;
+	address->if_index = msg->if_index;
+
+	return packet_len;
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover, UNUSED uint32_t *priority, UNUSED bool *is_dup)
 {
 	proto_radius_udp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_udp_t);
@@ -134,10 +234,17 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_tim
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, buffer, buffer_len, flags,
-			     &address->src_ipaddr, &address->src_port,
-			     &address->dst_ipaddr, &address->dst_port,
-			     &address->if_index, &timestamp);
+	if (inst->recv_batch > 1) {
+		data_size = mod_read_batch(li, inst, thread, flags, address, recv_time_p, buffer, buffer_len);
+
+	} else {
+		data_size = udp_recv(thread->sockfd, buffer, buffer_len, flags,
+				     &address->src_ipaddr, &address->src_port,
+				     &address->dst_ipaddr, &address->dst_port,
+				     &address->if_index, &timestamp);
+		li->read_syscalls++;
+		if (data_size > 0) li->read_packets++;
+	}
 	if (data_size < 0) {
 		DEBUG2("proto_radius_udp got read error: %s", fr_strerror());
 		return data_size;
@@ -181,7 +288,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_tim
 	}
 
 	// @todo - maybe convert timestamp?
-	*recv_time_p = fr_time();
+	if (inst->recv_batch <= 1) *recv_time_p = fr_time();
 
 	/*
 	 *	proto_radius sets the priority
@@ -198,9 +305,109 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_tim
 }
 
 
+/** Write all of the queued replies, using sendmmsg() where possible
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+	int				i, sent, flags;
+
+	if (!thread->send_num) return 0;
+
+	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
+
+	sent = udp_send_mmsg(thread->sockfd, thread->send, thread->send_num, flags);
+	li->write_syscalls++;
+	if (sent < 0) {
+		PERROR("proto_radius_udp failed writing %d replies, retrying them one at a time", thread->send_num);
+		sent = 0;
+	}
+	li->write_packets += sent;
+
+	/*
+	 *	Short write.  Fall back to sending the rest of the
+	 *	replies one at a time.  If that fails, the client
+	 *	will retransmit, and we will reply from the cache.
+	 */
+	for (i = sent; i < thread->send_num; i++) {
+		fr_udp_mmsg_t *msg = &thread->send[i];
+
+		li->write_syscalls++;
+		if (udp_send(thread->sockfd, msg->data, msg->data_len, flags,
+			     &msg->src_ipaddr, msg->src_port, msg->if_index,
+			     &msg->dst_ipaddr, msg->dst_port) < 0) {
+			PERROR("proto_radius_udp failed writing reply to %pV port %u",
+			       fr_box_ipaddr(msg->dst_ipaddr), msg->dst_port);
+			continue;
+		}
+		li->write_packets++;
+	}
+
+	thread->send_num = 0;
+	return 0;
+}
+
+/** Queue a reply, to be written by mod_flush()
+ *
+ */
+static ssize_t mod_write_queue(fr_listen_t *li, proto_radius_udp_t const *inst, proto_radius_udp_thread_t *thread,
+			       fr_io_address_t const *address, uint8_t const *buffer, size_t buffer_len)
+{
+	fr_udp_mmsg_t			*msg;
+
+	if (!thread->send) {
+		MEM(thread->send = talloc_zero_array(thread, fr_udp_mmsg_t, inst->send_batch));
+		MEM(thread->send_buffer = talloc_array(thread, uint8_t, inst->send_batch * MAX_PACKET_LEN));
+	}
+
+	/*
+	 *	The reply doesn't fit into a slot in the batch, so
+	 *	send it on its own, after the replies which are
+	 *	already queued.
+	 */
+	if (buffer_len > MAX_PACKET_LEN) {
+		ssize_t	data_size;
+		char	*packet;
+
+		if (thread->send_num) (void) mod_flush(li);
+
+		memcpy(&packet, &buffer, sizeof(packet)); /* const issues */
+
+		li->write_syscalls++;
+		data_size = udp_send(thread->sockfd, packet, buffer_len, UDP_FLAGS_CONNECTED * (thread->connection != NULL),
+				     &address->dst_ipaddr, address->dst_port,
+				     address->if_index,
+				     &address->src_ipaddr, address->src_port);
+		if (data_size > 0) li->write_packets++;
+
+		return data_size;
+	}
+
+	msg = &thread->send[thread->send_num];
+	msg->data = thread->send_buffer + (thread->send_num * MAX_PACKET_LEN);
+	msg->data_len = buffer_len;
+	memcpy(msg->data, buffer, buffer_len);
+
+	msg->src_ipaddr = address->dst_ipaddr;
+	msg->src_port = address->dst_port;
+	msg->if_index = address->if_index;
+	msg->dst_ipaddr = address->src_ipaddr;
+	msg->dst_port = address->src_port;
+
+	/*
+	 *	The queue is full, write it now.
+	 */
+	if (++thread->send_num == (int) inst->send_batch) (void) mod_flush(li);
+
+	return buffer_len;
+}
+
+
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
+	proto_radius_udp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_udp_t);
 	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
 
 	fr_io_track_t			*track = talloc_get_type_abort(packet_ctx, fr_io_track_t);
@@ -232,12 +439,18 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 		if (track->reply_len >= 20) {
 			char *packet;
 
+			if (inst->send_batch > 1) {
+				(void) mod_write_queue(li, inst, thread, address, track->reply, track->reply_len);
+				return buffer_len;
+			}
+
 			memcpy(&packet, &track->reply, sizeof(packet)); /* const issues */
 
-			(void) udp_send(thread->sockfd, packet, track->reply_len, flags,
-					&address->dst_ipaddr, address->dst_port,
-					address->if_index,
-					&address->src_ipaddr, address->src_port);
+			li->write_syscalls++;
+			if (udp_send(thread->sockfd, packet, track->reply_len, flags,
+				     &address->dst_ipaddr, address->dst_port,
+				     address->if_index,
+				     &address->src_ipaddr, address->src_port) > 0) li->write_packets++;
 		}
 
 		return buffer_len;
@@ -248,6 +461,15 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 */
 	rad_assert(buffer_len >= 20);
 
+	/*
+	 *	Queue the reply, so that mod_flush() can write many
+	 *	replies in one system call.
+	 */
+	if (inst->send_batch > 1) {
+		data_size = mod_write_queue(li, inst, thread, address, buffer, buffer_len);
+		goto done;
+	}
+
 	/*
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
@@ -256,12 +478,15 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 			     &address->dst_ipaddr, address->dst_port,
 			     address->if_index,
 			     &address->src_ipaddr, address->src_port);
+	li->write_syscalls++;
 
 	/*
 	 *	This socket is dead.  That's an error...
 	 */
 	if (data_size <= 0) return data_size;
+	li->write_packets++;
 
+done:
 	/*
 	 *	Root through the reply to determine any
 	 *	connection-level negotiation data.
@@ -413,6 +638,18 @@ static int mod_compare(UNUSED void const *instance, void const *one, void const
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+static uint32_t mod_hash(UNUSED void const *instance, void const *packet)
+{
+	uint8_t const *p = packet;
+
+	/*
+	 *	The same fields as mod_compare(), so that
+	 *	conflicting packets end up in the same place.
+	 *	Code, then ID.
+	 */
+	return fr_hash(p, 2);
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -452,6 +689,17 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	/*
+	 *	The batches are read and written with one call to
+	 *	recvmmsg() or sendmmsg(), which take at most
+	 *	UDP_MMSG_MAX datagrams.
+	 */
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, <=, UDP_MMSG_MAX);
+
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, <=, UDP_MMSG_MAX);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -545,8 +793,10 @@ fr_app_io_t proto_radius_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -1,4 +1,4 @@
-SUBMAKEFILES := rbmonkey.mk eapol_test/all.mk dict/all.mk trie/all.mk unit/all.mk map/all.mk xlat/all.mk keywords/all.mk util/all.mk auth/all.mk modules/all.mk daemon/all.mk 
+SUBMAKEFILES := rbmonkey.mk bench_dict.mk eapol_test/all.mk dict/all.mk trie/all.mk unit/all.mk map/all.mk xlat/all.mk keywords/all.mk util/all.mk auth/all.mk modules/all.mk daemon/all.mk 
 
 #
 #  Include all of the autoconf definitions into the Make variable space
@@ -0,0 +1,484 @@
+/*
+ * bench_dict.c	Time child lookups, and decoding of the unit test vectors
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/base.h>
+#include <freeradius-devel/util/latency.h>
+#include <freeradius-devel/server/dl.h>
+#include <freeradius-devel/io/test_point.h>
+
+#include <ctype.h>
+#include <dlfcn.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Reads the same files as unit_test_attribute, and keeps every
+ *	"decode-pair" input.  For "decode-pair -", that's the hex in the
+ *	"data" line of the previous "encode-pair".
+ */
+typedef struct {
+	char const			*file;
+	int				lineno;
+	fr_test_point_pair_decode_t	*tp;
+	fr_dict_t const			*dict;
+	uint8_t				*data;
+	size_t				data_len;
+} bench_vector_t;
+
+typedef struct {
+	fr_dict_attr_t const		*parent;
+	unsigned int			attr;
+} bench_lookup_t;
+
+#define MAX_DICTS	(32)
+#define MAX_LIBS	(32)
+
+static bench_vector_t	*vectors;
+static size_t		num_vectors;
+
+static fr_dict_t	*dicts[MAX_DICTS];
+static size_t		num_dicts;
+
+static void		*libs[MAX_LIBS];
+static size_t		num_libs;
+
+static bench_lookup_t	*lookups;
+static size_t		num_lookups;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: bench_dict [OPTS] file...\n");
+	fprintf(stderr, "  -D <dict_dir>          Set dictionary directory.\n");
+	fprintf(stderr, "  -n <num>               Decode each vector num times (default 10000).\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Files are unit_test_attribute inputs, e.g. src/tests/unit/radius_rfc.txt\n");
+
+	exit(EXIT_FAILURE);
+}
+
+/*
+ *	"01 02 03" or "010203"
+ */
+static ssize_t hex_parse(uint8_t **out, TALLOC_CTX *ctx, char const *p)
+{
+	uint8_t	*data;
+	size_t	len = 0;
+
+	data = talloc_array(ctx, uint8_t, (strlen(p) / 2) + 1);
+	if (!data) return -1;
+
+	while (*p) {
+		if (isspace((int) *p)) {
+			p++;
+			continue;
+		}
+
+		if (fr_hex2bin(data + len, 1, p, 2) != 1) {
+			talloc_free(data);
+			return -1;
+		}
+		len++;
+		p += 2;
+	}
+
+	*out = data;
+	return len;
+}
+
+static fr_dict_t *dict_load(char const *proto_name)
+{
+	fr_dict_t	*dict;
+	size_t		i;
+
+	for (i = 0; i < num_dicts; i++) {
+		if (strcmp(fr_dict_root(dicts[i])->name, proto_name) == 0) return dicts[i];
+	}
+
+	if (num_dicts == MAX_DICTS) {
+		fprintf(stderr, "bench_dict: Too many dictionaries\n");
+		return NULL;
+	}
+
+	if (fr_dict_protocol_afrom_file(&dict, proto_name) < 0) {
+		fr_perror("bench_dict");
+		return NULL;
+	}
+	dicts[num_dicts++] = dict;
+
+	return dict;
+}
+
+static void *lib_load(char const *proto_name)
+{
+	char	dl_name[128];
+	void	*handle;
+
+	snprintf(dl_name, sizeof(dl_name), "libfreeradius-%s", proto_name);
+
+	if (num_libs == MAX_LIBS) {
+		fprintf(stderr, "bench_dict: Too many libraries\n");
+		return NULL;
+	}
+
+	handle = dl_by_name(dl_name);
+	if (!handle) {
+		fprintf(stderr, "bench_dict: Failed to link to library \"%s\": %s\n", dl_name, fr_strerror());
+		return NULL;
+	}
+	libs[num_libs++] = handle;
+
+	return handle;
+}
+
+static int vector_add(char const *file, int lineno, fr_test_point_pair_decode_t *tp, fr_dict_t const *dict,
+		      char const *hex)
+{
+	bench_vector_t	*v;
+	ssize_t		len;
+
+	if ((num_vectors % 64) == 0) {
+		vectors = talloc_realloc(NULL, vectors, bench_vector_t, num_vectors + 64);
+		if (!vectors) return -1;
+	}
+
+	v = &vectors[num_vectors];
+	len = hex_parse(&v->data, vectors, hex);
+	if (len <= 0) return 0;		/* Not hex, e.g. an error message */
+
+	v->file = file;
+	v->lineno = lineno;
+	v->tp = tp;
+	v->dict = dict;
+	v->data_len = len;
+	num_vectors++;
+
+	return 0;
+}
+
+static int file_read(fr_dict_t *internal, char const *file)
+{
+	FILE				*fp;
+	char				buffer[8192];
+	char				last_data[8192];
+	int				lineno = 0;
+	void				*handle = NULL;
+	char				proto_name[128] = "";
+	fr_dict_t			*dict = internal;
+	bool				last_was_encode = false;
+
+	last_data[0] = '\0';
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		fprintf(stderr, "bench_dict: Error opening %s: %s\n", file, fr_syserror(errno));
+		return -1;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		char				*p, *q;
+		fr_test_point_pair_decode_t	*tp;
+		char				symbol[256];
+
+		lineno++;
+
+		p = strchr(buffer, '\n');
+		if (p) *p = '\0';
+
+		p = strchr(buffer, '#');
+		if (p && ((p == buffer) || (p[-1] != '['))) *p = '\0';
+
+		p = buffer;
+		while (isspace((int) *p)) p++;
+		if (!*p) continue;
+
+		if (strncmp(p, "load-dictionary ", 16) == 0) {
+			dict = dict_load(p + 16);
+			if (!dict) goto error;
+			continue;
+		}
+
+		if (strncmp(p, "load ", 5) == 0) {
+			handle = lib_load(p + 5);
+			if (!handle) goto error;
+			strlcpy(proto_name, p + 5, sizeof(proto_name));
+			continue;
+		}
+
+		if (strncmp(p, "data", 4) == 0) {
+			if (last_was_encode) strlcpy(last_data, p[4] ? p + 5 : "", sizeof(last_data));
+			last_was_encode = false;
+			continue;
+		}
+
+		last_was_encode = (strncmp(p, "encode-pair", 11) == 0);
+		if (strncmp(p, "decode-pair", 11) != 0) continue;
+		if (!handle) continue;
+
+		/*
+		 *	decode-pair[.symbol] <hex>|-
+		 */
+		q = strchr(p, ' ');
+		if (!q) continue;
+		*q++ = '\0';
+
+		if (p[11] == '.') {
+			strlcpy(symbol, p + 12, sizeof(symbol));
+		} else {
+			snprintf(symbol, sizeof(symbol), "%s_tp_decode", proto_name);
+		}
+
+		tp = dlsym(handle, symbol);
+		if (!tp) {
+			fprintf(stderr, "bench_dict: %s[%d]: Test point \"%s\" not exported by library\n",
+				file, lineno, symbol);
+			goto error;
+		}
+
+		if (vector_add(file, lineno, tp, dict,
+			       (strcmp(q, "-") == 0) ? last_data : q) < 0) {
+			fprintf(stderr, "bench_dict: Out of memory\n");
+		error:
+			fclose(fp);
+			return -1;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/*
+ *	What fr_dict_attr_child_by_num() did before the child index
+ */
+static fr_dict_attr_t const *child_by_bin(fr_dict_attr_t const *parent, unsigned int attr)
+{
+	fr_dict_attr_t const *bin;
+
+	if (!parent->children) return NULL;
+
+	for (bin = parent->children[attr & 0xff]; bin; bin = bin->next) {
+		if (bin->attr == attr) return bin;
+	}
+
+	return NULL;
+}
+
+static int lookups_add(fr_dict_attr_t const *da)
+{
+	size_t			i, len;
+	fr_dict_attr_t const	*p;
+
+	len = talloc_array_length(da->children);
+	for (i = 0; i < len; i++) for (p = da->children[i]; p; p = p->next) {
+		if ((num_lookups % 1024) == 0) {
+			lookups = talloc_realloc(NULL, lookups, bench_lookup_t, num_lookups + 1024);
+			if (!lookups) return -1;
+		}
+
+		lookups[num_lookups].parent = da;
+		lookups[num_lookups].attr = p->attr;
+		num_lookups++;
+	}
+
+	/*
+	 *	After all of the siblings, so that they're next to
+	 *	each other.
+	 */
+	for (i = 0; i < len; i++) for (p = da->children[i]; p; p = p->next) {
+		if (lookups_add(p) < 0) return -1;
+	}
+
+	return 0;
+}
+
+static void bench_lookup(unsigned int rounds)
+{
+	size_t			i, j, found;
+	uint64_t		start, t_bin, t_index, t_batch;
+	fr_dict_attr_t const	*out[16];
+	unsigned int		attr[16];
+
+	for (i = 0; i < num_dicts; i++) {
+		if (lookups_add(fr_dict_root(dicts[i])) < 0) {
+			fprintf(stderr, "bench_dict: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!num_lookups) return;
+
+	for (i = 0; i < num_lookups; i++) {
+		if (fr_dict_attr_child_by_num(lookups[i].parent, lookups[i].attr) !=
+		    child_by_bin(lookups[i].parent, lookups[i].attr)) {
+			fprintf(stderr, "bench_dict: Index and bins disagree for %s.%u\n",
+				lookups[i].parent->name, lookups[i].attr);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	found = 0;
+	start = fr_latency_now();
+	for (j = 0; j < rounds; j++) for (i = 0; i < num_lookups; i++) {
+		if (child_by_bin(lookups[i].parent, lookups[i].attr)) found++;
+	}
+	t_bin = fr_latency_now() - start;
+
+	start = fr_latency_now();
+	for (j = 0; j < rounds; j++) for (i = 0; i < num_lookups; i++) {
+		if (fr_dict_attr_child_by_num(lookups[i].parent, lookups[i].attr)) found++;
+	}
+	t_index = fr_latency_now() - start;
+
+	/*
+	 *	Siblings are next to each other in the lookup list, so
+	 *	batch runs of up to 16 with the same parent.
+	 */
+	start = fr_latency_now();
+	for (j = 0; j < rounds; j++) for (i = 0; i < num_lookups; ) {
+		size_t n = 0;
+
+		while (((i + n) < num_lookups) && (n < NUM_ELEMENTS(attr)) &&
+		       (lookups[i + n].parent == lookups[i].parent)) {
+			attr[n] = lookups[i + n].attr;
+			n++;
+		}
+		found += fr_dict_attr_child_by_num_batch(out, lookups[i].parent, attr, n);
+		i += n;
+	}
+	t_batch = fr_latency_now() - start;
+
+	if (found != (num_lookups * rounds * 3)) {
+		fprintf(stderr, "bench_dict: Found %zu of %zu children\n", found, num_lookups * rounds * 3);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%zu children in %zu dictionaries\n", num_lookups, num_dicts);
+	printf("\tbins %6.1f  index %6.1f  batch %6.1f ns/lookup\n",
+	       (double) t_bin / (num_lookups * rounds),
+	       (double) t_index / (num_lookups * rounds),
+	       (double) t_batch / (num_lookups * rounds));
+}
+
+static void bench_decode(unsigned int rounds)
+{
+	size_t		i;
+	unsigned int	j;
+	TALLOC_CTX	*ctx;
+	uint64_t	start, taken, total = 0;
+
+	ctx = talloc_init("bench_dict");
+
+	for (i = 0; i < num_vectors; i++) {
+		bench_vector_t	*v = &vectors[i];
+		void		*decoder_ctx = NULL;
+		size_t		pairs = 0;
+
+		if (v->tp->test_ctx && (v->tp->test_ctx(&decoder_ctx, ctx) < 0)) {
+			fr_perror("bench_dict: %s[%d]: Failed initialising decoder", v->file, v->lineno);
+			exit(EXIT_FAILURE);
+		}
+
+		start = fr_latency_now();
+		for (j = 0; j < rounds; j++) {
+			VALUE_PAIR	*head = NULL, *vp;
+			fr_cursor_t	cursor;
+			uint8_t const	*p = v->data;
+			size_t		len = v->data_len;
+
+			fr_cursor_init(&cursor, &head);
+			while (len > 0) {
+				ssize_t dec_len;
+
+				dec_len = v->tp->func(ctx, &cursor, v->dict, p, len, decoder_ctx);
+				if ((dec_len <= 0) || ((size_t) dec_len > len)) break;	/* Error vectors */
+				p += dec_len;
+				len -= dec_len;
+			}
+
+			if (!j) for (vp = head; vp; vp = vp->next) pairs++;
+			fr_pair_list_free(&head);
+		}
+		taken = fr_latency_now() - start;
+		total += taken;
+
+		printf("\t%s[%d]  %3zu pairs  %7.1f ns/decode\n", v->file, v->lineno, pairs,
+		       (double) taken / rounds);
+
+		talloc_free_children(ctx);
+	}
+
+	printf("%zu vectors  %7.1f ns/decode\n", num_vectors, (double) total / (num_vectors * rounds));
+
+	talloc_free(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char const	*dict_dir = DICTDIR;
+	unsigned int	rounds = 10000;
+	fr_dict_t	*dict = NULL;
+	size_t		i;
+	TALLOC_CTX	*autofree = talloc_autofree_context();
+
+	while ((c = getopt(argc, argv, "D:n:h")) != -1) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			rounds = atoi(optarg);
+			if (!rounds) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (!argc) usage();
+
+	if (fr_dict_global_init(autofree, dict_dir) < 0) {
+		fr_perror("bench_dict");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_dict_internal_afrom_file(&dict, FR_DICTIONARY_INTERNAL_DIR) < 0) {
+		fr_perror("bench_dict");
+		exit(EXIT_FAILURE);
+	}
+
+	for (c = 0; c < argc; c++) if (file_read(dict, argv[c]) < 0) exit(EXIT_FAILURE);
+
+	bench_lookup(rounds / 10 ? rounds / 10 : 1);
+	bench_decode(rounds);
+
+	talloc_free(vectors);
+	talloc_free(lookups);
+	for (i = 0; i < num_libs; i++) dlclose(libs[i]);
+	for (i = 0; i < num_dicts; i++) fr_dict_free(&dicts[i]);
+	fr_dict_free(&dict);
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+TARGET := bench_dict
+
+SOURCES := bench_dict.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
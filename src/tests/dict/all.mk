@@ -28,3 +28,32 @@ TESTS.DICT_FILES := $(addprefix $(BUILD_DIR)/tests/dict/,$(notdir $(FILES)))
 $(TESTS.DICT_FILES): | $(BUILD_DIR)/tests/dict
 
 tests.dict: $(TESTS.DICT_FILES)
+
+#
+#  Write binary images of the dictionaries, load them again, and
+#  check that they export the same attributes as the text files.
+#
+#  The export order depends on the hash chains, so it's sorted.
+#
+$(BUILD_DIR)/tests/dict/image: $(wildcard $(top_srcdir)/share/dictionary/*) $(BUILD_DIR)/bin/radict $(TESTBINDIR)/radict
+	${Q}echo DICT-IMAGE
+	${Q}rm -rf $@_dir
+	${Q}mkdir -p $(dir $@)
+	${Q}cp -RP $(top_srcdir)/share/dictionary $@_dir
+	${Q}$(TESTBIN)/radict -D $@_dir -E > $@_text.out
+	${Q}$(TESTBIN)/radict -D $@_dir -C > $@_cache.out
+	${Q}if [ ! -f $@_dir/radius/dictionary.image ]; then \
+		cat $@_cache.out; \
+		echo "radict -C did not write $@_dir/radius/dictionary.image"; \
+		exit 1; \
+	fi
+	${Q}$(TESTBIN)/radict -D $@_dir -E > $@_image.out
+	${Q}sort $@_text.out > $@_text.txt
+	${Q}sort $@_image.out > $@_image.txt
+	${Q}if [ ! -s $@_text.txt ] || ! diff $@_text.txt $@_image.txt; then \
+		echo "Dictionaries loaded from images differ from $(top_srcdir)/share/dictionary"; \
+		exit 1; \
+	fi
+	${Q}touch $@
+
+tests.dict: $(BUILD_DIR)/tests/dict/image
@@ -0,0 +1,19 @@
+TARGET		:= trie_bench
+
+SRC_CFLAGS	:= -DTESTING -DNO_TRIE_VERIFY
+SOURCES		:= trie_bench.c
+TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-util.a
+
+#
+#  The same test program as "trie", but without the internal
+#  verification routines, which would otherwise dominate the
+#  timings of the "bench" command.
+#
+#	./build/bin/local/trie_bench src/tests/trie/bench.in
+#
+src/tests/trie/trie_bench.c: ${top_srcdir}/src/lib/util/trie.c
+	@[ -e $@ ] || ln -s $^ $@
+
+${top_srcdir}/src/tests/trie/trie_bench.c: ${top_srcdir}/src/lib/util/trie.c
+	@[ -e $@ ] || ln -s $^ $@
@@ -1,4 +1,4 @@
-SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk 
+SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk timer_test.mk request_pool_test.mk bench_io.mk bench_btree.mk bench_htable.mk btree_test.mk htable_test.mk radius_tcp_queue_test.mk rate_limit_test.mk
 
 #
 #  These require pthread.
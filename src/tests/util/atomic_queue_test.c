@@ -76,8 +76,9 @@ int main(int argc, char *argv[])
 {
 	int			c, i, rcode = 0;
 	int			size;
+	unsigned int		num;
 	intptr_t		val;
-	void			*data;
+	void			*data, **array;
 	fr_atomic_queue_t	*aq;
 	TALLOC_CTX		*autofree = talloc_autofree_context();
 
@@ -190,6 +191,51 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	/*
+	 *	Bulk pops.  Move the head and tail along by one, so
+	 *	that the run wraps around the end of the array.  Then
+	 *	fill the queue, and pop one more entry than it holds.
+	 */
+	array = talloc_array(autofree, void *, size + 1);
+	for (i = 0; i <= size; i++) {
+		val = i + OFFSET;
+		array[i] = (void *) val;
+	}
+
+	if (!fr_atomic_queue_push(aq, array[0]) || !fr_atomic_queue_pop(aq, &data)) {
+		fprintf(stderr, "Failed moving the queue along\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < size; i++) {
+		if (!fr_atomic_queue_push(aq, array[i])) {
+			fprintf(stderr, "Failed pushing %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memset(array, 0, sizeof(array[0]) * (size + 1));
+
+	num = fr_atomic_queue_pop_bulk(aq, array, size + 1);
+	if (num != (unsigned int) size) {
+		fprintf(stderr, "Bulk pop expected %d, got %u\n", size, num);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < size; i++) {
+		val = (intptr_t) array[i];
+		if (val != (i + OFFSET)) {
+			fprintf(stderr, "Bulk pop expected %d, got %d\n",
+				i + OFFSET, (int) val);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (fr_atomic_queue_pop_bulk(aq, array, size) != 0) {
+		fprintf(stderr, "Bulk popped an entry past the end of the queue.");
+		exit(EXIT_FAILURE);
+	}
+
 	return rcode;
 }
 
@@ -0,0 +1,82 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tests/util/bench.h
+ * @brief Helpers shared by the data structure benchmarks.
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSIDH(bench_h, "$Id$")
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/rbtree.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <talloc.h>
+
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
+
+/** The operations which are timed
+ *
+ * So that different kinds of table can be run through the same code.
+ */
+typedef struct {
+	char const	*name;
+	void		*(*create)(TALLOC_CTX *ctx);
+	bool		(*insert)(void *table, void const *data);
+	void		*(*find)(void *table, void const *data);
+	bool		(*delete)(void *table, void const *data);
+	void		(*destroy)(void *table);
+	int		(*walk)(void *table, rb_walker_t callback, void *ctx);	//!< in order, or NULL.
+} bench_ops_t;
+
+/** The bytes allocated from the heap
+ *
+ * This includes large blocks which are mmap()'d, and the talloc
+ * headers, which are a large part of the cost of per-entry allocations.
+ *
+ * @return the number of bytes, or 0 if we can't tell.
+ */
+static inline size_t bench_heap_used(void)
+{
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+#elif defined(__GLIBC__)
+	struct mallinfo mi = mallinfo();
+
+	return (size_t) mi.uordblks + (size_t) mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+static inline void NEVER_RETURNS bench_fail(bench_ops_t const *ops, char const *what, uint64_t key)
+{
+	fprintf(stderr, "%s failed %s of key %" PRIu64 "\n", ops->name, what, key);
+	exit(EXIT_FAILURE);
+}
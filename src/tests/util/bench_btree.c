@@ -0,0 +1,330 @@
+/*
+ * bench_btree.c	Check fr_btree_t, and compare it with rbtree_t
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <freeradius-devel/util/base.h>
+#include <freeradius-devel/util/btree.h>
+#include <freeradius-devel/util/latency.h>
+#include <freeradius-devel/util/rand.h>
+
+#include "bench.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Like rbmonkey, each round first checks that the tree gives the
+ *	right answers for random data, and then times each operation.
+ */
+typedef struct {
+	uint64_t	key;
+	uint64_t	pad[3];
+} bench_entry_t;
+
+static int comp(void const *a, void const *b)
+{
+	bench_entry_t const *one = a, *two = b;
+
+	return (one->key > two->key) - (one->key < two->key);
+}
+
+static uint64_t prefix(void const *a)
+{
+	return ((bench_entry_t const *) a)->key;
+}
+
+static void *rb_create(TALLOC_CTX *ctx)
+{
+	return rbtree_create(ctx, comp, NULL, RBTREE_FLAG_NONE);
+}
+
+static bool rb_insert(void *tree, void const *data)
+{
+	return rbtree_insert(tree, data);
+}
+
+static void *rb_find(void *tree, void const *data)
+{
+	return rbtree_finddata(tree, data);
+}
+
+static bool rb_delete(void *tree, void const *data)
+{
+	return rbtree_deletebydata(tree, data);
+}
+
+static int rb_walk(void *tree, rb_walker_t callback, void *ctx)
+{
+	return rbtree_walk(tree, RBTREE_IN_ORDER, callback, ctx);
+}
+
+static void tree_free(void *tree)
+{
+	talloc_free(tree);
+}
+
+static void *bt_create(TALLOC_CTX *ctx)
+{
+	return fr_btree_create(ctx, comp, prefix, NULL, FR_BTREE_FLAG_NONE);
+}
+
+static void *bt_create_no_prefix(TALLOC_CTX *ctx)
+{
+	return fr_btree_create(ctx, comp, NULL, NULL, FR_BTREE_FLAG_NONE);
+}
+
+static bool bt_insert(void *tree, void const *data)
+{
+	return fr_btree_insert(tree, data);
+}
+
+static void *bt_find(void *tree, void const *data)
+{
+	return fr_btree_finddata(tree, data);
+}
+
+static bool bt_delete(void *tree, void const *data)
+{
+	return fr_btree_deletebydata(tree, data);
+}
+
+static int bt_walk(void *tree, rb_walker_t callback, void *ctx)
+{
+	return fr_btree_walk(tree, callback, ctx);
+}
+
+static bench_ops_t trees[] = {
+	{ "rbtree", rb_create, rb_insert, rb_find, rb_delete, tree_free, rb_walk },
+	{ "btree", bt_create, bt_insert, bt_find, bt_delete, tree_free, bt_walk },
+	{ "btree (no prefix)", bt_create_no_prefix, bt_insert, bt_find, bt_delete, tree_free, bt_walk },
+};
+
+typedef struct {
+	uint64_t	last;
+	uint32_t	count;
+} walk_ctx_t;
+
+static int walk_cb(void *ctx, void *data)
+{
+	walk_ctx_t *walk = ctx;
+	bench_entry_t *entry = data;
+
+	if (walk->count && (entry->key <= walk->last)) return -1;
+
+	walk->last = entry->key;
+	walk->count++;
+	return 0;
+}
+
+static double nsec_per_op(uint64_t nsec, uint32_t ops)
+{
+	return (double) nsec / ops;
+}
+
+/*
+ *	Insert half of the entries, delete some of them, and check
+ *	that the tree has exactly the right ones, in the right order.
+ */
+static void check(bench_ops_t const *bt, bench_entry_t *entries, uint32_t num)
+{
+	void		*tree;
+	uint32_t	i, half = num / 2;
+	walk_ctx_t	walk = { 0 };
+
+	tree = bt->create(NULL);
+	if (!tree) bench_fail(bt, "create", 0);
+
+	for (i = 0; i < half; i++) {
+		if (!bt->insert(tree, &entries[i])) bench_fail(bt, "insert", entries[i].key);
+	}
+	if (bt->insert(tree, &entries[0])) bench_fail(bt, "duplicate insert", entries[0].key);
+
+	for (i = 0; i < half; i += 3) {
+		if (!bt->delete(tree, &entries[i])) bench_fail(bt, "delete", entries[i].key);
+	}
+
+	for (i = 0; i < num; i++) {
+		void *found = bt->find(tree, &entries[i]);
+
+		if ((i < half) && (i % 3)) {
+			if (found != &entries[i]) bench_fail(bt, "find", entries[i].key);
+		} else {
+			if (found) bench_fail(bt, "find of deleted", entries[i].key);
+		}
+	}
+
+	if (bt->walk(tree, walk_cb, &walk) != 0) bench_fail(bt, "ordered walk", walk.last);
+	if (walk.count != (half - ((half + 2) / 3))) bench_fail(bt, "walk count", walk.count);
+
+	bt->destroy(tree);
+}
+
+static void bench(bench_ops_t const *bt, bench_entry_t *entries, uint32_t *order, uint32_t num)
+{
+	void		*tree;
+	uint32_t	i;
+	uint64_t	start, t_insert, t_find, t_walk, t_delete;
+	size_t		before, memory;
+	walk_ctx_t	walk = { 0 };
+
+	before = bench_heap_used();
+
+	tree = bt->create(NULL);
+	if (!tree) bench_fail(bt, "create", 0);
+
+	start = fr_latency_now();
+	for (i = 0; i < num; i++) {
+		if (!bt->insert(tree, &entries[i])) bench_fail(bt, "insert", entries[i].key);
+	}
+	t_insert = fr_latency_now() - start;
+
+	memory = bench_heap_used() - before;
+
+	/*
+	 *	Look the entries up in a different order to the one
+	 *	they were inserted in.
+	 */
+	start = fr_latency_now();
+	for (i = 0; i < num; i++) {
+		uint32_t j = order[i];
+
+		if (bt->find(tree, &entries[j]) != &entries[j]) bench_fail(bt, "find", entries[j].key);
+	}
+	t_find = fr_latency_now() - start;
+
+	start = fr_latency_now();
+	if (bt->walk(tree, walk_cb, &walk) != 0) bench_fail(bt, "ordered walk", walk.last);
+	t_walk = fr_latency_now() - start;
+	if (walk.count != num) bench_fail(bt, "walk count", walk.count);
+
+	start = fr_latency_now();
+	for (i = 0; i < num; i++) {
+		if (!bt->delete(tree, &entries[num - i - 1])) bench_fail(bt, "delete", entries[num - i - 1].key);
+	}
+	t_delete = fr_latency_now() - start;
+
+	bt->destroy(tree);
+
+	printf("\t%-18s insert %7.1f  find %7.1f  walk %6.1f  delete %7.1f ns/op", bt->name,
+	       nsec_per_op(t_insert, num), nsec_per_op(t_find, num),
+	       nsec_per_op(t_walk, num), nsec_per_op(t_delete, num));
+
+	if (memory) {
+		printf("  %6.1f bytes/entry\n", (double) memory / num);
+	} else {
+		printf("\n");
+	}
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: bench_btree [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Use num entries.  May be given more than once.\n");
+	fprintf(stderr, "                         Default is 10000, 1000000 and 10000000.\n");
+	fprintf(stderr, "  -s <seed>              Seed for the random keys.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+#define MAX_SIZES (8)
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	unsigned int	i, j, num_sizes = 0;
+	uint32_t	sizes[MAX_SIZES], max = 0, n, k, tmp;
+	uint32_t	*order;
+	uint64_t	state = 0x2545f4914f6cdd1dULL;
+	bench_entry_t	*entries;
+
+	while ((c = getopt(argc, argv, "hn:s:")) != -1) switch (c) {
+		case 'n':
+			if (num_sizes == MAX_SIZES) usage();
+			sizes[num_sizes] = atoi(optarg);
+			if ((sizes[num_sizes] < 3) || (sizes[num_sizes] > 100000000)) usage();
+			num_sizes++;
+			break;
+
+		case 's':
+			state = strtoull(optarg, NULL, 0);
+			if (!state) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (!num_sizes) {
+		sizes[0] = 10000;
+		sizes[1] = 1000000;
+		sizes[2] = 10000000;
+		num_sizes = 3;
+	}
+
+	for (i = 0; i < num_sizes; i++) if (sizes[i] > max) max = sizes[i];
+
+	entries = talloc_zero_array(NULL, bench_entry_t, max);
+	order = talloc_array(entries, uint32_t, max);
+	if (!entries || !order) {
+		fprintf(stderr, "bench_btree: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Random keys, which are unique because the low bits
+	 *	are the index.
+	 */
+	for (n = 0; n < max; n++) {
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		entries[n].key = ((state * 0x2545f4914f6cdd1dULL) & ~((uint64_t) 0xffffffff)) | n;
+	}
+
+	for (i = 0; i < num_sizes; i++) {
+		printf("%u entries\n", sizes[i]);
+
+		/*
+		 *	A random permutation of the entries, for the
+		 *	lookups.
+		 */
+		for (n = 0; n < sizes[i]; n++) order[n] = n;
+		for (n = sizes[i] - 1; n > 0; n--) {
+			k = fr_rand() % (n + 1);
+			tmp = order[n];
+			order[n] = order[k];
+			order[k] = tmp;
+		}
+
+		for (j = 0; j < NUM_ELEMENTS(trees); j++) {
+			check(&trees[j], entries, sizes[i]);
+			bench(&trees[j], entries, order, sizes[i]);
+		}
+	}
+
+	talloc_free(entries);
+
+	return 0;
+}
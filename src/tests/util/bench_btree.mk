@@ -0,0 +1,7 @@
+TARGET := bench_btree
+
+SOURCES := bench_btree.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
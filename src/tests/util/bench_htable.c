@@ -0,0 +1,265 @@
+/*
+ * bench_htable.c	Compare fr_htable_t with fr_hash_table_t
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/htable.h>
+#include <freeradius-devel/util/latency.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	The data which is put into the tables.  The key is at the
+ *	start, and the rest is there to make it look like a typical
+ *	structure.
+ */
+typedef struct {
+	uint32_t	key;
+	uint32_t	pad[7];
+} bench_entry_t;
+
+static uint32_t		num_entries = 1000000;
+static int		num_rounds = 3;
+
+static uint32_t entry_hash(void const *data)
+{
+	bench_entry_t const *entry = data;
+
+	return fr_hash(&entry->key, sizeof(entry->key));
+}
+
+static int entry_cmp(void const *one, void const *two)
+{
+	bench_entry_t const *a = one, *b = two;
+
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+static void *hash_table_create(TALLOC_CTX *ctx)
+{
+	return fr_hash_table_create(ctx, entry_hash, entry_cmp, NULL);
+}
+
+static bool hash_table_insert(void *table, void const *data)
+{
+	return (fr_hash_table_insert(table, data) != 0);
+}
+
+static void *hash_table_find(void *table, void const *data)
+{
+	return fr_hash_table_finddata(table, data);
+}
+
+static bool hash_table_delete(void *table, void const *data)
+{
+	return (fr_hash_table_delete(table, data) != 0);
+}
+
+static void hash_table_destroy(void *table)
+{
+	fr_hash_table_free(table);
+}
+
+static void *htable_create(TALLOC_CTX *ctx)
+{
+	return fr_htable_create(ctx, entry_hash, entry_cmp, NULL);
+}
+
+static bool htable_insert(void *table, void const *data)
+{
+	return (fr_htable_insert(table, data) != 0);
+}
+
+static void *htable_find(void *table, void const *data)
+{
+	return fr_htable_finddata(table, data);
+}
+
+static bool htable_delete(void *table, void const *data)
+{
+	return (fr_htable_delete(table, data) != 0);
+}
+
+static void htable_destroy(void *table)
+{
+	fr_htable_free(table);
+}
+
+static bench_ops_t tables[] = {
+	{ "fr_hash_table", hash_table_create, hash_table_insert, hash_table_find, hash_table_delete, hash_table_destroy, NULL },
+	{ "fr_htable", htable_create, htable_insert, htable_find, htable_delete, htable_destroy, NULL },
+};
+
+static uint32_t xorshift(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+static double mops(uint32_t ops, uint64_t nsec)
+{
+	if (!nsec) return 0;
+
+	return ((double) ops * 1000) / nsec;
+}
+
+static void bench_run(bench_ops_t const *bt, bench_entry_t *entries, bench_entry_t *missing,
+		      uint32_t *order)
+{
+	void		*table;
+	uint32_t	i;
+	uint64_t	start, t_insert = 0, t_hit = 0, t_miss = 0, t_delete = 0;
+	size_t		before, memory = 0;
+	int		round;
+
+	for (round = 0; round < num_rounds; round++) {
+		before = bench_heap_used();
+
+		table = bt->create(NULL);
+		if (!table) bench_fail(bt, "create", 0);
+
+		start = fr_latency_now();
+		for (i = 0; i < num_entries; i++) {
+			if (!bt->insert(table, &entries[i])) bench_fail(bt, "insert", entries[i].key);
+		}
+		t_insert += fr_latency_now() - start;
+
+		memory = bench_heap_used() - before;
+
+		start = fr_latency_now();
+		for (i = 0; i < num_entries; i++) {
+			bench_entry_t *entry = &entries[order[i]];
+
+			if (bt->find(table, entry) != entry) bench_fail(bt, "find", entry->key);
+		}
+		t_hit += fr_latency_now() - start;
+
+		start = fr_latency_now();
+		for (i = 0; i < num_entries; i++) {
+			if (bt->find(table, &missing[i])) bench_fail(bt, "miss", missing[i].key);
+		}
+		t_miss += fr_latency_now() - start;
+
+		start = fr_latency_now();
+		for (i = 0; i < num_entries; i++) {
+			bench_entry_t *entry = &entries[order[i]];
+
+			if (!bt->delete(table, entry)) bench_fail(bt, "delete", entry->key);
+		}
+		t_delete += fr_latency_now() - start;
+
+		bt->destroy(table);
+	}
+
+	printf("\t%-16s insert %7.2f  find %7.2f  miss %7.2f  delete %7.2f Mops/s", bt->name,
+	       mops(num_entries * num_rounds, t_insert), mops(num_entries * num_rounds, t_hit),
+	       mops(num_entries * num_rounds, t_miss), mops(num_entries * num_rounds, t_delete));
+
+	if (memory) {
+		printf("  %6.1f bytes/entry\n", (double) memory / num_entries);
+	} else {
+		printf("\n");
+	}
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: bench_htable [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Put num entries into each table.\n");
+	fprintf(stderr, "  -r <num>               Repeat each test num times.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	uint32_t		i, j, tmp, state = 0x12345678;
+	bench_entry_t		*entries, *missing;
+	uint32_t		*order;
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+
+	while ((c = getopt(argc, argv, "hn:r:")) != -1) switch (c) {
+		case 'n':
+			num_entries = atoi(optarg);
+			if (!num_entries || (num_entries > (1 << 26))) usage();
+			break;
+
+		case 'r':
+			num_rounds = atoi(optarg);
+			if ((num_rounds <= 0) || (num_rounds > 100)) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	entries = talloc_zero_array(autofree, bench_entry_t, num_entries);
+	missing = talloc_zero_array(autofree, bench_entry_t, num_entries);
+	order = talloc_array(autofree, uint32_t, num_entries);
+	if (!entries || !missing || !order) {
+		fprintf(stderr, "bench_htable: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Even keys are in the table, odd keys aren't.  Look
+	 *	them up in a random order, so that we're not just
+	 *	measuring the cache.
+	 */
+	for (i = 0; i < num_entries; i++) {
+		entries[i].key = i << 1;
+		missing[i].key = (i << 1) | 1;
+		order[i] = i;
+	}
+
+	for (i = num_entries - 1; i > 0; i--) {
+		j = xorshift(&state) % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	printf("%u entries, %d rounds\n", num_entries, num_rounds);
+
+	for (i = 0; i < NUM_ELEMENTS(tables); i++) {
+		bench_run(&tables[i], entries, missing, order);
+	}
+
+	return 0;
+}
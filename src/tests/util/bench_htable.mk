@@ -0,0 +1,6 @@
+TARGET := bench_htable
+
+SOURCES		:= bench_htable.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,533 @@
+/*
+ * bench_io.c	Benchmark the network -> channel -> worker pipeline
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/network.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/latency.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+/*
+ *	The maximum number of packets each client may have
+ *	outstanding.  Must be a power of 2.
+ */
+#define MAX_OUTSTANDING		(4096)
+
+/*
+ *	The packets are just a sequence number, followed by padding.
+ */
+#define MIN_PACKET_SIZE		(sizeof(uint32_t))
+
+/*
+ *	How long we wait for the networks to add the sockets, and
+ *	how long a client waits for a reply before giving up.
+ */
+#define BENCH_TIMEOUT		(5)
+
+/** One listener, and the client thread which sends packets to it
+ *
+ *  The two ends are connected by a datagram socketpair, so that
+ *  the network side sees an ordinary socket.
+ */
+typedef struct {
+	int			id;
+	fr_listen_t		*listen;	//!< the server side
+	fr_network_t		*nr;		//!< which the listener was added to
+
+	int			server_fd;
+	int			client_fd;
+
+	/*
+	 *	Written by the network thread.
+	 */
+	fr_time_t		recv_time[MAX_OUTSTANDING];
+
+	/*
+	 *	Written by the client thread.
+	 */
+	pthread_t		pthread_id;
+	fr_time_t		sent_time[MAX_OUTSTANDING];
+	uint32_t		sent;
+	uint32_t		received;
+	bool			timed_out;	//!< stopped waiting for replies
+	fr_time_t		start;
+	fr_time_t		end;
+	fr_latency_t		rtt;		//!< round trip time, as seen by the client
+} bench_listen_t;
+
+static int			debug_lvl = 0;
+static uint32_t			max_packets = 100000;
+static uint32_t			max_outstanding = 64;
+static uint32_t			rate = 0;
+static size_t			packet_size = 64;
+
+/*
+ *	The networks add the sockets asynchronously, so we count them
+ *	as they're added, before starting the clients.
+ */
+static pthread_mutex_t		listen_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		listen_cond = PTHREAD_COND_INITIALIZER;
+static int			num_listening = 0;
+
+static fr_io_final_t bench_process(UNUSED void const *instance, REQUEST *request, fr_io_action_t action)
+{
+	MPRINT1("\t\tPROCESS --- request %"PRIu64" action %d\n", request->number, action);
+	return FR_IO_REPLY;
+}
+
+static int bench_decode(UNUSED void const *instance, REQUEST *request, uint8_t *const data, UNUSED size_t data_len)
+{
+	uint32_t number;
+
+	/*
+	 *	The data is the packet number.
+	 */
+	memcpy(&number, data, sizeof(number));
+	request->number = number;
+
+	request->async->process = bench_process;
+
+	return 0;
+}
+
+static ssize_t bench_encode(UNUSED void const *instance, REQUEST *request, uint8_t *buffer, size_t buffer_len)
+{
+	uint32_t number = request->number;
+
+	if (buffer_len < sizeof(number)) return -1;
+
+	memcpy(buffer, &number, sizeof(number));
+
+	return sizeof(number);
+}
+
+static size_t bench_nak(UNUSED fr_listen_t *li, UNUSED void *packet_ctx, uint8_t *const packet, UNUSED size_t packet_len,
+			uint8_t *reply, UNUSED size_t reply_len)
+{
+	memcpy(reply, packet, sizeof(uint32_t));
+
+	return sizeof(uint32_t);
+}
+
+static ssize_t bench_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len,
+			  size_t *leftover, uint32_t *priority, bool *is_dup)
+{
+	bench_listen_t	*bl = talloc_get_type_abort(li->thread_instance, bench_listen_t);
+	ssize_t		data_size;
+	uint32_t	number;
+
+	*leftover = 0;
+	*is_dup = false;
+
+	data_size = recv(bl->server_fd, buffer, buffer_len, 0);
+	if (data_size < 0) {
+		if (errno == EWOULDBLOCK) return 0;
+		return -1;
+	}
+	if ((size_t) data_size < MIN_PACKET_SIZE) return 0;
+
+	/*
+	 *	The client never has more than MAX_OUTSTANDING packets
+	 *	in flight, so the slot is free.
+	 */
+	memcpy(&number, buffer, sizeof(number));
+	bl->recv_time[number & (MAX_OUTSTANDING - 1)] = fr_time();
+	*recv_time = &bl->recv_time[number & (MAX_OUTSTANDING - 1)];
+	*priority = PRIORITY_NORMAL;
+
+	return data_size;
+}
+
+static ssize_t bench_write(fr_listen_t *li, UNUSED void *packet_ctx, UNUSED fr_time_t request_time,
+			   uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
+{
+	bench_listen_t	*bl = talloc_get_type_abort(li->thread_instance, bench_listen_t);
+
+	return send(bl->server_fd, buffer, buffer_len, 0);
+}
+
+/*
+ *	Called by the network thread once it's reading the socket.
+ */
+static void bench_event_list_set(UNUSED fr_listen_t *li, UNUSED fr_event_list_t *el, UNUSED void *nr)
+{
+	pthread_mutex_lock(&listen_mutex);
+	num_listening++;
+	pthread_cond_signal(&listen_cond);
+	pthread_mutex_unlock(&listen_mutex);
+}
+
+static int bench_close(UNUSED fr_listen_t *li)
+{
+	/*
+	 *	The sockets are closed by main().
+	 */
+	return 0;
+}
+
+static fr_app_io_t app_io = {
+	.name = "bench-io",
+	.default_message_size = 4096,
+	.read = bench_read,
+	.write = bench_write,
+	.close = bench_close,
+	.event_list_set = bench_event_list_set,
+	.nak = bench_nak,
+	.encode = bench_encode,
+	.decode = bench_decode
+};
+
+static void entry_point_set(UNUSED void const *ctx, REQUEST *request)
+{
+	request->async->process = bench_process;
+}
+
+static fr_app_t bench_app = {
+	.entry_point_set = entry_point_set,
+};
+
+static bool bench_receive(bench_listen_t *bl, int timeout)
+{
+	struct pollfd	pfd = { .fd = bl->client_fd, .events = POLLIN };
+	uint8_t		buffer[256];
+	uint32_t	number;
+	ssize_t		data_size;
+	bool		got_reply = false;
+
+	if (poll(&pfd, 1, timeout) <= 0) return false;
+
+	while ((data_size = recv(bl->client_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+		if ((size_t) data_size < sizeof(number)) continue;
+
+		memcpy(&number, buffer, sizeof(number));
+		fr_latency_add(&bl->rtt, fr_time() - bl->sent_time[number & (MAX_OUTSTANDING - 1)]);
+		bl->received++;
+		got_reply = true;
+	}
+
+	return got_reply;
+}
+
+/** Send packets as fast as possible, or at a fixed rate
+ *
+ */
+static void *bench_client(void *arg)
+{
+	bench_listen_t	*bl = arg;
+	uint8_t		*packet;
+	fr_time_t	now, next, last_reply;
+
+	packet = talloc_zero_array(NULL, uint8_t, packet_size);
+	if (!packet) return NULL;
+
+	bl->start = last_reply = fr_time();
+
+	while (bl->received < max_packets) {
+		int timeout = 100;
+
+		now = fr_time();
+
+		while ((bl->sent < max_packets) && ((bl->sent - bl->received) < max_outstanding)) {
+			if (rate) {
+				next = bl->start + (((fr_time_t) bl->sent * NANOSEC) / rate);
+				if (next > now) {
+					timeout = (next - now) / 1000000;
+					break;
+				}
+			}
+
+			memcpy(packet, &bl->sent, sizeof(bl->sent));
+			bl->sent_time[bl->sent & (MAX_OUTSTANDING - 1)] = now;
+
+			if (send(bl->client_fd, packet, packet_size, 0) < 0) {
+				if (errno == EWOULDBLOCK) break;
+
+				fprintf(stderr, "bench_io: Failed sending packet: %s\n", fr_syserror(errno));
+				goto done;
+			}
+			bl->sent++;
+		}
+
+		if (bench_receive(bl, timeout)) {
+			last_reply = fr_time();
+
+		/*
+		 *	Lost packets are never replied to, so don't
+		 *	wait for them forever.
+		 */
+		} else if ((bl->sent > bl->received) &&
+			   ((fr_time() - last_reply) > ((fr_time_t) BENCH_TIMEOUT * NANOSEC))) {
+			fprintf(stderr, "bench_io: Client %d timed out with %u of %u replies\n",
+				bl->id, bl->received, bl->sent);
+			bl->timed_out = true;
+			break;
+		}
+	}
+
+done:
+	bl->end = fr_time();
+	talloc_free(packet);
+
+	return NULL;
+}
+
+static void print_latency(char const *name, fr_latency_t const *lat)
+{
+	printf("\t%-16s p50 %6" PRIu64 " p90 %6" PRIu64 " p99 %6" PRIu64 " p999 %6" PRIu64 " max %6" PRIu64 " usec\n",
+	       name,
+	       fr_latency_percentile(lat, 500) / 1000,
+	       fr_latency_percentile(lat, 900) / 1000,
+	       fr_latency_percentile(lat, 990) / 1000,
+	       fr_latency_percentile(lat, 999) / 1000,
+	       lat->max / 1000);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: bench_io [OPTS]\n");
+	fprintf(stderr, "  -c <num>               Send num packets from each client.\n");
+	fprintf(stderr, "  -l <num>               Create num listeners, each with its own client.\n");
+	fprintf(stderr, "                         Default is one per network thread.\n");
+	fprintf(stderr, "  -n <num>               Start num network threads.\n");
+	fprintf(stderr, "  -o <num>               Allow num outstanding packets per client.\n");
+	fprintf(stderr, "  -r <pps>               Send packets at pps per client.  Default is as fast as possible.\n");
+	fprintf(stderr, "  -s <bytes>             Size of each packet.\n");
+	fprintf(stderr, "  -w <num>               Start num worker threads.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, j;
+	int			num_networks = 1;
+	int			num_workers = 2;
+	int			num_listeners = 0;
+	fr_schedule_config_t	config;
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+	fr_schedule_t		*sched;
+	bench_listen_t		**bl;
+	fr_network_t		**networks;
+	fr_time_t		start = 0, end = 0;
+	uint64_t		received = 0;
+	bool			timed_out = false;
+	struct timespec		deadline;
+	fr_latency_t		rtt = { 0 }, lat;
+	fr_channel_stats_t	to_workers, from_workers, total_to = { 0 }, total_from = { 0 };
+	static char const	*stages[] = { "network.read", "channel.queue", "worker.decode",
+					      "worker.encode", "network.write" };
+
+	fr_time_start();
+
+	fr_log_init(&default_log, false);
+
+	while ((c = getopt(argc, argv, "c:hl:n:o:r:s:w:x")) != -1) switch (c) {
+		case 'c':
+			max_packets = atoi(optarg);
+			if (!max_packets) usage();
+			break;
+
+		case 'l':
+			num_listeners = atoi(optarg);
+			if ((num_listeners <= 0) || (num_listeners > 1024)) usage();
+			break;
+
+		case 'n':
+			num_networks = atoi(optarg);
+			if ((num_networks <= 0) || (num_networks > 16)) usage();
+			break;
+
+		case 'o':
+			max_outstanding = atoi(optarg);
+			if (!max_outstanding || (max_outstanding > MAX_OUTSTANDING)) usage();
+			break;
+
+		case 'r':
+			rate = atoi(optarg);
+			break;
+
+		case 's':
+			packet_size = atoi(optarg);
+			if ((packet_size < MIN_PACKET_SIZE) || (packet_size > 4096)) usage();
+			break;
+
+		case 'w':
+			num_workers = atoi(optarg);
+			if ((num_workers <= 0) || (num_workers > 1024)) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			fr_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (!num_listeners) num_listeners = num_networks;
+
+	config = (fr_schedule_config_t) {
+		.max_networks = num_networks,
+		.max_workers = num_workers
+	};
+
+	sched = fr_schedule_create(autofree, NULL, &default_log, debug_lvl, &config, NULL, NULL);
+	if (!sched) {
+		fprintf(stderr, "bench_io: Failed to create scheduler\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bl = talloc_zero_array(autofree, bench_listen_t *, num_listeners);
+	networks = talloc_zero_array(autofree, fr_network_t *, num_networks);
+
+	for (i = 0; i < num_listeners; i++) {
+		int fd[2];
+
+		bl[i] = talloc_zero(bl, bench_listen_t);
+
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fd) < 0) {
+			fprintf(stderr, "bench_io: Failed creating socketpair: %s\n", fr_syserror(errno));
+			exit(EXIT_FAILURE);
+		}
+		(void) fr_nonblock(fd[0]);
+
+		bl[i]->id = i;
+		bl[i]->server_fd = fd[0];
+		bl[i]->client_fd = fd[1];
+
+		bl[i]->listen = talloc_zero(autofree, fr_listen_t);
+		bl[i]->listen->fd = fd[0];
+		bl[i]->listen->name = "bench";
+		bl[i]->listen->app_io = &app_io;
+		bl[i]->listen->app = &bench_app;
+		bl[i]->listen->thread_instance = bl[i];
+		bl[i]->listen->default_message_size = app_io.default_message_size;
+		bl[i]->listen->num_messages = max_outstanding;
+
+		bl[i]->nr = fr_schedule_listen_add_network(sched, bl[i]->listen, i % num_networks);
+		if (!bl[i]->nr) {
+			fr_perror("bench_io: Failed adding listener");
+			exit(EXIT_FAILURE);
+		}
+		networks[i % num_networks] = bl[i]->nr;
+	}
+
+	/*
+	 *	Wait for the networks to add the sockets.
+	 */
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += BENCH_TIMEOUT;
+
+	pthread_mutex_lock(&listen_mutex);
+	while (num_listening < num_listeners) {
+		if (pthread_cond_timedwait(&listen_cond, &listen_mutex, &deadline) == ETIMEDOUT) {
+			fprintf(stderr, "bench_io: Only %d of %d listeners were added\n", num_listening, num_listeners);
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_mutex_unlock(&listen_mutex);
+
+	for (i = 0; i < num_listeners; i++) {
+		if (fr_schedule_pthread_create(&bl[i]->pthread_id, bench_client, bl[i]) < 0) {
+			fr_perror("bench_io: Failed creating client thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < num_listeners; i++) {
+		(void) pthread_join(bl[i]->pthread_id, NULL);
+
+		if (!start || (bl[i]->start < start)) start = bl[i]->start;
+		if (bl[i]->end > end) end = bl[i]->end;
+
+		received += bl[i]->received;
+		fr_latency_merge(&rtt, &bl[i]->rtt);
+		if (bl[i]->timed_out) timed_out = true;
+	}
+
+	/*
+	 *	The network threads are still running, but the
+	 *	clients have received all of their replies, so the
+	 *	counts no longer change.
+	 */
+	for (i = 0; i < num_networks; i++) {
+		if (!networks[i]) continue;
+
+		fr_network_channel_stats(networks[i], &to_workers, &from_workers);
+		total_to.packets += to_workers.packets;
+		total_to.signals += to_workers.signals;
+		total_from.packets += from_workers.packets;
+		total_from.signals += from_workers.signals;
+	}
+
+	printf("%d networks, %d workers, %d clients, %u packets each, %u outstanding\n",
+	       num_networks, num_workers, num_listeners, max_packets, max_outstanding);
+
+	if (end > start) {
+		printf("\tthroughput\t%" PRIu64 " packets/s\n", (received * NANOSEC) / (end - start));
+	}
+
+	if (total_to.packets) {
+		printf("\tsignals\t\t%.3f to workers, %.3f from workers, per packet\n",
+		       (double) total_to.signals / total_to.packets,
+		       (double) total_from.signals / (total_from.packets ? total_from.packets : 1));
+	}
+
+	print_latency("round trip", &rtt);
+	for (j = 0; j < (int) NUM_ELEMENTS(stages); j++) {
+		if (fr_latency_get(&lat, stages[j], NULL) < 0) continue;
+
+		print_latency(stages[j], &lat);
+	}
+
+	(void) fr_schedule_destroy(sched);
+
+	for (i = 0; i < num_listeners; i++) {
+		close(bl[i]->server_fd);
+		close(bl[i]->client_fd);
+	}
+
+	if (timed_out) exit(EXIT_FAILURE);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := bench_io
+
+SOURCES		:= bench_io.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
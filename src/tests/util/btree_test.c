@@ -0,0 +1,362 @@
+/*
+ * btree_test.c	Tests for fr_btree_t
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/util/btree.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Entry i has key (i + 1) * 2, so the entries are in key order,
+ *	and odd keys are never in the tree.
+ */
+typedef struct {
+	uint64_t	key;
+} test_entry_t;
+
+/*
+ *	What a walk or an iteration should return: the present
+ *	entries with index in [next, end).
+ */
+typedef struct {
+	test_entry_t	*entries;
+	bool		*present;
+	uint32_t	next;
+	uint32_t	end;
+	uint64_t	bad;		//!< key of the wrong data, if any
+} test_walk_t;
+
+static int		debug_lvl = 0;
+static uint32_t		num_entries = 100000;
+static int		num_ranges = 100;
+
+static int entry_cmp(void const *one, void const *two)
+{
+	test_entry_t const *a = one, *b = two;
+
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+static uint64_t entry_prefix(void const *data)
+{
+	return ((test_entry_t const *) data)->key;
+}
+
+static int num_freed;
+
+static void entry_free(UNUSED void *data)
+{
+	num_freed++;
+}
+
+static void NEVER_RETURNS fail(char const *test, char const *what, uint64_t key)
+{
+	fprintf(stderr, "%s: failed %s of key %" PRIu64 "\n", test, what, key);
+	exit(EXIT_FAILURE);
+}
+
+/*
+ *	Fisher-Yates, so that every order is equally likely.
+ */
+static void shuffle(uint32_t *order, uint32_t num)
+{
+	uint32_t i, j, tmp;
+
+	for (i = 0; i < num; i++) order[i] = i;
+
+	for (i = num - 1; i > 0; i--) {
+		j = fr_rand() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+/*
+ *	The index of the first entry with key >= "key".
+ */
+static uint32_t entry_index(uint64_t key)
+{
+	uint64_t i;
+
+	if (key <= 2) return 0;
+
+	i = ((key + 1) / 2) - 1;
+
+	return (i < num_entries) ? (uint32_t) i : num_entries;
+}
+
+/*
+ *	Return the next entry the walk should see, or NULL if there
+ *	are no more.
+ */
+static test_entry_t *walk_next(test_walk_t *walk)
+{
+	while ((walk->next < walk->end) && !walk->present[walk->next]) walk->next++;
+
+	if (walk->next == walk->end) return NULL;
+
+	return &walk->entries[walk->next++];
+}
+
+static int walk_cb(void *ctx, void *data)
+{
+	test_walk_t *walk = ctx;
+
+	if (walk_next(walk) != data) {
+		walk->bad = ((test_entry_t *) data)->key;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void check_walk(char const *test, char const *what, fr_btree_t *tree,
+		       test_entry_t *entries, bool *present, test_entry_t const *start, test_entry_t const *end)
+{
+	test_walk_t		walk;
+	fr_btree_iter_t		iter;
+	test_entry_t		*data, *missed;
+
+	walk = (test_walk_t) {
+		.entries = entries,
+		.present = present,
+		.next = start ? entry_index(start->key) : 0,
+		.end = end ? entry_index(end->key) : num_entries
+	};
+
+	if (walk.end < walk.next) walk.end = walk.next;
+
+	if (!start && !end) {
+		if (fr_btree_walk(tree, walk_cb, &walk) != 0) fail(test, what, walk.bad);
+	} else {
+		if (fr_btree_walk_range(tree, start, end, walk_cb, &walk) != 0) fail(test, what, walk.bad);
+	}
+	if ((missed = walk_next(&walk))) fail(test, what, missed->key);
+
+	/*
+	 *	The iterator from the same start should return the
+	 *	same data, and then carry on to the end of the tree.
+	 */
+	walk.next = start ? entry_index(start->key) : 0;
+	walk.end = num_entries;
+
+	for (data = fr_btree_iter_init(tree, &iter, start); data; data = fr_btree_iter_next(tree, &iter)) {
+		if (walk_next(&walk) != data) fail(test, "iteration", data->key);
+	}
+	if ((missed = walk_next(&walk))) fail(test, "iteration", missed->key);
+}
+
+/*
+ *	Check that the tree holds exactly the present entries.
+ */
+static void check_contents(char const *test, fr_btree_t *tree, test_entry_t *entries, bool *present)
+{
+	uint32_t	i, count = 0;
+	int		r;
+	test_entry_t	missing, start, end;
+
+	for (i = 0; i < num_entries; i++) {
+		void *found = fr_btree_finddata(tree, &entries[i]);
+
+		if (present[i]) {
+			if (found != &entries[i]) fail(test, "find", entries[i].key);
+			count++;
+		} else {
+			if (found) fail(test, "find of deleted", entries[i].key);
+		}
+
+		missing.key = entries[i].key + 1;
+		if (fr_btree_finddata(tree, &missing)) fail(test, "find of missing", missing.key);
+	}
+
+	if (fr_btree_num_elements(tree) != count) fail(test, "count", fr_btree_num_elements(tree));
+
+	check_walk(test, "walk", tree, entries, present, NULL, NULL);
+
+	/*
+	 *	Ranges with random ends, which may or may not be keys
+	 *	in the tree, and may be outside of all of the keys.
+	 */
+	for (r = 0; r < num_ranges; r++) {
+		start.key = fr_rand() % ((uint64_t) num_entries * 2 + 4);
+		end.key = start.key + (fr_rand() % ((r & 1) ? 64 : ((uint64_t) num_entries * 2)));
+
+		check_walk(test, "range walk", tree, entries, present, &start, &end);
+		check_walk(test, "range walk to the end", tree, entries, present, &start, NULL);
+		check_walk(test, "range walk from the start", tree, entries, present, NULL, &end);
+	}
+}
+
+static void test_insert_delete(char const *test, fr_btree_prefix_t prefix, test_entry_t *entries, uint32_t *order)
+{
+	fr_btree_t	*tree;
+	bool		*present;
+	uint32_t	i;
+
+	present = talloc_zero_array(NULL, bool, num_entries);
+	tree = fr_btree_create(NULL, entry_cmp, prefix, NULL, FR_BTREE_FLAG_NONE);
+	if (!present || !tree) fail(test, "create", 0);
+
+	check_contents(test, tree, entries, present);
+
+	/*
+	 *	Insert everything in a random order.
+	 */
+	shuffle(order, num_entries);
+	for (i = 0; i < num_entries; i++) {
+		if (!fr_btree_insert(tree, &entries[order[i]])) fail(test, "insert", entries[order[i]].key);
+		present[order[i]] = true;
+	}
+	if (fr_btree_insert(tree, &entries[0])) fail(test, "duplicate insert", entries[0].key);
+
+	check_contents(test, tree, entries, present);
+
+	/*
+	 *	Delete half, in a different order.
+	 */
+	shuffle(order, num_entries);
+	for (i = 0; i < num_entries / 2; i++) {
+		if (!fr_btree_deletebydata(tree, &entries[order[i]])) fail(test, "delete", entries[order[i]].key);
+		present[order[i]] = false;
+	}
+	if (fr_btree_deletebydata(tree, &entries[order[0]])) fail(test, "second delete", entries[order[0]].key);
+
+	check_contents(test, tree, entries, present);
+
+	/*
+	 *	Put some back, and delete the rest.
+	 */
+	for (i = 0; i < num_entries / 4; i++) {
+		if (!fr_btree_insert(tree, &entries[order[i]])) fail(test, "re-insert", entries[order[i]].key);
+		present[order[i]] = true;
+	}
+
+	check_contents(test, tree, entries, present);
+
+	for (i = 0; i < num_entries; i++) {
+		if (!present[i]) continue;
+
+		if (!fr_btree_deletebydata(tree, &entries[i])) fail(test, "delete", entries[i].key);
+		present[i] = false;
+	}
+
+	check_contents(test, tree, entries, present);
+
+	talloc_free(tree);
+	talloc_free(present);
+}
+
+/*
+ *	With FR_BTREE_FLAG_REPLACE, inserting a duplicate replaces the
+ *	data, and frees the old data.
+ */
+static void test_replace(test_entry_t *entries)
+{
+	fr_btree_t	*tree;
+	test_entry_t	copy;
+	uint32_t	i;
+
+	tree = fr_btree_create(NULL, entry_cmp, entry_prefix, entry_free, FR_BTREE_FLAG_REPLACE);
+	if (!tree) fail(__FUNCTION__, "create", 0);
+
+	for (i = 0; i < 1000; i++) {
+		if (!fr_btree_insert(tree, &entries[i])) fail(__FUNCTION__, "insert", entries[i].key);
+	}
+
+	copy = entries[500];
+	num_freed = 0;
+	if (!fr_btree_insert(tree, &copy)) fail(__FUNCTION__, "replace", copy.key);
+	if (num_freed != 1) fail(__FUNCTION__, "free of replaced data", copy.key);
+	if (fr_btree_finddata(tree, &entries[500]) != &copy) fail(__FUNCTION__, "find of replaced data", copy.key);
+	if (fr_btree_num_elements(tree) != 1000) fail(__FUNCTION__, "count", fr_btree_num_elements(tree));
+
+	if (!fr_btree_deletebydata(tree, &copy)) fail(__FUNCTION__, "delete", copy.key);
+	if (num_freed != 2) fail(__FUNCTION__, "free of deleted data", copy.key);
+
+	talloc_free(tree);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: btree_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Use num entries.\n");
+	fprintf(stderr, "  -r <num>               Check num random ranges each time.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	uint32_t		i, *order;
+	test_entry_t		*entries;
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+
+	while ((c = getopt(argc, argv, "hn:r:x")) != -1) switch (c) {
+		case 'n':
+			num_entries = atoi(optarg);
+			if ((num_entries < 1000) || (num_entries > (1 << 24))) usage();
+			break;
+
+		case 'r':
+			num_ranges = atoi(optarg);
+			if (num_ranges < 0) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	entries = talloc_zero_array(autofree, test_entry_t, num_entries);
+	order = talloc_array(autofree, uint32_t, num_entries);
+	if (!entries || !order) {
+		fprintf(stderr, "btree_test: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < num_entries; i++) entries[i].key = ((uint64_t) i + 1) * 2;
+
+	test_insert_delete("prefix", entry_prefix, entries, order);
+	if (debug_lvl) printf("prefix: OK\n");
+
+	test_insert_delete("no prefix", NULL, entries, order);
+	if (debug_lvl) printf("no prefix: OK\n");
+
+	test_replace(entries);
+	if (debug_lvl) printf("replace: OK\n");
+
+	return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * htable_test.c	Tests for fr_htable_t
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/htable.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+typedef struct {
+	uint32_t	key;
+} test_entry_t;
+
+static int		debug_lvl = 0;
+static uint32_t		num_entries = 100000;
+
+static uint32_t entry_hash(void const *data)
+{
+	test_entry_t const *entry = data;
+
+	return fr_hash(&entry->key, sizeof(entry->key));
+}
+
+/*
+ *	Every entry has the same hash, so they're all in one probe
+ *	sequence, and deletes have to leave DELETED slots behind.
+ */
+static uint32_t entry_hash_collide(UNUSED void const *data)
+{
+	return 0;
+}
+
+static int entry_cmp(void const *one, void const *two)
+{
+	test_entry_t const *a = one, *b = two;
+
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+static int entry_count(void *ctx, UNUSED void *data)
+{
+	uint32_t *count = ctx;
+
+	(*count)++;
+	return 0;
+}
+
+static void NEVER_RETURNS fail(char const *test, char const *what, uint32_t key)
+{
+	fprintf(stderr, "%s: failed %s of key %u\n", test, what, key);
+	exit(EXIT_FAILURE);
+}
+
+/*
+ *	Check that exactly the entries in [start, end), and no others
+ *	from "entries", are in the table.
+ */
+static void check_range(char const *test, fr_htable_t *ht, test_entry_t *entries, uint32_t num,
+			uint32_t start, uint32_t end)
+{
+	uint32_t		i, count = 0;
+	fr_htable_iter_t	iter;
+	void			*data;
+
+	for (i = 0; i < num; i++) {
+		void *found = fr_htable_finddata(ht, &entries[i]);
+
+		if ((i >= start) && (i < end)) {
+			if (found != &entries[i]) fail(test, "find", entries[i].key);
+		} else {
+			if (found) fail(test, "find of deleted", entries[i].key);
+		}
+	}
+
+	if (fr_htable_num_elements(ht) != (end - start)) fail(test, "count", fr_htable_num_elements(ht));
+
+	for (data = fr_htable_iter_init(ht, &iter); data; data = fr_htable_iter_next(ht, &iter)) count++;
+	if (count != (end - start)) fail(test, "iteration", count);
+
+	count = 0;
+	(void) fr_htable_walk(ht, entry_count, &count);
+	if (count != (end - start)) fail(test, "walk", count);
+}
+
+/*
+ *	Grow the table a long way past its initial size, then delete
+ *	entries, and check that the others are still found.
+ */
+static void test_find_after_delete(test_entry_t *entries)
+{
+	fr_htable_t	*ht;
+	uint32_t	i;
+
+	ht = fr_htable_create(NULL, entry_hash, entry_cmp, NULL);
+	if (!ht) fail(__FUNCTION__, "create", 0);
+
+	for (i = 0; i < num_entries; i++) {
+		if (!fr_htable_insert(ht, &entries[i])) fail(__FUNCTION__, "insert", entries[i].key);
+	}
+	if (fr_htable_insert(ht, &entries[0])) fail(__FUNCTION__, "duplicate insert", entries[0].key);
+
+	check_range(__FUNCTION__, ht, entries, num_entries, 0, num_entries);
+
+	/*
+	 *	Delete from both ends, so that what's left is in the
+	 *	middle.
+	 */
+	for (i = 0; i < num_entries / 4; i++) {
+		if (!fr_htable_delete(ht, &entries[i])) fail(__FUNCTION__, "delete", entries[i].key);
+		if (!fr_htable_delete(ht, &entries[num_entries - i - 1])) {
+			fail(__FUNCTION__, "delete", entries[num_entries - i - 1].key);
+		}
+	}
+	if (fr_htable_delete(ht, &entries[0])) fail(__FUNCTION__, "second delete", entries[0].key);
+
+	check_range(__FUNCTION__, ht, entries, num_entries, num_entries / 4, num_entries - (num_entries / 4));
+
+	fr_htable_free(ht);
+}
+
+/*
+ *	With every entry in one probe sequence, deleted entries leave
+ *	DELETED slots.  Lookups have to probe past them, and inserts
+ *	should re-use them, rather than growing the table.
+ */
+static void test_tombstone_reuse(test_entry_t *entries)
+{
+	fr_htable_t	*ht;
+	uint32_t	i;
+	size_t		memory;
+
+	ht = fr_htable_create(NULL, entry_hash_collide, entry_cmp, NULL);
+	if (!ht) fail(__FUNCTION__, "create", 0);
+
+	for (i = 0; i < 24; i++) {
+		if (!fr_htable_insert(ht, &entries[i])) fail(__FUNCTION__, "insert", entries[i].key);
+	}
+	memory = fr_htable_memory(ht);
+
+	for (i = 6; i < 18; i++) {
+		if (!fr_htable_delete(ht, &entries[i])) fail(__FUNCTION__, "delete", entries[i].key);
+	}
+
+	for (i = 0; i < 24; i++) {
+		void *found = fr_htable_finddata(ht, &entries[i]);
+
+		if ((i >= 6) && (i < 18)) {
+			if (found) fail(__FUNCTION__, "find of deleted", entries[i].key);
+		} else {
+			if (found != &entries[i]) fail(__FUNCTION__, "find past deleted", entries[i].key);
+		}
+	}
+
+	/*
+	 *	Put the same number back.
+	 */
+	for (i = 24; i < 36; i++) {
+		if (!fr_htable_insert(ht, &entries[i])) fail(__FUNCTION__, "insert", entries[i].key);
+	}
+	if (fr_htable_memory(ht) != memory) fail(__FUNCTION__, "re-use of deleted slots", (uint32_t) fr_htable_memory(ht));
+
+	for (i = 0; i < 36; i++) {
+		void *found = fr_htable_finddata(ht, &entries[i]);
+
+		if ((i >= 6) && (i < 18)) {
+			if (found) fail(__FUNCTION__, "find of deleted", entries[i].key);
+		} else {
+			if (found != &entries[i]) fail(__FUNCTION__, "find after re-use", entries[i].key);
+		}
+	}
+	if (fr_htable_num_elements(ht) != 24) fail(__FUNCTION__, "count", fr_htable_num_elements(ht));
+
+	fr_htable_free(ht);
+}
+
+/*
+ *	Keep a small number of entries in the table, while inserting
+ *	and deleting many different ones.  The DELETED slots should be
+ *	cleaned out, and the table shouldn't keep growing.
+ */
+static void test_churn(test_entry_t *entries, fr_hash_table_hash_t hash)
+{
+	fr_htable_t	*ht;
+	uint32_t	i, live = 8;
+	size_t		memory = 0;
+
+	ht = fr_htable_create(NULL, hash, entry_cmp, NULL);
+	if (!ht) fail(__FUNCTION__, "create", 0);
+
+	for (i = 0; i < num_entries; i++) {
+		if (!fr_htable_insert(ht, &entries[i])) fail(__FUNCTION__, "insert", entries[i].key);
+
+		if (i >= live) {
+			if (!fr_htable_delete(ht, &entries[i - live])) fail(__FUNCTION__, "delete", entries[i - live].key);
+		}
+
+		/*
+		 *	Give the table time to settle at its working
+		 *	size.
+		 */
+		if (i == (num_entries / 2)) memory = fr_htable_memory(ht);
+	}
+
+	if (debug_lvl) printf("%s: %zu bytes after %u inserts, %zu at the end\n",
+			      __FUNCTION__, memory, num_entries / 2, fr_htable_memory(ht));
+
+	if (fr_htable_memory(ht) > memory) fail(__FUNCTION__, "growth", (uint32_t) fr_htable_memory(ht));
+
+	check_range(__FUNCTION__, ht, entries, num_entries, num_entries - live, num_entries);
+
+	fr_htable_free(ht);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: htable_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Use num entries.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	uint32_t		i;
+	test_entry_t		*entries;
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+
+	while ((c = getopt(argc, argv, "hn:x")) != -1) switch (c) {
+		case 'n':
+			num_entries = atoi(optarg);
+			if ((num_entries < 64) || (num_entries > (1 << 24))) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	entries = talloc_zero_array(autofree, test_entry_t, num_entries);
+	if (!entries) {
+		fprintf(stderr, "htable_test: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < num_entries; i++) entries[i].key = i;
+
+	test_find_after_delete(entries);
+	test_tombstone_reuse(entries);
+	test_churn(entries, entry_hash);
+
+	/*
+	 *	The same, with every entry in one probe sequence.  Each
+	 *	lookup is then linear in the table size, so use fewer.
+	 */
+	if (num_entries > 4096) num_entries = 4096;
+	test_churn(entries, entry_hash_collide);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := htable_test
+
+SOURCES		:= htable_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -54,6 +54,7 @@ static int		my_alloc_size = ALLOC_SIZE;
 
 static int		debug_lvl = 0;
 static bool		touch_memory = false;
+static bool		fixed = false;
 
 static char const      	*seed_string = "foo";
 static size_t		seed_string_len = 3;
@@ -186,6 +187,7 @@ static void  free_blocks(UNUSED fr_message_set_t *ms, UNUSED uint32_t *seed, int
 static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: message_set_test [OPTS]\n");
+	fprintf(stderr, "  -f                     Use a fixed message set, in huge pages.\n");
 	fprintf(stderr, "  -s <string>            Set random seed to <string>.\n");
 	fprintf(stderr, "  -t                     Touch 'packet' memory.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
@@ -205,7 +207,11 @@ int main(int argc, char *argv[])
 	memset(array, 0, sizeof(array));
 	memset(messages, 0, sizeof(messages));
 
-	while ((c = getopt(argc, argv, "hs:tx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "fhs:tx")) != -1) switch (c) {
+		case 'f':
+			fixed = true;
+			break;
+
 		case 's':
 			seed_string = optarg;
 			seed_string_len = strlen(optarg);
@@ -228,7 +234,15 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	ms = fr_message_set_create(autofree, ARRAY_SIZE, sizeof(fr_message_t), ARRAY_SIZE * 1024);
+	/*
+	 *	A fixed message set can't grow, so it has to be large
+	 *	enough for all of the messages we have outstanding.
+	 */
+	if (fixed) {
+		ms = fr_message_set_create_fixed(autofree, MY_ARRAY_SIZE, sizeof(fr_message_t), MY_ARRAY_SIZE * 4096);
+	} else {
+		ms = fr_message_set_create(autofree, ARRAY_SIZE, sizeof(fr_message_t), ARRAY_SIZE * 1024);
+	}
 	if (!ms) {
 		fprintf(stderr, "Failed creating message set\n");
 		exit(EXIT_FAILURE);
@@ -422,6 +436,19 @@ int main(int argc, char *argv[])
 	rcode = fr_message_set_messages_used(ms);
 	rad_assert(rcode == 0);
 
+	if (fixed) {
+		fr_message_set_stats_t stats;
+
+		fr_message_set_stats(ms, &stats);
+		MPRINT1("GC runs %" PRIu64 ", %u buffers in huge pages\n", stats.num_gc, stats.num_hugepage);
+
+		if (stats.num_grown || stats.num_alloc_failed) {
+			fprintf(stderr, "Fixed message set grew %" PRIu64 " times, and failed %" PRIu64 " times\n",
+				stats.num_grown, stats.num_alloc_failed);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	return rcode;
 }
 
@@ -209,6 +209,8 @@ static void NEVER_RETURNS usage(void)
 	fprintf(stderr, "  -n <num>               Start num network threads\n");
 	fprintf(stderr, "  -i <address>[:port]    Set IP address and optional port.\n");
 	fprintf(stderr, "  -s <secret>            Set shared secret.\n");
+	fprintf(stderr, "  -S                     Enable work stealing between workers.\n");
+	fprintf(stderr, "  -w <num>               Start num worker threads\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
 	exit(EXIT_FAILURE);
@@ -219,7 +221,9 @@ int main(int argc, char *argv[])
 	int			c;
 	int			num_networks = 1;
 	int			num_workers = 2;
+	bool			work_stealing = false;
 	uint16_t		port16 = 0;
+	fr_schedule_config_t	config;
 	TALLOC_CTX		*autofree = talloc_autofree_context();
 	fr_schedule_t		*sched;
 	fr_listen_t		listen = { .app_io = &app_io, .app = &test_app };
@@ -238,7 +242,7 @@ int main(int argc, char *argv[])
 	my_ipaddr.addr.v4.s_addr = htonl(INADDR_LOOPBACK);
 	my_port = 1812;
 
-	while ((c = getopt(argc, argv, "i:n:s:w:x")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "i:n:s:Sw:x")) != -1) switch (c) {
 		case 'i':
 			if (fr_inet_pton_port(&my_ipaddr, &port16, optarg, -1, AF_INET, true, false) < 0) {
 				fr_perror("Failed parsing ipaddr");
@@ -256,6 +260,10 @@ int main(int argc, char *argv[])
 			secret = optarg;
 			break;
 
+		case 'S':
+			work_stealing = true;
+			break;
+
 		case 'w':
 			num_workers = atoi(optarg);
 			if ((num_workers <= 0) || (num_workers > 1024)) usage();
@@ -279,7 +287,13 @@ int main(int argc, char *argv[])
 	app_io_inst->ipaddr = my_ipaddr;
 	app_io_inst->port = my_port;
 
-	sched = fr_schedule_create(autofree, NULL, &default_log, debug_lvl, num_networks, num_workers, NULL, NULL);
+	config = (fr_schedule_config_t) {
+		.max_networks = num_networks,
+		.max_workers = num_workers,
+		.work_stealing = work_stealing
+	};
+
+	sched = fr_schedule_create(autofree, NULL, &default_log, debug_lvl, &config, NULL, NULL);
 	if (!sched) {
 		fprintf(stderr, "schedule_test: Failed to create scheduler\n");
 		exit(EXIT_FAILURE);
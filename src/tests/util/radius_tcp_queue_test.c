@@ -0,0 +1,206 @@
+/*
+ * radius_tcp_queue_test.c	Tests for the proto_radius_tcp send queue
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+/*
+ *	The queue functions are static, so we test them by including
+ *	the module.
+ */
+#include "../../modules/proto_radius/proto_radius_tcp.c"
+
+#include <sys/socket.h>
+#include <fcntl.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+static int		debug_lvl = 0;
+
+/*
+ *	Reply N is all bytes of (N & 0xff), so the reader can check
+ *	that nothing was lost, duplicated, or reordered.
+ */
+static size_t reply_len(int n)
+{
+	return 20 + ((n * 37) % (MAX_PACKET_LEN - 20));
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: radius_tcp_queue_test [OPTS]\n");
+	fprintf(stderr, "  -n replies             number of replies to write.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int				c, fd[2], flags, sndbuf = 4096;
+	int				num_replies = 1000;
+	int				written = 0, read_num = 0, blocked = 0, rounds = 0;
+	size_t				read_offset = 0;
+	ssize_t				rcode;
+	uint8_t				buffer[MAX_PACKET_LEN];
+	fr_listen_t			*li;
+	proto_radius_tcp_t		*inst;
+	proto_radius_tcp_thread_t	*thread;
+	TALLOC_CTX			*autofree = talloc_autofree_context();
+
+	while ((c = getopt(argc, argv, "hn:x")) != -1) switch (c) {
+		case 'n':
+			num_replies = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+		fprintf(stderr, "Failed creating sockets: %s\n", fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	A small, non-blocking socket, so that the queue fills
+	 *	up quickly when nothing is reading the other end.
+	 */
+	(void) setsockopt(fd[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	flags = fcntl(fd[0], F_GETFL, 0);
+	(void) fcntl(fd[0], F_SETFL, flags | O_NONBLOCK);
+	flags = fcntl(fd[1], F_GETFL, 0);
+	(void) fcntl(fd[1], F_SETFL, flags | O_NONBLOCK);
+
+	MEM(inst = talloc_zero(autofree, proto_radius_tcp_t));
+	inst->send_batch = 16;
+
+	MEM(thread = talloc_zero(autofree, proto_radius_tcp_thread_t));
+	thread->sockfd = fd[0];
+	thread->name = "test";
+
+	MEM(li = talloc_zero(autofree, fr_listen_t));
+	li->fd = fd[0];
+	li->app_io_instance = inst;
+	li->thread_instance = thread;
+
+	while (read_num < num_replies) {
+		/*
+		 *	Queue replies until the queue is full.
+		 */
+		while (written < num_replies) {
+			memset(buffer, written & 0xff, reply_len(written));
+
+			rcode = mod_write_queue(li, inst, thread, buffer, reply_len(written));
+			if (rcode < 0) {
+				if (errno != EWOULDBLOCK) {
+					fprintf(stderr, "Failed writing reply %d: %s\n", written, fr_strerror());
+					exit(EXIT_FAILURE);
+				}
+
+				if (!thread->send_num) {
+					fprintf(stderr, "Blocked with an empty queue at reply %d\n", written);
+					exit(EXIT_FAILURE);
+				}
+
+				blocked++;
+				break;
+			}
+
+			if ((size_t) rcode != reply_len(written)) {
+				fprintf(stderr, "Short write of reply %d\n", written);
+				exit(EXIT_FAILURE);
+			}
+
+			if (thread->send_used > TCP_SEND_QUEUE_SIZE) {
+				fprintf(stderr, "Queue holds %zu bytes, more than %d\n",
+					thread->send_used, TCP_SEND_QUEUE_SIZE);
+				exit(EXIT_FAILURE);
+			}
+
+			written++;
+		}
+
+		if (debug_lvl) printf("Wrote %d replies, %zu bytes queued\n", written, thread->send_used);
+
+		/*
+		 *	Nothing blocked, so write out the last batch.
+		 */
+		if (written == num_replies) (void) mod_flush(li);
+
+		/*
+		 *	Drain the other end, and check the data.
+		 */
+		while ((rcode = read(fd[1], buffer, sizeof(buffer))) > 0) {
+			ssize_t i;
+
+			for (i = 0; i < rcode; i++) {
+				if (read_num >= num_replies) {
+					fprintf(stderr, "Read more data than was written\n");
+					exit(EXIT_FAILURE);
+				}
+
+				if (buffer[i] != (read_num & 0xff)) {
+					fprintf(stderr, "Reply %d has bad data at offset %zu\n", read_num, read_offset);
+					exit(EXIT_FAILURE);
+				}
+
+				if (++read_offset == reply_len(read_num)) {
+					read_num++;
+					read_offset = 0;
+				}
+			}
+		}
+
+		if (mod_flush(li) < 0) {
+			fprintf(stderr, "Failed flushing: %s\n", fr_strerror());
+			exit(EXIT_FAILURE);
+		}
+
+		/*
+		 *	Every round drains the socket, so we should
+		 *	be done long before this.
+		 */
+		if (++rounds > num_replies) {
+			fprintf(stderr, "Read only %d of %d replies\n", read_num, num_replies);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!blocked) {
+		fprintf(stderr, "The queue never filled up\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (debug_lvl) printf("The queue was full %d times\n", blocked);
+
+	close(fd[0]);
+	close(fd[1]);
+
+	return 0;
+}
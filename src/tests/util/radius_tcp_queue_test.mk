@@ -0,0 +1,6 @@
+TARGET := radius_tcp_queue_test
+
+SOURCES		:= radius_tcp_queue_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-radius.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,131 @@
+/*
+ * rate_limit_test.c	Tests for the per-client packet rate limit
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/master.h>
+#include <freeradius-devel/io/channel.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+static int		debug_lvl = 0;
+
+/*
+ *	Send "num" packets, evenly spaced over "duration", starting at
+ *	"start".  Return how many were admitted.
+ */
+static int send_packets(fr_io_rate_limit_t *rate, uint32_t max_pps, uint32_t priority,
+			fr_time_t start, fr_time_t duration, int num)
+{
+	int i, admitted = 0;
+
+	for (i = 0; i < num; i++) {
+		fr_time_t now = start + ((duration * i) / num);
+
+		if (fr_io_rate_limit_admit(rate, max_pps, priority, now)) admitted++;
+	}
+
+	return admitted;
+}
+
+static void check(char const *what, int admitted, int min, int max)
+{
+	if (debug_lvl) printf("%s: %d admitted\n", what, admitted);
+
+	if ((admitted < min) || (admitted > max)) {
+		fprintf(stderr, "%s: admitted %d packets, expected %d to %d\n", what, admitted, min, max);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: rate_limit_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	uint32_t		max_pps;
+	fr_io_rate_limit_t	rate;
+	fr_time_t		start = NANOSEC;
+	uint32_t const		priorities[] = { PRIORITY_LOW, PRIORITY_NORMAL, PRIORITY_HIGH };
+	size_t			i;
+
+	while ((c = getopt(argc, argv, "hx")) != -1) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	Small limits.  A client sending at its limit has every
+	 *	packet admitted, whatever the priority.  Before, the
+	 *	reserve for lower priorities was larger than the
+	 *	bucket, and they were never admitted.
+	 */
+	for (max_pps = 1; max_pps <= 4; max_pps++) {
+		for (i = 0; i < NUM_ELEMENTS(priorities); i++) {
+			memset(&rate, 0, sizeof(rate));
+
+			check("at the limit", send_packets(&rate, max_pps, priorities[i], start,
+							   (fr_time_t) 10 * NANOSEC, 10 * max_pps),
+			      10 * max_pps, 10 * max_pps);
+		}
+	}
+
+	/*
+	 *	An idle client with a limit of one packet per second
+	 *	gets one packet through, and then has to wait.
+	 */
+	memset(&rate, 0, sizeof(rate));
+	check("idle, low", send_packets(&rate, 1, PRIORITY_LOW, start, 0, 1), 1, 1);
+	check("burst, low", send_packets(&rate, 1, PRIORITY_LOW, start, 0, 10), 0, 0);
+	check("one second later, low", send_packets(&rate, 1, PRIORITY_LOW, start + NANOSEC, 0, 1), 1, 1);
+
+	/*
+	 *	A flood at ten times the limit is cut to the limit, plus
+	 *	the initial bucket.
+	 */
+	memset(&rate, 0, sizeof(rate));
+	check("flood, normal", send_packets(&rate, 2, PRIORITY_NORMAL, start, (fr_time_t) 10 * NANOSEC, 200), 20, 22);
+
+	/*
+	 *	Lower priority packets can't empty the bucket, so
+	 *	higher priority packets still get through.
+	 */
+	memset(&rate, 0, sizeof(rate));
+	check("burst, low", send_packets(&rate, 100, PRIORITY_LOW, start, 0, 1000), 50, 51);
+	check("burst, normal", send_packets(&rate, 100, PRIORITY_NORMAL, start, 0, 1000), 24, 26);
+	check("burst, high", send_packets(&rate, 100, PRIORITY_HIGH, start, 0, 1000), 24, 26);
+
+	return 0;
+}
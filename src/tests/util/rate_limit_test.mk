@@ -0,0 +1,6 @@
+TARGET := rate_limit_test
+
+SOURCES		:= rate_limit_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
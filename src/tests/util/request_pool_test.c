@@ -0,0 +1,185 @@
+/*
+ * request_pool_test.c	Benchmark recycled request pools
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/request_pool.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/util/strerror.h>
+#include <stdint.h>
+#include <string.h>
+#include <freeradius-devel/server/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: request_pool_test [OPTS]\n");
+	fprintf(stderr, "  -a allocs              number of allocations done by each request.\n");
+	fprintf(stderr, "  -n num                 number of requests.\n");
+	fprintf(stderr, "  -p bytes               initial size of the request pools.\n");
+	fprintf(stderr, "  -s bytes               average size of each allocation.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+/** Do the kind of allocations which a request does while it's being processed
+ *
+ */
+static void request_work(REQUEST *request, int allocs, size_t size)
+{
+	int		i;
+	uint8_t		*p;
+
+	for (i = 0; i < allocs; i++) {
+		/*
+		 *	Sizes between size / 2 and size * 3 / 2.
+		 */
+		p = talloc_array(request, uint8_t, (size / 2) + ((i * 7919) % (size + 1)));
+		if (!p) {
+			fprintf(stderr, "Failed allocating memory\n");
+			exit(EXIT_FAILURE);
+		}
+		p[0] = i & 0xff;
+	}
+}
+
+static void run_malloc(int num, int allocs, size_t size)
+{
+	int		i;
+	fr_time_t	start, end;
+	REQUEST		*request;
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		request = request_alloc(NULL);
+		if (!request) {
+			fprintf(stderr, "Failed allocating request\n");
+			exit(EXIT_FAILURE);
+		}
+
+		request_work(request, allocs, size);
+		talloc_free(request);
+	}
+	end = fr_time();
+
+	printf("malloc\n");
+	printf("\t%d requests\t%" PRIu64 " ns/request\n", num, (end - start) / num);
+}
+
+static void run_pool(TALLOC_CTX *ctx, char const *name, int num, int allocs, size_t size,
+		     size_t pool_size, bool adaptive)
+{
+	int			i;
+	fr_time_t		start, end;
+	REQUEST			*request;
+	fr_request_pool_t	*rp;
+	fr_request_pool_stats_t	stats;
+
+	rp = fr_request_pool_create(ctx, pool_size, 16, adaptive);
+	if (!rp) {
+		fprintf(stderr, "Failed creating request pool\n");
+		exit(EXIT_FAILURE);
+	}
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		request = fr_request_pool_alloc(rp);
+		if (!request) {
+			fprintf(stderr, "Failed allocating request\n");
+			exit(EXIT_FAILURE);
+		}
+
+		request_work(request, allocs, size);
+		fr_request_pool_free(rp, request);
+	}
+	end = fr_time();
+
+	fr_request_pool_stats(rp, &stats);
+
+	printf("%s\n", name);
+	printf("\t%d requests\t%" PRIu64 " ns/request\n", num, (end - start) / num);
+	printf("\tpool size\t%zu bytes\n", stats.pool_size);
+
+	if (debug_lvl) {
+		printf("\tallocated\t%" PRIu64 "\n", stats.num_allocated);
+		printf("\treused\t\t%" PRIu64 "\n", stats.num_reused);
+		printf("\tresized\t\t%" PRIu64 "\n", stats.num_resized);
+	}
+
+	talloc_free(rp);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	int			num = 1000000;
+	int			allocs = 40;
+	size_t			size = 128;
+	size_t			pool_size = 4096;
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+
+	while ((c = getopt(argc, argv, "a:hn:p:s:x")) != -1) switch (c) {
+		case 'a':
+			allocs = atoi(optarg);
+			if (allocs < 0) usage();
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			if (num <= 0) usage();
+			break;
+
+		case 'p':
+			pool_size = atoi(optarg);
+			if (!pool_size) usage();
+			break;
+
+		case 's':
+			size = atoi(optarg);
+			if (!size) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fr_time_start();
+
+	if (debug_lvl) printf("%d requests, %d allocations of ~%zu bytes each\n", num, allocs, size);
+
+	run_malloc(num, allocs, size);
+	run_pool(autofree, "pool", num, allocs, size, pool_size, false);
+	run_pool(autofree, "adaptive", num, allocs, size, pool_size, true);
+
+	return 0;
+}
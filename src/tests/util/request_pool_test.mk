@@ -0,0 +1,6 @@
+TARGET := request_pool_test
+
+SOURCES		:= request_pool_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
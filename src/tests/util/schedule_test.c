@@ -46,6 +46,7 @@ static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: schedule_test [OPTS]\n");
 	fprintf(stderr, "  -n <num>               Start num network threads\n");
+	fprintf(stderr, "  -s                     Enable work stealing between workers\n");
 	fprintf(stderr, "  -w <num>               Start num worker threads\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
@@ -57,6 +58,8 @@ int main(int argc, char *argv[])
 	int c;
 	int num_networks = 1;
 	int num_workers = 2;
+	bool work_stealing = false;
+	fr_schedule_config_t config;
 	TALLOC_CTX	*autofree = talloc_autofree_context();
 	fr_schedule_t	*sched;
 
@@ -64,12 +67,16 @@ int main(int argc, char *argv[])
 
 	fr_log_init(&default_log, false);
 
-	while ((c = getopt(argc, argv, "n:w:x")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "n:sw:x")) != -1) switch (c) {
 		case 'n':
 			num_networks = atoi(optarg);
 			if ((num_networks <= 0) || (num_networks > 16)) usage();
 			break;
 
+		case 's':
+			work_stealing = true;
+			break;
+
 		case 'w':
 			num_workers = atoi(optarg);
 			if ((num_workers <= 0) || (num_workers > 1024)) usage();
@@ -90,7 +97,13 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	sched = fr_schedule_create(autofree, NULL, &default_log, L_DBG_LVL_MAX, num_networks, num_workers, NULL, NULL);
+	config = (fr_schedule_config_t) {
+		.max_networks = num_networks,
+		.max_workers = num_workers,
+		.work_stealing = work_stealing
+	};
+
+	sched = fr_schedule_create(autofree, NULL, &default_log, L_DBG_LVL_MAX, &config, NULL, NULL);
 	if (!sched) {
 		fprintf(stderr, "schedule_test: Failed to create scheduler\n");
 		exit(EXIT_FAILURE);
@@ -0,0 +1,237 @@
+/*
+ * timer_test.c	Benchmark timer events, using a heap and a timer wheel
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/strerror.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <freeradius-devel/server/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+static int		debug_lvl = 0;
+static int		fired = 0;
+static int		early = 0;
+
+
+/**********************************************************************/
+typedef struct rad_request REQUEST;
+REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx);
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request);
+void talloc_const_free(void const *ptr);
+
+REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
+{
+	return NULL;
+}
+
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request)
+{
+}
+
+void talloc_const_free(void const *ptr)
+{
+	void *tmp;
+	if (!ptr) return;
+
+	memcpy(&tmp, &ptr, sizeof(tmp));
+	talloc_free(tmp);
+}
+/**********************************************************************/
+
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: timer_test [OPTS]\n");
+	fprintf(stderr, "  -k keep                percentage of timers which are not deleted before they fire.\n");
+	fprintf(stderr, "  -n num                 number of outstanding timers.\n");
+	fprintf(stderr, "  -r usec                resolution of the timer wheel.\n");
+	fprintf(stderr, "  -s sec                 spread timers over this many seconds.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void timer_fire(UNUSED fr_event_list_t *el, struct timeval *now, void *uctx)
+{
+	struct timeval *when = uctx;
+
+	if (fr_timeval_cmp(when, now) > 0) early++;
+	fired++;
+}
+
+/** Insert, delete, and run timers, using one type of event list
+ *
+ */
+static void run_test(TALLOC_CTX *ctx, char const *name, fr_time_t resolution,
+		     struct timeval const *whens, int num, int keep)
+{
+	fr_event_list_t		*el;
+	fr_event_timer_t const	**evs;
+	struct timeval		when;
+	fr_time_t		start, inserted, deleted, ran;
+	int			i, kept = 0;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	if (!el) {
+		fprintf(stderr, "Failed allocating event list: %s\n", fr_strerror());
+		exit(EXIT_FAILURE);
+	}
+
+	if (resolution && (fr_event_list_timer_wheel(el, resolution) < 0)) {
+		fprintf(stderr, "Failed enabling timer wheel: %s\n", fr_strerror());
+		exit(EXIT_FAILURE);
+	}
+
+	evs = talloc_zero_array(ctx, fr_event_timer_t const *, num);
+	fired = early = 0;
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		memcpy(&when, &whens[i], sizeof(when));
+
+		if (fr_event_timer_insert(NULL, el, &evs[i], &when, timer_fire, &whens[i]) < 0) {
+			fprintf(stderr, "Failed inserting timer %d: %s\n", i, fr_strerror());
+			exit(EXIT_FAILURE);
+		}
+	}
+	inserted = fr_time();
+
+	/*
+	 *	Most timers are cancelled before they fire.
+	 */
+	for (i = 0; i < num; i++) {
+		if ((i % 100) < keep) {
+			kept++;
+			continue;
+		}
+
+		if (fr_event_timer_delete(el, &evs[i]) < 0) {
+			fprintf(stderr, "Failed deleting timer %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+	deleted = fr_time();
+
+	/*
+	 *	Run everything, in one second steps.
+	 */
+	memcpy(&when, &whens[0], sizeof(when));
+	for (i = 0; i < num; i++) if (fr_timeval_cmp(&whens[i], &when) < 0) memcpy(&when, &whens[i], sizeof(when));
+
+	while (fr_event_list_num_timers(el) > 0) {
+		struct timeval now;
+
+		when.tv_sec++;
+		do {
+			now = when;
+		} while (fr_event_timer_run(el, &now) == 1);
+	}
+	ran = fr_time();
+
+	printf("%s\n", name);
+	printf("\tinsert   %d timers\t%" PRIu64 " ns/timer\n", num, (inserted - start) / num);
+	printf("\tdelete   %d timers\t%" PRIu64 " ns/timer\n", num - kept, (deleted - inserted) / (num - kept ? num - kept : 1));
+	printf("\trun      %d timers\t%" PRIu64 " ns/timer\n", kept, (ran - deleted) / (kept ? kept : 1));
+
+	if ((fired != kept) || early) {
+		fprintf(stderr, "%s: expected %d timers to fire, got %d, %d early\n", name, kept, fired, early);
+		exit(EXIT_FAILURE);
+	}
+
+	talloc_free(evs);
+	talloc_free(el);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i;
+	int			num = 1000000;
+	int			keep = 10;
+	int			spread = 60;
+	fr_time_t		resolution = 1000000;
+	struct timeval		now, *whens;
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+
+	while ((c = getopt(argc, argv, "hk:n:r:s:x")) != -1) switch (c) {
+		case 'k':
+			keep = atoi(optarg);
+			if ((keep < 0) || (keep > 100)) usage();
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			if (num <= 0) usage();
+			break;
+
+		case 'r':
+			resolution = ((fr_time_t) atoi(optarg)) * 1000;
+			if (!resolution) usage();
+			break;
+
+		case 's':
+			spread = atoi(optarg);
+			if (spread <= 0) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fr_time_start();
+
+	/*
+	 *	Use the same expiry times for both tests.
+	 */
+	whens = talloc_array(autofree, struct timeval, num);
+	gettimeofday(&now, NULL);
+	for (i = 0; i < num; i++) {
+		uint64_t usec = ((uint64_t) fr_rand() * (uint64_t) spread * USEC) >> 32;
+
+		whens[i].tv_sec = now.tv_sec + (usec / USEC);
+		whens[i].tv_usec = now.tv_usec + (usec % USEC);
+		if (whens[i].tv_usec >= USEC) {
+			whens[i].tv_sec++;
+			whens[i].tv_usec -= USEC;
+		}
+	}
+
+	if (debug_lvl) printf("%d timers over %d seconds, %d%% fire\n", num, spread, keep);
+
+	run_test(autofree, "heap", 0, whens, num, keep);
+	run_test(autofree, "wheel", resolution, whens, num, keep);
+
+	return 0;
+}